@@ -0,0 +1,7 @@
+#version 400 compatibility
+
+// Casters arrive in world space: the shadow pass loads an identity view, so
+// the modelview only carries each object's own transform.
+void main() {
+    gl_Position = gl_ModelViewMatrix * gl_Vertex;
+}
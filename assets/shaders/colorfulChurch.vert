@@ -4,14 +4,22 @@ layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 texture_coordinate;
 layout (location = 3) in vec3 color;
 
-uniform mat4 u_model;
-uniform mat4 uLightSpace;
+// Per-view camera, smoke and clip data
+layout (std140, binding = 0) uniform frame_constants {
+    mat4 projection;
+    mat4 view;
+    mat4 invView;
+    vec4 cameraPos;    // xyz
+    vec4 smokeParams;  // Start, end
+    vec4 clipPlane;    // World space plane equation
+    ivec4 flags;       // Clip plane enabled, smoke enabled
+} frame;
 
-layout (std140, binding = 0) uniform commom_matrices
-{
-    mat4 u_projection;
-    mat4 u_view;
-};
+// Per-object transforms, bound from a ring buffer before each draw
+layout (std140, binding = 3) uniform object_constants {
+    mat4 model;
+    mat4 normalMatrix;
+} object;
 
 out V_OUT
 {
@@ -19,17 +27,15 @@ out V_OUT
    vec3 normal;
    vec2 texture_coordinate;
    vec3 color;
-    vec4 lightSpacePos;
 } v_out;
 
 void main()
 {
-    gl_Position = u_projection * u_view * u_model * vec4(position, 1.0f);
+    gl_Position = frame.projection * frame.view * object.model * vec4(position, 1.0f);
 
-    vec4 worldPos = u_model * vec4(position, 1.0f);
+    vec4 worldPos = object.model * vec4(position, 1.0f);
     v_out.position = worldPos.xyz;
-    v_out.normal = mat3(transpose(inverse(u_model))) * normal;
+    v_out.normal = mat3(object.normalMatrix) * normal;
     v_out.texture_coordinate = vec2(texture_coordinate.x, 1.0f - texture_coordinate.y);
     v_out.color = color;
-    v_out.lightSpacePos = uLightSpace * worldPos;
 }
\ No newline at end of file
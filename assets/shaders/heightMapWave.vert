@@ -6,16 +6,23 @@ layout (location = 2) in vec2 texcoord;
 out vec3 vs_worldpos;
 out vec3 vs_normal;
 out vec2 vs_texcoord;
-out vec4 vLightSpacePos;
 
-uniform mat4 u_model;
-uniform mat4 uLightSpace;
+// Per-view camera, smoke and clip data
+layout (std140, binding = 0) uniform frame_constants {
+    mat4 projection;
+    mat4 view;
+    mat4 invView;
+    vec4 cameraPos;    // xyz
+    vec4 smokeParams;  // Start, end
+    vec4 clipPlane;    // World space plane equation
+    ivec4 flags;       // Clip plane enabled, smoke enabled
+} frame;
 
-layout (std140, binding = 0) uniform commom_matrices
-{
-    mat4 u_projection;
-    mat4 u_view;
-};
+// Per-object transforms, bound from a ring buffer before each draw
+layout (std140, binding = 3) uniform object_constants {
+    mat4 model;
+    mat4 normalMatrix;
+} object;
 
 uniform sampler2D u_texture;
 uniform float u_time;
@@ -49,10 +56,9 @@ void main(void){
     // Normal = normalize(-dy/dx, 1, -dy/dz)
     vec3 newNormal = normalize(vec3(-dIdx * u_heightScale, 1.0, -dIdz * u_heightScale));
 
-    vec4 worldPos = u_model * pos;
-    gl_Position = u_projection * u_view * worldPos;
+    vec4 worldPos = object.model * pos;
+    gl_Position = frame.projection * frame.view * worldPos;
     vs_worldpos = worldPos.xyz;
-    vs_normal = normalize(mat3(u_model) * newNormal);
+    vs_normal = normalize(mat3(object.model) * newNormal);
     vs_texcoord = texcoord; // Pass original texcoord for shading if needed
-    vLightSpacePos = uLightSpace * worldPos;
 }
\ No newline at end of file
@@ -1,79 +1,142 @@
 #version 430 core
 
+// Feature variants (see ShaderVariants): FLAT_SHADOW, SMOKE, DIR_SHADOW,
+// VSM_SHADOWS
+
 in vec2 vTexCoord;
 in vec3 vNormal;
 in vec3 vWorldPos;
-in vec4 vLightSpacePos;
+flat in uint vMeshIndex;
 out vec4 FragColor;
 
-struct Material {
-    sampler2D texture_diffuse1;
-    sampler2D texture_specular1;
+// Per-mesh materials of the model being drawn: x is the diffuse layer, or
+// -1 for none, and y the array of u_materialTextures holding it
+layout (std430, binding = 0) readonly buffer model_materials {
+    ivec4 materials[];
 };
 
-uniform Material material;
-uniform vec3 uCameraPos;
-uniform vec2 uSmokeParams;
-uniform int uShadowPass;
-uniform bool smokeEnabled;
+// One array per compressed format and size, bound to units 0 to 3. The
+// index is constant over each draw of the multi-draw.
+uniform sampler2DArray u_materialTextures[4];
+
+// Per-view camera, smoke and clip data
+layout (std140, binding = 0) uniform frame_constants {
+    mat4 projection;
+    mat4 view;
+    mat4 invView;
+    vec4 cameraPos;    // xyz
+    vec4 smokeParams;  // Start, end
+    vec4 clipPlane;    // World space plane equation
+    ivec4 flags;       // Clip plane enabled, smoke enabled
+} frame;
+
+// Scene lights, filled once per frame
+layout (std140, binding = 2) uniform light_constants {
+    vec4 dirLightDir;  // xyz, pointing away from the light
+    vec4 pointLightPos;
+    vec4 spotLightPos;
+    vec4 spotLightDir;
+    vec4 spotCone;     // Inner and outer cosine
+    ivec4 enabled;     // Directional, point, spot
+    ivec4 shadows;     // Directional, point, spot
+} lights;
 
-uniform sampler2D u_shadowMap;
-uniform vec3 u_lightDir;
-uniform bool u_enableShadow;
+uniform sampler2D u_shadowMap;  // Shadow atlas, depth moments with VSM_SHADOWS
 
-float computeShadow(vec3 normal, vec4 lightSpacePos) {
-    vec3 projCoords = lightSpacePos.xyz / lightSpacePos.w;
-    projCoords = projCoords * 0.5 + 0.5;
+// Views and lights packed into the shadow atlas. Light 0 is the directional
+// light, 1 the point light and 2 the spot light.
+layout (std140, binding = 1) uniform shadow_atlas {
+    mat4 u_shadowViewMatrices[16];
+    vec4 u_shadowViewRects[16];   // Atlas uv offset (xy) and size (zw)
+    ivec4 u_shadowLights[4];      // First view, view count, enabled, type
+    vec4 u_shadowLightParams[4];  // Position (xyz), far plane (w)
+};
 
-    if (projCoords.x < 0.0 || projCoords.x > 1.0 ||
-        projCoords.y < 0.0 || projCoords.y > 1.0 ||
-        projCoords.z > 1.0)
+// Variance shadow map lookup: Chebyshev bound on the fraction of occluders
+// behind depth, with the low tail cut to hide light bleeding
+float vsmShadow(vec2 moments, float depth) {
+    if (depth <= moments.x)
         return 0.0;
+    float variance = max(moments.y - moments.x * moments.x, 0.00002);
+    float d = depth - moments.x;
+    float pMax = variance / (variance + d * d);
+    return 1.0 - clamp((pMax - 0.3) / 0.7, 0.0, 1.0);
+}
 
+// Shadow from the first (tightest) cascade whose tile covers the fragment
+float computeShadow(vec3 normal, vec3 worldPos) {
     vec3 N = normalize(normal);
-    vec3 L = normalize(-u_lightDir);
+    vec3 L = normalize(-lights.dirLightDir.xyz);
     float bias = max(0.0009, 0.0015 * (1.0 - dot(N, L)));
+    vec2 atlasTexel = 1.0 / vec2(textureSize(u_shadowMap, 0));
+    ivec4 light = u_shadowLights[0];
 
-    float shadow = 0.0;
-    vec2 texelSize = 1.0 / vec2(textureSize(u_shadowMap, 0));
-    for (int x = -1; x <= 1; ++x) {
-        for (int y = -1; y <= 1; ++y) {
-            float pcfDepth = texture(u_shadowMap,
-                                     projCoords.xy + vec2(x, y) * texelSize).r;
-            shadow += (projCoords.z - bias > pcfDepth) ? 1.0 : 0.0;
+    for (int i = 0; i < light.y; ++i) {
+        int view = light.x + i;
+        vec4 lightSpacePos = u_shadowViewMatrices[view] * vec4(worldPos, 1.0);
+        vec3 projCoords = lightSpacePos.xyz / lightSpacePos.w;
+        projCoords = projCoords * 0.5 + 0.5;
+
+        // Keep the PCF kernel inside this cascade's tile
+        vec4 rect = u_shadowViewRects[view];
+        vec2 margin = 2.0 * atlasTexel / rect.zw;
+        if (any(lessThan(projCoords.xy, margin)) ||
+            any(greaterThan(projCoords.xy, 1.0 - margin)))
+            continue;
+        if (projCoords.z > 1.0)
+            return 0.0;
+
+        vec2 atlasUV = rect.xy + projCoords.xy * rect.zw;
+#ifdef VSM_SHADOWS
+        vec2 moments = texture(u_shadowMap, atlasUV).rg;
+        return vsmShadow(moments, projCoords.z);
+#else
+        float shadow = 0.0;
+        for (int x = -1; x <= 1; ++x) {
+            for (int y = -1; y <= 1; ++y) {
+                vec2 uv = atlasUV + vec2(x, y) * atlasTexel;
+                float pcfDepth = texture(u_shadowMap, uv).r;
+                shadow += (projCoords.z - bias > pcfDepth) ? 1.0 : 0.0;
+            }
         }
+        return shadow / 9.0;
+#endif
     }
-    shadow /= 9.0;
-    return shadow;
+    return 0.0;
 }
 
 void main() {
-    if (uShadowPass == 1) {
-        FragColor = vec4(0.0, 0.0, 0.0, 0.5);
-        return;
-    }
-
-    vec4 baseColor = texture(material.texture_diffuse1, vTexCoord);
+#ifdef FLAT_SHADOW
+    // Planar projected shadow: flat and translucent
+    FragColor = vec4(0.0, 0.0, 0.0, 0.5);
+#else
+    ivec4 material = materials[vMeshIndex];
+    vec4 baseColor = material.x >= 0
+        ? texture(u_materialTextures[material.y],
+                  vec3(vTexCoord, float(material.x)))
+        : vec4(1.0);
 
     // Clip texels that should be masked out (matches glTF alphaCutoff=0.05).
     if (baseColor.a < 0.05)
         discard;
 
     float smoke = 0.0;
-    if (uSmokeParams.y > uSmokeParams.x && uSmokeParams.x >= 0.0) {
-        float dist = length(uCameraPos - vWorldPos);
-        smoke = clamp((dist - uSmokeParams.x) /
-                          max(uSmokeParams.y - uSmokeParams.x, 0.0001),
+#ifdef SMOKE
+    if (frame.smokeParams.y > frame.smokeParams.x && frame.smokeParams.x >= 0.0) {
+        float dist = length(frame.cameraPos.xyz - vWorldPos);
+        smoke = clamp((dist - frame.smokeParams.x) /
+                          max(frame.smokeParams.y - frame.smokeParams.x, 0.0001),
                       0.0, 1.0);
     }
+#endif
 
-    if (!smokeEnabled) smoke = 0.0;
     float shadow = 0.0;
-    if (u_enableShadow) {
-        shadow = computeShadow(vNormal, vLightSpacePos);
-    }
+#ifdef DIR_SHADOW
+    shadow = computeShadow(vNormal, vWorldPos);
+#endif
 
     vec3 litColor = baseColor.rgb * (1.0 - 0.7 * shadow);
     vec3 finalColor = mix(litColor, vec3(1.0), smoke);
     FragColor = vec4(finalColor, baseColor.a);
+#endif
 }
@@ -1,31 +1,46 @@
 #version 430 core
 
+// Feature variants (see ShaderVariants): CLIP_PLANE
+
 layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoord;
+layout(location = 3) in uint aMeshIndex;  // Per draw, from baseInstance
+
+// Per-view camera, smoke and clip data
+layout (std140, binding = 0) uniform frame_constants {
+    mat4 projection;
+    mat4 view;
+    mat4 invView;
+    vec4 cameraPos;    // xyz
+    vec4 smokeParams;  // Start, end
+    vec4 clipPlane;    // World space plane equation
+    ivec4 flags;       // Clip plane enabled, smoke enabled
+} frame;
 
-uniform mat4 uModel;
-uniform mat4 uView;
-uniform mat4 uProjection;
-uniform mat3 uNormalMatrix;
-uniform vec4 uClipPlane;
-uniform mat4 uLightSpace;
+// Per-object transforms, bound from a ring buffer before each draw
+layout (std140, binding = 3) uniform object_constants {
+    mat4 model;
+    mat4 normalMatrix;
+} object;
 
 out vec2 vTexCoord;
 out vec3 vNormal;
 out vec3 vWorldPos;
-out vec4 vLightSpacePos;
+flat out uint vMeshIndex;
 
 void main() {
-    vec4 worldPos = uModel * vec4(aPos, 1.0);
+    vec4 worldPos = object.model * vec4(aPos, 1.0);
     vWorldPos = worldPos.xyz;
-    vNormal = normalize(uNormalMatrix * aNormal);
+    vNormal = normalize(mat3(object.normalMatrix) * aNormal);
     vTexCoord = aTexCoord;
+    vMeshIndex = aMeshIndex;
 
-    vLightSpacePos = uLightSpace * worldPos;
-
-    vec4 eyePos = uView * worldPos;
-    gl_ClipDistance[0] = dot(uClipPlane, eyePos);
+#ifdef CLIP_PLANE
+    gl_ClipDistance[0] = dot(frame.clipPlane, worldPos);
+#else
+    gl_ClipDistance[0] = 1.0;
+#endif
 
-    gl_Position = uProjection * eyePos;
+    gl_Position = frame.projection * frame.view * worldPos;
 }
@@ -1,4 +1,7 @@
-#version 330 compatibility
+#version 420 compatibility
+
+// Feature variants (see ShaderVariants): BUMP_MAP, DIR_LIGHT, POINT_LIGHT,
+// SPOT_LIGHT, DIR_SHADOW, VSM_SHADOWS, SMOKE
 
 in vec3 v_posEye;
 in vec3 v_normalEye;
@@ -6,49 +9,97 @@ in vec2 v_uv;
 in vec4 v_color;
 
 in vec3 v_worldNormal;
-in vec4 v_lightSpacePos;
+in vec3 v_worldPos;
 
 uniform sampler2D u_bumpTex;
-uniform int u_bumpEnabled;
 uniform float u_bumpStrength;
 
-uniform int u_enableLight0;
-uniform int u_enableLight1;
-uniform int u_enableLight2;
-
-uniform sampler2D u_shadowMap;
-uniform vec3 u_lightDir;
-uniform bool u_enableShadow;
-
-uniform vec2 u_smokeParams; // x=start, y=end
-uniform int smokeEnabled;
+// Per-view camera, smoke and clip data
+layout (std140, binding = 0) uniform frame_constants {
+    mat4 projection;
+    mat4 view;
+    mat4 invView;
+    vec4 cameraPos;    // xyz
+    vec4 smokeParams;  // Start, end
+    vec4 clipPlane;    // World space plane equation
+    ivec4 flags;       // Clip plane enabled, smoke enabled
+} frame;
+
+// Scene lights, filled once per frame
+layout (std140, binding = 2) uniform light_constants {
+    vec4 dirLightDir;  // xyz, pointing away from the light
+    vec4 pointLightPos;
+    vec4 spotLightPos;
+    vec4 spotLightDir;
+    vec4 spotCone;     // Inner and outer cosine
+    ivec4 enabled;     // Directional, point, spot
+    ivec4 shadows;     // Directional, point, spot
+} lights;
+
+uniform sampler2D u_shadowMap;  // Shadow atlas, depth moments with VSM_SHADOWS
+
+// Views and lights packed into the shadow atlas. Light 0 is the directional
+// light, 1 the point light and 2 the spot light.
+layout (std140, binding = 1) uniform shadow_atlas {
+    mat4 u_shadowViewMatrices[16];
+    vec4 u_shadowViewRects[16];   // Atlas uv offset (xy) and size (zw)
+    ivec4 u_shadowLights[4];      // First view, view count, enabled, type
+    vec4 u_shadowLightParams[4];  // Position (xyz), far plane (w)
+};
 
 out vec4 fragColor;
 
-float computeShadow(vec3 normal, vec4 lightSpacePos) {
-    vec3 projCoords = lightSpacePos.xyz / lightSpacePos.w;
-    projCoords = projCoords * 0.5 + 0.5;
-
-    if (projCoords.x < 0.0 || projCoords.x > 1.0 ||
-        projCoords.y < 0.0 || projCoords.y > 1.0 ||
-        projCoords.z > 1.0)
+// Variance shadow map lookup: Chebyshev bound on the fraction of occluders
+// behind depth, with the low tail cut to hide light bleeding
+float vsmShadow(vec2 moments, float depth) {
+    if (depth <= moments.x)
         return 0.0;
+    float variance = max(moments.y - moments.x * moments.x, 0.00002);
+    float d = depth - moments.x;
+    float pMax = variance / (variance + d * d);
+    return 1.0 - clamp((pMax - 0.3) / 0.7, 0.0, 1.0);
+}
 
+// Shadow from the first (tightest) cascade whose tile covers the fragment
+float computeShadow(vec3 normal, vec3 worldPos) {
     vec3 N = normalize(normal);
-    vec3 L = normalize(-u_lightDir);
+    vec3 L = normalize(-lights.dirLightDir.xyz);
     float bias = max(0.0009, 0.0015 * (1.0 - dot(N, L)));
-
-    float shadow = 0.0;
-    vec2 texelSize = 1.0 / vec2(textureSize(u_shadowMap, 0));
-    for (int x = -1; x <= 1; ++x) {
-        for (int y = -1; y <= 1; ++y) {
-            float pcfDepth = texture(u_shadowMap,
-                                     projCoords.xy + vec2(x, y) * texelSize).r;
-            shadow += (projCoords.z - bias > pcfDepth) ? 1.0 : 0.0;
+    vec2 atlasTexel = 1.0 / vec2(textureSize(u_shadowMap, 0));
+    ivec4 light = u_shadowLights[0];
+
+    for (int i = 0; i < light.y; ++i) {
+        int view = light.x + i;
+        vec4 lightSpacePos = u_shadowViewMatrices[view] * vec4(worldPos, 1.0);
+        vec3 projCoords = lightSpacePos.xyz / lightSpacePos.w;
+        projCoords = projCoords * 0.5 + 0.5;
+
+        // Keep the PCF kernel inside this cascade's tile
+        vec4 rect = u_shadowViewRects[view];
+        vec2 margin = 2.0 * atlasTexel / rect.zw;
+        if (any(lessThan(projCoords.xy, margin)) ||
+            any(greaterThan(projCoords.xy, 1.0 - margin)))
+            continue;
+        if (projCoords.z > 1.0)
+            return 0.0;
+
+        vec2 atlasUV = rect.xy + projCoords.xy * rect.zw;
+#ifdef VSM_SHADOWS
+        vec2 moments = texture(u_shadowMap, atlasUV).rg;
+        return vsmShadow(moments, projCoords.z);
+#else
+        float shadow = 0.0;
+        for (int x = -1; x <= 1; ++x) {
+            for (int y = -1; y <= 1; ++y) {
+                vec2 uv = atlasUV + vec2(x, y) * atlasTexel;
+                float pcfDepth = texture(u_shadowMap, uv).r;
+                shadow += (projCoords.z - bias > pcfDepth) ? 1.0 : 0.0;
+            }
         }
+        return shadow / 9.0;
+#endif
     }
-    shadow /= 9.0;
-    return shadow;
+    return 0.0;
 }
 
 float heightAt(vec2 uv) {
@@ -102,33 +153,39 @@ void main() {
     vec3 albedo = v_color.rgb;
     vec3 N = normalize(v_normalEye);
 
-    if (u_bumpEnabled != 0) {
-        N = computeBumpNormal(N);
-    }
+#ifdef BUMP_MAP
+    N = computeBumpNormal(N);
+#endif
 
+#if defined(DIR_LIGHT) || defined(POINT_LIGHT) || defined(SPOT_LIGHT)
     vec3 color = vec3(0.0);
-    if (u_enableLight0 != 0) color += applyLight(0, N, albedo);
-    if (u_enableLight1 != 0) color += applyLight(1, N, albedo);
-    if (u_enableLight2 != 0) color += applyLight(2, N, albedo);
-
-    if (u_enableLight0 == 0 && u_enableLight1 == 0 && u_enableLight2 == 0) {
-        vec3 L = normalize(vec3(0.3, 0.8, 0.6));
-        float ndotl = max(dot(N, L), 0.0);
-        color = albedo * (0.2 + 0.8 * ndotl);
-    }
+#ifdef DIR_LIGHT
+    color += applyLight(0, N, albedo);
+#endif
+#ifdef POINT_LIGHT
+    color += applyLight(1, N, albedo);
+#endif
+#ifdef SPOT_LIGHT
+    color += applyLight(2, N, albedo);
+#endif
+#else
+    vec3 L = normalize(vec3(0.3, 0.8, 0.6));
+    float ndotl = max(dot(N, L), 0.0);
+    vec3 color = albedo * (0.2 + 0.8 * ndotl);
+#endif
 
     float shadow = 0.0;
-    if (u_enableShadow) {
-        shadow = computeShadow(v_worldNormal, v_lightSpacePos);
-    }
+#ifdef DIR_SHADOW
+    shadow = computeShadow(v_worldNormal, v_worldPos);
+#endif
 
     color *= (1.0 - 0.7 * shadow);
 
-    if (smokeEnabled != 0) {
-        float distEye = length(v_posEye);
-        float denom = max(u_smokeParams.y - u_smokeParams.x, 1e-5);
-        float fogFactor = clamp((u_smokeParams.y - distEye) / denom, 0.0, 1.0);
-        color = mix(vec3(1.0), color, fogFactor);
-    }
+#ifdef SMOKE
+    float distEye = length(v_posEye);
+    float denom = max(frame.smokeParams.y - frame.smokeParams.x, 1e-5);
+    float fogFactor = clamp((frame.smokeParams.y - distEye) / denom, 0.0, 1.0);
+    color = mix(vec3(1.0), color, fogFactor);
+#endif
     fragColor = vec4(color, v_color.a);
 }
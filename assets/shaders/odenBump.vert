@@ -1,4 +1,4 @@
-#version 330 compatibility
+#version 420 compatibility
 
 out vec3 v_posEye;
 out vec3 v_normalEye;
@@ -6,10 +6,18 @@ out vec2 v_uv;
 out vec4 v_color;
 
 out vec3 v_worldNormal;
-out vec4 v_lightSpacePos;
+out vec3 v_worldPos;
 
-uniform mat4 u_invView;
-uniform mat4 uLightSpace;
+// Per-view camera, smoke and clip data
+layout (std140, binding = 0) uniform frame_constants {
+    mat4 projection;
+    mat4 view;
+    mat4 invView;
+    vec4 cameraPos;    // xyz
+    vec4 smokeParams;  // Start, end
+    vec4 clipPlane;    // World space plane equation
+    ivec4 flags;       // Clip plane enabled, smoke enabled
+} frame;
 
 void main() {
     vec4 posEye4 = gl_ModelViewMatrix * gl_Vertex;
@@ -20,9 +28,9 @@ void main() {
     v_color = gl_Color;
 
     // Reconstruct world position from eye space: world = invView * eye
-    vec4 worldPos = u_invView * posEye4;
-    v_worldNormal = normalize(mat3(u_invView) * v_normalEye);
-    v_lightSpacePos = uLightSpace * worldPos;
+    vec4 worldPos = frame.invView * posEye4;
+    v_worldNormal = normalize(mat3(frame.invView) * v_normalEye);
+    v_worldPos = worldPos.xyz;
 
     gl_Position = gl_ProjectionMatrix * posEye4;
 }
@@ -3,30 +3,35 @@ layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoord;
 
-uniform mat4 u_model;
-uniform mat4 uLightSpace;
+// Per-view camera, smoke and clip data
+layout (std140, binding = 0) uniform frame_constants {
+    mat4 projection;
+    mat4 view;
+    mat4 invView;
+    vec4 cameraPos;    // xyz
+    vec4 smokeParams;  // Start, end
+    vec4 clipPlane;    // World space plane equation
+    ivec4 flags;       // Clip plane enabled, smoke enabled
+} frame;
 
-layout (std140, binding = 0) uniform commom_matrices
-{
-    mat4 u_projection;
-    mat4 u_view;
-};
+// Per-object transforms, bound from a ring buffer before each draw
+layout (std140, binding = 3) uniform object_constants {
+    mat4 model;
+    mat4 normalMatrix;
+} object;
 
 out vec3 vWorldPos;
 out vec3 vNormal;
 out vec2 vTexCoord;
 out vec4 vClipSpace;
-out vec4 vLightSpacePos;
 
 void main()
 {
-    vec4 worldPosition = u_model * vec4(aPos, 1.0);
+    vec4 worldPosition = object.model * vec4(aPos, 1.0);
     vWorldPos = worldPosition.xyz;
-    vNormal = mat3(transpose(inverse(u_model))) * aNormal;
+    vNormal = mat3(object.normalMatrix) * aNormal;
     vTexCoord = aTexCoord;
 
-    vClipSpace = u_projection * u_view * worldPosition;
+    vClipSpace = frame.projection * frame.view * worldPosition;
     gl_Position = vClipSpace;
-
-    vLightSpacePos = uLightSpace * worldPosition;
 }
\ No newline at end of file
@@ -0,0 +1,40 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+// 0 = depth atlas, 1 = horizontal result
+uniform int u_source;
+uniform sampler2D u_depth;
+uniform sampler2D u_blurred;
+
+// Tile being filtered: uv offset (xy) and size (zw) in the moments atlas
+uniform vec4 u_tile;
+uniform vec2 u_axis;
+uniform float u_texelSize;
+uniform int u_radius;
+
+vec2 fetchMoments(vec2 uv) {
+    // Stay inside the tile so neighbouring views never bleed in
+    vec2 halfTexel = vec2(0.5 * u_texelSize);
+    uv = clamp(uv, u_tile.xy + halfTexel, u_tile.xy + u_tile.zw - halfTexel);
+
+    if (u_source == 1)
+        return texture(u_blurred, uv).rg;
+
+    float depth = texture(u_depth, uv).r;
+    return vec2(depth, depth * depth);
+}
+
+void main() {
+    vec2 uv = u_tile.xy + TexCoords * u_tile.zw;
+    float sigma = float(max(u_radius, 1)) * 0.5 + 0.5;
+    vec2 moments = vec2(0.0);
+    float weightSum = 0.0;
+    for (int i = -u_radius; i <= u_radius; ++i) {
+        float w = exp(-float(i * i) / (2.0 * sigma * sigma));
+        moments += w * fetchMoments(uv + u_axis * float(i) * u_texelSize);
+        weightSum += w;
+    }
+    FragColor = vec4(moments / weightSum, 0.0, 1.0);
+}
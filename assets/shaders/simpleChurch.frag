@@ -1,4 +1,6 @@
 #version 430 core
+
+// Feature variants (see ShaderVariants): DIR_SHADOW, VSM_SHADOWS, SMOKE
 out vec4 f_color;
 
 in V_OUT
@@ -6,44 +8,96 @@ in V_OUT
    vec3 position;
    vec3 normal;
    vec2 texture_coordinate;
-    vec4 lightSpacePos;
 } f_in;
 
 uniform vec3 u_color;
 
 uniform sampler2D u_texture;
-uniform vec3 u_cameraPos;
-uniform vec2 u_smokeParams;
-uniform bool smokeEnabled;
 
-uniform sampler2D u_shadowMap;
-uniform vec3 u_lightDir;
-uniform bool u_enableShadow;
+// Per-view camera, smoke and clip data
+layout (std140, binding = 0) uniform frame_constants {
+    mat4 projection;
+    mat4 view;
+    mat4 invView;
+    vec4 cameraPos;    // xyz
+    vec4 smokeParams;  // Start, end
+    vec4 clipPlane;    // World space plane equation
+    ivec4 flags;       // Clip plane enabled, smoke enabled
+} frame;
+
+// Scene lights, filled once per frame
+layout (std140, binding = 2) uniform light_constants {
+    vec4 dirLightDir;  // xyz, pointing away from the light
+    vec4 pointLightPos;
+    vec4 spotLightPos;
+    vec4 spotLightDir;
+    vec4 spotCone;     // Inner and outer cosine
+    ivec4 enabled;     // Directional, point, spot
+    ivec4 shadows;     // Directional, point, spot
+} lights;
 
-float computeShadow(vec3 normal, vec4 lightSpacePos) {
-    vec3 projCoords = lightSpacePos.xyz / lightSpacePos.w;
-    projCoords = projCoords * 0.5 + 0.5;
+uniform sampler2D u_shadowMap;  // Shadow atlas, depth moments with VSM_SHADOWS
 
-    if (projCoords.x < 0.0 || projCoords.x > 1.0 ||
-        projCoords.y < 0.0 || projCoords.y > 1.0 ||
-        projCoords.z > 1.0)
+// Views and lights packed into the shadow atlas. Light 0 is the directional
+// light, 1 the point light and 2 the spot light.
+layout (std140, binding = 1) uniform shadow_atlas {
+    mat4 u_shadowViewMatrices[16];
+    vec4 u_shadowViewRects[16];   // Atlas uv offset (xy) and size (zw)
+    ivec4 u_shadowLights[4];      // First view, view count, enabled, type
+    vec4 u_shadowLightParams[4];  // Position (xyz), far plane (w)
+};
+
+// Variance shadow map lookup: Chebyshev bound on the fraction of occluders
+// behind depth, with the low tail cut to hide light bleeding
+float vsmShadow(vec2 moments, float depth) {
+    if (depth <= moments.x)
         return 0.0;
+    float variance = max(moments.y - moments.x * moments.x, 0.00002);
+    float d = depth - moments.x;
+    float pMax = variance / (variance + d * d);
+    return 1.0 - clamp((pMax - 0.3) / 0.7, 0.0, 1.0);
+}
 
+// Shadow from the first (tightest) cascade whose tile covers the fragment
+float computeShadow(vec3 normal, vec3 worldPos) {
     vec3 N = normalize(normal);
-    vec3 L = normalize(-u_lightDir);
+    vec3 L = normalize(-lights.dirLightDir.xyz);
     float bias = max(0.0009, 0.0015 * (1.0 - dot(N, L)));
+    vec2 atlasTexel = 1.0 / vec2(textureSize(u_shadowMap, 0));
+    ivec4 light = u_shadowLights[0];
 
-    float shadow = 0.0;
-    vec2 texelSize = 1.0 / vec2(textureSize(u_shadowMap, 0));
-    for (int x = -1; x <= 1; ++x) {
-        for (int y = -1; y <= 1; ++y) {
-            float pcfDepth = texture(u_shadowMap,
-                                     projCoords.xy + vec2(x, y) * texelSize).r;
-            shadow += (projCoords.z - bias > pcfDepth) ? 1.0 : 0.0;
+    for (int i = 0; i < light.y; ++i) {
+        int view = light.x + i;
+        vec4 lightSpacePos = u_shadowViewMatrices[view] * vec4(worldPos, 1.0);
+        vec3 projCoords = lightSpacePos.xyz / lightSpacePos.w;
+        projCoords = projCoords * 0.5 + 0.5;
+
+        // Keep the PCF kernel inside this cascade's tile
+        vec4 rect = u_shadowViewRects[view];
+        vec2 margin = 2.0 * atlasTexel / rect.zw;
+        if (any(lessThan(projCoords.xy, margin)) ||
+            any(greaterThan(projCoords.xy, 1.0 - margin)))
+            continue;
+        if (projCoords.z > 1.0)
+            return 0.0;
+
+        vec2 atlasUV = rect.xy + projCoords.xy * rect.zw;
+#ifdef VSM_SHADOWS
+        vec2 moments = texture(u_shadowMap, atlasUV).rg;
+        return vsmShadow(moments, projCoords.z);
+#else
+        float shadow = 0.0;
+        for (int x = -1; x <= 1; ++x) {
+            for (int y = -1; y <= 1; ++y) {
+                vec2 uv = atlasUV + vec2(x, y) * atlasTexel;
+                float pcfDepth = texture(u_shadowMap, uv).r;
+                shadow += (projCoords.z - bias > pcfDepth) ? 1.0 : 0.0;
+            }
         }
+        return shadow / 9.0;
+#endif
     }
-    shadow /= 9.0;
-    return shadow;
+    return 0.0;
 }
 
 void main()
@@ -51,20 +105,21 @@ void main()
     vec3 color = vec3(texture(u_texture, f_in.texture_coordinate));
 
     float shadow = 0.0;
-    if (u_enableShadow) {
-        shadow = computeShadow(f_in.normal, f_in.lightSpacePos);
-    }
+#ifdef DIR_SHADOW
+    shadow = computeShadow(f_in.normal, f_in.position);
+#endif
     color *= (1.0 - 0.7 * shadow);
 
     float smoke = 0.0;
-    if (u_smokeParams.y > u_smokeParams.x && u_smokeParams.x >= 0.0) {
-        float dist = length(u_cameraPos - f_in.position);
-        smoke = clamp((dist - u_smokeParams.x) /
-                          max(u_smokeParams.y - u_smokeParams.x, 0.0001),
+#ifdef SMOKE
+    if (frame.smokeParams.y > frame.smokeParams.x && frame.smokeParams.x >= 0.0) {
+        float dist = length(frame.cameraPos.xyz - f_in.position);
+        smoke = clamp((dist - frame.smokeParams.x) /
+                          max(frame.smokeParams.y - frame.smokeParams.x, 0.0001),
                       0.0, 1.0);
     }
+#endif
 
-    if (!smokeEnabled) smoke = 0.0;
     vec3 finalColor = mix(color, vec3(1.0), smoke);
     f_color = vec4(finalColor, 1.0f);
 }
\ No newline at end of file
@@ -4,16 +4,23 @@ layout (location = 1) in vec3 normal;
 
 out vec3 vs_worldpos;
 out vec3 vs_normal;
-out vec4 vLightSpacePos;
 
-uniform mat4 u_model;
-uniform mat4 uLightSpace;
+// Per-view camera, smoke and clip data
+layout (std140, binding = 0) uniform frame_constants {
+    mat4 projection;
+    mat4 view;
+    mat4 invView;
+    vec4 cameraPos;    // xyz
+    vec4 smokeParams;  // Start, end
+    vec4 clipPlane;    // World space plane equation
+    ivec4 flags;       // Clip plane enabled, smoke enabled
+} frame;
 
-layout (std140, binding = 0) uniform commom_matrices
-{
-    mat4 u_projection;
-    mat4 u_view;
-};
+// Per-object transforms, bound from a ring buffer before each draw
+layout (std140, binding = 3) uniform object_constants {
+    mat4 model;
+    mat4 normalMatrix;
+} object;
 
 uniform float u_time;
 uniform int u_waveCount;
@@ -54,9 +61,8 @@ void main(void){
     // Normal = normalize(-dy/dx, 1, -dy/dz)
     vec3 newNormal = normalize(vec3(-dIdx, 1.0, -dIdz));
 
-    vec4 worldPos = u_model * pos;
-    gl_Position = u_projection * u_view * worldPos;
+    vec4 worldPos = object.model * pos;
+    gl_Position = frame.projection * frame.view * worldPos;
     vs_worldpos = worldPos.xyz;
-    vs_normal = normalize(mat3(u_model) * newNormal);
-    vLightSpacePos = uLightSpace * worldPos;
+    vs_normal = normalize(mat3(object.model) * newNormal);
 }
\ No newline at end of file
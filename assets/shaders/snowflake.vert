@@ -4,29 +4,36 @@ layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 texture_coordinate;
 layout (location = 3) in vec3 barycentric;
 
-uniform mat4 u_model;
-uniform mat4 uLightSpace;
+// Per-view camera, smoke and clip data
+layout (std140, binding = 0) uniform frame_constants {
+    mat4 projection;
+    mat4 view;
+    mat4 invView;
+    vec4 cameraPos;    // xyz
+    vec4 smokeParams;  // Start, end
+    vec4 clipPlane;    // World space plane equation
+    ivec4 flags;       // Clip plane enabled, smoke enabled
+} frame;
 
-layout (std140, binding = 0) uniform commom_matrices {
-    mat4 u_projection;
-    mat4 u_view;
-};
+// Per-object transforms, bound from a ring buffer before each draw
+layout (std140, binding = 3) uniform object_constants {
+    mat4 model;
+    mat4 normalMatrix;
+} object;
 
 out V_OUT {
     vec3 worldPos;
     vec3 normal;
     vec3 bary;
     vec2 uv;
-    vec4 lightSpacePos;
 } v_out;
 
 void main() {
-    vec4 world = u_model * vec4(position, 1.0);
-    gl_Position = u_projection * u_view * world;
+    vec4 world = object.model * vec4(position, 1.0);
+    gl_Position = frame.projection * frame.view * world;
 
     v_out.worldPos = world.xyz;
-    v_out.normal = mat3(transpose(inverse(u_model))) * normal;
+    v_out.normal = mat3(object.normalMatrix) * normal;
     v_out.bary = barycentric;
     v_out.uv = texture_coordinate;
-    v_out.lightSpacePos = uLightSpace * world;
 }
@@ -1,72 +1,135 @@
-#version 330 core
+#version 420 core
+
+// Feature variants (see ShaderVariants): DIR_LIGHT, POINT_LIGHT,
+// SPOT_LIGHT, DIR_SHADOW, POINT_SHADOW, SPOT_SHADOW, VSM_SHADOWS, SMOKE
 out vec4 FragColor;
 
 in VS_OUT {
     vec3 worldPos;
     vec3 normal;
     vec3 color;
-    vec4 lightSpacePos;
 } fs_in;
 
-uniform vec3 u_lightDir;
-uniform vec3 u_viewPos;
-uniform vec2 u_smokeParams;
-uniform bool smokeEnabled;
-uniform sampler2D u_shadowMap;
-uniform bool u_enableShadow;
-uniform bool u_enableLight;
-// Point light
-uniform vec3 u_pointLightPos;
-uniform samplerCube u_pointShadowMap;
-uniform float u_pointFarPlane;
-uniform bool u_enablePointShadow;
-uniform bool u_enablePointLight;
-// Spot light
-uniform vec3 u_spotLightPos;
-uniform vec3 u_spotLightDir;
-uniform mat4 u_spotLightMatrix;
-uniform sampler2D u_spotShadowMap;
-uniform float u_spotFarPlane;
-uniform float u_spotInnerCos;
-uniform float u_spotOuterCos;
-uniform bool u_enableSpotShadow;
-uniform bool u_enableSpotLight;
-
-float computeShadow(vec3 normal, vec4 lightSpacePos) {
-    vec3 projCoords = lightSpacePos.xyz / lightSpacePos.w;
-    projCoords = projCoords * 0.5 + 0.5;
+// Per-view camera, smoke and clip data
+layout (std140, binding = 0) uniform frame_constants {
+    mat4 projection;
+    mat4 view;
+    mat4 invView;
+    vec4 cameraPos;    // xyz
+    vec4 smokeParams;  // Start, end
+    vec4 clipPlane;    // World space plane equation
+    ivec4 flags;       // Clip plane enabled, smoke enabled
+} frame;
+
+// Scene lights, filled once per frame
+layout (std140, binding = 2) uniform light_constants {
+    vec4 dirLightDir;  // xyz, pointing away from the light
+    vec4 pointLightPos;
+    vec4 spotLightPos;
+    vec4 spotLightDir;
+    vec4 spotCone;     // Inner and outer cosine
+    ivec4 enabled;     // Directional, point, spot
+    ivec4 shadows;     // Directional, point, spot
+} lights;
 
-    // Outside the light frustum: no shadow contribution
-    if (projCoords.x < 0.0 || projCoords.x > 1.0 ||
-        projCoords.y < 0.0 || projCoords.y > 1.0 ||
-        projCoords.z > 1.0)
+uniform sampler2D u_shadowMap;  // Shadow atlas, depth moments with VSM_SHADOWS
+
+// Views and lights packed into the shadow atlas. Light 0 is the directional
+// light, 1 the point light and 2 the spot light.
+layout (std140, binding = 1) uniform shadow_atlas {
+    mat4 u_shadowViewMatrices[16];
+    vec4 u_shadowViewRects[16];   // Atlas uv offset (xy) and size (zw)
+    ivec4 u_shadowLights[4];      // First view, view count, enabled, type
+    vec4 u_shadowLightParams[4];  // Position (xyz), far plane (w)
+};
+
+// Variance shadow map lookup: Chebyshev bound on the fraction of occluders
+// behind depth, with the low tail cut to hide light bleeding
+float vsmShadow(vec2 moments, float depth) {
+    if (depth <= moments.x)
         return 0.0;
+    float variance = max(moments.y - moments.x * moments.x, 0.00002);
+    float d = depth - moments.x;
+    float pMax = variance / (variance + d * d);
+    return 1.0 - clamp((pMax - 0.3) / 0.7, 0.0, 1.0);
+}
 
+// Shadow from the first (tightest) cascade whose tile covers the fragment
+float computeShadow(vec3 normal, vec3 worldPos) {
     vec3 N = normalize(normal);
-    vec3 L = normalize(-u_lightDir);
-
+    vec3 L = normalize(-lights.dirLightDir.xyz);
     float bias = max(0.0009, 0.0015 * (1.0 - dot(N, L)));
-    float shadow = 0.0;
-    vec2 texelSize = 1.0 / vec2(textureSize(u_shadowMap, 0));
+    vec2 atlasTexel = 1.0 / vec2(textureSize(u_shadowMap, 0));
+    ivec4 light = u_shadowLights[0];
 
-    for (int x = -1; x <= 1; ++x) {
-        for (int y = -1; y <= 1; ++y) {
-            float pcfDepth = texture(u_shadowMap,
-                                     projCoords.xy + vec2(x, y) * texelSize).r;
-            shadow += projCoords.z - bias > pcfDepth ? 1.0 : 0.0;
+    for (int i = 0; i < light.y; ++i) {
+        int view = light.x + i;
+        vec4 lightSpacePos = u_shadowViewMatrices[view] * vec4(worldPos, 1.0);
+        vec3 projCoords = lightSpacePos.xyz / lightSpacePos.w;
+        projCoords = projCoords * 0.5 + 0.5;
+
+        // Keep the PCF kernel inside this cascade's tile
+        vec4 rect = u_shadowViewRects[view];
+        vec2 margin = 2.0 * atlasTexel / rect.zw;
+        if (any(lessThan(projCoords.xy, margin)) ||
+            any(greaterThan(projCoords.xy, 1.0 - margin)))
+            continue;
+        if (projCoords.z > 1.0)
+            return 0.0;
+
+        vec2 atlasUV = rect.xy + projCoords.xy * rect.zw;
+#ifdef VSM_SHADOWS
+        vec2 moments = texture(u_shadowMap, atlasUV).rg;
+        return vsmShadow(moments, projCoords.z);
+#else
+        float shadow = 0.0;
+        for (int x = -1; x <= 1; ++x) {
+            for (int y = -1; y <= 1; ++y) {
+                vec2 uv = atlasUV + vec2(x, y) * atlasTexel;
+                float pcfDepth = texture(u_shadowMap, uv).r;
+                shadow += (projCoords.z - bias > pcfDepth) ? 1.0 : 0.0;
+            }
         }
+        return shadow / 9.0;
+#endif
     }
-    shadow /= 9.0;
-    return shadow;
+    return 0.0;
+}
+
+// Atlas uv of the point light's cube face tile that dir points through
+vec2 pointShadowUV(vec3 dir) {
+    vec3 a = abs(dir);
+    int face;
+    if (a.x >= a.y && a.x >= a.z)
+        face = dir.x > 0.0 ? 0 : 1;
+    else if (a.y >= a.z)
+        face = dir.y > 0.0 ? 2 : 3;
+    else
+        face = dir.z > 0.0 ? 4 : 5;
+
+    int view = u_shadowLights[1].x + face;
+    vec4 clip = u_shadowViewMatrices[view] *
+                vec4(u_shadowLightParams[1].xyz + dir, 1.0);
+    vec2 uv = clip.xy / clip.w * 0.5 + 0.5;
+
+    // Half a texel in keeps bilinear taps off the neighbouring tiles
+    vec4 rect = u_shadowViewRects[view];
+    vec2 inset = 0.5 / vec2(textureSize(u_shadowMap, 0)) / rect.zw;
+    return rect.xy + clamp(uv, inset, 1.0 - inset) * rect.zw;
 }
 
 float computePointShadow(vec3 fragPos) {
-    vec3 fragToLight = fragPos - u_pointLightPos;
+    vec3 fragToLight = fragPos - u_shadowLightParams[1].xyz;
     float currentDepth = length(fragToLight);
+    float farPlane = u_shadowLightParams[1].w;
+#ifdef VSM_SHADOWS
+    vec2 moments = texture(u_shadowMap, pointShadowUV(fragToLight)).rg;
+    return vsmShadow(moments, currentDepth / farPlane);
+#else
     float bias = 0.006;
     float shadow = 0.0;
     int samples = 20;
-    float diskRadius = (1.0 + currentDepth / u_pointFarPlane) * 0.05;
+    float diskRadius = (1.0 + currentDepth / farPlane) * 0.05;
     vec3 sampleOffsetDirections[20] = vec3[](
         vec3( 1,  1,  1), vec3( 1, -1,  1), vec3(-1, -1,  1), vec3(-1,  1,  1),
         vec3( 1,  1, -1), vec3( 1, -1, -1), vec3(-1, -1, -1), vec3(-1,  1, -1),
@@ -77,16 +140,18 @@ float computePointShadow(vec3 fragPos) {
 
     for (int i = 0; i < samples; ++i) {
         vec3 sampleDir = normalize(fragToLight + sampleOffsetDirections[i] * diskRadius);
-        float closestDepth = texture(u_pointShadowMap, sampleDir).r;
-        closestDepth *= u_pointFarPlane;
+        float closestDepth = texture(u_shadowMap, pointShadowUV(sampleDir)).r;
+        closestDepth *= farPlane;
         shadow += (currentDepth - bias > closestDepth) ? 1.0 : 0.0;
     }
     shadow /= float(samples);
     return shadow;
+#endif
 }
 
 float computeSpotShadow(vec3 fragPos) {
-    vec4 lightSpace = u_spotLightMatrix * vec4(fragPos, 1.0);
+    int view = u_shadowLights[2].x;
+    vec4 lightSpace = u_shadowViewMatrices[view] * vec4(fragPos, 1.0);
     vec3 projCoords = lightSpace.xyz / lightSpace.w;
     projCoords = projCoords * 0.5 + 0.5;
 
@@ -94,22 +159,31 @@ float computeSpotShadow(vec3 fragPos) {
         projCoords.y > 1.0 || projCoords.z > 1.0)
         return 0.0;
 
-    float currentDepth = length(fragPos - u_spotLightPos);
+    float currentDepth = length(fragPos - u_shadowLightParams[2].xyz);
+    float farPlane = u_shadowLightParams[2].w;
+
+    // Keep the PCF kernel inside the spot tile
+    vec4 rect = u_shadowViewRects[view];
+    vec2 texelSize = 1.0 / vec2(textureSize(u_shadowMap, 0));
+    vec2 inset = 1.5 * texelSize / rect.zw;
+    vec2 atlasUV = rect.xy + clamp(projCoords.xy, inset, 1.0 - inset) * rect.zw;
+#ifdef VSM_SHADOWS
+    vec2 moments = texture(u_shadowMap, atlasUV).rg;
+    return vsmShadow(moments, currentDepth / farPlane);
+#else
     float bias = 0.004;
     float shadow = 0.0;
-    vec2 texelSize = 1.0 / vec2(textureSize(u_spotShadowMap, 0));
     for (int x = -1; x <= 1; ++x) {
         for (int y = -1; y <= 1; ++y) {
             float closestDepth =
-                texture(u_spotShadowMap,
-                        projCoords.xy + vec2(x, y) * texelSize)
-                    .r;
-            closestDepth *= u_spotFarPlane;
+                texture(u_shadowMap, atlasUV + vec2(x, y) * texelSize).r;
+            closestDepth *= farPlane;
             shadow += (currentDepth - bias > closestDepth) ? 1.0 : 0.0;
         }
     }
     shadow /= 9.0;
     return shadow;
+#endif
 }
 
 void main() {
@@ -117,25 +191,29 @@ void main() {
     vec3 ambient = 0.05 * albedo;
 
     vec3 N = normalize(fs_in.normal);
-    vec3 V = normalize(u_viewPos - fs_in.worldPos);
+    vec3 V = normalize(frame.cameraPos.xyz - fs_in.worldPos);
 
     // Directional light
     vec3 dirLight = vec3(0.0);
-    if (u_enableLight) {
-        vec3 Ld = normalize(-u_lightDir);
+#ifdef DIR_LIGHT
+    {
+        vec3 Ld = normalize(-lights.dirLightDir.xyz);
         vec3 Hd = normalize(Ld + V);
         float diffD = max(dot(N, Ld), 0.0);
         float specD = pow(max(dot(N, Hd), 0.0), 32.0) * 0.25;
-        float shadowD = (u_enableShadow && u_enableLight)
-                            ? computeShadow(N, fs_in.lightSpacePos)
-                            : 0.0;
+        float shadowD = 0.0;
+#ifdef DIR_SHADOW
+        shadowD = computeShadow(N, fs_in.worldPos);
+#endif
         dirLight = (1.0 - shadowD) * (diffD * albedo + specD);
     }
+#endif
 
     // Point light
     vec3 pointLight = vec3(0.0);
-    if (u_enablePointLight) {
-        vec3 Lp = u_pointLightPos - fs_in.worldPos;
+#ifdef POINT_LIGHT
+    {
+        vec3 Lp = lights.pointLightPos.xyz - fs_in.worldPos;
         float dist = length(Lp);
         Lp = normalize(Lp);
         vec3 Hp = normalize(Lp + V);
@@ -143,48 +221,53 @@ void main() {
         float specP = pow(max(dot(N, Hp), 0.0), 32.0) * 0.25;
         float attenuation = 1.0 / (1.0 + 0.02 * dist + 0.004 * dist * dist);
         float pointStrength = 1.5;
-        float shadowP = (u_enablePointShadow && u_enablePointLight)
-                            ? computePointShadow(fs_in.worldPos)
-                            : 0.0;
+        float shadowP = 0.0;
+#ifdef POINT_SHADOW
+        shadowP = computePointShadow(fs_in.worldPos);
+#endif
         pointLight = pointStrength * (1.0 - shadowP) * attenuation *
                      (diffP * albedo + specP);
     }
+#endif
 
     // Spot light
     vec3 spotLight = vec3(0.0);
-    if (u_enableSpotLight) {
-        vec3 Ls = u_spotLightPos - fs_in.worldPos;
+#ifdef SPOT_LIGHT
+    {
+        vec3 Ls = lights.spotLightPos.xyz - fs_in.worldPos;
         float dist = length(Ls);
         Ls = normalize(Ls);
         vec3 Hs = normalize(Ls + V);
-        float theta = dot(-u_spotLightDir, Ls);
-        float spotEffect = clamp((theta - u_spotOuterCos) /
-                                     max(u_spotInnerCos - u_spotOuterCos, 1e-3),
+        float theta = dot(-lights.spotLightDir.xyz, Ls);
+        float spotEffect = clamp((theta - lights.spotCone.y) /
+                                     max(lights.spotCone.x - lights.spotCone.y, 1e-3),
                                  0.0, 1.0);
-        if (theta > u_spotOuterCos) {
+        if (theta > lights.spotCone.y) {
             float diffS = max(dot(N, Ls), 0.0);
             float specS = pow(max(dot(N, Hs), 0.0), 32.0) * 0.25;
             float attenuation = 1.0 / (1.0 + 0.02 * dist + 0.004 * dist * dist);
             float spotStrength = 1.5;
-            float shadowS = (u_enableSpotShadow && u_enableSpotLight)
-                                ? computeSpotShadow(fs_in.worldPos)
-                                : 0.0;
+            float shadowS = 0.0;
+#ifdef SPOT_SHADOW
+            shadowS = computeSpotShadow(fs_in.worldPos);
+#endif
             spotLight = spotStrength * 1.33 * (1.0 - shadowS) * spotEffect *
                         attenuation * (diffS * albedo + specS);
         }
     }
+#endif
 
     vec3 lighting = ambient + dirLight + pointLight + spotLight;
 
     float smoke = 0.0;
-    if (u_smokeParams.y > u_smokeParams.x && u_smokeParams.x >= 0.0) {
-        float dist = length(u_viewPos - fs_in.worldPos);
-        smoke = clamp((dist - u_smokeParams.x) /
-                          max(u_smokeParams.y - u_smokeParams.x, 0.0001),
+#ifdef SMOKE
+    if (frame.smokeParams.y > frame.smokeParams.x && frame.smokeParams.x >= 0.0) {
+        float dist = length(frame.cameraPos.xyz - fs_in.worldPos);
+        smoke = clamp((dist - frame.smokeParams.x) /
+                          max(frame.smokeParams.y - frame.smokeParams.x, 0.0001),
                       0.0, 1.0);
     }
-    if (!smokeEnabled)
-        smoke = 0.0;
+#endif
 
     vec3 finalColor = mix(lighting, vec3(1.0), smoke);
     FragColor = vec4(finalColor, 1.0);
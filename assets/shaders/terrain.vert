@@ -1,4 +1,6 @@
-#version 330 core
+#version 420 core
+
+// Feature variants (see ShaderVariants): CLIP_PLANE
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec3 aColor;
@@ -7,30 +9,37 @@ out VS_OUT {
     vec3 worldPos;
     vec3 normal;
     vec3 color;
-    vec4 lightSpacePos;
 } vs_out;
 
-uniform mat4 u_model;
-uniform mat4 u_view;
-uniform mat4 u_proj;
-uniform mat4 u_lightSpace;
-uniform vec4 u_clipPlane;
-uniform bool u_enableClip;
+// Per-view camera, smoke and clip data
+layout (std140, binding = 0) uniform frame_constants {
+    mat4 projection;
+    mat4 view;
+    mat4 invView;
+    vec4 cameraPos;    // xyz
+    vec4 smokeParams;  // Start, end
+    vec4 clipPlane;    // World space plane equation
+    ivec4 flags;       // Clip plane enabled, smoke enabled
+} frame;
+
+// Per-object transforms, bound from a ring buffer before each draw
+layout (std140, binding = 3) uniform object_constants {
+    mat4 model;
+    mat4 normalMatrix;
+} object;
 
 void main() {
-    vec4 world = u_model * vec4(aPos, 1.0);
+    vec4 world = object.model * vec4(aPos, 1.0);
     vs_out.worldPos = world.xyz;
 
-    mat3 normalMat = transpose(inverse(mat3(u_model)));
-    vs_out.normal = normalize(normalMat * aNormal);
+    vs_out.normal = normalize(mat3(object.normalMatrix) * aNormal);
     vs_out.color = aColor;
-    vs_out.lightSpacePos = u_lightSpace * world;
 
-    if (u_enableClip) {
-        gl_ClipDistance[0] = dot(world, u_clipPlane);
-    } else {
-        gl_ClipDistance[0] = 1.0;
-    }
+#ifdef CLIP_PLANE
+    gl_ClipDistance[0] = dot(world, frame.clipPlane);
+#else
+    gl_ClipDistance[0] = 1.0;
+#endif
 
-    gl_Position = u_proj * u_view * world;
+    gl_Position = frame.projection * frame.view * world;
 }
@@ -11,20 +11,28 @@ out V_OUT
     vec2 texture_coordinate;
 } v_out;
 
-uniform mat4 u_model;
-uniform mat4 u_view;
-uniform mat4 u_projection;
-uniform mat4 u_lightSpace;
+// Per-view camera, smoke and clip data
+layout (std140, binding = 0) uniform frame_constants {
+    mat4 projection;
+    mat4 view;
+    mat4 invView;
+    vec4 cameraPos;    // xyz
+    vec4 smokeParams;  // Start, end
+    vec4 clipPlane;    // World space plane equation
+    ivec4 flags;       // Clip plane enabled, smoke enabled
+} frame;
 
-out vec4 v_lightSpacePos;
+// Per-object transforms, bound from a ring buffer before each draw
+layout (std140, binding = 3) uniform object_constants {
+    mat4 model;
+    mat4 normalMatrix;
+} object;
 
 void main()
 {
-    v_out.position = vec3(u_model * vec4(position, 1.0));
-    v_out.normal = mat3(transpose(inverse(u_model))) * normal;
+    v_out.position = vec3(object.model * vec4(position, 1.0));
+    v_out.normal = mat3(object.normalMatrix) * normal;
     v_out.texture_coordinate = texture_coordinate;
 
-    v_lightSpacePos = u_lightSpace * vec4(v_out.position, 1.0);
-
-    gl_Position = u_projection * u_view * vec4(v_out.position, 1.0);
+    gl_Position = frame.projection * frame.view * vec4(v_out.position, 1.0);
 }
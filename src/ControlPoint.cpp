@@ -24,11 +24,12 @@
 
 *************************************************************************/
 
-#include <GL/gl.h>
+#include <glad/glad.h>
 #include <math.h>
 #include <windows.h>
 
 #include "ControlPoint.H"
+#include "RenderUtilities/PrimitiveMesh.h"
 #include "Utilities/3dUtils.h"
 
 //****************************************************************************
@@ -67,11 +68,9 @@ ControlPoint::ControlPoint(const Pnt3f& _pos, const Pnt3f& _orient)
 //
 // * Draw the control point
 //============================================================================
-void ControlPoint::draw()
+void ControlPoint::draw(const PrimitiveMesh& mesh)
 //============================================================================
 {
-    float size = 2.0;
-
     glPushMatrix();
     glTranslatef(pos.x, pos.y, pos.z);
     float theta1 = -radiansToDegrees(atan2(orient.z, orient.x));
@@ -79,52 +78,6 @@ void ControlPoint::draw()
     float theta2 = -radiansToDegrees(acos(orient.y));
     glRotatef(theta2, 0, 0, 1);
 
-    glBegin(GL_QUADS);
-    glNormal3f(0, 0, 1);
-    glVertex3f(size, size, size);
-    glVertex3f(-size, size, size);
-    glVertex3f(-size, -size, size);
-    glVertex3f(size, -size, size);
-
-    glNormal3f(0, 0, -1);
-    glVertex3f(size, size, -size);
-    glVertex3f(size, -size, -size);
-    glVertex3f(-size, -size, -size);
-    glVertex3f(-size, size, -size);
-
-    // no top - it will be the point
-
-    glNormal3f(0, -1, 0);
-    glVertex3f(size, -size, size);
-    glVertex3f(-size, -size, size);
-    glVertex3f(-size, -size, -size);
-    glVertex3f(size, -size, -size);
-
-    glNormal3f(1, 0, 0);
-    glVertex3f(size, size, size);
-    glVertex3f(size, -size, size);
-    glVertex3f(size, -size, -size);
-    glVertex3f(size, size, -size);
-
-    glNormal3f(-1, 0, 0);
-    glVertex3f(-size, size, size);
-    glVertex3f(-size, size, -size);
-    glVertex3f(-size, -size, -size);
-    glVertex3f(-size, -size, size);
-    glEnd();
-    glBegin(GL_TRIANGLE_FAN);
-    glNormal3f(0, 1.0f, 0);
-    glVertex3f(0, 3.0f * size, 0);
-    glNormal3f(1.0f, 0.0f, 1.0f);
-    glVertex3f(size, size, size);
-    glNormal3f(-1.0f, 0.0f, 1.0f);
-    glVertex3f(-size, size, size);
-    glNormal3f(-1.0f, 0.0f, -1.0f);
-    glVertex3f(-size, size, -size);
-    glNormal3f(1.0f, 0.0f, -1.0f);
-    glVertex3f(size, size, -size);
-    glNormal3f(1.0f, 0.0f, 1.0f);
-    glVertex3f(size, size, size);
-    glEnd();
+    mesh.draw(false);
     glPopMatrix();
 }
\ No newline at end of file
@@ -0,0 +1,258 @@
+#pragma once
+#include <glad/glad.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Model.h"
+#include "ProcessMemory.h"
+#include "Shader.h"
+#include "ShaderVariants.h"
+#include "TextureCache.h"
+
+// Process-wide cache of shader programs and models. Callers hold shared
+// pointers; the cache only keeps weak ones, so an asset is unloaded (its
+// program, buffers and texture references freed) when its last user lets
+// go, and loaded again on the next request. A model's diffuse images end
+// up in one texture array, shared through the TextureCache by the models
+// that use the same images.
+//
+// Models load in the background: worker threads parse the file and decode
+// its images, then queue it for the GL thread, which uploads a bounded
+// amount per frame in processUploads.
+class AssetCache {
+public:
+    static AssetCache& instance() {
+        static AssetCache cache;
+        return cache;
+    }
+
+    // Program for the given stage files (null for unused stages) and
+    // #define lines, compiled once per distinct combination
+    std::shared_ptr<Shader> getShader(const char* vert, const char* tesc,
+                                      const char* tese, const char* geom,
+                                      const char* frag,
+                                      const std::string& defines = "") {
+        std::string key;
+        for (const char* stage : { vert, tesc, tese, geom, frag }) {
+            key += stage ? stage : "";
+            key += '|';
+        }
+        key += defines;
+
+        std::shared_ptr<Shader> shader = shaders[key].lock();
+        if (shader) {
+            ++stats.shaderReuses;
+            return shader;
+        }
+        shader.reset(new Shader(vert, tesc, tese, geom, frag, defines),
+                     [](Shader* s) {
+                         glDeleteProgram(s->Program);
+                         delete s;
+                     });
+        shaders[key] = shader;
+        ++stats.shaderLoads;
+        return shader;
+    }
+
+    // Feature variants of the program for the given stage files, shared
+    // by every user of the same files and usedFeatures
+    std::shared_ptr<ShaderVariants> getShaderVariants(
+        const char* vert, const char* tesc, const char* tese,
+        const char* geom, const char* frag, unsigned usedFeatures) {
+        std::string key;
+        for (const char* stage : { vert, tesc, tese, geom, frag }) {
+            key += stage ? stage : "";
+            key += '|';
+        }
+        key += std::to_string(usedFeatures);
+
+        std::shared_ptr<ShaderVariants> variants = shaderVariants[key].lock();
+        if (variants) {
+            ++stats.shaderReuses;
+            return variants;
+        }
+        variants = std::make_shared<ShaderVariants>(vert, tesc, tese, geom,
+                                                    frag, usedFeatures);
+        shaderVariants[key] = variants;
+        return variants;
+    }
+
+    // Model for an already resolved path, shared by every actor and
+    // instance that draws it. A new model is returned at once and draws
+    // nothing until isReady(); a worker loads it meanwhile. Models that keep
+    // their mesh data on the CPU are cached apart from those that do not.
+    std::shared_ptr<Model> getModel(const std::string& path,
+                                    bool keepCpuData = false) {
+        const std::string key = keepCpuData ? path + "|cpu" : path;
+        std::shared_ptr<Model> model = models[key].lock();
+        if (model) {
+            ++stats.modelReuses;
+            return model;
+        }
+        model = std::make_shared<Model>();
+        model->setKeepCpuData(keepCpuData);
+        models[key] = model;
+        ++stats.modelLoads;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(Job{ path, model });
+        }
+        wake.notify_one();
+        return model;
+    }
+
+    // Upload models the workers have finished, one step at a time, until
+    // budgetMs is spent. At least one step runs per call. Returns true while
+    // any model is still loading or uploading. GL thread only.
+    bool processUploads(double budgetMs) {
+        const auto start = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!uploads.empty()) {
+            // Workers only append, so the front stays put while unlocked
+            std::shared_ptr<Model> model = uploads.front();
+            lock.unlock();
+            // Resident memory is sampled around the step that frees the
+            // model's CPU mesh copies
+            const size_t releasedBefore = model->getReleasedBytes();
+            const size_t residentBefore = residentMemoryBytes();
+            const bool done = model->uploadStep();
+            if (model->getReleasedBytes() != releasedBefore) {
+                const size_t residentAfter = residentMemoryBytes();
+                if (releaseSamples == 0)
+                    residentBeforeFirstRelease = residentBefore;
+                residentAfterLastRelease = residentAfter;
+                residentDropped += residentBefore > residentAfter
+                                       ? residentBefore - residentAfter
+                                       : 0;
+                ++releaseSamples;
+            }
+            lock.lock();
+            if (done) {
+                uploads.pop_front();
+                ++uploaded;
+                meshBytesReleased += model->getReleasedBytes();
+                meshBytesKept += model->getCpuBytes();
+            }
+
+            const std::chrono::duration<double, std::milli> elapsed =
+                std::chrono::steady_clock::now() - start;
+            if (elapsed.count() >= budgetMs)
+                break;
+        }
+        return !jobs.empty() || busyWorkers > 0 || !uploads.empty();
+    }
+
+    // Models that finished uploading so far, for anything cached from the
+    // drawn scene
+    int uploadedModels() const { return uploaded; }
+
+    void printStats() const {
+        std::cout << "Assets: " << stats.shaderLoads << " programs built ("
+                  << stats.shaderReuses << " reused), " << stats.modelLoads
+                  << " models loaded (" << stats.modelReuses << " reused, "
+                  << uploaded << " uploaded), "
+                  << TextureCache::instance().size() << " model textures ("
+                  << TextureCache::instance().reuses() << " reused)"
+                  << std::endl;
+        ShaderVariants::printStats();
+        const double mb = 1.0 / (1024.0 * 1024.0);
+        std::cout << "Mesh CPU data: " << meshBytesReleased * mb
+                  << " MB released after upload, " << meshBytesKept * mb
+                  << " MB kept; resident memory "
+                  << residentBeforeFirstRelease * mb
+                  << " MB before the first release, "
+                  << residentAfterLastRelease * mb
+                  << " MB after the last, " << residentDropped * mb
+                  << " MB dropped across " << releaseSamples << " releases"
+                  << std::endl;
+    }
+
+    ~AssetCache() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers) {
+            if (worker.joinable())
+                worker.join();
+        }
+    }
+
+private:
+    struct Job {
+        std::string path;
+        std::shared_ptr<Model> model;
+    };
+
+    struct Stats {
+        int shaderLoads = 0;
+        int shaderReuses = 0;
+        int modelLoads = 0;
+        int modelReuses = 0;
+    };
+
+    std::unordered_map<std::string, std::weak_ptr<Shader>> shaders;
+    std::unordered_map<std::string, std::weak_ptr<ShaderVariants>>
+        shaderVariants;
+    std::unordered_map<std::string, std::weak_ptr<Model>> models;
+    Stats stats;
+    int uploaded = 0;
+    size_t meshBytesReleased = 0;  // Summed over uploaded models
+    size_t meshBytesKept = 0;
+
+    // Measured resident memory around the release steps
+    int releaseSamples = 0;
+    size_t residentBeforeFirstRelease = 0;
+    size_t residentAfterLastRelease = 0;
+    size_t residentDropped = 0;  // Summed over releases
+
+    // Shared with the workers
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::deque<Job> jobs;                       // Waiting for a worker
+    std::deque<std::shared_ptr<Model>> uploads;  // Loaded, waiting for GL
+    int busyWorkers = 0;
+    std::vector<std::thread> workers;
+
+    // One core is left to the GL thread
+    AssetCache() {
+        const unsigned cores = std::thread::hardware_concurrency();
+        const unsigned count = cores > 2 ? std::min(cores - 1, 4u) : 1u;
+        for (unsigned i = 0; i < count; ++i)
+            workers.emplace_back(&AssetCache::workerLoop, this);
+    }
+
+    void workerLoop() {
+        for (;;) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (stopping)
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+                ++busyWorkers;
+            }
+
+            job.model->load(job.path);
+
+            // The queue takes the worker's reference, so a model is never
+            // destroyed (and its GL objects freed) off the GL thread
+            std::lock_guard<std::mutex> lock(mutex);
+            uploads.push_back(std::move(job.model));
+            --busyWorkers;
+        }
+    }
+};
@@ -0,0 +1,47 @@
+#pragma once
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <glm/glm.hpp>
+
+// Axis-aligned bounding box. Starts empty; grows with expand().
+struct BoundingBox {
+    glm::vec3 min{ FLT_MAX };
+    glm::vec3 max{ -FLT_MAX };
+
+    bool isEmpty() const { return min.x > max.x; }
+
+    void expand(const glm::vec3& p) {
+        min = glm::min(min, p);
+        max = glm::max(max, p);
+    }
+
+    void expand(const BoundingBox& other) {
+        if (other.isEmpty())
+            return;
+        expand(other.min);
+        expand(other.max);
+    }
+
+    glm::vec3 center() const { return (min + max) * 0.5f; }
+    glm::vec3 extent() const { return (max - min) * 0.5f; }
+
+    // Box around this one after an affine transform: the center moves with
+    // m and the extent is spread by the absolute rotation/scale part
+    BoundingBox transformed(const glm::mat4& m) const {
+        if (isEmpty())
+            return *this;
+        const glm::vec3 c = glm::vec3(m * glm::vec4(center(), 1.0f));
+        const glm::vec3 e = extent();
+        glm::vec3 r(0.0f);
+        for (int col = 0; col < 3; ++col) {
+            r.x += std::abs(m[col][0]) * e[col];
+            r.y += std::abs(m[col][1]) * e[col];
+            r.z += std::abs(m[col][2]) * e[col];
+        }
+        BoundingBox result;
+        result.min = c - r;
+        result.max = c + r;
+        return result;
+    }
+};
@@ -0,0 +1,283 @@
+#include "CompressedTexture.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "FileStamp.h"
+
+namespace {
+// DDS header, after the "DDS " magic. Only the fields the reader and
+// writer use are named.
+struct DdsHeader {
+    uint32_t size;  // 124
+    uint32_t flags;
+    uint32_t height;
+    uint32_t width;
+    uint32_t linearSize;
+    uint32_t depth;
+    uint32_t mipMapCount;
+    uint32_t reserved1[11];  // 0-3: source size and mtime, low word first
+    uint32_t formatSize;  // 32
+    uint32_t formatFlags;
+    char fourCC[4];
+    uint32_t formatUnused[5];
+    uint32_t caps;
+    uint32_t caps2;
+    uint32_t reserved2[3];
+};
+
+// Follows the header when fourCC is "DX10"
+struct DdsHeaderDx10 {
+    uint32_t dxgiFormat;
+    uint32_t resourceDimension;  // 3: 2D
+    uint32_t miscFlag;
+    uint32_t arraySize;
+    uint32_t miscFlags2;
+};
+
+const uint32_t DDSD_CAPS = 0x1;
+const uint32_t DDSD_HEIGHT = 0x2;
+const uint32_t DDSD_WIDTH = 0x4;
+const uint32_t DDSD_PIXELFORMAT = 0x1000;
+const uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+const uint32_t DDSD_LINEARSIZE = 0x80000;
+const uint32_t DDPF_FOURCC = 0x4;
+const uint32_t DDSCAPS_COMPLEX = 0x8;
+const uint32_t DDSCAPS_TEXTURE = 0x1000;
+const uint32_t DDSCAPS_MIPMAP = 0x400000;
+
+// DXGI formats and the GL formats they upload as
+struct FormatMapping {
+    uint32_t dxgi;
+    const char* fourCC;  // Legacy header name, if any
+    GLenum gl;
+};
+const FormatMapping kFormats[] = {
+    { 71, "DXT1", GL_COMPRESSED_RGB_S3TC_DXT1_EXT },
+    { 77, "DXT5", GL_COMPRESSED_RGBA_S3TC_DXT5_EXT },
+    { 80, "ATI1", GL_COMPRESSED_RED_RGTC1 },
+    { 80, "BC4U", GL_COMPRESSED_RED_RGTC1 },
+    { 83, "ATI2", GL_COMPRESSED_RG_RGTC2 },
+    { 83, "BC5U", GL_COMPRESSED_RG_RGTC2 },
+    { 98, nullptr, GL_COMPRESSED_RGBA_BPTC_UNORM },
+};
+
+void writeStamp(DdsHeader& header, uint64_t size, int64_t time) {
+    header.reserved1[0] = (uint32_t)size;
+    header.reserved1[1] = (uint32_t)(size >> 32);
+    header.reserved1[2] = (uint32_t)(uint64_t)time;
+    header.reserved1[3] = (uint32_t)((uint64_t)time >> 32);
+}
+
+uint64_t stampSize(const DdsHeader& header) {
+    return (uint64_t)header.reserved1[1] << 32 | header.reserved1[0];
+}
+
+int64_t stampTime(const DdsHeader& header) {
+    return (int64_t)((uint64_t)header.reserved1[3] << 32 |
+                     header.reserved1[2]);
+}
+
+bool hasExtension(const char* name) {
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; ++i) {
+        const GLubyte* extension = glGetStringi(GL_EXTENSIONS, (GLuint)i);
+        if (extension &&
+            std::strcmp(reinterpret_cast<const char*>(extension), name) == 0)
+            return true;
+    }
+    return false;
+}
+}  // namespace
+
+size_t CompressedTexture::blockBytes(GLenum format) {
+    switch (format) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RED_RGTC1:
+        return 8;
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+    case GL_COMPRESSED_RG_RGTC2:
+    case GL_COMPRESSED_RGBA_BPTC_UNORM:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+size_t CompressedTexture::levelBytes(GLenum format, int width, int height) {
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) *
+           blockBytes(format);
+}
+
+std::string CompressedTexture::pathFor(const std::string& sourcePath) {
+    const size_t slash = sourcePath.find_last_of("/\\");
+    const size_t dot = sourcePath.find_last_of('.');
+    if (dot == std::string::npos ||
+        (slash != std::string::npos && dot < slash))
+        return sourcePath + ".dds";
+    return sourcePath.substr(0, dot) + ".dds";
+}
+
+bool CompressedTexture::load(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+
+    char magic[4] = {};
+    DdsHeader header = {};
+    in.read(magic, 4);
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    bool valid = in && std::memcmp(magic, "DDS ", 4) == 0 &&
+                 header.size == sizeof(DdsHeader) &&
+                 (header.formatFlags & DDPF_FOURCC) && header.caps2 == 0 &&
+                 header.width > 0 && header.height > 0;
+
+    // Format from the DX10 header or the legacy fourCC
+    format = 0;
+    if (valid && std::memcmp(header.fourCC, "DX10", 4) == 0) {
+        DdsHeaderDx10 dx10 = {};
+        in.read(reinterpret_cast<char*>(&dx10), sizeof(dx10));
+        valid = in && dx10.resourceDimension == 3 && dx10.arraySize == 1;
+        for (const FormatMapping& mapping : kFormats) {
+            if (valid && mapping.dxgi == dx10.dxgiFormat)
+                format = mapping.gl;
+        }
+    } else if (valid) {
+        for (const FormatMapping& mapping : kFormats) {
+            if (mapping.fourCC &&
+                std::memcmp(mapping.fourCC, header.fourCC, 4) == 0)
+                format = mapping.gl;
+        }
+    }
+    valid = valid && format != 0;
+
+    width = (int)header.width;
+    height = (int)header.height;
+    sourceSize = stampSize(header);
+    sourceTime = stampTime(header);
+    const int levels = header.mipMapCount > 0 ? (int)header.mipMapCount : 1;
+    data.clear();
+    levelOffsets.clear();
+    for (int level = 0; valid && level < levels; ++level) {
+        if (levelWidth(level) == 1 && levelHeight(level) == 1 &&
+            level + 1 < levels)
+            valid = false;  // More levels than the chain has
+        levelOffsets.push_back(data.size());
+        const size_t bytes = getLevelSize(level);
+        data.resize(data.size() + bytes);
+        in.read(reinterpret_cast<char*>(&data[levelOffsets.back()]),
+                (std::streamsize)bytes);
+        valid = valid && (bool)in;
+    }
+
+    if (!valid) {
+        std::cout << "Invalid or unsupported compressed texture: " << path
+                  << std::endl;
+        format = 0;
+        data.clear();
+        levelOffsets.clear();
+        return false;
+    }
+    return true;
+}
+
+bool CompressedTexture::save(const std::string& path) const {
+    uint32_t dxgi = 0;
+    for (const FormatMapping& mapping : kFormats) {
+        if (mapping.gl == format)
+            dxgi = mapping.dxgi;
+    }
+    if (dxgi == 0 || empty())
+        return false;
+
+    DdsHeader header = {};
+    header.size = sizeof(DdsHeader);
+    header.flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT |
+                   DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE;
+    header.height = (uint32_t)height;
+    header.width = (uint32_t)width;
+    header.linearSize = (uint32_t)getLevelSize(0);
+    header.mipMapCount = (uint32_t)getLevelCount();
+    header.formatSize = 32;
+    header.formatFlags = DDPF_FOURCC;
+    std::memcpy(header.fourCC, "DX10", 4);
+    header.caps = DDSCAPS_TEXTURE | DDSCAPS_COMPLEX | DDSCAPS_MIPMAP;
+    writeStamp(header, sourceSize, sourceTime);
+
+    DdsHeaderDx10 dx10 = {};
+    dx10.dxgiFormat = dxgi;
+    dx10.resourceDimension = 3;
+    dx10.arraySize = 1;
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write("DDS ", 4);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(&dx10), sizeof(dx10));
+    out.write(reinterpret_cast<const char*>(data.data()),
+              (std::streamsize)data.size());
+    return (bool)out;
+}
+
+bool CompressedTexture::loadFor(const std::string& sourcePath) {
+    const std::string path = pathFor(sourcePath);
+    if (!load(path))
+        return false;
+    if (!FileStamp::matches(sourcePath.c_str(), sourceSize, sourceTime)) {
+        std::cout << "Compressed texture is older than its image, decoding "
+                  << sourcePath << " instead: " << path << std::endl;
+        *this = CompressedTexture();
+        return false;
+    }
+    return true;
+}
+
+bool CompressedTexture::isCooked(const std::string& sourcePath) {
+    std::ifstream in(pathFor(sourcePath), std::ios::binary);
+    char magic[4] = {};
+    DdsHeader header = {};
+    in.read(magic, 4);
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    return in && std::memcmp(magic, "DDS ", 4) == 0 &&
+           FileStamp::matches(sourcePath.c_str(), stampSize(header),
+                              stampTime(header));
+}
+
+bool CompressedTexture::isSupported() const {
+    // RGTC (BC4, BC5) and BPTC (BC7) are core since GL 3.0 and 4.2
+    if (format != GL_COMPRESSED_RGB_S3TC_DXT1_EXT &&
+        format != GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+        return format != 0;
+    static const bool s3tc = hasExtension("GL_EXT_texture_compression_s3tc");
+    return s3tc;
+}
+
+void CompressedTexture::upload(GLenum target) const {
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int level = 0; level < getLevelCount(); ++level) {
+        glCompressedTexImage2D(target, level, format, levelWidth(level),
+                               levelHeight(level), 0,
+                               (GLsizei)getLevelSize(level),
+                               getLevel(level));
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+GLuint CompressedTexture::createTexture(GLenum wrap) const {
+    GLuint id = 0;
+    glGenTextures(1, &id);
+    glBindTexture(GL_TEXTURE_2D, id);
+    upload(GL_TEXTURE_2D);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                    getLevelCount() - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    getLevelCount() > 1 ? GL_LINEAR_MIPMAP_LINEAR
+                                        : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return id;
+}
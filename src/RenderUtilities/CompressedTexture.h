@@ -0,0 +1,74 @@
+#pragma once
+#include <glad/glad.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// S3TC is an extension rather than core, so glad does not define it
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// Block-compressed image with its full mip chain, read from or written to
+// a .dds file next to the source image. The AssetCooker encodes them (BC1,
+// BC4, BC5 or BC7, see TextureEncoder); texture loaders look for one first
+// and upload the blocks as they are, falling back to decoding the source
+// image when there is no file or the driver lacks the format.
+class CompressedTexture {
+public:
+    GLenum format = 0;  // GL compressed internal format
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> data;  // Every level, largest first
+    std::vector<size_t> levelOffsets;  // Into data, one per level
+    uint64_t sourceSize = 0;  // FileStamp of the image it was encoded from
+    int64_t sourceTime = 0;
+
+    bool empty() const { return data.empty(); }
+    int getLevelCount() const { return (int)levelOffsets.size(); }
+    int levelWidth(int level) const { return std::max(width >> level, 1); }
+    int levelHeight(int level) const { return std::max(height >> level, 1); }
+    const unsigned char* getLevel(int level) const {
+        return data.data() + levelOffsets[level];
+    }
+    size_t getLevelSize(int level) const {
+        return levelBytes(format, levelWidth(level), levelHeight(level));
+    }
+
+    // Bytes per 4x4 block, 0 for formats this class does not handle
+    static size_t blockBytes(GLenum format);
+    static size_t levelBytes(GLenum format, int width, int height);
+
+    // Compressed file for a source image: same name, .dds extension
+    static std::string pathFor(const std::string& sourcePath);
+
+    // Fails without a message if the file does not exist; an existing file
+    // in a layout or format this reader does not know is reported
+    bool load(const std::string& path);
+    bool save(const std::string& path) const;
+
+    // Load the compressed file of a source image, rejecting it (with a
+    // message) if the image changed since it was encoded
+    bool loadFor(const std::string& sourcePath);
+
+    // Whether the source image has a compressed file that is up to date,
+    // from the file's header only
+    static bool isCooked(const std::string& sourcePath);
+
+    // Whether the current context can sample the format. The first call
+    // queries the context, so it must come from the GL thread; the answer
+    // is cached and later calls may come from any thread.
+    bool isSupported() const;
+
+    // Upload every level to target (GL_TEXTURE_2D or a cube map face) of
+    // the bound texture
+    void upload(GLenum target) const;
+
+    // New 2D texture holding every level, with trilinear filtering
+    GLuint createTexture(GLenum wrap) const;
+};
@@ -0,0 +1,193 @@
+#include "CookedMesh.h"
+
+#include <cstring>
+#include <iostream>
+
+#include "FileStamp.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+const char kMagic[4] = { 'M', 'S', 'H', '5' };
+
+bool inside(uint64_t offset, uint64_t bytes, size_t size) {
+    return offset <= size && bytes <= size - offset;
+}
+
+// Every index of a submesh addresses one of its own vertices
+template <typename Index>
+bool indicesInRange(const void* indices, const CookedSubmesh& submesh) {
+    const Index* first =
+        static_cast<const Index*>(indices) + submesh.firstIndex;
+    for (uint32_t i = 0; i < submesh.indexCount; ++i) {
+        if (first[i] >= submesh.vertexCount)
+            return false;
+    }
+    return true;
+}
+}  // namespace
+
+bool CookedMeshFile::open(const char* path, const char* sourcePath,
+                          uint32_t vertexStride) {
+    close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping =
+        CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        CloseHandle(file);
+        return false;
+    }
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    fileHandle = file;
+    mappingHandle = mapping;
+    data = static_cast<const unsigned char*>(view);
+    size = (size_t)fileSize.QuadPart;
+#else
+    fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+
+    void* view = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view == MAP_FAILED) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+
+    data = static_cast<const unsigned char*>(view);
+    size = (size_t)st.st_size;
+#endif
+
+    // Validate every table and blob before the loader reads them
+    bool valid = size >= sizeof(CookedMeshHeader) &&
+                 std::memcmp(getHeader().magic, kMagic, 4) == 0 &&
+                 getHeader().vertexStride == vertexStride &&
+                 (getHeader().indexStride == 2 || getHeader().indexStride == 4);
+    if (valid) {
+        const CookedMeshHeader& header = getHeader();
+        valid = inside(header.submeshOffset,
+                       (uint64_t)header.submeshCount * sizeof(CookedSubmesh),
+                       size) &&
+                inside(header.textureOffset,
+                       (uint64_t)header.textureCount * sizeof(CookedTexture),
+                       size) &&
+                inside(header.vertexOffset,
+                       (uint64_t)header.vertexCount * vertexStride, size) &&
+                inside(header.indexOffset,
+                       (uint64_t)header.indexCount * header.indexStride,
+                       size) &&
+                inside(header.stringOffset, header.stringBytes, size);
+    }
+    for (uint32_t i = 0; valid && i < getHeader().submeshCount; ++i) {
+        const CookedSubmesh& submesh = getSubmesh((int)i);
+        valid = (uint64_t)submesh.baseVertex + submesh.vertexCount <=
+                    getHeader().vertexCount &&
+                (uint64_t)submesh.firstIndex + submesh.indexCount <=
+                    getHeader().indexCount &&
+                (uint64_t)submesh.firstTexture + submesh.textureCount <=
+                    getHeader().textureCount;
+        if (valid) {
+            valid = getHeader().indexStride == 2
+                        ? indicesInRange<uint16_t>(getIndices(), submesh)
+                        : indicesInRange<uint32_t>(getIndices(), submesh);
+        }
+        for (int lod = 0; valid && lod < MAX_MESH_LODS; ++lod) {
+            valid = (uint64_t)submesh.lodFirstIndex[lod] +
+                        submesh.lodIndexCount[lod] <=
+                    submesh.indexCount;
+        }
+    }
+    for (uint32_t i = 0; valid && i < getHeader().textureCount; ++i) {
+        const CookedTexture& texture = getTexture((int)i);
+        valid = (uint64_t)texture.nameOffset + texture.nameLength <=
+                getHeader().stringBytes;
+        if (valid && texture.dataOffset) {
+            const uint64_t bytes =
+                texture.embeddedHeight == 0
+                    ? texture.embeddedWidth
+                    : (uint64_t)texture.embeddedWidth *
+                          texture.embeddedHeight * 4;
+            valid = inside(texture.dataOffset, bytes, size);
+        }
+    }
+
+    if (!valid) {
+        std::cout << "Invalid or outdated cooked mesh: " << path << std::endl;
+        close();
+        return false;
+    }
+    if (!FileStamp::matches(sourcePath, getHeader().sourceSize,
+                            getHeader().sourceTime)) {
+        std::cout << "Cooked mesh is older than its model, importing "
+                  << sourcePath << " instead: " << path << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void CookedMeshFile::close() {
+#ifdef _WIN32
+    if (data)
+        UnmapViewOfFile(data);
+    if (mappingHandle)
+        CloseHandle(mappingHandle);
+    if (fileHandle)
+        CloseHandle(fileHandle);
+    mappingHandle = nullptr;
+    fileHandle = nullptr;
+#else
+    if (data)
+        munmap(const_cast<unsigned char*>(data), size);
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+#endif
+    data = nullptr;
+    size = 0;
+}
+
+std::string CookedMeshFile::pathFor(const std::string& sourcePath) {
+    const size_t slash = sourcePath.find_last_of("/\\");
+    const size_t dot = sourcePath.find_last_of('.');
+    if (dot == std::string::npos ||
+        (slash != std::string::npos && dot < slash))
+        return sourcePath + ".mesh";
+    return sourcePath.substr(0, dot) + ".mesh";
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "Mesh.h"
+
+// On-disk layout of a cooked model (.mesh), written by the AssetCooker:
+// header, submesh table, texture table, then the vertex and index blobs of
+// all submeshes merged, texture names and embedded image bytes. Vertices
+// hold only the attributes the model shaders read (CookedVertex) and
+// indices are in the type the model draws with, so the blobs go straight
+// to glBufferData. Node transforms are already baked in and the meshes
+// already optimized.
+struct CookedMeshHeader {
+    char magic[4];          // "MSH5"
+    uint32_t vertexStride;  // sizeof(CookedVertex) of the cooker
+    uint32_t indexStride;   // 2 or 4 bytes, for the whole model
+    uint32_t reserved;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t submeshCount;
+    uint32_t textureCount;
+    float boundsMin[3];
+    float boundsMax[3];
+    float lodErrors[MAX_MESH_LODS];  // Model units, 0 for the full mesh
+    uint64_t submeshOffset;
+    uint64_t textureOffset;
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    uint64_t stringOffset;  // Texture names
+    uint64_t stringBytes;
+    uint64_t sourceSize;  // FileStamp of the model it was cooked from
+    int64_t sourceTime;
+};
+
+// Cooked vertex: the leading position, normal and texture coordinates of
+// the runtime Vertex, at the same offsets
+struct CookedVertex {
+    float position[3];
+    float normal[3];
+    float texCoords[2];
+};
+static_assert(offsetof(CookedVertex, normal) == offsetof(Vertex, Normal) &&
+                  offsetof(CookedVertex, texCoords) ==
+                      offsetof(Vertex, TexCoords),
+              "CookedVertex must share Vertex's attribute offsets");
+
+// One mesh: its range in the merged blobs, its levels of detail and its
+// textures
+struct CookedSubmesh {
+    uint32_t baseVertex;
+    uint32_t vertexCount;
+    uint32_t firstIndex;
+    uint32_t indexCount;  // All levels of detail
+    uint32_t firstTexture;  // Into the texture table
+    uint32_t textureCount;
+    uint32_t reserved;
+    float boundsMin[3];
+    float boundsMax[3];
+    uint32_t lodFirstIndex[MAX_MESH_LODS];  // Relative to firstIndex
+    uint32_t lodIndexCount[MAX_MESH_LODS];
+};
+
+enum CookedTextureType { COOKED_DIFFUSE = 0, COOKED_SPECULAR = 1 };
+
+// Texture reference as named by the material. Images stored in the source
+// file are copied along: compressed bytes (height 0, width = byte count)
+// or raw BGRA texels, like an aiTexture.
+struct CookedTexture {
+    uint32_t type;  // CookedTextureType
+    uint32_t nameOffset;  // Into the string section
+    uint32_t nameLength;
+    uint32_t embeddedWidth;
+    uint32_t embeddedHeight;
+    uint32_t reserved;
+    uint64_t dataOffset;  // Byte offset of the embedded image, 0 if external
+};
+
+// Read-only memory mapping of a .mesh file. Blobs are read in place; the OS
+// pages them in when they are uploaded.
+class CookedMeshFile {
+public:
+    CookedMeshFile() = default;
+    CookedMeshFile(const CookedMeshFile&) = delete;
+    CookedMeshFile& operator=(const CookedMeshFile&) = delete;
+    ~CookedMeshFile() { close(); }
+
+    // Fails without a message if the file does not exist; an existing file
+    // that does not match this build's layout, is out of date with the
+    // source model or has ranges or indices out of bounds is reported and
+    // rejected
+    bool open(const char* path, const char* sourcePath, uint32_t vertexStride);
+    void close();
+
+    bool isOpen() const { return data != nullptr; }
+
+    const CookedMeshHeader& getHeader() const {
+        return *reinterpret_cast<const CookedMeshHeader*>(data);
+    }
+
+    const CookedSubmesh& getSubmesh(int i) const {
+        return reinterpret_cast<const CookedSubmesh*>(
+            data + getHeader().submeshOffset)[i];
+    }
+
+    const CookedTexture& getTexture(int i) const {
+        return reinterpret_cast<const CookedTexture*>(
+            data + getHeader().textureOffset)[i];
+    }
+
+    const void* getVertices() const { return data + getHeader().vertexOffset; }
+    const void* getIndices() const { return data + getHeader().indexOffset; }
+
+    std::string getName(const CookedTexture& texture) const {
+        const char* names = reinterpret_cast<const char*>(
+            data + getHeader().stringOffset);
+        return std::string(names + texture.nameOffset, texture.nameLength);
+    }
+
+    const unsigned char* getEmbedded(const CookedTexture& texture) const {
+        return texture.dataOffset ? data + texture.dataOffset : nullptr;
+    }
+
+    // Cooked file next to a source model: same name, .mesh extension
+    static std::string pathFor(const std::string& sourcePath);
+
+private:
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#else
+    int fd = -1;
+#endif
+};
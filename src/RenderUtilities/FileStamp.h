@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdint>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// Byte size and modification time of a file. Cooked files (.hmt, .mesh,
+// .dds) record the stamp of the source they were cooked from and are
+// rejected once the source no longer matches it.
+struct FileStamp {
+    uint64_t size = 0;
+    int64_t time = 0;
+
+    // False if the file cannot be read
+    static bool of(const char* path, FileStamp& stamp) {
+#ifdef _WIN32
+        struct _stat64 st;
+        if (_stat64(path, &st) != 0)
+            return false;
+#else
+        struct stat st;
+        if (stat(path, &st) != 0)
+            return false;
+#endif
+        stamp.size = (uint64_t)st.st_size;
+        stamp.time = (int64_t)st.st_mtime;
+        return true;
+    }
+
+    // True unless the source exists and differs from the recorded stamp; a
+    // cooked file shipped without its source is kept
+    static bool matches(const char* sourcePath, uint64_t size, int64_t time) {
+        FileStamp stamp;
+        if (!of(sourcePath, stamp))
+            return true;
+        return stamp.size == size && stamp.time == time;
+    }
+};
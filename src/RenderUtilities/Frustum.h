@@ -0,0 +1,46 @@
+#pragma once
+#include <cmath>
+#include <glm/glm.hpp>
+
+#include "BoundingBox.h"
+
+// The six clip planes of a world to clip matrix (Gribb/Hartmann), for
+// rejecting bounding boxes that cannot reach the viewport
+class Frustum {
+public:
+    explicit Frustum(const glm::mat4& viewProj) {
+        const glm::vec4 row0(viewProj[0][0], viewProj[1][0], viewProj[2][0],
+                             viewProj[3][0]);
+        const glm::vec4 row1(viewProj[0][1], viewProj[1][1], viewProj[2][1],
+                             viewProj[3][1]);
+        const glm::vec4 row2(viewProj[0][2], viewProj[1][2], viewProj[2][2],
+                             viewProj[3][2]);
+        const glm::vec4 row3(viewProj[0][3], viewProj[1][3], viewProj[2][3],
+                             viewProj[3][3]);
+        planes[0] = row3 + row0;  // Left
+        planes[1] = row3 - row0;  // Right
+        planes[2] = row3 + row1;  // Bottom
+        planes[3] = row3 - row1;  // Top
+        planes[4] = row3 + row2;  // Near
+        planes[5] = row3 - row2;  // Far
+    }
+
+    // False only if the box lies entirely outside one of the planes
+    bool intersects(const BoundingBox& box) const {
+        if (box.isEmpty())
+            return false;
+        const glm::vec3 c = box.center();
+        const glm::vec3 e = box.extent();
+        for (const glm::vec4& p : planes) {
+            const glm::vec3 n(p);
+            const float reach = std::abs(n.x) * e.x + std::abs(n.y) * e.y +
+                                std::abs(n.z) * e.z;
+            if (glm::dot(n, c) + p.w + reach < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+private:
+    glm::vec4 planes[6];
+};
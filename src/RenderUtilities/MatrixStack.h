@@ -0,0 +1,109 @@
+#pragma once
+#include <glad/glad.h>
+#include <cmath>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Frustum.h"
+
+// Camera and model transforms of one view, kept on the CPU. The renderer
+// builds the view and projection here and hands the stack down the draw
+// calls, so nothing has to read matrices back from the driver. Shaders get
+// them through the scene constants; fixed-function geometry gets the top of
+// the stack with load(), which only writes GL state.
+class MatrixStack {
+public:
+    glm::mat4 projection{ 1.0f };
+    glm::mat4 view{ 1.0f };
+    glm::vec4 clipPlane{ 0.0f };  // World space plane equation
+    bool clipEnabled = false;
+
+    // World to clip matrices draws are culled against, for passes whose
+    // clip space is not projection * view (a shadow light draws all its
+    // atlas views at once). Empty means the camera's frustum.
+    std::vector<glm::mat4> cullViews;
+
+    MatrixStack() : models(1, glm::mat4(1.0f)) {}
+
+    // Start a new view with an empty model stack
+    void setCamera(const glm::mat4& proj, const glm::mat4& viewMatrix) {
+        projection = proj;
+        view = viewMatrix;
+        models.assign(1, glm::mat4(1.0f));
+        hasCamera = true;
+    }
+
+    void setClipPlane(const glm::vec4& plane) {
+        clipPlane = plane;
+        clipEnabled = true;
+    }
+
+    void push() { models.push_back(models.back()); }
+
+    void pop() {
+        if (models.size() > 1)
+            models.pop_back();
+    }
+
+    void multiply(const glm::mat4& m) { models.back() = models.back() * m; }
+
+    void translate(const glm::vec3& t) {
+        models.back() = glm::translate(models.back(), t);
+    }
+
+    // Angle in degrees, like glRotatef
+    void rotate(float degrees, const glm::vec3& axis) {
+        models.back() = glm::rotate(models.back(), glm::radians(degrees), axis);
+    }
+
+    void scale(const glm::vec3& s) {
+        models.back() = glm::scale(models.back(), s);
+    }
+
+    // Whether a world space box can reach any view of this pass. Stacks
+    // without a camera or cull views draw everything. With a clip plane,
+    // boxes wholly on its clipped side are rejected too, so the water passes
+    // skip what lies on the far side of the water.
+    bool isVisible(const BoundingBox& worldBounds) const {
+        if (clipEnabled && !worldBounds.isEmpty()) {
+            const glm::vec3 n(clipPlane);
+            const glm::vec3 e = worldBounds.extent();
+            const float reach = std::abs(n.x) * e.x + std::abs(n.y) * e.y +
+                                std::abs(n.z) * e.z;
+            if (glm::dot(n, worldBounds.center()) + clipPlane.w + reach < 0.0f)
+                return false;
+        }
+        if (!cullViews.empty()) {
+            for (const glm::mat4& viewProj : cullViews) {
+                if (Frustum(viewProj).intersects(worldBounds))
+                    return true;
+            }
+            return false;
+        }
+        if (!hasCamera)
+            return true;
+        return Frustum(projection * view).intersects(worldBounds);
+    }
+
+    const glm::mat4& model() const { return models.back(); }
+    glm::mat4 modelView() const { return view * models.back(); }
+
+    // Write the projection and the current modelview into the
+    // fixed-function state
+    void load() const {
+        glMatrixMode(GL_PROJECTION);
+        glLoadMatrixf(&projection[0][0]);
+        glMatrixMode(GL_MODELVIEW);
+        loadModelView();
+    }
+
+    void loadModelView() const {
+        const glm::mat4 mv = modelView();
+        glLoadMatrixf(&mv[0][0]);
+    }
+
+private:
+    std::vector<glm::mat4> models;
+    bool hasCamera = false;
+};
@@ -5,16 +5,19 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <string>
+#include <utility>
 #include <vector>
 
-#include "Shader.h"
+#include "BoundingBox.h"
 
 #define MAX_BONE_INFLUENCE 4
+#define MAX_MESH_LODS 4
 
 struct Texture {
     unsigned int id;
     std::string type;
     std::string path;
+    std::string key;  // TextureCache entry the image is shared under
 };
 
 struct Vertex {
@@ -34,73 +37,77 @@ struct Vertex {
 	float m_Weights[MAX_BONE_INFLUENCE];
 };
 
+// Index range of one level of detail, relative to the mesh's first index
+struct MeshLod {
+    unsigned int firstIndex = 0;
+    unsigned int indexCount = 0;
+};
+
+// One part of a model: where it lives in the model's merged vertex and
+// index buffers, and its data on the CPU until the model uploads it. The
+// model owns all GL objects and draws every mesh with one indirect
+// multi-draw. Meshes are moved, never copied.
 class Mesh {
     public:
-        // mesh data
+        // mesh data, empty once uploaded unless the model keeps it
         std::vector<Vertex>       vertices;
         std::vector<unsigned int> indices;
         std::vector<Texture>      textures;
 
-        Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures) {
-            this->vertices = vertices;
-            this->indices = indices;
-            this->textures = textures;
+        // Sizes of the data, kept after it is released
+        unsigned int vertexCount = 0;
+        unsigned int indexCount = 0;  // All levels of detail
+
+        // Range in the model's buffers, set when the model merges them
+        unsigned int baseVertex = 0;
+        unsigned int firstIndex = 0;
+
+        // Levels of detail, finest first. All share the mesh's vertices;
+        // indices holds their ranges back to back.
+        std::vector<MeshLod> lods;
+
+        Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures)
+            : vertices(std::move(vertices)), indices(std::move(indices)), textures(std::move(textures)) {
+            vertexCount = (unsigned int)this->vertices.size();
+            indexCount = (unsigned int)this->indices.size();
+            MeshLod full;
+            full.indexCount = indexCount;
+            lods.push_back(full);
 
-            setupMesh();
+            for (const Vertex& vertex : this->vertices)
+                bounds.expand(vertex.Position);
         }   
 
-        void Draw(Shader &shader) {
-            unsigned int diffuseNr = 1;
-            unsigned int specularNr = 1;
-            for(unsigned int i = 0; i < textures.size(); i++) {
-                glActiveTexture(GL_TEXTURE0 + i); // activate proper texture unit before binding
-                // retrieve texture number (the N in diffuse_textureN)
-                std::string number;
-                std::string name = textures[i].type;
-                if(name == "texture_diffuse")
-                    number = std::to_string(diffuseNr++);
-                else if(name == "texture_specular")
-                    number = std::to_string(specularNr++);
-
-                shader.setInt(("material." + name + number).c_str(), i);
-                glBindTexture(GL_TEXTURE_2D, textures[i].id);
-            }
-            glActiveTexture(GL_TEXTURE0);
-
-            // draw mesh
-            glBindVertexArray(VAO);
-            glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-            glBindVertexArray(0);
-        }  
+        // Mesh read from a cooked file: its data is already merged there,
+        // so only the range and bounds are kept
+        Mesh(std::vector<Texture> textures, const BoundingBox& bounds,
+             unsigned int baseVertex, unsigned int vertexCount,
+             unsigned int firstIndex, unsigned int indexCount, std::vector<MeshLod> lods)
+            : textures(std::move(textures)), vertexCount(vertexCount), indexCount(indexCount),
+              baseVertex(baseVertex), firstIndex(firstIndex), lods(std::move(lods)), bounds(bounds) {}
+
+        Mesh(Mesh&&) = default;
+        Mesh& operator=(Mesh&&) = default;
+        Mesh(const Mesh&) = delete;
+        Mesh& operator=(const Mesh&) = delete;
+
+        // Drop the CPU copies of the vertices and indices, returning the
+        // bytes freed
+        size_t releaseCpuData() {
+            const size_t bytes = cpuBytes();
+            std::vector<Vertex>().swap(vertices);
+            std::vector<unsigned int>().swap(indices);
+            return bytes;
+        }
+
+        // Bytes held by the CPU copies
+        size_t cpuBytes() const {
+            return vertices.capacity() * sizeof(Vertex) + indices.capacity() * sizeof(unsigned int);
+        }
+
+        // Model space bounds, for culling
+        const BoundingBox& getBounds() const { return bounds; }
     private:
-        //  render data
-        unsigned int VAO, VBO, EBO;
-
-        void setupMesh() {
-            glGenVertexArrays(1, &VAO);
-            glGenBuffers(1, &VBO);
-            glGenBuffers(1, &EBO);
-        
-            glBindVertexArray(VAO);
-            glBindBuffer(GL_ARRAY_BUFFER, VBO);
-
-            glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);  
-
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), 
-                        &indices[0], GL_STATIC_DRAW);
-
-            // vertex positions
-            glEnableVertexAttribArray(0);	
-            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-            // vertex normals
-            glEnableVertexAttribArray(1);	
-            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-            // vertex texture coords
-            glEnableVertexAttribArray(2);	
-            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-
-            glBindVertexArray(0);
-        }  
+        BoundingBox bounds;
 };  
 #endif
\ No newline at end of file
@@ -0,0 +1,223 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+// Import-time optimization of indexed triangle lists, run on every mesh
+// before it is merged or cooked: weld duplicate vertices, order triangles
+// for the post-transform vertex cache (Forsyth), then order vertices by
+// first use so fetches walk the vertex buffer forwards.
+namespace MeshOptimizer {
+
+// Average cache miss ratio: vertices transformed per triangle by a FIFO
+// post-transform cache of cacheSize entries. 3 is the worst case; well
+// ordered meshes approach 0.5 to 0.7.
+inline float acmr(const std::vector<unsigned int>& indices,
+                  size_t vertexCount, int cacheSize = 16) {
+    const size_t triangles = indices.size() / 3;
+    if (triangles == 0)
+        return 0.0f;
+
+    // A vertex is cached while fewer than cacheSize misses followed its own
+    // (insertedAt is the miss count right after it was inserted)
+    std::vector<size_t> insertedAt(vertexCount, 0);
+    size_t misses = 0;
+    for (unsigned int index : indices) {
+        if (insertedAt[index] == 0 ||
+            misses - insertedAt[index] >= (size_t)cacheSize) {
+            ++misses;
+            insertedAt[index] = misses;
+        }
+    }
+    return (float)misses / triangles;
+}
+
+// Merge bitwise identical vertices and point the indices at the survivors.
+// Vertex must have no padding and value-initialized unused members.
+template <typename Vertex>
+void weldVertices(std::vector<Vertex>& vertices,
+                  std::vector<unsigned int>& indices) {
+    if (vertices.empty())
+        return;
+
+    size_t tableSize = 1;
+    while (tableSize < vertices.size() * 2)
+        tableSize *= 2;
+    const unsigned int empty = ~0u;
+    std::vector<unsigned int> table(tableSize, empty);  // Into welded
+
+    auto hashOf = [](const Vertex& v) {
+        // FNV-1a over the raw bytes
+        const unsigned char* bytes =
+            reinterpret_cast<const unsigned char*>(&v);
+        size_t hash = 2166136261u;
+        for (size_t i = 0; i < sizeof(Vertex); ++i) {
+            hash ^= bytes[i];
+            hash *= 16777619u;
+        }
+        return hash;
+    };
+
+    std::vector<Vertex> welded;
+    welded.reserve(vertices.size());
+    std::vector<unsigned int> remap(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        size_t slot = hashOf(vertices[i]) & (tableSize - 1);
+        while (table[slot] != empty &&
+               std::memcmp(&welded[table[slot]], &vertices[i],
+                           sizeof(Vertex)) != 0)
+            slot = (slot + 1) & (tableSize - 1);
+        if (table[slot] == empty) {
+            table[slot] = (unsigned int)welded.size();
+            welded.push_back(vertices[i]);
+        }
+        remap[i] = table[slot];
+    }
+
+    for (unsigned int& index : indices)
+        index = remap[index];
+    vertices.swap(welded);
+}
+
+// Forsyth's linear-speed vertex cache optimization: greedily emit the
+// triangle whose vertices score highest, favoring vertices recently used
+// and vertices with few triangles left
+inline void optimizeVertexCache(std::vector<unsigned int>& indices,
+                                size_t vertexCount) {
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    const int CACHE_SIZE = 32;
+    auto vertexScore = [CACHE_SIZE](int cachePosition,
+                                    unsigned int remaining) {
+        if (remaining == 0)
+            return -1.0f;
+        float score = 0.0f;
+        if (cachePosition >= 0) {
+            // The last triangle's vertices get a fixed score so the next
+            // triangle does not simply reuse its edge
+            if (cachePosition < 3)
+                score = 0.75f;
+            else
+                score = std::pow(1.0f - (float)(cachePosition - 3) /
+                                            (CACHE_SIZE - 3),
+                                 1.5f);
+        }
+        return score + 2.0f / std::sqrt((float)remaining);
+    };
+
+    // Triangles of each vertex, as ranges into one array. The first
+    // remaining[v] entries of a range are the ones not emitted yet.
+    std::vector<unsigned int> offsets(vertexCount + 1, 0);
+    for (unsigned int index : indices)
+        ++offsets[index + 1];
+    for (size_t v = 0; v < vertexCount; ++v)
+        offsets[v + 1] += offsets[v];
+    std::vector<unsigned int> adjacency(indices.size());
+    std::vector<unsigned int> remaining(vertexCount, 0);
+    for (size_t t = 0; t < triangleCount; ++t) {
+        for (int k = 0; k < 3; ++k) {
+            const unsigned int v = indices[3 * t + k];
+            adjacency[offsets[v] + remaining[v]++] = (unsigned int)t;
+        }
+    }
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> scores(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v)
+        scores[v] = vertexScore(-1, remaining[v]);
+    std::vector<float> triangleScores(triangleCount);
+    for (size_t t = 0; t < triangleCount; ++t) {
+        triangleScores[t] = scores[indices[3 * t]] +
+                            scores[indices[3 * t + 1]] +
+                            scores[indices[3 * t + 2]];
+    }
+    std::vector<char> emitted(triangleCount, 0);
+
+    std::vector<unsigned int> result;
+    result.reserve(indices.size());
+    std::vector<unsigned int> cache;
+    std::vector<unsigned int> nextCache;
+    size_t scanCursor = 0;
+    long best = (long)(std::max_element(triangleScores.begin(),
+                                        triangleScores.end()) -
+                       triangleScores.begin());
+
+    while (best >= 0) {
+        emitted[best] = 1;
+        nextCache.clear();
+        for (int k = 0; k < 3; ++k) {
+            const unsigned int v = indices[3 * best + k];
+            result.push_back(v);
+            nextCache.push_back(v);
+
+            unsigned int* live = &adjacency[offsets[v]];
+            unsigned int* last = live + remaining[v] - 1;
+            std::swap(*std::find(live, last, (unsigned int)best), *last);
+            --remaining[v];
+        }
+        for (unsigned int v : cache) {
+            if (v != nextCache[0] && v != nextCache[1] && v != nextCache[2])
+                nextCache.push_back(v);
+        }
+
+        // Rescore every vertex that moved in or fell out of the cache,
+        // then the triangles still using them
+        for (size_t i = 0; i < nextCache.size(); ++i) {
+            const unsigned int v = nextCache[i];
+            cachePosition[v] = i < (size_t)CACHE_SIZE ? (int)i : -1;
+            scores[v] = vertexScore(cachePosition[v], remaining[v]);
+        }
+        best = -1;
+        float bestScore = -1.0f;
+        for (unsigned int v : nextCache) {
+            for (unsigned int a = 0; a < remaining[v]; ++a) {
+                const unsigned int t = adjacency[offsets[v] + a];
+                triangleScores[t] = scores[indices[3 * t]] +
+                                    scores[indices[3 * t + 1]] +
+                                    scores[indices[3 * t + 2]];
+                if (triangleScores[t] > bestScore) {
+                    bestScore = triangleScores[t];
+                    best = (long)t;
+                }
+            }
+        }
+        if (nextCache.size() > (size_t)CACHE_SIZE)
+            nextCache.resize(CACHE_SIZE);
+        cache.swap(nextCache);
+
+        // Nothing left around the cache: restart at the next unused one
+        if (best < 0) {
+            while (scanCursor < triangleCount && emitted[scanCursor])
+                ++scanCursor;
+            if (scanCursor < triangleCount)
+                best = (long)scanCursor;
+        }
+    }
+
+    indices.swap(result);
+}
+
+// Renumber vertices in order of first use by the indices, dropping any
+// that no triangle references
+template <typename Vertex>
+void optimizeVertexFetch(std::vector<Vertex>& vertices,
+                         std::vector<unsigned int>& indices) {
+    const unsigned int unused = ~0u;
+    std::vector<unsigned int> remap(vertices.size(), unused);
+    std::vector<Vertex> ordered;
+    ordered.reserve(vertices.size());
+    for (unsigned int& index : indices) {
+        if (remap[index] == unused) {
+            remap[index] = (unsigned int)ordered.size();
+            ordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(ordered);
+}
+
+}  // namespace MeshOptimizer
@@ -0,0 +1,304 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Quadric error mesh simplification (Garland and Heckbert) for building
+// levels of detail. Edges collapse onto one of their existing vertices, so
+// a simplified index list still addresses the original vertex array and
+// every LOD of a mesh shares its vertex range.
+//
+// Vertices with the same position but different attributes (UV or normal
+// seams) move together: a collapse is only taken if every vertex of the
+// moving position has a neighbor at the target position to be replaced by.
+// Positions on open borders never move.
+namespace MeshSimplifier {
+
+// Symmetric 4x4 error quadric, upper triangle only
+struct Quadric {
+    double a[10] = {};
+
+    void addPlane(const glm::dvec3& n, double d) {
+        a[0] += n.x * n.x; a[1] += n.x * n.y; a[2] += n.x * n.z;
+        a[3] += n.x * d;   a[4] += n.y * n.y; a[5] += n.y * n.z;
+        a[6] += n.y * d;   a[7] += n.z * n.z; a[8] += n.z * d;
+        a[9] += d * d;
+    }
+
+    void add(const Quadric& q) {
+        for (int i = 0; i < 10; ++i)
+            a[i] += q.a[i];
+    }
+
+    // Sum of squared distances to the accumulated planes
+    double error(const glm::vec3& p) const {
+        const double x = p.x, y = p.y, z = p.z;
+        return a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z +
+               2 * a[3] * x + a[4] * y * y + 2 * a[5] * y * z +
+               2 * a[6] * y + a[7] * z * z + 2 * a[8] * z + a[9];
+    }
+};
+
+// Reduce indices towards targetIndexCount. Returns the simplified list and
+// writes the largest collapse error, as a distance in model units, to
+// error. Stops early when no collapse is left that keeps the surface
+// intact.
+inline std::vector<unsigned int> simplify(
+    const std::vector<glm::vec3>& positions,
+    const std::vector<unsigned int>& indices, size_t targetIndexCount,
+    float& error) {
+    error = 0.0f;
+    std::vector<unsigned int> result = indices;
+    const size_t vertexCount = positions.size();
+    if (result.size() <= targetIndexCount || vertexCount == 0)
+        return result;
+
+    // Position groups: every vertex points at the first vertex sharing its
+    // position, and the members of each group are listed together
+    std::vector<unsigned int> group(vertexCount);
+    {
+        size_t tableSize = 1;
+        while (tableSize < vertexCount * 2)
+            tableSize *= 2;
+        const unsigned int empty = ~0u;
+        std::vector<unsigned int> table(tableSize, empty);
+        for (size_t v = 0; v < vertexCount; ++v) {
+            const unsigned char* bytes =
+                reinterpret_cast<const unsigned char*>(&positions[v]);
+            size_t hash = 2166136261u;
+            for (size_t i = 0; i < sizeof(glm::vec3); ++i) {
+                hash ^= bytes[i];
+                hash *= 16777619u;
+            }
+            size_t slot = hash & (tableSize - 1);
+            while (table[slot] != empty &&
+                   positions[table[slot]] != positions[v])
+                slot = (slot + 1) & (tableSize - 1);
+            if (table[slot] == empty)
+                table[slot] = (unsigned int)v;
+            group[v] = table[slot];
+        }
+    }
+    std::vector<unsigned int> memberOffsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; ++v)
+        ++memberOffsets[group[v] + 1];
+    for (size_t v = 0; v < vertexCount; ++v)
+        memberOffsets[v + 1] += memberOffsets[v];
+    std::vector<unsigned int> members(vertexCount);
+    {
+        std::vector<unsigned int> fill(memberOffsets.begin(),
+                                       memberOffsets.end() - 1);
+        for (size_t v = 0; v < vertexCount; ++v)
+            members[fill[group[v]]++] = (unsigned int)v;
+    }
+
+    // Border positions: an edge used by a single triangle
+    std::vector<char> locked(vertexCount, 0);
+    {
+        std::vector<std::pair<unsigned int, unsigned int>> edges;
+        for (size_t i = 0; i < result.size(); i += 3) {
+            for (int k = 0; k < 3; ++k) {
+                unsigned int a = group[result[i + k]];
+                unsigned int b = group[result[i + (k + 1) % 3]];
+                edges.push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+        for (size_t i = 0; i < edges.size();) {
+            size_t j = i;
+            while (j < edges.size() && edges[j] == edges[i])
+                ++j;
+            if (j - i == 1)
+                locked[edges[i].first] = locked[edges[i].second] = 1;
+            i = j;
+        }
+    }
+
+    // Plane quadrics of the original surface, per position group
+    std::vector<Quadric> quadrics(vertexCount);
+    for (size_t i = 0; i < result.size(); i += 3) {
+        const glm::dvec3 p0(positions[result[i]]);
+        const glm::dvec3 p1(positions[result[i + 1]]);
+        const glm::dvec3 p2(positions[result[i + 2]]);
+        glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+        const double length = glm::length(n);
+        if (length <= 0.0)
+            continue;
+        n /= length;
+        Quadric q;
+        q.addPlane(n, -glm::dot(n, p0));
+        for (int k = 0; k < 3; ++k)
+            quadrics[group[result[i + k]]].add(q);
+    }
+
+    struct Collapse {
+        unsigned int from;  // Position groups
+        unsigned int to;
+        double cost;
+    };
+
+    double maxCost = 0.0;
+    std::vector<unsigned int> remap(vertexCount);
+    std::vector<char> touched(vertexCount);
+    while (result.size() > targetIndexCount) {
+        const size_t triangleCount = result.size() / 3;
+
+        // Triangles around each vertex, rebuilt every pass
+        std::vector<unsigned int> offsets(vertexCount + 1, 0);
+        for (unsigned int index : result)
+            ++offsets[index + 1];
+        for (size_t v = 0; v < vertexCount; ++v)
+            offsets[v + 1] += offsets[v];
+        std::vector<unsigned int> around(result.size());
+        {
+            std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+            for (size_t t = 0; t < triangleCount; ++t)
+                for (int k = 0; k < 3; ++k)
+                    around[fill[result[3 * t + k]]++] = (unsigned int)t;
+        }
+
+        // Cheapest direction of every edge between movable positions
+        std::vector<Collapse> candidates;
+        for (size_t i = 0; i < result.size(); i += 3) {
+            for (int k = 0; k < 3; ++k) {
+                const unsigned int a = group[result[i + k]];
+                const unsigned int b = group[result[i + (k + 1) % 3]];
+                if (a >= b)
+                    continue;  // Each undirected edge once per triangle
+                Quadric q = quadrics[a];
+                q.add(quadrics[b]);
+                Collapse c;
+                const double toB = locked[a] ? -1.0 : q.error(positions[b]);
+                const double toA = locked[b] ? -1.0 : q.error(positions[a]);
+                if (toB < 0.0 && toA < 0.0)
+                    continue;
+                if (toA < 0.0 || (toB >= 0.0 && toB <= toA)) {
+                    c.from = a;
+                    c.to = b;
+                    c.cost = toB;
+                } else {
+                    c.from = b;
+                    c.to = a;
+                    c.cost = toA;
+                }
+                candidates.push_back(c);
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(),
+                  [](const Collapse& x, const Collapse& y) {
+                      return x.cost < y.cost;
+                  });
+
+        // Collapse in cost order, leaving the neighborhood of each collapse
+        // alone for the rest of the pass so every check sees current data
+        for (size_t v = 0; v < vertexCount; ++v)
+            remap[v] = (unsigned int)v;
+        std::fill(touched.begin(), touched.end(), 0);
+        size_t removed = 0;
+        const size_t wanted = (result.size() - targetIndexCount) / 3;
+        for (const Collapse& c : candidates) {
+            if (removed >= wanted)
+                break;
+            if (touched[c.from] || touched[c.to])
+                continue;
+
+            // Every vertex at the moving position needs a partner at the
+            // target through one of its own triangles
+            bool valid = true;
+            for (unsigned int m = memberOffsets[c.from];
+                 valid && m < memberOffsets[c.from + 1]; ++m) {
+                const unsigned int v = members[m];
+                unsigned int partner = ~0u;
+                for (unsigned int t = offsets[v];
+                     t < offsets[v + 1] && partner == ~0u; ++t) {
+                    const unsigned int* tri = &result[3 * around[t]];
+                    for (int k = 0; k < 3; ++k)
+                        if (group[tri[k]] == c.to)
+                            partner = tri[k];
+                }
+                if (offsets[v] != offsets[v + 1] && partner == ~0u)
+                    valid = false;
+                remap[v] = partner == ~0u ? v : partner;
+            }
+
+            // No remaining triangle may turn over
+            for (unsigned int m = memberOffsets[c.from];
+                 valid && m < memberOffsets[c.from + 1]; ++m) {
+                const unsigned int v = members[m];
+                for (unsigned int t = offsets[v]; valid && t < offsets[v + 1];
+                     ++t) {
+                    const unsigned int* tri = &result[3 * around[t]];
+                    glm::vec3 before[3];
+                    glm::vec3 after[3];
+                    bool collapses = false;
+                    for (int k = 0; k < 3; ++k) {
+                        before[k] = positions[tri[k]];
+                        const bool moves = group[tri[k]] == c.from;
+                        after[k] = moves ? positions[c.to] : before[k];
+                        collapses = collapses || group[tri[k]] == c.to;
+                    }
+                    if (collapses)
+                        continue;  // Becomes degenerate and is dropped
+                    const glm::vec3 n0 = glm::cross(before[1] - before[0],
+                                                    before[2] - before[0]);
+                    const glm::vec3 n1 = glm::cross(after[1] - after[0],
+                                                    after[2] - after[0]);
+                    if (glm::dot(n0, n1) <= 0.0f)
+                        valid = false;
+                }
+            }
+
+            if (!valid) {
+                for (unsigned int m = memberOffsets[c.from];
+                     m < memberOffsets[c.from + 1]; ++m)
+                    remap[members[m]] = members[m];
+                continue;
+            }
+
+            for (unsigned int m = memberOffsets[c.from];
+                 m < memberOffsets[c.from + 1]; ++m) {
+                const unsigned int v = members[m];
+                for (unsigned int t = offsets[v]; t < offsets[v + 1]; ++t) {
+                    const unsigned int* tri = &result[3 * around[t]];
+                    bool degenerate = false;
+                    for (int k = 0; k < 3; ++k) {
+                        touched[group[tri[k]]] = 1;
+                        degenerate = degenerate || group[tri[k]] == c.to;
+                    }
+                    if (degenerate)
+                        ++removed;
+                }
+            }
+            touched[c.from] = touched[c.to] = 1;
+            quadrics[c.to].add(quadrics[c.from]);
+            maxCost = std::max(maxCost, c.cost);
+        }
+
+        if (removed == 0)
+            break;
+
+        // Apply the pass and drop triangles that lost an edge
+        std::vector<unsigned int> next;
+        next.reserve(result.size());
+        for (size_t i = 0; i < result.size(); i += 3) {
+            const unsigned int a = remap[result[i]];
+            const unsigned int b = remap[result[i + 1]];
+            const unsigned int c = remap[result[i + 2]];
+            if (group[a] == group[b] || group[b] == group[c] ||
+                group[a] == group[c])
+                continue;
+            next.push_back(a);
+            next.push_back(b);
+            next.push_back(c);
+        }
+        result.swap(next);
+    }
+
+    error = (float)std::sqrt(std::max(maxCost, 0.0));
+    return result;
+}
+
+}  // namespace MeshSimplifier
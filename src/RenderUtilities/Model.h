@@ -12,43 +12,869 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <fstream>
+#include "CompressedTexture.h"
+#include "CookedMesh.h"
+#include "FileStamp.h"
 #include "Mesh.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
 #include "Shader.h"
+#include "TextureCache.h"
 
 class Model 
 {
     public:
+        // Empty model, filled by load() and made drawable by uploadStep()
+        Model() = default;
+
+        // Load and upload in one go, on the GL thread
         explicit Model(const std::string& path)
         {
-            loadModel(path);
+            load(path);
+            while (!uploadStep())
+                ;
         }
-        
+
+        // Materials are read from this shader storage binding
+        static const GLuint MATERIAL_BINDING = 0;
+
+        // Diffuse texture arrays a model may use, bound to units 0 and up
+        static const int MAX_MATERIAL_ARRAYS = 4;
+
+        // Owns GL buffers and texture references, so it is not copied
+        Model(const Model&) = delete;
+        Model& operator=(const Model&) = delete;
+
+        ~Model()
+        {
+            // Models dropped before their upload started own no GL objects
+            if (vao)
+            {
+                GLuint buffers[] = { vbo, ebo, drawIdBuffer, indirectBuffer,
+                                     subsetBuffer, materialBuffer };
+                glDeleteBuffers(6, buffers);
+                glDeleteVertexArrays(1, &vao);
+            }
+            // The texture arrays are cache entries too
+            for (const std::string& key : textureKeys)
+                TextureCache::instance().release(key);
+        }
+
+        // CPU half of loading: map the cooked .mesh file next to the model
+        // or, without one, import the model with Assimp; then build the
+        // meshes and decode every texture image. Touches no GL state, so it
+        // may run on a worker thread.
+        void load(const std::string& path)
+        {
+            filePath = path;
+            directory = path.substr(0, path.find_last_of('/'));
+            if (cooked.open(CookedMeshFile::pathFor(path).c_str(), path.c_str(), sizeof(CookedVertex)))
+            {
+                loadCooked();
+                return;
+            }
+
+            Assimp::Importer import;
+            const aiScene *scene = importScene(import, path);
+            if (!scene)
+                return;
+
+            processNode(scene->mRootNode, scene);
+            for (const Mesh& mesh : meshes)
+            {
+                bounds.expand(mesh.getBounds());
+                for (const Texture& texture : mesh.textures)
+                {
+                    const aiTexture* source = texture.path.empty() || texture.path[0] != '*'
+                                                  ? nullptr
+                                                  : scene->GetEmbeddedTexture(texture.path.c_str());
+                    EmbeddedImage embedded;
+                    if (source)
+                    {
+                        embedded.data = reinterpret_cast<const unsigned char*>(source->pcData);
+                        embedded.width = source->mWidth;
+                        embedded.height = source->mHeight;
+                    }
+                    addImage(texture, source ? &embedded : nullptr);
+                }
+            }
+        }
+
+        // Import a model with Assimp and write it as a cooked .mesh file,
+        // which load() then maps instead of importing. The resolved paths of
+        // the image files its materials use are added to texturePaths.
+        static bool cook(const std::string& path, const std::string& outPath,
+                         std::vector<std::string>* texturePaths = nullptr)
+        {
+            Model model;
+            model.filePath = path;
+            model.directory = path.substr(0, path.find_last_of('/'));
+            Assimp::Importer import;
+            const aiScene *scene = model.importScene(import, path);
+            if (!scene)
+                return false;
+            model.processNode(scene->mRootNode, scene);
+
+            std::vector<CookedVertex> allVertices;
+            std::vector<unsigned int> allIndices;
+            std::vector<CookedSubmesh> submeshes;
+            std::vector<CookedTexture> textures;
+            std::vector<int64_t> embeddedOffsets;  // Into embeddedData, -1 if external
+            std::string names;
+            std::vector<unsigned char> embeddedData;
+            BoundingBox bounds;
+            for (const Mesh& mesh : model.meshes)
+            {
+                CookedSubmesh submesh = {};
+                submesh.baseVertex = (uint32_t)allVertices.size();
+                submesh.vertexCount = (uint32_t)mesh.vertices.size();
+                submesh.firstIndex = (uint32_t)allIndices.size();
+                submesh.indexCount = (uint32_t)mesh.indices.size();
+                submesh.firstTexture = (uint32_t)textures.size();
+                submesh.textureCount = (uint32_t)mesh.textures.size();
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    submesh.boundsMin[axis] = mesh.getBounds().min[axis];
+                    submesh.boundsMax[axis] = mesh.getBounds().max[axis];
+                }
+                for (int lod = 0; lod < MAX_MESH_LODS; ++lod)
+                {
+                    submesh.lodFirstIndex[lod] = mesh.lods[lod].firstIndex;
+                    submesh.lodIndexCount[lod] = mesh.lods[lod].indexCount;
+                }
+                submeshes.push_back(submesh);
+                bounds.expand(mesh.getBounds());
+                for (const Vertex& vertex : mesh.vertices)
+                {
+                    CookedVertex cookedVertex;
+                    std::memcpy(cookedVertex.position, &vertex.Position, sizeof(cookedVertex.position));
+                    std::memcpy(cookedVertex.normal, &vertex.Normal, sizeof(cookedVertex.normal));
+                    std::memcpy(cookedVertex.texCoords, &vertex.TexCoords, sizeof(cookedVertex.texCoords));
+                    allVertices.push_back(cookedVertex);
+                }
+                allIndices.insert(allIndices.end(), mesh.indices.begin(), mesh.indices.end());
+
+                for (const Texture& texture : mesh.textures)
+                {
+                    CookedTexture cookedTexture = {};
+                    cookedTexture.type = texture.type == "texture_specular" ? COOKED_SPECULAR : COOKED_DIFFUSE;
+                    cookedTexture.nameOffset = (uint32_t)names.size();
+                    cookedTexture.nameLength = (uint32_t)texture.path.size();
+                    names += texture.path;
+
+                    // Embedded images are copied once, however many meshes use them
+                    int64_t offset = -1;
+                    const aiTexture* source = texture.path.empty() || texture.path[0] != '*'
+                                                  ? nullptr
+                                                  : scene->GetEmbeddedTexture(texture.path.c_str());
+                    if (source)
+                    {
+                        cookedTexture.embeddedWidth = source->mWidth;
+                        cookedTexture.embeddedHeight = source->mHeight;
+                        for (size_t t = 0; t < textures.size() && offset < 0; ++t)
+                        {
+                            if (embeddedOffsets[t] >= 0 &&
+                                names.compare(textures[t].nameOffset, textures[t].nameLength,
+                                              texture.path) == 0)
+                                offset = embeddedOffsets[t];
+                        }
+                        if (offset < 0)
+                        {
+                            const size_t bytes = source->mHeight == 0
+                                                     ? (size_t)source->mWidth
+                                                     : (size_t)source->mWidth * source->mHeight * 4;
+                            const unsigned char* data = reinterpret_cast<const unsigned char*>(source->pcData);
+                            offset = (int64_t)embeddedData.size();
+                            embeddedData.insert(embeddedData.end(), data, data + bytes);
+                        }
+                    }
+                    textures.push_back(cookedTexture);
+                    embeddedOffsets.push_back(offset);
+                    if (!source && texturePaths &&
+                        std::find(texturePaths->begin(), texturePaths->end(), texture.key) ==
+                            texturePaths->end())
+                        texturePaths->push_back(texture.key);
+                }
+            }
+
+            const bool shortIndices = fitsShortIndices(model.meshes);
+            const std::vector<GLushort> allShortIndices =
+                shortIndices ? std::vector<GLushort>(allIndices.begin(), allIndices.end())
+                             : std::vector<GLushort>();
+            const size_t indexStride = shortIndices ? sizeof(GLushort) : sizeof(unsigned int);
+            const void* indexData = shortIndices ? (const void*)allShortIndices.data()
+                                                 : (const void*)allIndices.data();
+
+            // Sections start 8-byte aligned
+            auto align = [](uint64_t offset) { return (offset + 7) & ~(uint64_t)7; };
+            CookedMeshHeader header = {};
+            std::memcpy(header.magic, "MSH5", 4);
+            header.vertexStride = sizeof(CookedVertex);
+            header.indexStride = (uint32_t)indexStride;
+            header.vertexCount = (uint32_t)allVertices.size();
+            header.indexCount = (uint32_t)allIndices.size();
+            header.submeshCount = (uint32_t)submeshes.size();
+            header.textureCount = (uint32_t)textures.size();
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                header.boundsMin[axis] = bounds.min[axis];
+                header.boundsMax[axis] = bounds.max[axis];
+            }
+            for (int lod = 0; lod < MAX_MESH_LODS; ++lod)
+                header.lodErrors[lod] = model.lodErrors[lod];
+            FileStamp source;
+            FileStamp::of(path.c_str(), source);
+            header.sourceSize = source.size;
+            header.sourceTime = source.time;
+            header.submeshOffset = align(sizeof(CookedMeshHeader));
+            header.textureOffset = align(header.submeshOffset + submeshes.size() * sizeof(CookedSubmesh));
+            header.vertexOffset = align(header.textureOffset + textures.size() * sizeof(CookedTexture));
+            header.indexOffset = align(header.vertexOffset + allVertices.size() * sizeof(CookedVertex));
+            header.stringOffset = align(header.indexOffset + allIndices.size() * indexStride);
+            header.stringBytes = names.size();
+            const uint64_t dataOffset = align(header.stringOffset + names.size());
+            for (size_t t = 0; t < textures.size(); ++t)
+            {
+                if (embeddedOffsets[t] >= 0)
+                    textures[t].dataOffset = dataOffset + (uint64_t)embeddedOffsets[t];
+            }
+
+            std::ofstream out(outPath, std::ios::binary | std::ios::trunc);
+            if (!out)
+            {
+                std::cout << "Failed to write cooked mesh: " << outPath << std::endl;
+                return false;
+            }
+            uint64_t written = 0;
+            auto put = [&out, &written](uint64_t offset, const void* bytes, uint64_t count)
+            {
+                static const char padding[8] = {};
+                out.write(padding, (std::streamsize)(offset - written));
+                out.write(static_cast<const char*>(bytes), (std::streamsize)count);
+                written = offset + count;
+            };
+            put(0, &header, sizeof(header));
+            put(header.submeshOffset, submeshes.data(), submeshes.size() * sizeof(CookedSubmesh));
+            put(header.textureOffset, textures.data(), textures.size() * sizeof(CookedTexture));
+            put(header.vertexOffset, allVertices.data(), allVertices.size() * sizeof(CookedVertex));
+            put(header.indexOffset, indexData, allIndices.size() * indexStride);
+            put(header.stringOffset, names.data(), names.size());
+            put(dataOffset, embeddedData.data(), embeddedData.size());
+
+            const ImportStats& stats = model.importStats;
+            std::cout << "Cooked " << path << " -> " << outPath << " (" << submeshes.size()
+                      << " meshes, " << allVertices.size() << " vertices, " << allIndices.size() / 3
+                      << " triangles, " << (shortIndices ? 16 : 32) << "-bit indices)" << std::endl;
+            if (stats.triangles > 0)
+            {
+                std::cout << "  ACMR " << stats.missesBefore / stats.triangles << " -> "
+                          << stats.missesAfter / stats.triangles << ", vertices "
+                          << stats.verticesBefore << " -> " << allVertices.size() << std::endl;
+            }
+            std::cout << "  LOD triangles (error):";
+            for (int lod = 0; lod < MAX_MESH_LODS; ++lod)
+            {
+                size_t triangles = 0;
+                for (const Mesh& mesh : model.meshes)
+                    triangles += mesh.lods[lod].indexCount / 3;
+                std::cout << " " << triangles << " (" << model.lodErrors[lod] << ")";
+            }
+            std::cout << std::endl;
+            return (bool)out;
+        }
+
+        // GL half, in pieces small enough to spread over frames: one image
+        // per call, then the merged buffers, then the texture array. Returns
+        // true once the model can be drawn.
+        bool uploadStep()
+        {
+            if (ready)
+                return true;
+
+            if (nextImage < images.size())
+            {
+                uploadImage(images[nextImage++]);
+                return false;
+            }
+            if (!meshes.empty() && vao == 0)
+            {
+                buildBuffers();
+                return false;
+            }
+            if (!meshes.empty())
+                buildMaterials();
+
+            std::vector<DecodedImage>().swap(images);
+            ready = true;
+            return true;
+        }
+
+        // Uploaded and safe to draw
+        bool isReady() const { return ready; }
+
+        // Keep each mesh's vertices and indices on the CPU after upload,
+        // for collision or picking. Off by default; set before the upload.
+        void setKeepCpuData(bool keep) { keepCpuData = keep; }
+
+        // Bytes of mesh data still on the CPU, and freed after upload
+        size_t getCpuBytes() const
+        {
+            size_t bytes = 0;
+            for (const Mesh& mesh : meshes)
+                bytes += mesh.cpuBytes();
+            return bytes;
+        }
+        size_t getReleasedBytes() const { return releasedBytes; }
+
+        // Draw every mesh with the texture arrays on units 0 and up
         void Draw(Shader &shader)
         {
-            for(unsigned int i = 0; i < meshes.size(); i++)
-                meshes[i].Draw(shader);
+            for (int i = 0; i < textureArrayCount; ++i)
+            {
+                glActiveTexture(GL_TEXTURE0 + i);
+                glBindTexture(GL_TEXTURE_2D_ARRAY, textureArrays[i]);
+            }
+            glActiveTexture(GL_TEXTURE0);
+            setTextureUnits(shader);
+            bindMaterials();
+            glBindVertexArray(vao);
+            drawMeshes(nullptr);
+            glBindVertexArray(0);
         } 	
+
+        const std::vector<Mesh>& getMeshes() const { return meshes; }
+
+        // Union of the mesh bounds, in model space
+        const BoundingBox& getBounds() const { return bounds; }
+
+        // Largest simplification error of a level of detail over all
+        // meshes, in model units
+        float getLodError(int lod) const { return lodErrors[lod]; }
+
+        // Coarsest level of detail whose error stays within tolerance once
+        // scaled by screenPerUnit (screen size of one model unit)
+        int selectLod(float screenPerUnit, float tolerance) const
+        {
+            for (int lod = MAX_MESH_LODS - 1; lod > 0; --lod)
+                if (lodErrors[lod] * screenPerUnit <= tolerance)
+                    return lod;
+            return 0;
+        }
+
+        // Merged geometry of all meshes, with the mesh index as an
+        // instanced attribute (location 3)
+        GLuint getVAO() const { return vao; }
+
+        // Diffuse textures of all meshes, one layer each, spread over up
+        // to MAX_MATERIAL_ARRAYS arrays
+        int getTextureArrayCount() const { return textureArrayCount; }
+        GLuint getTextureArray(int i) const { return textureArrays[i]; }
+
+        // Point u_materialTextures[i] at texture unit i
+        static void setTextureUnits(Shader& shader)
+        {
+            static const char* const names[MAX_MATERIAL_ARRAYS] = {
+                "u_materialTextures[0]", "u_materialTextures[1]",
+                "u_materialTextures[2]", "u_materialTextures[3]" };
+            for (int i = 0; i < MAX_MATERIAL_ARRAYS; ++i)
+                shader.set(names[i], i);
+        }
+
+        // Per-mesh material table (ivec4: diffuse layer or -1, its array,
+        // unused)
+        void bindMaterials() const
+        {
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_BINDING,
+                             materialBuffer);
+        }
+
+        // One indirect multi-draw over all meshes, or over the listed mesh
+        // indices only, at one level of detail. The model's vertex array
+        // must be bound.
+        void drawMeshes(const std::vector<int>* subset, int lod = 0) const
+        {
+            if (commands.empty())
+                return;
+
+            // Commands are stored level by level, one per mesh
+            const size_t first = (size_t)lod * meshes.size();
+            GLsizei count = (GLsizei)meshes.size();
+            const void* offset = (const void*)(first * sizeof(DrawCommand));
+            if (subset && subset->empty())
+                return;
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+            if (subset)
+            {
+                std::vector<DrawCommand> visible;
+                visible.reserve(subset->size());
+                for (int i : *subset)
+                    visible.push_back(commands[first + i]);
+                count = (GLsizei)visible.size();
+                offset = nullptr;
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, subsetBuffer);
+                glBufferData(GL_DRAW_INDIRECT_BUFFER,
+                             visible.size() * sizeof(DrawCommand),
+                             visible.data(), GL_STREAM_DRAW);
+            }
+
+            glMultiDrawElementsIndirect(GL_TRIANGLES, indexType, offset,
+                                        count, 0);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        }
     private:
+        // glMultiDrawElementsIndirect command layout
+        struct DrawCommand
+        {
+            GLuint count;
+            GLuint instanceCount;
+            GLuint firstIndex;
+            GLint baseVertex;
+            GLuint baseInstance;  // Mesh index, read back as the draw id
+        };
+
+        // Image bytes stored inside a model file, laid out like an
+        // aiTexture: compressed (height 0, width = byte count) or BGRA texels
+        struct EmbeddedImage
+        {
+            const unsigned char* data = nullptr;
+            unsigned int width = 0;
+            unsigned int height = 0;
+        };
+
+        // Pixels decoded by load(), or the blocks of a cooked .dds next to
+        // the image, waiting for the GL thread
+        struct DecodedImage
+        {
+            std::string key;
+            std::string path;  // As the material names it
+            int width = 0;
+            int height = 0;
+            int components = 0;
+            std::vector<unsigned char> pixels;  // Empty if decoding failed
+            CompressedTexture compressed;       // Empty if not cooked
+        };
+
+        // Layers of the uncompressed texture array are scaled to the
+        // largest image, up to this
+        static const GLint MAX_LAYER_SIZE = 2048;
+
+        // Diffuse images that share one texture array: compressed ones of
+        // one format, size and mip count, or every uncompressed one
+        // (format 0, sized to the largest)
+        struct LayerGroup
+        {
+            GLint format = 0;
+            GLint width = 0;
+            GLint height = 0;
+            GLint maxLevel = 0;
+            std::vector<GLuint> sources;
+            std::string key;  // '|' before each image key
+        };
+
+        // Meshes with fewer triangles than this keep their previous level
+        // of detail instead of being simplified further
+        static const size_t MIN_LOD_TRIANGLES = 64;
+
         // model data
-        std::vector<Texture> textures_loaded;
         std::vector<Mesh> meshes;
+        BoundingBox bounds;
+        std::string filePath;
         std::string directory;
+        std::vector<std::string> textureKeys;  // One per cache reference held
+        bool keepCpuData = false;
+        size_t releasedBytes = 0;
+        float lodErrors[MAX_MESH_LODS] = {};  // Model units, per level of detail
 
-        void loadModel(const std::string& path)
+        // Vertex cache behavior of the imported meshes before and after
+        // optimization, summed over meshes (misses = ACMR * triangles)
+        struct ImportStats
         {
-            Assimp::Importer import;
-            const aiScene *scene = import.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);	
-            
-            if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) 
+            size_t triangles = 0;
+            size_t verticesBefore = 0;
+            double missesBefore = 0.0;
+            double missesAfter = 0.0;
+        };
+        ImportStats importStats;
+
+        // Upload progress
+        CookedMeshFile cooked;  // Mapped until its blobs are uploaded
+        std::vector<DecodedImage> images;  // One per distinct texture key
+        size_t nextImage = 0;
+        bool ready = false;
+
+        // Merged GPU data
+        GLuint vao = 0;
+        GLuint vbo = 0;
+        GLuint ebo = 0;
+        GLuint drawIdBuffer = 0;
+        GLuint indirectBuffer = 0;
+        GLuint subsetBuffer = 0;  // Rewritten for partially culled draws
+        GLuint materialBuffer = 0;
+        GLuint textureArrays[MAX_MATERIAL_ARRAYS] = {};
+        int textureArrayCount = 0;
+        GLenum indexType = GL_UNSIGNED_INT;
+        std::vector<DrawCommand> commands;
+
+        // Mesh-local indices fit 16 bits when every mesh has fewer than
+        // 65536 vertices; the merged buffer then uses them throughout
+        static bool fitsShortIndices(const std::vector<Mesh>& meshes)
+        {
+            return std::all_of(meshes.begin(), meshes.end(),
+                               [](const Mesh& mesh) { return mesh.vertexCount < 65536; });
+        }
+
+        // Suballocate every mesh in one vertex and one index buffer and
+        // record one indirect command per mesh and level of detail. Each
+        // mesh is copied straight into its range and then, unless the model
+        // keeps CPU data, released.
+        void buildBuffers()
+        {
+            size_t vertexCount = 0;
+            size_t indexCount = 0;
+            for (Mesh& mesh : meshes)
             {
-                std::cout << "ERROR::ASSIMP::" << import.GetErrorString() << std::endl;
-                return;
+                if (!cooked.isOpen())
+                {
+                    mesh.baseVertex = (unsigned int)vertexCount;
+                    mesh.firstIndex = (unsigned int)indexCount;
+                }
+                vertexCount += mesh.vertexCount;
+                indexCount += mesh.indexCount;
             }
-            directory = path.substr(0, path.find_last_of('/'));
+            const size_t indexStride = cooked.isOpen() ? cooked.getHeader().indexStride
+                                       : fitsShortIndices(meshes) ? sizeof(GLushort)
+                                                                  : sizeof(unsigned int);
+            indexType = indexStride == sizeof(GLushort) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
 
-            processNode(scene->mRootNode, scene);
-        }  
+            glGenVertexArrays(1, &vao);
+            glGenBuffers(1, &vbo);
+            glGenBuffers(1, &ebo);
+            glGenBuffers(1, &drawIdBuffer);
+            glGenBuffers(1, &indirectBuffer);
+            glGenBuffers(1, &subsetBuffer);
+
+            glBindVertexArray(vao);
+            glBindBuffer(GL_ARRAY_BUFFER, vbo);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+            // Cooked vertices keep only what the shaders read, at the offsets
+            // they have in Vertex
+            const GLsizei vertexStride = cooked.isOpen() ? sizeof(CookedVertex) : sizeof(Vertex);
+            if (cooked.isOpen())
+            {
+                // Already merged: upload straight from the mapped file
+                glBufferData(GL_ARRAY_BUFFER, vertexCount * vertexStride,
+                             cooked.getVertices(), GL_STATIC_DRAW);
+                glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * indexStride,
+                             cooked.getIndices(), GL_STATIC_DRAW);
+                if (keepCpuData)
+                    copyCookedData();
+                cooked.close();
+            }
+            else
+            {
+                glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), nullptr, GL_STATIC_DRAW);
+                glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * indexStride, nullptr, GL_STATIC_DRAW);
+                std::vector<GLushort> shortIndices;
+                for (Mesh& mesh : meshes)
+                {
+                    glBufferSubData(GL_ARRAY_BUFFER, mesh.baseVertex * sizeof(Vertex),
+                                    mesh.vertices.size() * sizeof(Vertex), mesh.vertices.data());
+                    const void* indexData = mesh.indices.data();
+                    if (indexStride == sizeof(GLushort))
+                    {
+                        shortIndices.assign(mesh.indices.begin(), mesh.indices.end());
+                        indexData = shortIndices.data();
+                    }
+                    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, mesh.firstIndex * indexStride,
+                                    mesh.indices.size() * indexStride, indexData);
+                    if (!keepCpuData)
+                        releasedBytes += mesh.releaseCpuData();
+                }
+            }
+
+            for (int lod = 0; lod < MAX_MESH_LODS; ++lod)
+            {
+                for (size_t i = 0; i < meshes.size(); ++i)
+                {
+                    const Mesh& mesh = meshes[i];
+                    DrawCommand command;
+                    command.count = (GLuint)mesh.lods[lod].indexCount;
+                    command.instanceCount = 1;
+                    command.firstIndex = mesh.firstIndex + mesh.lods[lod].firstIndex;
+                    command.baseVertex = (GLint)mesh.baseVertex;
+                    command.baseInstance = (GLuint)i;
+                    commands.push_back(command);
+                }
+            }
+            std::vector<GLuint> drawIds;
+            for (size_t i = 0; i < meshes.size(); ++i)
+                drawIds.push_back((GLuint)i);
+
+            glBindBuffer(GL_ARRAY_BUFFER, vbo);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, vertexStride, (void*)0);
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, vertexStride, (void*)offsetof(Vertex, Normal));
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, vertexStride, (void*)offsetof(Vertex, TexCoords));
+
+            // One id per instance; each command's baseInstance picks its own
+            glBindBuffer(GL_ARRAY_BUFFER, drawIdBuffer);
+            glBufferData(GL_ARRAY_BUFFER, drawIds.size() * sizeof(GLuint),
+                         drawIds.data(), GL_STATIC_DRAW);
+            glEnableVertexAttribArray(3);
+            glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, 0, (void*)0);
+            glVertexAttribDivisor(3, 1);
+
+            glBindVertexArray(0);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER,
+                         commands.size() * sizeof(DrawCommand),
+                         commands.data(), GL_STATIC_DRAW);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        }
+
+        // Give cooked meshes CPU copies of their ranges in the mapped file,
+        // expanded to the runtime Vertex
+        void copyCookedData()
+        {
+            const CookedVertex* vertices = static_cast<const CookedVertex*>(cooked.getVertices());
+            const bool shortIndices = cooked.getHeader().indexStride == sizeof(GLushort);
+            for (Mesh& mesh : meshes)
+            {
+                mesh.vertices.assign(mesh.vertexCount, Vertex());
+                for (unsigned int v = 0; v < mesh.vertexCount; ++v)
+                {
+                    const CookedVertex& source = vertices[mesh.baseVertex + v];
+                    Vertex& vertex = mesh.vertices[v];
+                    vertex.Position = glm::vec3(source.position[0], source.position[1], source.position[2]);
+                    vertex.Normal = glm::vec3(source.normal[0], source.normal[1], source.normal[2]);
+                    vertex.TexCoords = glm::vec2(source.texCoords[0], source.texCoords[1]);
+                }
+                if (shortIndices)
+                {
+                    const GLushort* indices = static_cast<const GLushort*>(cooked.getIndices()) + mesh.firstIndex;
+                    mesh.indices.assign(indices, indices + mesh.indexCount);
+                }
+                else
+                {
+                    const GLuint* indices = static_cast<const GLuint*>(cooked.getIndices()) + mesh.firstIndex;
+                    mesh.indices.assign(indices, indices + mesh.indexCount);
+                }
+            }
+        }
+
+        // Copy each distinct diffuse texture into one layer of a texture
+        // array and store the array and layer per mesh in the material
+        // buffer. Compressed images are grouped by format, size and mip
+        // count and copied block for block, one array per group; images
+        // that are not compressed are scaled into one RGBA8 array. Each
+        // array is shared through the TextureCache under the list of its
+        // images, so models with the same images use one array; an image in
+        // two different lists is stored once per array. The standalone
+        // textures are released afterwards.
+        void buildMaterials()
+        {
+            std::vector<LayerGroup> groups;
+            std::vector<GLuint> placed;  // Sources already given a layer
+            std::vector<glm::ivec2> placedAt;  // Their layer and array
+            std::vector<glm::ivec4> materials(meshes.size(), glm::ivec4(-1, 0, 0, 0));
+            for (size_t i = 0; i < meshes.size(); ++i)
+            {
+                for (const Texture& texture : meshes[i].textures)
+                {
+                    if (texture.type != "texture_diffuse" || texture.id == 0)
+                        continue;
+                    auto it = std::find(placed.begin(), placed.end(), texture.id);
+                    if (it != placed.end())
+                    {
+                        const glm::ivec2 at = placedAt[it - placed.begin()];
+                        materials[i] = glm::ivec4(at.x, at.y, 0, 0);
+                        break;
+                    }
+
+                    LayerGroup layer;
+                    GLint compressed = 0;
+                    glBindTexture(GL_TEXTURE_2D, texture.id);
+                    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &layer.width);
+                    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &layer.height);
+                    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+                    if (layer.width == 0 || layer.height == 0)
+                        break;  // Failed to load
+                    if (compressed)
+                    {
+                        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT,
+                                                 &layer.format);
+                        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &layer.maxLevel);
+                    }
+
+                    // Uncompressed images all share the one RGBA8 group
+                    auto group = std::find_if(groups.begin(), groups.end(),
+                        [&layer](const LayerGroup& g) {
+                            return g.format == layer.format &&
+                                   (layer.format == 0 ||
+                                    (g.width == layer.width && g.height == layer.height &&
+                                     g.maxLevel == layer.maxLevel));
+                        });
+                    if (group == groups.end())
+                    {
+                        if (groups.size() == MAX_MATERIAL_ARRAYS)
+                        {
+                            std::cout << "Too many texture formats and sizes in " << filePath
+                                      << "; drawing " << texture.key << " untextured" << std::endl;
+                            break;
+                        }
+                        group = groups.insert(groups.end(), layer);
+                    }
+                    else if (layer.format == 0)
+                    {
+                        group->width = std::max(group->width, layer.width);
+                        group->height = std::max(group->height, layer.height);
+                    }
+
+                    const glm::ivec2 at((int)group->sources.size(), (int)(group - groups.begin()));
+                    group->sources.push_back(texture.id);
+                    group->key += '|' + texture.key;
+                    placed.push_back(texture.id);
+                    placedAt.push_back(at);
+                    materials[i] = glm::ivec4(at.x, at.y, 0, 0);
+                    break;
+                }
+            }
+            glBindTexture(GL_TEXTURE_2D, 0);
+
+            std::vector<std::string> arrayKeys;
+            for (LayerGroup& group : groups)
+            {
+                const std::string key = "array" + group.key;
+                GLuint array = TextureCache::instance().acquire(key);
+                if (array == 0)
+                {
+                    array = group.format != 0 ? buildCompressedArray(group)
+                                              : buildScaledArray(group);
+                    TextureCache::instance().insert(key, array);
+                }
+                textureArrays[textureArrayCount++] = array;
+                arrayKeys.push_back(key);
+            }
+
+            glGenBuffers(1, &materialBuffer);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, materialBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER,
+                         materials.size() * sizeof(glm::ivec4),
+                         materials.data(), GL_STATIC_DRAW);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+            for (const std::string& key : textureKeys)
+                TextureCache::instance().release(key);
+            textureKeys = arrayKeys;
+            for (Mesh& mesh : meshes)
+                for (Texture& texture : mesh.textures)
+                    texture.id = 0;
+        }
+
+        // Array in the group's compressed format, copied block for block
+        // with every cooked mip level
+        GLuint buildCompressedArray(const LayerGroup& group)
+        {
+            GLuint array = 0;
+            glGenTextures(1, &array);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, array);
+            glTexStorage3D(GL_TEXTURE_2D_ARRAY, group.maxLevel + 1, (GLenum)group.format,
+                           group.width, group.height, (GLsizei)group.sources.size());
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+                            group.maxLevel > 0 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+            for (size_t layer = 0; layer < group.sources.size(); ++layer)
+            {
+                for (GLint level = 0; level <= group.maxLevel; ++level)
+                {
+                    glCopyImageSubData(group.sources[layer], GL_TEXTURE_2D, level, 0, 0, 0,
+                                       array, GL_TEXTURE_2D_ARRAY, level, 0, 0, (GLint)layer,
+                                       std::max(group.width >> level, 1),
+                                       std::max(group.height >> level, 1), 1);
+                }
+            }
+            return array;
+        }
+
+        // RGBA8 array at the group's largest image size, up to
+        // MAX_LAYER_SIZE, with each source scaled into its layer by a
+        // framebuffer blit
+        GLuint buildScaledArray(const LayerGroup& group)
+        {
+            const GLint width = std::min(group.width, MAX_LAYER_SIZE);
+            const GLint height = std::min(group.height, MAX_LAYER_SIZE);
+            GLint levels = 1;
+            while ((std::max(width, height) >> levels) > 0)
+                ++levels;
+
+            GLuint array = 0;
+            glGenTextures(1, &array);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, array);
+            glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGBA8, width, height,
+                           (GLsizei)group.sources.size());
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+            GLint prevRead = 0;
+            GLint prevDraw = 0;
+            glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &prevRead);
+            glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prevDraw);
+            GLboolean scissor = glIsEnabled(GL_SCISSOR_TEST);
+            GLboolean colorMask[4];
+            glGetBooleanv(GL_COLOR_WRITEMASK, colorMask);
+            glDisable(GL_SCISSOR_TEST);
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+            GLuint fbos[2];
+            glGenFramebuffers(2, fbos);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, fbos[0]);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbos[1]);
+            for (size_t layer = 0; layer < group.sources.size(); ++layer)
+            {
+                GLint w = 0;
+                GLint h = 0;
+                glBindTexture(GL_TEXTURE_2D, group.sources[layer]);
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &w);
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
+                glBindTexture(GL_TEXTURE_2D, 0);
+
+                glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                       GL_TEXTURE_2D, group.sources[layer], 0);
+                glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                          array, 0, (GLint)layer);
+                glBlitFramebuffer(0, 0, w, h, 0, 0, width, height,
+                                  GL_COLOR_BUFFER_BIT, GL_LINEAR);
+            }
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, prevRead);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, prevDraw);
+            glDeleteFramebuffers(2, fbos);
+
+            glColorMask(colorMask[0], colorMask[1], colorMask[2], colorMask[3]);
+            if (scissor)
+                glEnable(GL_SCISSOR_TEST);
+
+            glBindTexture(GL_TEXTURE_2D_ARRAY, array);
+            glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+            return array;
+        }
 
         static glm::mat4 aiToGlm(const aiMatrix4x4& m)
         {
@@ -82,12 +908,14 @@ class Model
             std::vector<Vertex> vertices;
             std::vector<unsigned int> indices;
             std::vector<Texture> textures;
+            vertices.reserve(mesh->mNumVertices);
+            indices.reserve((size_t)mesh->mNumFaces * 3);
             glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(transform)));
             
             for(unsigned int i = 0; i < mesh->mNumVertices; i++)
             {
                 glm::vec3 vector;
-                Vertex vertex;
+                Vertex vertex = {};  // Unused attributes stay zero for welding
                 // process vertex positions, normals and texture coordinates    
                 glm::vec4 position(mesh->mVertices[i].x, mesh->mVertices[i].y,
                                     mesh->mVertices[i].z, 1.0f);
@@ -126,56 +954,172 @@ class Model
             {
                 aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
                 std::vector<Texture> diffuseMaps = loadMaterialTextures(material, 
-                                                    aiTextureType_DIFFUSE, "texture_diffuse", scene);
+                                                    aiTextureType_DIFFUSE, "texture_diffuse");
                 textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
                 std::vector<Texture> specularMaps = loadMaterialTextures(material, 
-                                                    aiTextureType_SPECULAR, "texture_specular", scene);
+                                                    aiTextureType_SPECULAR, "texture_specular");
                 textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
             }  
 
-            return Mesh(vertices, indices, textures);
+            // Weld, then order triangles for the post-transform cache and
+            // vertices for fetch locality
+            importStats.triangles += indices.size() / 3;
+            importStats.verticesBefore += vertices.size();
+            importStats.missesBefore += MeshOptimizer::acmr(indices, vertices.size()) * (indices.size() / 3);
+            MeshOptimizer::weldVertices(vertices, indices);
+            MeshOptimizer::optimizeVertexCache(indices, vertices.size());
+            MeshOptimizer::optimizeVertexFetch(vertices, indices);
+            importStats.missesAfter += MeshOptimizer::acmr(indices, vertices.size()) * (indices.size() / 3);
+
+            Mesh result(std::move(vertices), std::move(indices), std::move(textures));
+            buildLods(result);
+            return result;
         }  
 
-        std::vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, std::string typeName,
-                                                 const aiScene* scene)
+        // Append the coarser levels of detail to a mesh's indices, each
+        // simplified from the previous one to about half its triangles, and
+        // widen the model's errors to cover them. Errors add up, since every
+        // level deviates from the one it was built from.
+        void buildLods(Mesh& mesh)
+        {
+            std::vector<glm::vec3> positions;
+            positions.reserve(mesh.vertices.size());
+            for (const Vertex& vertex : mesh.vertices)
+                positions.push_back(vertex.Position);
+
+            std::vector<unsigned int> level = mesh.indices;
+            float error = 0.0f;
+            for (int lod = 1; lod < MAX_MESH_LODS; ++lod)
+            {
+                MeshLod range = mesh.lods.back();
+                if (level.size() / 3 >= MIN_LOD_TRIANGLES)
+                {
+                    float collapseError = 0.0f;
+                    std::vector<unsigned int> simplified =
+                        MeshSimplifier::simplify(positions, level, level.size() / 6 * 3, collapseError);
+                    if (simplified.size() < level.size())
+                    {
+                        MeshOptimizer::optimizeVertexCache(simplified, positions.size());
+                        level.swap(simplified);
+                        error += collapseError;
+                        range.firstIndex = (unsigned int)mesh.indices.size();
+                        range.indexCount = (unsigned int)level.size();
+                        mesh.indices.insert(mesh.indices.end(), level.begin(), level.end());
+                    }
+                }
+                mesh.lods.push_back(range);
+                lodErrors[lod] = std::max(lodErrors[lod], error);
+            }
+            mesh.indexCount = (unsigned int)mesh.indices.size();
+        }
+
+        std::vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, std::string typeName)
         {
             std::vector<Texture> textures;
             for(unsigned int i = 0; i < mat->GetTextureCount(type); i++)
             {
                 aiString str;
                 mat->GetTexture(type, i, &str);
-                bool skip = false;
-                for(unsigned int j = 0; j < textures_loaded.size(); j++)
+
+                Texture texture;
+                texture.id = 0;  // Set when the image is uploaded
+                texture.key = textureKey(str.C_Str());
+                texture.type = typeName;
+                texture.path = str.C_Str();
+                textures.push_back(texture);
+            }
+            return textures;
+        }  
+
+        // Embedded textures belong to this file; others are shared by every
+        // model that resolves to the same image
+        std::string textureKey(const std::string& path) const
+        {
+            if (!path.empty() && path[0] == '*')
+                return filePath + path;
+            std::string name = path;
+            std::replace(name.begin(), name.end(), '\\', '/');
+            return resolveTexturePath(directory, name);
+        }
+
+        // Decode a texture's image unless another texture shares it
+        void addImage(const Texture& texture, const EmbeddedImage* embedded)
+        {
+            const std::string& key = texture.key;
+            if (std::any_of(images.begin(), images.end(),
+                            [&key](const DecodedImage& image) { return image.key == key; }))
+                return;
+            images.push_back(decodeImage(texture.path, directory, embedded, true));
+            images.back().key = key;
+            images.back().path = texture.path;
+        }
+
+        static const aiScene* importScene(Assimp::Importer& import, const std::string& path)
+        {
+            const aiScene *scene = import.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+            if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+            {
+                std::cout << "ERROR::ASSIMP::" << import.GetErrorString() << std::endl;
+                return nullptr;
+            }
+            return scene;
+        }
+
+        // Build the meshes from the mapped cooked file; the blobs stay in
+        // the mapping until buildBuffers uploads them
+        void loadCooked()
+        {
+            static const char* typeNames[] = { "texture_diffuse", "texture_specular" };
+            const CookedMeshHeader& header = cooked.getHeader();
+            for (int lod = 0; lod < MAX_MESH_LODS; ++lod)
+                lodErrors[lod] = header.lodErrors[lod];
+            for (uint32_t i = 0; i < header.submeshCount; ++i)
+            {
+                const CookedSubmesh& submesh = cooked.getSubmesh((int)i);
+                std::vector<Texture> textures;
+                for (uint32_t t = 0; t < submesh.textureCount; ++t)
                 {
-                    if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                    {
-                        textures.push_back(textures_loaded[j]);
-                        skip = true; 
-                        break;
-                    }
-                }
-                if(!skip)
-                {   // if texture hasn't been loaded already, load it
+                    const CookedTexture& source = cooked.getTexture((int)(submesh.firstTexture + t));
                     Texture texture;
-                    texture.id = TextureFromFile(str.C_Str(), directory, scene);
-                    texture.type = typeName;
-                    texture.path = str.C_Str();
+                    texture.id = 0;
+                    texture.type = typeNames[source.type == COOKED_SPECULAR ? 1 : 0];
+                    texture.path = cooked.getName(source);
+                    texture.key = textureKey(texture.path);
+
+                    EmbeddedImage embedded;
+                    embedded.data = cooked.getEmbedded(source);
+                    embedded.width = source.embeddedWidth;
+                    embedded.height = source.embeddedHeight;
+                    addImage(texture, embedded.data ? &embedded : nullptr);
                     textures.push_back(texture);
-                    textures_loaded.push_back(texture); // add to loaded textures
                 }
+
+                BoundingBox meshBounds;
+                meshBounds.min = glm::vec3(submesh.boundsMin[0], submesh.boundsMin[1], submesh.boundsMin[2]);
+                meshBounds.max = glm::vec3(submesh.boundsMax[0], submesh.boundsMax[1], submesh.boundsMax[2]);
+                std::vector<MeshLod> lods(MAX_MESH_LODS);
+                for (int lod = 0; lod < MAX_MESH_LODS; ++lod)
+                {
+                    lods[lod].firstIndex = submesh.lodFirstIndex[lod];
+                    lods[lod].indexCount = submesh.lodIndexCount[lod];
+                }
+                meshes.emplace_back(std::move(textures), meshBounds, submesh.baseVertex,
+                                    submesh.vertexCount, submesh.firstIndex,
+                                    submesh.indexCount, std::move(lods));
+                bounds.expand(meshBounds);
             }
-            return textures;
-        }  
+        }
 
-        unsigned int TextureFromFile(const char *path, const std::string &directory, const aiScene* scene)
+        // Read and decode one texture image without touching GL. Files
+        // with a cooked .dds are not decoded if allowCompressed is set.
+        static DecodedImage decodeImage(const std::string& path, const std::string &directory,
+                                        const EmbeddedImage* embedded, bool allowCompressed)
         {
-            std::string relativePath = path ? std::string(path) : std::string();
+            std::string relativePath = path;
             std::string filename = relativePath;
             std::replace(filename.begin(), filename.end(), '\\', '/');
 
-            unsigned int textureID;
-            glGenTextures(1, &textureID);
-
+            DecodedImage image;
             int width = 0;
             int height = 0;
             int nrComponents = 0;
@@ -183,34 +1127,32 @@ class Model
             bool shouldFree = false;
 
             bool attemptedEmbedded = false;
-            if (!relativePath.empty() && relativePath[0] == '*' && scene)
+            if (embedded)
             {
-                const aiTexture* embedded = scene->GetEmbeddedTexture(relativePath.c_str());
-                if (embedded)
+                attemptedEmbedded = true;
+                if (embedded->height == 0)
                 {
-                    attemptedEmbedded = true;
-                    if (embedded->mHeight == 0)
-                    {
-                        // Compressed data (e.g., PNG) stored in mWidth bytes
-                        unsigned char* compressed = reinterpret_cast<unsigned char*>(embedded->pcData);
-                        data = stbi_load_from_memory(compressed, embedded->mWidth, &width, &height,
-                                                     &nrComponents, 0);
-                        shouldFree = data != nullptr;
-                    }
-                    else
-                    {
-                        // Raw image data (width x height) in BGRA 8-bit texels
-                        width = embedded->mWidth;
-                        height = embedded->mHeight;
-                        nrComponents = 4;
-                        data = reinterpret_cast<unsigned char*>(embedded->pcData);
-                    }
+                    // Compressed data (e.g., PNG) stored in width bytes
+                    data = stbi_load_from_memory(embedded->data, (int)embedded->width, &width, &height,
+                                                 &nrComponents, 0);
+                    shouldFree = data != nullptr;
+                }
+                else
+                {
+                    // Raw image data (width x height) in BGRA 8-bit texels
+                    width = (int)embedded->width;
+                    height = (int)embedded->height;
+                    nrComponents = 4;
+                    data = const_cast<unsigned char*>(embedded->data);
                 }
             }
 
             if (!data)
             {
                 std::string resolved = resolveTexturePath(directory, filename);
+                if (allowCompressed &&
+                    image.compressed.loadFor(resolved))
+                    return image;
                 data = stbi_load(resolved.c_str(), &width, &height, &nrComponents, 0);
                 if (!data)
                 {
@@ -227,29 +1169,70 @@ class Model
 
             if (data)
             {
-                GLenum format = GL_RGB;
-                if (nrComponents == 1)
-                    format = GL_RED;
-                else if (nrComponents == 3)
-                    format = GL_RGB;
-                else if (nrComponents == 4)
-                    format = GL_RGBA;
-
-                glBindTexture(GL_TEXTURE_2D, textureID);
-                glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-                glGenerateMipmap(GL_TEXTURE_2D);
-
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
+                image.width = width;
+                image.height = height;
+                image.components = nrComponents;
+                image.pixels.assign(data, data + (size_t)width * height * nrComponents);
                 if (shouldFree)
                 {
                     stbi_image_free(data);
                 }
             }
+            return image;
+        }
+
+        // Create the texture for one decoded image, or share the cached one,
+        // and hand it to every mesh that uses the image
+        void uploadImage(const DecodedImage& image)
+        {
+            GLuint textureID = TextureCache::instance().acquire(image.key);
+            if (textureID == 0)
+            {
+                if (!image.compressed.empty() && image.compressed.isSupported())
+                    textureID = image.compressed.createTexture(GL_REPEAT);
+                else if (!image.compressed.empty())
+                    textureID = createTexture(decodeImage(image.path, directory, nullptr, false));
+                else
+                    textureID = createTexture(image);
+                if (textureID != 0)
+                    TextureCache::instance().insert(image.key, textureID);
+            }
+            if (textureID == 0)
+                return;
+
+            textureKeys.push_back(image.key);
+            for (Mesh& mesh : meshes)
+                for (Texture& texture : mesh.textures)
+                    if (texture.key == image.key)
+                        texture.id = textureID;
+        }
+
+        // Mipmapped texture from decoded pixels, 0 if decoding failed
+        static GLuint createTexture(const DecodedImage& image)
+        {
+            if (image.pixels.empty())
+                return 0;
+
+            GLenum format = GL_RGB;
+            if (image.components == 1)
+                format = GL_RED;
+            else if (image.components == 3)
+                format = GL_RGB;
+            else if (image.components == 4)
+                format = GL_RGBA;
+
+            GLuint textureID = 0;
+            glGenTextures(1, &textureID);
+            glBindTexture(GL_TEXTURE_2D, textureID);
+            glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format,
+                         GL_UNSIGNED_BYTE, image.pixels.data());
+            glGenerateMipmap(GL_TEXTURE_2D);
 
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glBindTexture(GL_TEXTURE_2D, 0);
             return textureID;
         }
 
@@ -0,0 +1,270 @@
+#pragma once
+#include <glad/glad.h>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Procedural geometry (boxes, spheres, wheels) built once on the CPU and
+// kept in an indexed vertex array. The arrays are bound through the legacy
+// vertex, normal, texcoord and color pointers, so the same mesh feeds the
+// fixed-function pipeline, the compatibility shaders (gl_Vertex, gl_Normal,
+// gl_MultiTexCoord0, gl_Color) and the shadow caster programs. Placement,
+// orientation and animation come from the modelview at draw time.
+class PrimitiveMesh {
+public:
+    struct Vertex {
+        glm::vec3 position;
+        glm::vec3 normal;
+        glm::vec2 texCoord;
+        GLubyte color[4];
+    };
+
+    // Faces of an axis-aligned box, usable as a mask for addBox
+    enum BoxFace {
+        BOX_POS_X = 1 << 0,
+        BOX_NEG_X = 1 << 1,
+        BOX_POS_Y = 1 << 2,
+        BOX_NEG_Y = 1 << 3,
+        BOX_POS_Z = 1 << 4,
+        BOX_NEG_Z = 1 << 5,
+        BOX_ALL_FACES = 0x3F
+    };
+
+    ~PrimitiveMesh() { release(); }
+
+    bool isReady() const { return vao != 0; }
+
+    // Color given to the vertices added from now on
+    void setColor(GLubyte r, GLubyte g, GLubyte b) {
+        color[0] = r;
+        color[1] = g;
+        color[2] = b;
+    }
+
+    GLuint addVertex(const glm::vec3& position, const glm::vec3& normal,
+                     const glm::vec2& texCoord) {
+        Vertex v;
+        v.position = position;
+        v.normal = normal;
+        v.texCoord = texCoord;
+        for (int i = 0; i < 4; ++i)
+            v.color[i] = color[i];
+        vertices.push_back(v);
+        return (GLuint)vertices.size() - 1;
+    }
+
+    void addTriangle(GLuint a, GLuint b, GLuint c) {
+        indices.push_back(a);
+        indices.push_back(b);
+        indices.push_back(c);
+    }
+
+    // Flat quad, counter-clockwise seen from the side normal points to
+    void addQuad(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2,
+                 const glm::vec3& p3, const glm::vec3& normal) {
+        GLuint a = addVertex(p0, normal, glm::vec2(0.0f, 0.0f));
+        GLuint b = addVertex(p1, normal, glm::vec2(1.0f, 0.0f));
+        GLuint c = addVertex(p2, normal, glm::vec2(1.0f, 1.0f));
+        GLuint d = addVertex(p3, normal, glm::vec2(0.0f, 1.0f));
+        addTriangle(a, b, c);
+        addTriangle(a, c, d);
+    }
+
+    // Axis-aligned box with one flat quad per face listed in faces
+    void addBox(const glm::vec3& center, const glm::vec3& half,
+                int faces = BOX_ALL_FACES) {
+        static const glm::vec3 axes[3] = { glm::vec3(1.0f, 0.0f, 0.0f),
+                                           glm::vec3(0.0f, 1.0f, 0.0f),
+                                           glm::vec3(0.0f, 0.0f, 1.0f) };
+        for (int face = 0; face < 6; ++face) {
+            if (!(faces & (1 << face)))
+                continue;
+            const int axis = face / 2;
+            const float sign = (face % 2 == 0) ? 1.0f : -1.0f;
+            const glm::vec3 n = axes[axis] * sign;
+            // u x v = n keeps every face counter-clockwise from outside
+            const glm::vec3 u = axes[(axis + 1) % 3] * sign;
+            const glm::vec3 v = axes[(axis + 2) % 3];
+
+            const glm::vec3 c = center + n * half;
+            const glm::vec3 du = u * half;
+            const glm::vec3 dv = v * half;
+            addQuad(c - du - dv, c + du - dv, c + du + dv, c - du + dv, n);
+        }
+    }
+
+    // Sphere with its poles on the z axis and texture coordinates laid out
+    // like gluSphere
+    void addSphere(const glm::vec3& center, float radius, int slices,
+                   int stacks) {
+        const float pi = 3.14159265358979f;
+        const GLuint first = (GLuint)vertices.size();
+        for (int stack = 0; stack <= stacks; ++stack) {
+            const float rho = pi * stack / stacks;
+            for (int slice = 0; slice <= slices; ++slice) {
+                const float theta = 2.0f * pi * slice / slices;
+                const glm::vec3 n(-std::sin(theta) * std::sin(rho),
+                                  std::cos(theta) * std::sin(rho),
+                                  std::cos(rho));
+                addVertex(center + n * radius, n,
+                          glm::vec2((float)slice / slices,
+                                    1.0f - (float)stack / stacks));
+            }
+        }
+
+        const GLuint row = slices + 1;
+        for (int stack = 0; stack < stacks; ++stack) {
+            for (int slice = 0; slice < slices; ++slice) {
+                const GLuint a = first + stack * row + slice;
+                const GLuint b = a + row;
+                addTriangle(a, b, b + 1);
+                addTriangle(a, b + 1, a + 1);
+            }
+        }
+    }
+
+    // Wheel around the z axis: a rim of rimSlices quads and two caps of
+    // capSectors triangles alternating between capColors
+    void addWheel(float radius, float width, int rimSlices, int capSectors,
+                  const GLubyte rimColor[3], const GLubyte capColors[2][3]) {
+        const float twoPi = 6.28318530717959f;
+        const float halfWidth = width * 0.5f;
+        auto radial = [](float angle) {
+            return glm::vec3(std::sin(angle), std::cos(angle), 0.0f);
+        };
+
+        setColor(rimColor[0], rimColor[1], rimColor[2]);
+        const GLuint first = (GLuint)vertices.size();
+        for (int i = 0; i <= rimSlices; ++i) {
+            const float u = (float)i / rimSlices;
+            const glm::vec3 n = radial(u * twoPi);
+            addVertex(n * radius + glm::vec3(0.0f, 0.0f, halfWidth), n,
+                      glm::vec2(u, 0.0f));
+            addVertex(n * radius - glm::vec3(0.0f, 0.0f, halfWidth), n,
+                      glm::vec2(u, 1.0f));
+        }
+        for (int i = 0; i < rimSlices; ++i) {
+            const GLuint outer = first + 2 * i;
+            addTriangle(outer, outer + 3, outer + 1);
+            addTriangle(outer, outer + 2, outer + 3);
+        }
+
+        // Sectors are flat colored, so each gets its own center vertex
+        for (int side = 0; side < 2; ++side) {
+            const float sign = side == 0 ? 1.0f : -1.0f;
+            const glm::vec3 n(0.0f, 0.0f, sign);
+            const glm::vec3 capCenter = n * halfWidth;
+            for (int i = 0; i < capSectors; ++i) {
+                const GLubyte* c = capColors[i % 2];
+                setColor(c[0], c[1], c[2]);
+                const glm::vec3 rim0 =
+                    capCenter + radial(twoPi * i / capSectors) * radius;
+                const glm::vec3 rim1 =
+                    capCenter + radial(twoPi * (i + 1) / capSectors) * radius;
+                GLuint a = addVertex(capCenter, n, glm::vec2(0.5f, 0.5f));
+                GLuint b = addVertex(rim0, n, glm::vec2(0.0f, 0.0f));
+                GLuint d = addVertex(rim1, n, glm::vec2(1.0f, 0.0f));
+                if (sign > 0.0f)
+                    addTriangle(a, d, b);
+                else
+                    addTriangle(a, b, d);
+            }
+        }
+    }
+
+    // Move the built geometry into GPU buffers and record the array layout
+    // in a vertex array object. The CPU copy is dropped.
+    void upload() {
+        if (vao != 0 || indices.empty())
+            return;
+
+        glGenVertexArrays(1, &vao);
+        glGenBuffers(1, &vbo);
+        glGenBuffers(1, &ebo);
+
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex),
+                     vertices.data(), GL_STATIC_DRAW);
+
+        // 16-bit indices whenever the vertex count allows
+        indexCount = (GLsizei)indices.size();
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        if (vertices.size() <= 0xFFFF) {
+            std::vector<GLushort> shortIndices(indices.begin(), indices.end());
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                         shortIndices.size() * sizeof(GLushort),
+                         shortIndices.data(), GL_STATIC_DRAW);
+            indexType = GL_UNSIGNED_SHORT;
+        } else {
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                         indices.size() * sizeof(GLuint), indices.data(),
+                         GL_STATIC_DRAW);
+            indexType = GL_UNSIGNED_INT;
+        }
+
+        const GLsizei stride = sizeof(Vertex);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(3, GL_FLOAT, stride,
+                        (void*)offsetof(Vertex, position));
+        glEnableClientState(GL_NORMAL_ARRAY);
+        glNormalPointer(GL_FLOAT, stride, (void*)offsetof(Vertex, normal));
+        glClientActiveTexture(GL_TEXTURE0);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glTexCoordPointer(2, GL_FLOAT, stride,
+                          (void*)offsetof(Vertex, texCoord));
+        glColorPointer(4, GL_UNSIGNED_BYTE, stride,
+                       (void*)offsetof(Vertex, color));
+
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+        std::vector<Vertex>().swap(vertices);
+        std::vector<GLuint>().swap(indices);
+    }
+
+    void release() {
+        if (vao)
+            glDeleteVertexArrays(1, &vao);
+        if (vbo)
+            glDeleteBuffers(1, &vbo);
+        if (ebo)
+            glDeleteBuffers(1, &ebo);
+        vao = vbo = ebo = 0;
+        indexCount = 0;
+    }
+
+    GLuint getVAO() const { return vao; }
+
+    // Draw with the vertex array already bound. Without vertex colors the
+    // current color applies, as shadow passes expect.
+    void drawElements(bool withColors) const {
+        if (withColors)
+            glEnableClientState(GL_COLOR_ARRAY);
+        else
+            glDisableClientState(GL_COLOR_ARRAY);
+        glDrawElements(GL_TRIANGLES, indexCount, indexType, nullptr);
+    }
+
+    // Bind, draw and leave no vertex array bound
+    void draw(bool withColors) const {
+        if (vao == 0)
+            return;
+        glBindVertexArray(vao);
+        drawElements(withColors);
+        glBindVertexArray(0);
+    }
+
+private:
+    std::vector<Vertex> vertices;
+    std::vector<GLuint> indices;
+    GLubyte color[4] = { 255, 255, 255, 255 };
+
+    GLuint vao = 0;
+    GLuint vbo = 0;
+    GLuint ebo = 0;
+    GLsizei indexCount = 0;
+    GLenum indexType = GL_UNSIGNED_SHORT;
+};
@@ -0,0 +1,6 @@
+#pragma once
+#include <cstddef>
+
+// Bytes of this process's memory currently resident in RAM (the working
+// set on Windows), or 0 where it cannot be read
+size_t residentMemoryBytes();
@@ -0,0 +1,160 @@
+#pragma once
+#include <glad/glad.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// On-disk cache of linked program binaries. A program is keyed by a hash
+// of its final stage sources (defines included) and of the driver's
+// vendor, renderer and version strings, so any edit or driver update
+// misses and rebuilds from source. A stale or rejected binary is treated
+// as a miss too.
+class ProgramCache {
+public:
+    static const char* directory() { return "./shadercache"; }
+
+    // Key for the given sources under the current driver. GL thread only.
+    static uint64_t keyFor(const std::string& sources) {
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](const char* text) {
+            for (; text && *text; ++text) {
+                hash ^= (unsigned char)*text;
+                hash *= 1099511628211ull;
+            }
+            hash ^= 0xff;  // Separator, so "ab"+"c" differs from "a"+"bc"
+            hash *= 1099511628211ull;
+        };
+        mix(sources.c_str());
+        for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+            mix(reinterpret_cast<const char*>(glGetString(name)));
+        return hash;
+    }
+
+    // Whether the driver can hand out program binaries at all
+    static bool isSupported() {
+        static const bool supported = [] {
+            GLint formats = 0;
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+            return formats > 0;
+        }();
+        return supported;
+    }
+
+    // Load the binary stored for key into program. True if the program
+    // linked from it.
+    static bool load(GLuint program, uint64_t key) {
+        if (!isSupported())
+            return false;
+        std::ifstream in(pathFor(key), std::ios::binary);
+        if (!in) {
+            ++stats().misses;
+            return false;
+        }
+
+        Header header = {};
+        in.read(reinterpret_cast<char*>(&header), sizeof(header));
+        std::vector<char> binary;
+        bool valid = in && std::memcmp(header.magic, "PBIN", 4) == 0 &&
+                     header.key == key && header.length > 0;
+        if (valid) {
+            binary.resize(header.length);
+            in.read(binary.data(), (std::streamsize)binary.size());
+            valid = (bool)in;
+        }
+
+        GLint linked = GL_FALSE;
+        if (valid) {
+            glProgramBinary(program, header.format, binary.data(),
+                            (GLsizei)binary.size());
+            glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        }
+        if (linked)
+            ++stats().hits;
+        else
+            ++stats().rejected;
+        return linked == GL_TRUE;
+    }
+
+    // Store the binary of a linked program, which must have been linked
+    // with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set
+    static void store(GLuint program, uint64_t key) {
+        if (!isSupported())
+            return;
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+
+        Header header = {};
+        std::memcpy(header.magic, "PBIN", 4);
+        header.key = key;
+        std::vector<char> binary(length);
+        GLsizei written = 0;
+        glGetProgramBinary(program, length, &written, &header.format,
+                           binary.data());
+        if (written <= 0)
+            return;
+        header.length = (uint32_t)written;
+
+        makeDirectory();
+        std::ofstream out(pathFor(key), std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(binary.data(), written);
+        if (out)
+            ++stats().stores;
+    }
+
+    static void printStats() {
+        std::cout << "Program cache: " << stats().hits << " loaded from "
+                  << directory() << ", " << stats().misses
+                  << " compiled from source, " << stats().rejected
+                  << " stale binaries rebuilt, " << stats().stores
+                  << " stored" << std::endl;
+    }
+
+private:
+    struct Header {
+        char magic[4];
+        GLenum format;
+        uint32_t length;
+        uint64_t key;
+    };
+
+    struct Stats {
+        int hits = 0;
+        int misses = 0;
+        int rejected = 0;
+        int stores = 0;
+    };
+
+    static Stats& stats() {
+        static Stats shared;
+        return shared;
+    }
+
+    static std::string pathFor(uint64_t key) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/%016llx.bin",
+                      (unsigned long long)key);
+        return directory() + std::string(name);
+    }
+
+    // Fails harmlessly when it already exists
+    static void makeDirectory() {
+#ifdef _WIN32
+        _mkdir(directory());
+#else
+        mkdir(directory(), 0755);
+#endif
+    }
+};
@@ -0,0 +1,148 @@
+#pragma once
+#include <glad/glad.h>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Ordering buckets, the most significant part of a sort key. Opaque draws
+// are sorted by state and then front to back; blended ones back to front.
+enum RenderPass { OPAQUE_PASS = 0, BLENDED_PASS = 1 };
+
+// One submitted draw. The queue binds the program, textures (units 0 and
+// up) and vertex array listed here, skipping any already bound, then calls
+// draw to set per-object uniforms and issue the draw call. A zero vao
+// leaves the geometry to draw (immediate mode). setup runs only when the
+// program is bound, for state all draws with that program share.
+struct RenderItem {
+    static const int MAX_TEXTURES = 4;
+
+    uint64_t key = 0;
+    GLuint program = 0;  // 0 = fixed function
+    GLuint vao = 0;
+    GLuint textures[MAX_TEXTURES] = {};
+    int textureCount = 0;
+    GLenum textureTarget = GL_TEXTURE_2D;  // Shared by all listed textures
+    std::function<void()> setup;
+    std::function<void()> draw;
+};
+
+// Collects the draws of one view, sorts them by a packed 64-bit key and
+// executes them with redundant binds removed:
+//   pass (4 bits) | program (12) | material (24) | depth (24)
+class RenderQueue {
+public:
+    struct Stats {
+        int items = 0;
+        int programBinds = 0;  // Issued
+        int textureBinds = 0;
+        int vaoBinds = 0;
+        int bindsSaved = 0;  // Skipped because the state was already bound
+        int culledObjects = 0;  // Rejected by culling before submission
+        int culledMeshes = 0;
+        int modelLods[4] = {};  // Model draws per level of detail
+    };
+
+    static uint64_t makeKey(RenderPass pass, GLuint program, GLuint material,
+                            float depth, float maxDepth) {
+        float d = std::min(std::max(depth / maxDepth, 0.0f), 1.0f);
+        if (pass == BLENDED_PASS)
+            d = 1.0f - d;
+        const uint64_t depthBits = (uint64_t)(d * 0xFFFFFF);
+        return ((uint64_t)pass & 0xF) << 60 |
+               ((uint64_t)program & 0xFFF) << 48 |
+               ((uint64_t)material & 0xFFFFFF) << 24 | depthBits;
+    }
+
+    void submit(RenderItem item) { items.push_back(std::move(item)); }
+
+    // Record draws a caller culled instead of submitting
+    void countCulled(int objects, int meshes) {
+        frame.culledObjects += objects;
+        frame.culledMeshes += meshes;
+    }
+
+    // Record the level of detail a model was submitted at
+    void countLod(int lod) {
+        ++frame.modelLods[std::min(std::max(lod, 0), 3)];
+    }
+
+    // Sort, draw and clear the submitted items. Leaves no program or
+    // vertex array bound and texture unit 0 active.
+    void flush() {
+        if (items.empty())
+            return;
+
+        std::stable_sort(items.begin(), items.end(),
+                         [](const RenderItem& a, const RenderItem& b) {
+                             return a.key < b.key;
+                         });
+
+        // Nothing is assumed about the state left by earlier draw code
+        const GLuint unknown = ~0u;
+        GLuint boundProgram = unknown;
+        GLuint boundVao = unknown;
+        GLuint boundTextures[RenderItem::MAX_TEXTURES];
+        std::fill(boundTextures, boundTextures + RenderItem::MAX_TEXTURES,
+                  unknown);
+
+        for (const RenderItem& item : items) {
+            ++frame.items;
+
+            if (item.program != boundProgram) {
+                glUseProgram(item.program);
+                boundProgram = item.program;
+                ++frame.programBinds;
+                if (item.setup)
+                    item.setup();
+            } else {
+                ++frame.bindsSaved;
+            }
+
+            for (int unit = 0; unit < item.textureCount; ++unit) {
+                if (item.textures[unit] == boundTextures[unit]) {
+                    ++frame.bindsSaved;
+                    continue;
+                }
+                glActiveTexture(GL_TEXTURE0 + unit);
+                glBindTexture(item.textureTarget, item.textures[unit]);
+                boundTextures[unit] = item.textures[unit];
+                ++frame.textureBinds;
+            }
+            glActiveTexture(GL_TEXTURE0);
+
+            if (item.vao != 0) {
+                if (item.vao != boundVao) {
+                    glBindVertexArray(item.vao);
+                    boundVao = item.vao;
+                    ++frame.vaoBinds;
+                } else {
+                    ++frame.bindsSaved;
+                }
+            } else if (boundVao != 0) {
+                glBindVertexArray(0);
+                boundVao = 0;
+            }
+
+            if (item.draw)
+                item.draw();
+        }
+
+        glBindVertexArray(0);
+        glUseProgram(0);
+        items.clear();
+    }
+
+    // Start counting a new frame; the finished one stays readable
+    void beginFrame() {
+        lastFrame = frame;
+        frame = Stats();
+    }
+
+    const Stats& lastFrameStats() const { return lastFrame; }
+
+private:
+    std::vector<RenderItem> items;
+    Stats frame;
+    Stats lastFrame;
+};
@@ -0,0 +1,183 @@
+#pragma once
+#include <glad/glad.h>
+#include <cstring>
+#include <glm/glm.hpp>
+
+// std140 mirror of the frame_constants block: everything that changes per
+// view (main camera, water reflection, water refraction)
+struct FrameConstants {
+    glm::mat4 projection{ 1.0f };
+    glm::mat4 view{ 1.0f };
+    glm::mat4 invView{ 1.0f };
+    glm::vec4 cameraPos{ 0.0f };    // xyz
+    glm::vec4 smokeParams{ 0.0f };  // Start, end
+    glm::vec4 clipPlane{ 0.0f };    // World space plane equation
+    glm::ivec4 flags{ 0 };          // Clip plane enabled, smoke enabled
+};
+
+// std140 mirror of the light_constants block, filled once per frame
+struct LightConstants {
+    glm::vec4 dirLightDir{ 0.0f };  // xyz, pointing away from the light
+    glm::vec4 pointLightPos{ 0.0f };
+    glm::vec4 spotLightPos{ 0.0f };
+    glm::vec4 spotLightDir{ 0.0f };
+    glm::vec4 spotCone{ 0.0f };   // Inner and outer cosine
+    glm::ivec4 enabled{ 0 };      // Directional, point, spot
+    glm::ivec4 shadows{ 0 };      // Directional, point, spot
+};
+
+// std140 mirror of the object_constants block. The normal matrix is a mat4
+// because a std140 mat3 is padded to the same size anyway.
+struct ObjectConstants {
+    glm::mat4 model;
+    glm::mat4 normalMatrix;
+};
+
+// Owns the uniform buffers every scene shader reads its camera, light and
+// per-object data from. Frame and light constants are uploaded once per view
+// and once per frame instead of being set on every program. Object constants
+// are written into a persistently mapped ring and bound with
+// glBindBufferRange, so a draw only costs a memcpy and one range bind.
+class SceneConstants {
+public:
+    static const GLuint FRAME_BINDING = 0;
+    static const GLuint LIGHT_BINDING = 2;  // 1 holds the shadow atlas
+    static const GLuint OBJECT_BINDING = 3;
+
+    // The ring is split into segments fenced separately, so the CPU only
+    // waits if it laps a segment the GPU is still reading
+    static const int RING_SEGMENTS = 3;
+    static const int OBJECTS_PER_SEGMENT = 256;
+
+    // Last uploaded values, for CPU-side users such as culling
+    FrameConstants frame;
+    LightConstants lights;
+
+    ~SceneConstants() { release(); }
+
+    void init() {
+        if (frameUbo != 0)
+            return;
+
+        frameUbo = createBuffer(sizeof(FrameConstants));
+        lightUbo = createBuffer(sizeof(LightConstants));
+
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        objectStride = ((GLsizeiptr)sizeof(ObjectConstants) + alignment - 1) /
+                       alignment * alignment;
+        const GLsizeiptr ringSize =
+            objectStride * OBJECTS_PER_SEGMENT * RING_SEGMENTS;
+
+        const GLbitfield flags =
+            GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glGenBuffers(1, &ringBuffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, ringBuffer);
+        glBufferStorage(GL_UNIFORM_BUFFER, ringSize, nullptr, flags);
+        ringData = static_cast<unsigned char*>(
+            glMapBufferRange(GL_UNIFORM_BUFFER, 0, ringSize, flags));
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        segment = 0;
+        slot = 0;
+    }
+
+    void release() {
+        if (ringBuffer && ringData) {
+            glBindBuffer(GL_UNIFORM_BUFFER, ringBuffer);
+            glUnmapBuffer(GL_UNIFORM_BUFFER);
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        }
+        for (GLsync& fence : fences) {
+            if (fence)
+                glDeleteSync(fence);
+            fence = 0;
+        }
+        if (frameUbo)
+            glDeleteBuffers(1, &frameUbo);
+        if (lightUbo)
+            glDeleteBuffers(1, &lightUbo);
+        if (ringBuffer)
+            glDeleteBuffers(1, &ringBuffer);
+        frameUbo = lightUbo = ringBuffer = 0;
+        ringData = nullptr;
+    }
+
+    void setFrame(const FrameConstants& constants) {
+        frame = constants;
+        upload(frameUbo, FRAME_BINDING, &frame, sizeof(frame));
+    }
+
+    void setLights(const LightConstants& constants) {
+        lights = constants;
+        upload(lightUbo, LIGHT_BINDING, &lights, sizeof(lights));
+    }
+
+    // Write one object's model matrix into the ring and bind it for the
+    // next draw
+    void pushObject(const glm::mat4& model) {
+        if (!ringData)
+            return;
+
+        if (slot == OBJECTS_PER_SEGMENT)
+            nextSegment();
+
+        ObjectConstants constants;
+        constants.model = model;
+        constants.normalMatrix = glm::transpose(glm::inverse(model));
+
+        const GLintptr offset =
+            objectStride * (segment * OBJECTS_PER_SEGMENT + slot++);
+        std::memcpy(ringData + offset, &constants, sizeof(constants));
+        glBindBufferRange(GL_UNIFORM_BUFFER, OBJECT_BINDING, ringBuffer, offset,
+                          sizeof(ObjectConstants));
+    }
+
+private:
+    GLuint frameUbo = 0;
+    GLuint lightUbo = 0;
+    GLuint ringBuffer = 0;
+    unsigned char* ringData = nullptr;
+    GLsizeiptr objectStride = 0;
+    GLsync fences[RING_SEGMENTS] = {};
+    int segment = 0;
+    int slot = 0;
+
+    GLuint createBuffer(GLsizeiptr size) const {
+        GLuint buffer = 0;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        return buffer;
+    }
+
+    void upload(GLuint buffer, GLuint binding, const void* data,
+                GLsizeiptr size) const {
+        if (buffer == 0)
+            return;
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+    }
+
+    // Fence the segment just filled and move to the next one, waiting for
+    // the GPU only if it has not finished reading it yet
+    void nextSegment() {
+        fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        segment = (segment + 1) % RING_SEGMENTS;
+        slot = 0;
+
+        GLsync& fence = fences[segment];
+        if (!fence)
+            return;
+        GLenum status = GL_TIMEOUT_EXPIRED;
+        while (status == GL_TIMEOUT_EXPIRED) {
+            status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                      1000000);
+        }
+        glDeleteSync(fence);
+        fence = 0;
+    }
+};
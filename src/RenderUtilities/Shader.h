@@ -2,13 +2,23 @@
 #define SHADER_H
 
 #include <glad/glad.h>
+#include <glm/glm.hpp>
 
 #include <string>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <vector>
+#include <unordered_map>
+#include <algorithm>
 
+#include "ProgramCache.h"
+
+// KHR_parallel_shader_compile (and its ARB twin) postdate the glad headers
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
 
 
 class Shader
@@ -26,44 +36,195 @@ public:
 	//DEFINE_ENUM_FLAG_OPERATORS(Type);
 
 	Type type = NULL_SHADER;
-	// Constructor generates the shader on the fly
-	Shader(const GLchar* vert, const GLchar* tesc, const GLchar* tese, const char* geom, const char* frag)
+	// Constructor generates the shader on the fly. defines ("#define ..."
+	// lines) are inserted after the #version line of every stage. A binary
+	// of the same sources in the ProgramCache is loaded instead of
+	// compiling. Where the driver compiles in parallel, the link is only
+	// waited for on first use (or by finishCompleted), so a batch of
+	// programs created together compiles at once.
+	Shader(const GLchar* vert, const GLchar* tesc, const GLchar* tese, const char* geom, const char* frag,
+		const std::string& defines = "")
 	{
-		std::vector<GLuint> shaders;
-		if (vert)
-		{
-			shaders.push_back(this->compileShader(GL_VERTEX_SHADER, this->readCode(vert).c_str()));
-			this->type = (Shader::Type)(this->type | Type::VERTEX_SHADER);
-		}
-		if (tesc)
+		const GLchar* paths[] = { vert, tesc, tese, geom, frag };
+		const GLenum stages[] = { GL_VERTEX_SHADER, GL_TESS_CONTROL_SHADER, GL_TESS_EVALUATION_SHADER, GL_GEOMETRY_SHADER, GL_FRAGMENT_SHADER };
+		const Type types[] = { VERTEX_SHADER, TESS_CONTROL_SHADER, TESS_EVALUATION_SHADER, GEOMETRY_SHADER, FRAGMENT_SHADER };
+		std::string codes[5];
+		std::string allCode;
+		for (int i = 0; i < 5; ++i)
 		{
-			shaders.push_back(this->compileShader(GL_TESS_CONTROL_SHADER, this->readCode(tesc).c_str()));
-			this->type = (Shader::Type)(this->type | Type::TESS_CONTROL_SHADER);
+			if (!paths[i])
+				continue;
+			codes[i] = this->withDefines(this->readCode(paths[i]), defines);
+			allCode += std::to_string(stages[i]) + ':' + codes[i];
+			this->type = (Shader::Type)(this->type | types[i]);
 		}
-		if (tese)
+
+		// Shader Program
+		this->Program = glCreateProgram();
+		this->cacheKey = ProgramCache::keyFor(allCode);
+		if (ProgramCache::load(this->Program, this->cacheKey))
 		{
-			shaders.push_back(this->compileShader(GL_TESS_EVALUATION_SHADER, this->readCode(tese).c_str()));
-			this->type = (Shader::Type)(this->type | Type::TESS_EVALUATION_SHADER);
+			this->introspectUniforms();
+			return;
 		}
-		if (geom)
+
+		for (int i = 0; i < 5; ++i)
 		{
-			shaders.push_back(this->compileShader(GL_GEOMETRY_SHADER, this->readCode(geom).c_str()));
-			this->type = (Shader::Type)(this->type | Type::GEOMETRY_SHADER);
+			if (paths[i])
+				this->stageShaders.push_back(this->compileShader(stages[i], codes[i].c_str()));
 		}
-		if (frag)
+		for (GLuint shader : this->stageShaders)
+			glAttachShader(this->Program, shader);
+
+		glProgramParameteri(this->Program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(this->Program);
+
+		pendingShaders().push_back(this);
+		if (!parallelCompile())
+			this->finishLink();
+	}
+	~Shader()
+	{
+		std::vector<Shader*>& pending = pendingShaders();
+		pending.erase(std::remove(pending.begin(), pending.end(), this), pending.end());
+	}
+	Shader(const Shader&) = delete;
+	Shader& operator=(const Shader&) = delete;
+
+	// Finish the programs whose parallel compile and link is done, without
+	// waiting for the others. Returns how many are still compiling.
+	static int finishCompleted()
+	{
+		std::vector<Shader*> pending = pendingShaders();
+		for (Shader* shader : pending)
 		{
-			shaders.push_back(this->compileShader(GL_FRAGMENT_SHADER, this->readCode(frag).c_str()));
-			this->type = (Shader::Type)(this->type | Type::FRAGMENT_SHADER);
+			GLint done = GL_TRUE;
+			glGetProgramiv(shader->Program, GL_COMPLETION_STATUS_KHR, &done);
+			if (done)
+				shader->finishLink();
 		}
-		// Shader Program
+		return (int)pendingShaders().size();
+	}
+
+	// Whether the driver compiles and links on its own threads
+	static bool parallelCompile()
+	{
+		static const bool supported = [] {
+			GLint count = 0;
+			glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+			for (GLint i = 0; i < count; ++i)
+			{
+				const char* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, (GLuint)i));
+				if (name && (std::strcmp(name, "GL_KHR_parallel_shader_compile") == 0 ||
+					std::strcmp(name, "GL_ARB_parallel_shader_compile") == 0))
+					return true;
+			}
+			return false;
+		}();
+		return supported;
+	}
+
+	// Uses the current shader
+	void Use()
+	{
+		if (!this->stageShaders.empty())
+			this->finishLink();
+		glUseProgram(this->Program);
+	}
+
+	// Typed uniform setters. Locations come from the table built at link
+	// time, and a value equal to the last one uploaded is skipped, so every
+	// write to a uniform must go through these. The program must be in use.
+	// Unknown (or optimized out) names are ignored like location -1.
+	void set(const char* name, int value)
+	{
+		GLint location;
+		const Uniform* uniform = this->changed(name, value, location);
+		if (!uniform)
+			return;
+		if (uniform->type == GL_FLOAT)
+			glUniform1f(location, (float)value);
+		else
+			glUniform1i(location, value);
+	}
+	void set(const char* name, float value)
+	{
+		GLint location;
+		if (this->changed(name, value, location))
+			glUniform1f(location, value);
+	}
+	void set(const char* name, const glm::vec2& value)
+	{
+		GLint location;
+		if (this->changed(name, value, location))
+			glUniform2fv(location, 1, &value[0]);
+	}
+	void set(const char* name, const glm::vec3& value)
+	{
+		GLint location;
+		if (this->changed(name, value, location))
+			glUniform3fv(location, 1, &value[0]);
+	}
+	void set(const char* name, const glm::vec4& value)
+	{
+		GLint location;
+		if (this->changed(name, value, location))
+			glUniform4fv(location, 1, &value[0]);
+	}
+	void set(const char* name, const glm::mat3& value)
+	{
+		GLint location;
+		if (this->changed(name, value, location))
+			glUniformMatrix3fv(location, 1, GL_FALSE, &value[0][0]);
+	}
+	void set(const char* name, const glm::mat4& value)
+	{
+		GLint location;
+		if (this->changed(name, value, location))
+			glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]);
+	}
+
+	// Cached location for uploads the setters do not cover (arrays). Such
+	// uniforms bypass the redundancy check.
+	GLint getUniformLocation(const char* name)
+	{
+		if (!this->stageShaders.empty())
+			this->finishLink();
+		auto it = this->uniformSlots.find(hashName(name));
+		return it == this->uniformSlots.end() ? -1 : this->uniforms[it->second].location;
+	}
+private:
+	struct Uniform
+	{
+		GLint location;
+		GLenum type;
+		bool cached;
+		unsigned char value[sizeof(glm::mat4)];  // Last uploaded value
+	};
+	std::vector<Uniform> uniforms;
+	std::unordered_map<unsigned int, size_t> uniformSlots;  // Name hash -> uniforms
+	uint64_t cacheKey = 0;
+	std::vector<GLuint> stageShaders;  // Until the link is finished
+
+	// Programs linked but not yet checked, in creation order
+	static std::vector<Shader*>& pendingShaders()
+	{
+		static std::vector<Shader*> pending;
+		return pending;
+	}
+
+	// Wait for the link, report errors, store the binary and read the
+	// uniforms
+	void finishLink()
+	{
+		std::vector<Shader*>& pending = pendingShaders();
+		pending.erase(std::remove(pending.begin(), pending.end(), this), pending.end());
+
 		GLint success;
 		GLchar infoLog[512];
-		this->Program = glCreateProgram();
-
-		for (GLuint shader : shaders)
-			glAttachShader(this->Program, shader);
+		for (GLuint shader : this->stageShaders)
+			this->reportCompileErrors(shader);
 
-		glLinkProgram(this->Program);
 		// Print linking errors if any
 		glGetProgramiv(this->Program, GL_LINK_STATUS, &success);
 		if (!success)
@@ -72,20 +233,125 @@ public:
 			std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
 		}
 
-		for (GLuint shader : shaders)
+		for (GLuint shader : this->stageShaders)
 			glDeleteShader(shader);
+		this->stageShaders.clear();
+
+		if (success)
+		{
+			ProgramCache::store(this->Program, this->cacheKey);
+			this->introspectUniforms();
+		}
 	}
-	// Uses the current shader
-	void Use()
+
+	// FNV-1a; hashing the C string avoids building a std::string per lookup
+	static unsigned int hashName(const char* name)
 	{
-		glUseProgram(this->Program);
+		unsigned int hash = 2166136261u;
+		for (; *name; ++name)
+		{
+			hash ^= (unsigned char)*name;
+			hash *= 16777619u;
+		}
+		return hash;
 	}
 
-	void setInt(const std::string &name, int value) const
+	bool addUniform(const std::string& name, GLint location, GLenum type)
 	{
-		glUniform1i(glGetUniformLocation(this->Program, name.c_str()), value);
+		const unsigned int hash = hashName(name.c_str());
+		if (this->uniformSlots.count(hash))
+		{
+			std::cout << "WARNING::SHADER::UNIFORM_HASH_COLLISION " << name << std::endl;
+			return false;
+		}
+		Uniform uniform;
+		uniform.location = location;
+		uniform.type = type;
+		uniform.cached = false;
+		this->uniformSlots[hash] = this->uniforms.size();
+		this->uniforms.push_back(uniform);
+		return true;
+	}
+
+	// Record every active default-block uniform once, after linking. Arrays
+	// are reachable by their base name and by each element.
+	void introspectUniforms()
+	{
+		GLint count = 0;
+		GLint maxLength = 0;
+		glGetProgramiv(this->Program, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(this->Program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+		std::vector<GLchar> buffer(maxLength + 1);
+		for (GLint i = 0; i < count; ++i)
+		{
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(this->Program, i, (GLsizei)buffer.size(), &length, &size, &type, buffer.data());
+			std::string name(buffer.data(), length);
+
+			// Members of uniform blocks have no location
+			GLint location = glGetUniformLocation(this->Program, name.c_str());
+			if (location < 0)
+				continue;
+
+			const size_t bracket = name.find("[0]");
+			if (bracket == std::string::npos || bracket + 3 != name.size())
+			{
+				this->addUniform(name, location, type);
+				continue;
+			}
+
+			// Element 0 shares the base name's entry
+			const std::string base = name.substr(0, bracket);
+			if (this->addUniform(base, location, type))
+				this->uniformSlots[hashName(name.c_str())] = this->uniforms.size() - 1;
+			for (GLint e = 1; e < size; ++e)
+			{
+				const std::string element = base + "[" + std::to_string(e) + "]";
+				this->addUniform(element, glGetUniformLocation(this->Program, element.c_str()), type);
+			}
+		}
+	}
+
+	// Returns the uniform if value differs from what it last received,
+	// recording value as the new last upload
+	template <typename T>
+	const Uniform* changed(const char* name, const T& value, GLint& location)
+	{
+		static_assert(sizeof(T) <= sizeof(glm::mat4), "Uniform value too large");
+		if (!this->stageShaders.empty())
+			this->finishLink();
+		auto it = this->uniformSlots.find(hashName(name));
+		if (it == this->uniformSlots.end())
+			return nullptr;
+
+		Uniform& uniform = this->uniforms[it->second];
+		if (uniform.cached && std::memcmp(uniform.value, &value, sizeof(T)) == 0)
+			return nullptr;
+		std::memcpy(uniform.value, &value, sizeof(T));
+		uniform.cached = true;
+		location = uniform.location;
+		return &uniform;
+	}
+
+	static std::string withDefines(const std::string& code, const std::string& defines)
+	{
+		if (defines.empty())
+			return code;
+		size_t insertAt = 0;
+		const size_t version = code.find("#version");
+		if (version != std::string::npos)
+		{
+			const size_t lineEnd = code.find('\n', version);
+			insertAt = lineEnd == std::string::npos ? code.size() : lineEnd + 1;
+		}
+		std::string result = code.substr(0, insertAt) + defines;
+		if (defines.back() != '\n')
+			result += '\n';
+		return result + code.substr(insertAt);
 	}
-private:
 	std::string readCode(const GLchar* path)
 	{
 		std::string code;
@@ -115,16 +381,23 @@ private:
 	GLuint compileShader(GLenum shader_type, const char* code)
 	{
 		GLuint shader_number;
-		GLint success;
-		GLchar infoLog[512];
-		// Vertex Shader
+		// Errors are read once the program is linked, so compiles can run
+		// in parallel
 		shader_number = glCreateShader(shader_type);
 		glShaderSource(shader_number, 1, &code, NULL);
 		glCompileShader(shader_number);
+		return shader_number;
+	}
+	void reportCompileErrors(GLuint shader_number)
+	{
+		GLint success;
+		GLint shader_type;
+		GLchar infoLog[512];
 		// Print compile errors if any
 		glGetShaderiv(shader_number, GL_COMPILE_STATUS, &success);
 		if (!success)
 		{
+			glGetShaderiv(shader_number, GL_SHADER_TYPE, &shader_type);
 			glGetShaderInfoLog(shader_number, 512, NULL, infoLog);
 			if(shader_type == GL_VERTEX_SHADER)
 				std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
@@ -137,7 +410,6 @@ private:
 			else if (shader_type == GL_FRAGMENT_SHADER)
 				std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
 		}
-		return shader_number;
 	}
 };
 
@@ -0,0 +1,155 @@
+#pragma once
+#include <glad/glad.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "SceneConstants.h"
+#include "Shader.h"
+
+// Feature keys scene shaders are specialized on. Each set bit becomes a
+// "#define <name>" line after the #version line of every stage, so a
+// variant only contains the code of the features that are on instead of
+// branching on flags per fragment.
+enum ShaderFeature : unsigned {
+    FEATURE_CLIP_PLANE = 1u << 0,    // CLIP_PLANE: water reflection clip
+    FEATURE_SMOKE = 1u << 1,         // SMOKE
+    FEATURE_DIR_LIGHT = 1u << 2,     // DIR_LIGHT
+    FEATURE_POINT_LIGHT = 1u << 3,   // POINT_LIGHT
+    FEATURE_SPOT_LIGHT = 1u << 4,    // SPOT_LIGHT
+    FEATURE_DIR_SHADOW = 1u << 5,    // DIR_SHADOW
+    FEATURE_POINT_SHADOW = 1u << 6,  // POINT_SHADOW
+    FEATURE_SPOT_SHADOW = 1u << 7,   // SPOT_SHADOW
+    FEATURE_VSM_SHADOWS = 1u << 8,   // VSM_SHADOWS: atlas holds moments
+    FEATURE_BUMP_MAP = 1u << 9,      // BUMP_MAP
+    FEATURE_FLAT_SHADOW = 1u << 10,  // FLAT_SHADOW: planar shadow pass
+    FEATURE_COUNT = 11,
+};
+
+// The programs built from one set of stage files, one per combination of
+// the features those files read. Variants compile the first time they are
+// asked for, or ahead of time through prewarm. Obtained through the
+// AssetCache, so every user of the same files shares the variants.
+class ShaderVariants {
+public:
+    // usedFeatures: the ShaderFeature bits the sources test; others are
+    // dropped from the masks passed in
+    ShaderVariants(const char* vert, const char* tesc, const char* tese,
+                   const char* geom, const char* frag, unsigned usedFeatures)
+        : usedFeatures(usedFeatures) {
+        const char* stages[] = { vert, tesc, tese, geom, frag };
+        for (int i = 0; i < 5; ++i) {
+            hasStage[i] = stages[i] != nullptr;
+            paths[i] = stages[i] ? stages[i] : "";
+        }
+    }
+
+    ShaderVariants(const ShaderVariants&) = delete;
+    ShaderVariants& operator=(const ShaderVariants&) = delete;
+
+    ~ShaderVariants() {
+        for (auto& variant : variants)
+            glDeleteProgram(variant.second->Program);
+    }
+
+    // Program for the features in mask. Compiling one here stalls the
+    // frame, which the counters report.
+    Shader* get(unsigned mask) {
+        mask &= usedFeatures;
+        auto it = variants.find(mask);
+        if (it != variants.end())
+            return it->second.get();
+        ++counters().compiledOnDemand;
+        return compile(mask);
+    }
+
+    // Compile the variant for mask now, if it is not there yet
+    void prewarm(unsigned mask) {
+        mask &= usedFeatures;
+        if (variants.count(mask))
+            return;
+        ++counters().prewarmed;
+        compile(mask);
+    }
+
+    unsigned getUsedFeatures() const { return usedFeatures; }
+    int getVariantCount() const { return (int)variants.size(); }
+
+    // "#define" lines for the features in mask
+    static std::string defines(unsigned mask) {
+        static const char* const names[FEATURE_COUNT] = {
+            "CLIP_PLANE",   "SMOKE",        "DIR_LIGHT",    "POINT_LIGHT",
+            "SPOT_LIGHT",   "DIR_SHADOW",   "POINT_SHADOW", "SPOT_SHADOW",
+            "VSM_SHADOWS",  "BUMP_MAP",     "FLAT_SHADOW",
+        };
+        std::string result;
+        for (unsigned i = 0; i < FEATURE_COUNT; ++i) {
+            if (mask & (1u << i)) {
+                result += "#define ";
+                result += names[i];
+                result += '\n';
+            }
+        }
+        return result;
+    }
+
+    // Features of the view and lights last uploaded to constants
+    static unsigned sceneFeatures(const SceneConstants& constants,
+                                  bool momentShadows) {
+        const FrameConstants& frame = constants.frame;
+        const LightConstants& lights = constants.lights;
+        unsigned mask = 0;
+        if (frame.flags.x != 0)
+            mask |= FEATURE_CLIP_PLANE;
+        if (frame.flags.y != 0)
+            mask |= FEATURE_SMOKE;
+        if (lights.enabled.x != 0)
+            mask |= FEATURE_DIR_LIGHT;
+        if (lights.enabled.y != 0)
+            mask |= FEATURE_POINT_LIGHT;
+        if (lights.enabled.z != 0)
+            mask |= FEATURE_SPOT_LIGHT;
+        if (lights.shadows.x != 0)
+            mask |= FEATURE_DIR_SHADOW;
+        if (lights.shadows.y != 0)
+            mask |= FEATURE_POINT_SHADOW;
+        if (lights.shadows.z != 0)
+            mask |= FEATURE_SPOT_SHADOW;
+        if (momentShadows)
+            mask |= FEATURE_VSM_SHADOWS;
+        return mask;
+    }
+
+    static void printStats() {
+        std::cout << "Shader variants: " << counters().prewarmed
+                  << " prewarmed, " << counters().compiledOnDemand
+                  << " compiled on demand" << std::endl;
+    }
+
+private:
+    struct Counters {
+        int prewarmed = 0;
+        int compiledOnDemand = 0;
+    };
+
+    unsigned usedFeatures;
+    bool hasStage[5];
+    std::string paths[5];  // Vertex, tess control, tess eval, geometry, frag
+    std::unordered_map<unsigned, std::unique_ptr<Shader>> variants;
+
+    static Counters& counters() {
+        static Counters shared;
+        return shared;
+    }
+
+    Shader* compile(unsigned mask) {
+        auto stage = [this](int i) {
+            return hasStage[i] ? paths[i].c_str() : nullptr;
+        };
+        Shader* shader = new Shader(stage(0), stage(1), stage(2), stage(3),
+                                    stage(4), defines(mask));
+        variants[mask].reset(shader);
+        return shader;
+    }
+};
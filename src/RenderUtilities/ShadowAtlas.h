@@ -0,0 +1,256 @@
+#pragma once
+#include <glad/glad.h>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "ShadowCache.h"
+#include "ShadowMoments.h"
+
+enum ShadowLightType { DIRECTIONAL_SHADOW, POINT_SHADOW, SPOT_SHADOW };
+
+// A shadow-casting light: the atlas views it owns and how its depth is stored.
+// Directional views hold window depth; point and spot views hold
+// distance / farPlane.
+struct ShadowLight {
+    ShadowLightType type = DIRECTIONAL_SHADOW;
+    bool enabled = false;
+    int firstView = 0;
+    int viewCount = 0;
+    glm::vec3 position{ 0.0f };
+    float farPlane = 1.0f;
+
+    // Lights without dynamic casters keep their tiles in the live atlas and
+    // skip the static copy
+    bool dynamicCasters = true;
+    // Uncached lights redraw every caster into the live atlas each frame
+    bool cached = true;
+    ShadowCache cache;
+};
+
+// Every shadow view of every light lives in one square tile of a single
+// depth texture. Tiles are carved out of the atlas by quadtree splits, so
+// each light chooses its own tile sizes at runtime. View matrices, tile
+// rects and light data reach the shaders through one uniform block.
+class ShadowAtlas {
+public:
+    static const int MAX_VIEWS = 16;
+    static const int MAX_LIGHTS = 4;
+    // The shaders declare the shadow_atlas block with this binding
+    static const int UBO_BINDING = 1;
+
+    int size = 4096;
+
+    GLuint fbo = 0;
+    GLuint depth = 0;
+    GLuint staticFbo = 0;  // Static casters only, copied into depth per frame
+    GLuint staticDepth = 0;
+    GLuint ubo = 0;
+
+    std::vector<ShadowLight> lights;
+    glm::mat4 viewMatrices[MAX_VIEWS];
+    glm::ivec4 viewRects[MAX_VIEWS];  // x, y, width, height in texels
+    int viewCount = 0;
+
+    // Blurred moments of the whole atlas, bound instead of it when filtered
+    ShadowMoments moments;
+    bool filtered = false;
+
+    ~ShadowAtlas() { release(); }
+
+    void init() {
+        if (fbo != 0)
+            return;
+
+        createDepth(depth, GL_LINEAR);
+        createDepth(staticDepth, GL_NEAREST);
+        createFramebuffer(fbo, depth);
+        createFramebuffer(staticFbo, staticDepth);
+
+        glGenBuffers(1, &ubo);
+        glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), nullptr,
+                     GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, UBO_BINDING, ubo);
+
+        lights.clear();
+        viewCount = 0;
+        freeTiles.assign(1, glm::ivec3(0, 0, size));
+    }
+
+    void release() {
+        if (depth)
+            glDeleteTextures(1, &depth);
+        if (staticDepth)
+            glDeleteTextures(1, &staticDepth);
+        if (fbo)
+            glDeleteFramebuffers(1, &fbo);
+        if (staticFbo)
+            glDeleteFramebuffers(1, &staticFbo);
+        if (ubo)
+            glDeleteBuffers(1, &ubo);
+        depth = staticDepth = 0;
+        fbo = staticFbo = 0;
+        ubo = 0;
+        moments.release();
+    }
+
+    // Register a light with one view per entry of tileSizes (powers of two).
+    // A tile that does not fit is halved until it does. Returns the light's
+    // index, or -1 if the atlas is full.
+    int addLight(ShadowLightType type, const std::vector<int>& tileSizes) {
+        if ((int)lights.size() >= MAX_LIGHTS ||
+            viewCount + (int)tileSizes.size() > MAX_VIEWS)
+            return -1;
+
+        ShadowLight light;
+        light.type = type;
+        light.firstView = viewCount;
+        light.viewCount = (int)tileSizes.size();
+
+        for (int tileSize : tileSizes) {
+            glm::ivec4 rect;
+            while (!allocate(tileSize, rect)) {
+                tileSize /= 2;
+                if (tileSize < 64)
+                    return -1;
+            }
+            viewMatrices[viewCount] = glm::mat4(1.0f);
+            viewRects[viewCount++] = rect;
+        }
+
+        lights.push_back(light);
+        return (int)lights.size() - 1;
+    }
+
+    // Push view matrices, tile rects and light data to the uniform block
+    void upload() const {
+        Block block;
+        for (int i = 0; i < MAX_VIEWS; ++i) {
+            block.viewMatrices[i] = viewMatrices[i];
+            block.viewRects[i] = glm::vec4(viewRects[i]) / (float)size;
+        }
+        for (int i = 0; i < MAX_LIGHTS; ++i) {
+            block.lights[i] = glm::ivec4(0);
+            block.lightParams[i] = glm::vec4(0.0f);
+            if (i >= (int)lights.size())
+                continue;
+            const ShadowLight& light = lights[i];
+            block.lights[i] = glm::ivec4(light.firstView, light.viewCount,
+                                         light.enabled ? 1 : 0, light.type);
+            block.lightParams[i] = glm::vec4(light.position, light.farPlane);
+        }
+
+        glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Block), &block);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, UBO_BINDING, ubo);
+    }
+
+    // One viewport and scissor per view, so a geometry shader can route
+    // primitives with gl_ViewportIndex
+    void setViewports(const ShadowLight& light) const {
+        for (int i = 0; i < light.viewCount; ++i) {
+            const glm::ivec4& r = viewRects[light.firstView + i];
+            glViewportIndexedf(i, (float)r.x, (float)r.y, (float)r.z,
+                               (float)r.w);
+            glScissorIndexed(i, r.x, r.y, r.z, r.w);
+        }
+        glEnable(GL_SCISSOR_TEST);
+    }
+
+    // Clear the light's tiles in the bound atlas framebuffer
+    void clearViews(const ShadowLight& light) const {
+        glEnable(GL_SCISSOR_TEST);
+        for (int i = 0; i < light.viewCount; ++i) {
+            const glm::ivec4& r = viewRects[light.firstView + i];
+            glScissor(r.x, r.y, r.z, r.w);
+            glClear(GL_DEPTH_BUFFER_BIT);
+        }
+        glDisable(GL_SCISSOR_TEST);
+    }
+
+    // Overwrite the light's live tiles with its cached static depth
+    void copyStatic(const ShadowLight& light) const {
+        for (int i = 0; i < light.viewCount; ++i) {
+            const glm::ivec4& r = viewRects[light.firstView + i];
+            glCopyImageSubData(staticDepth, GL_TEXTURE_2D, 0, r.x, r.y, 0,
+                               depth, GL_TEXTURE_2D, 0, r.x, r.y, 0, r.z, r.w,
+                               1);
+        }
+    }
+
+    // Bind the atlas (or its moments) for a receiving shader. The uniform
+    // block is bound once by upload. Leaves unit 0 active, as the render
+    // queue expects between items.
+    void apply(Shader* shader, int unit) const {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, filtered ? moments.texture : depth);
+        glActiveTexture(GL_TEXTURE0);
+
+        shader->set("u_shadowMap", unit);
+    }
+
+private:
+    // std140 mirror of the shadow_atlas block in the shaders
+    struct Block {
+        glm::mat4 viewMatrices[MAX_VIEWS];
+        glm::vec4 viewRects[MAX_VIEWS];  // uv offset (xy) and size (zw)
+        glm::ivec4 lights[MAX_LIGHTS];   // first view, count, enabled, type
+        glm::vec4 lightParams[MAX_LIGHTS];  // position (xyz), far plane (w)
+    };
+
+    std::vector<glm::ivec3> freeTiles;  // x, y, size of unused tiles
+
+    bool allocate(int tileSize, glm::ivec4& rect) {
+        // Smallest free tile that still fits keeps big tiles available
+        int best = -1;
+        for (int i = 0; i < (int)freeTiles.size(); ++i) {
+            if (freeTiles[i].z >= tileSize &&
+                (best < 0 || freeTiles[i].z < freeTiles[best].z))
+                best = i;
+        }
+        if (best < 0)
+            return false;
+
+        glm::ivec3 tile = freeTiles[best];
+        freeTiles.erase(freeTiles.begin() + best);
+
+        // Quarter it until it matches, returning the other three quarters
+        while (tile.z > tileSize) {
+            int half = tile.z / 2;
+            freeTiles.push_back(glm::ivec3(tile.x + half, tile.y, half));
+            freeTiles.push_back(glm::ivec3(tile.x, tile.y + half, half));
+            freeTiles.push_back(glm::ivec3(tile.x + half, tile.y + half, half));
+            tile.z = half;
+        }
+
+        rect = glm::ivec4(tile.x, tile.y, tile.z, tile.z);
+        return true;
+    }
+
+    void createDepth(GLuint& texture, GLint filter) const {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size, size, 0,
+                     GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    void createFramebuffer(GLuint& framebuffer, GLuint texture) const {
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                               GL_TEXTURE_2D, texture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+};
@@ -0,0 +1,30 @@
+#pragma once
+#include <vector>
+
+// Tracks whether a light's tiles in the static shadow atlas still match the
+// light. Static casters are rendered there only when the light or the static
+// scene changes; every frame the tiles are copied into the live atlas and
+// only dynamic casters are drawn on top.
+class ShadowCache {
+public:
+    // True if the tiles were rendered with the same light parameters and the
+    // same static scene version
+    bool isCurrent(const std::vector<float>& lightKey,
+                   unsigned int sceneVersion) const {
+        return valid && sceneVersion == version && lightKey == key;
+    }
+
+    void markCurrent(const std::vector<float>& lightKey,
+                     unsigned int sceneVersion) {
+        key = lightKey;
+        version = sceneVersion;
+        valid = true;
+    }
+
+    void invalidate() { valid = false; }
+
+private:
+    bool valid = false;
+    unsigned int version = 0;
+    std::vector<float> key;
+};
@@ -0,0 +1,106 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+// Cascade fitting for the directional light. Every cascade covers one slice
+// of the camera frustum and renders into its own shadow atlas tile, so near
+// slices get far more texels than one whole-terrain map would.
+class ShadowCascades {
+public:
+    static const int MAX_CASCADES = 4;
+
+    int count = MAX_CASCADES;
+    int tileSize[MAX_CASCADES] = { 2048, 2048, 1024, 1024 };  // Atlas texels
+    float splitLambda = 0.8f;      // 0 = uniform splits, 1 = logarithmic
+    float casterPadding = 400.0f;  // Pulls the light back for tall casters
+
+    glm::mat4 matrices[MAX_CASCADES];
+    float splitFar[MAX_CASCADES] = {};  // View distance where each one ends
+
+    // Fit one orthographic light frustum around each split of the camera
+    // frustum, up to maxDistance in front of the camera
+    void fit(const glm::mat4& cameraView, const glm::mat4& cameraProj,
+             const glm::vec3& lightDir, float maxDistance) {
+        const glm::mat4 invViewProj = glm::inverse(cameraProj * cameraView);
+
+        glm::vec3 nearCorners[4];
+        glm::vec3 farCorners[4];
+        for (int i = 0; i < 4; ++i) {
+            float x = (i & 1) ? 1.0f : -1.0f;
+            float y = (i & 2) ? 1.0f : -1.0f;
+            glm::vec4 n = invViewProj * glm::vec4(x, y, -1.0f, 1.0f);
+            glm::vec4 f = invViewProj * glm::vec4(x, y, 1.0f, 1.0f);
+            nearCorners[i] = glm::vec3(n) / n.w;
+            farCorners[i] = glm::vec3(f) / f.w;
+        }
+
+        // Distances along the view direction; also valid for ortho cameras
+        const float nearDist = -(cameraView * glm::vec4(nearCorners[0], 1)).z;
+        const float farDist = -(cameraView * glm::vec4(farCorners[0], 1)).z;
+        const float range = farDist - nearDist;
+        if (std::abs(range) < 1e-4f)
+            return;
+
+        const float endT =
+            range > 0.0f ? std::min(1.0f, maxDistance / range) : 1.0f;
+        const bool logSplits = nearDist > 0.0f && range > 0.0f;
+
+        glm::vec3 up(0.0f, 1.0f, 0.0f);
+        if (std::abs(lightDir.y) > 0.99f)
+            up = glm::vec3(0.0f, 0.0f, 1.0f);
+        const glm::mat4 lightRotation =
+            glm::lookAt(glm::vec3(0.0f), lightDir, up);
+        const glm::mat4 invLightRotation = glm::inverse(lightRotation);
+
+        float startT = 0.0f;
+        for (int c = 0; c < count; ++c) {
+            float endOfSplit = endT * (c + 1) / count;
+            if (logSplits) {
+                float n = nearDist;
+                float f = nearDist + range * endT;
+                float p = (c + 1) / (float)count;
+                float uniformD = n + (f - n) * p;
+                float logD = n * std::pow(f / n, p);
+                float d = splitLambda * logD + (1.0f - splitLambda) * uniformD;
+                endOfSplit = (d - nearDist) / range;
+            }
+
+            // Bounding sphere of the slice keeps the cascade size constant
+            // while the camera rotates, which stops edges from swimming
+            glm::vec3 corners[8];
+            glm::vec3 center(0.0f);
+            for (int i = 0; i < 4; ++i) {
+                glm::vec3 ray = farCorners[i] - nearCorners[i];
+                corners[i] = nearCorners[i] + ray * startT;
+                corners[i + 4] = nearCorners[i] + ray * endOfSplit;
+                center += corners[i] + corners[i + 4];
+            }
+            center /= 8.0f;
+
+            float radius = 0.0f;
+            for (int i = 0; i < 8; ++i)
+                radius = std::max(radius, glm::length(corners[i] - center));
+            radius = std::ceil(radius * 16.0f) / 16.0f;
+
+            // Snap the center to whole texels in light space
+            const float texel = 2.0f * radius / tileSize[c];
+            glm::vec3 lightCenter =
+                glm::vec3(lightRotation * glm::vec4(center, 1.0f));
+            lightCenter.x = std::floor(lightCenter.x / texel) * texel;
+            lightCenter.y = std::floor(lightCenter.y / texel) * texel;
+            center = glm::vec3(invLightRotation * glm::vec4(lightCenter, 1.0f));
+
+            const glm::vec3 eye = center - lightDir * (radius + casterPadding);
+            const glm::mat4 view = glm::lookAt(eye, center, up);
+            const glm::mat4 proj =
+                glm::ortho(-radius, radius, -radius, radius, 0.0f,
+                           2.0f * radius + casterPadding);
+
+            matrices[c] = proj * view;
+            splitFar[c] = nearDist + range * endOfSplit;
+            startT = endOfSplit;
+        }
+    }
+};
@@ -0,0 +1,132 @@
+#pragma once
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+
+// How receivers turn a shadow map into a shadow term
+enum ShadowFilter {
+    PCF_FILTER = 0,  // Several depth compares per fragment (reference look)
+    VSM_FILTER = 1   // One filtered fetch of prefiltered depth moments
+};
+
+// Variance shadow map built from a shadow atlas. Each tile is turned into
+// (depth, depth^2) and blurred with a separable Gaussian, once per light per
+// update, so receivers need a single bilinear fetch instead of a PCF loop.
+// The moments use the atlas layout at a lower resolution.
+class ShadowMoments {
+public:
+    GLuint texture = 0;  // RG32F moments
+    int resolution = 0;
+    int blurRadius = 2;  // Taps on each side, in moment texels
+
+    ~ShadowMoments() { release(); }
+
+    void init(int size) {
+        if (texture != 0)
+            return;
+
+        resolution = size;
+        createTexture(texture);
+        createTexture(blurTexture);  // Horizontal pass result
+
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, blurTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
+                               GL_TEXTURE_2D, texture, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        glGenVertexArrays(1, &emptyVAO);
+    }
+
+    void release() {
+        if (texture)
+            glDeleteTextures(1, &texture);
+        if (blurTexture)
+            glDeleteTextures(1, &blurTexture);
+        if (fbo)
+            glDeleteFramebuffers(1, &fbo);
+        if (emptyVAO)
+            glDeleteVertexArrays(1, &emptyVAO);
+        texture = 0;
+        blurTexture = 0;
+        fbo = 0;
+        emptyVAO = 0;
+    }
+
+    // Rebuild the moments of the given atlas tiles (x, y, width, height in
+    // atlas texels) from depthAtlas with the shadowMoments program. Leaves
+    // its own framebuffer and viewport bound; the caller rebinds its target.
+    void filter(Shader* shader, GLuint depthAtlas, int atlasSize,
+                const glm::ivec4* tiles, int tileCount) {
+        if (texture == 0 || tileCount == 0)
+            return;
+
+        shader->Use();
+        glBindVertexArray(emptyVAO);
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_BLEND);
+        glDisable(GL_CULL_FACE);
+        glDisable(GL_SCISSOR_TEST);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, depthAtlas);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, blurTexture);
+        glActiveTexture(GL_TEXTURE0);
+
+        shader->set("u_depth", 0);
+        shader->set("u_blurred", 1);
+        shader->set("u_texelSize", 1.0f / resolution);
+        shader->set("u_radius", blurRadius);
+
+        const float scale = (float)resolution / atlasSize;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        for (int i = 0; i < tileCount; ++i) {
+            const glm::ivec4 rect = glm::ivec4(glm::vec4(tiles[i]) * scale);
+            glViewport(rect.x, rect.y, rect.z, rect.w);
+            shader->set("u_tile", glm::vec4(rect) / (float)resolution);
+
+            // Depth -> moments, blurred along x
+            glDrawBuffer(GL_COLOR_ATTACHMENT0);
+            shader->set("u_source", 0);
+            shader->set("u_axis", glm::vec2(1.0f, 0.0f));
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+
+            // Blurred along y into the moments
+            glDrawBuffer(GL_COLOR_ATTACHMENT1);
+            shader->set("u_source", 1);
+            shader->set("u_axis", glm::vec2(0.0f, 1.0f));
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindVertexArray(0);
+        glUseProgram(0);
+        glEnable(GL_DEPTH_TEST);
+    }
+
+private:
+    GLuint blurTexture = 0;
+    GLuint fbo = 0;
+    GLuint emptyVAO = 0;
+
+    void createTexture(GLuint& tex) const {
+        glGenTextures(1, &tex);
+        glBindTexture(GL_TEXTURE_2D, tex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, resolution, resolution, 0,
+                     GL_RG, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+};
@@ -1,8 +1,9 @@
 #pragma once
 #include <glad/glad.h>
+#include <cstddef>
 #include <glm/glm.hpp>
-#include <opencv2/imgcodecs.hpp>
-#include <opencv2\opencv.hpp>
+
+#include "TextureStreamer.h"
 
 class Texture2D {
 public:
@@ -19,35 +20,28 @@ public:
 
     Texture2D(const char* path, Type texture_type = Texture2D::TEXTURE_DEFAULT)
         : type(texture_type) {
-        cv::Mat img;
-        // Load with alpha if present so PNG transparency is preserved
-        img = cv::imread(path, cv::IMREAD_UNCHANGED);
-
-        this->size.x = img.cols;
-        this->size.y = img.rows;
-
-        //cv::cvtColor(img, img, CV_BGR2RGB);
-
+        // The pixels (or the cooked .dds next to the file) are decoded and
+        // uploaded by the TextureStreamer and sample black until they
+        // arrive
         glGenTextures(1, &this->id);
 
         glBindTexture(GL_TEXTURE_2D, this->id);
-        glGenerateMipmap(GL_TEXTURE_2D);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        if (img.type() == CV_8UC4)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, img.cols, img.rows, 0,
-                         GL_BGRA, GL_UNSIGNED_BYTE, img.data);
-        else if (img.type() == CV_8UC3)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, img.cols, img.rows, 0,
-                         GL_BGR, GL_UNSIGNED_BYTE, img.data);
-        else if (img.type() == CV_8UC1)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, img.cols, img.rows, 0, GL_RED,
-                         GL_UNSIGNED_BYTE, img.data);
         glBindTexture(GL_TEXTURE_2D, 0);
 
-        img.release();
+        TextureStreamer::instance().request(path, this->id, GL_TEXTURE_2D, 0,
+                                            true, true);
+    }
+
+    Texture2D(const Texture2D&) = delete;
+    Texture2D& operator=(const Texture2D&) = delete;
+
+    ~Texture2D() {
+        TextureStreamer::instance().cancel(this->id);
+        glDeleteTextures(1, &this->id);
     }
 
     void bind(GLenum bind_unit) {
@@ -60,7 +54,47 @@ public:
         glBindTexture(GL_TEXTURE_2D, 0);
     }
 
-    glm::ivec2 size;
+    GLuint getId() const { return id; }
+
+    // Size of the uploaded image, zero until the streamer delivers it
+    glm::ivec2 getSize() const {
+        glm::ivec2 size(0);
+        glBindTexture(GL_TEXTURE_2D, this->id);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &size.x);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT,
+                                 &size.y);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return size;
+    }
+
+    // Bytes of every level uploaded so far, as stored by the driver for
+    // compressed images and estimated at 4 bytes a texel otherwise
+    size_t getGpuBytes() const {
+        size_t bytes = 0;
+        glBindTexture(GL_TEXTURE_2D, this->id);
+        for (GLint level = 0;; ++level) {
+            GLint width = 0, height = 0, compressed = GL_FALSE;
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH,
+                                     &width);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT,
+                                     &height);
+            if (width == 0 || height == 0)
+                break;
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, level,
+                                     GL_TEXTURE_COMPRESSED, &compressed);
+            if (compressed) {
+                GLint levelBytes = 0;
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, level,
+                                         GL_TEXTURE_COMPRESSED_IMAGE_SIZE,
+                                         &levelBytes);
+                bytes += (size_t)levelBytes;
+            } else {
+                bytes += (size_t)width * height * 4;
+            }
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return bytes;
+    }
 
 private:
     GLuint id;
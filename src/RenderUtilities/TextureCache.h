@@ -0,0 +1,56 @@
+#pragma once
+#include <glad/glad.h>
+#include <string>
+#include <unordered_map>
+
+// Model textures shared by every model that references the same image, and
+// the texture arrays built from them, keyed by their list of images.
+// Entries are found by content path in O(1) and reference counted; the GL
+// texture is deleted when the last model using it releases it.
+class TextureCache {
+public:
+    static TextureCache& instance() {
+        static TextureCache cache;
+        return cache;
+    }
+
+    // Texture cached under key with one more reference, or 0 if absent
+    GLuint acquire(const std::string& key) {
+        auto it = entries.find(key);
+        if (it == entries.end())
+            return 0;
+        ++it->second.refs;
+        ++hits;
+        return it->second.id;
+    }
+
+    // Cache a freshly loaded texture, holding one reference
+    void insert(const std::string& key, GLuint id) {
+        Entry entry;
+        entry.id = id;
+        entry.refs = 1;
+        entries[key] = entry;
+    }
+
+    void release(const std::string& key) {
+        auto it = entries.find(key);
+        if (it == entries.end() || --it->second.refs > 0)
+            return;
+        glDeleteTextures(1, &it->second.id);
+        entries.erase(it);
+    }
+
+    size_t size() const { return entries.size(); }
+    int reuses() const { return hits; }
+
+private:
+    struct Entry {
+        GLuint id = 0;
+        int refs = 0;
+    };
+
+    std::unordered_map<std::string, Entry> entries;
+    int hits = 0;
+
+    TextureCache() = default;
+};
@@ -0,0 +1,404 @@
+#include "TextureEncoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "FileStamp.h"
+#include "stb_image.h"
+
+namespace {
+typedef unsigned char Pixel[4];  // RGBA
+
+// Principal axis of a block's colors (channels 0 to channels - 1), by
+// power iteration on their covariance. Returns the mean too.
+void principalAxis(const Pixel* block, int channels, float* mean,
+                   float* axis) {
+    for (int c = 0; c < channels; ++c) {
+        mean[c] = 0.0f;
+        for (int i = 0; i < 16; ++i)
+            mean[c] += block[i][c];
+        mean[c] /= 16.0f;
+    }
+    float cov[4][4] = {};
+    for (int i = 0; i < 16; ++i) {
+        for (int a = 0; a < channels; ++a)
+            for (int b = 0; b < channels; ++b)
+                cov[a][b] += (block[i][a] - mean[a]) * (block[i][b] - mean[b]);
+    }
+    for (int c = 0; c < channels; ++c)
+        axis[c] = 1.0f;
+    for (int iteration = 0; iteration < 8; ++iteration) {
+        float next[4] = {};
+        float length = 0.0f;
+        for (int a = 0; a < channels; ++a) {
+            for (int b = 0; b < channels; ++b)
+                next[a] += cov[a][b] * axis[b];
+            length += next[a] * next[a];
+        }
+        length = std::sqrt(length);
+        if (length < 1e-6f)
+            break;  // Flat block: any axis will do
+        for (int c = 0; c < channels; ++c)
+            axis[c] = next[c] / length;
+    }
+}
+
+// Block colors at the two ends of the principal axis
+void axisEndpoints(const Pixel* block, int channels, float* low,
+                   float* high) {
+    float mean[4];
+    float axis[4];
+    principalAxis(block, channels, mean, axis);
+    float minT = 0.0f;
+    float maxT = 0.0f;
+    for (int i = 0; i < 16; ++i) {
+        float t = 0.0f;
+        for (int c = 0; c < channels; ++c)
+            t += (block[i][c] - mean[c]) * axis[c];
+        minT = std::min(minT, t);
+        maxT = std::max(maxT, t);
+    }
+    for (int c = 0; c < channels; ++c) {
+        low[c] = std::min(std::max(mean[c] + axis[c] * minT, 0.0f), 255.0f);
+        high[c] = std::min(std::max(mean[c] + axis[c] * maxT, 0.0f), 255.0f);
+    }
+}
+
+int distance(const Pixel a, const int* b, int channels) {
+    int sum = 0;
+    for (int c = 0; c < channels; ++c)
+        sum += (a[c] - b[c]) * (a[c] - b[c]);
+    return sum;
+}
+
+int nearest(const Pixel pixel, const int (*palette)[4], int count,
+            int channels) {
+    int best = 0;
+    int bestDistance = distance(pixel, palette[0], channels);
+    for (int i = 1; i < count; ++i) {
+        const int d = distance(pixel, palette[i], channels);
+        if (d < bestDistance) {
+            bestDistance = d;
+            best = i;
+        }
+    }
+    return best;
+}
+
+uint16_t pack565(const float* color) {
+    const int r = (int)std::lround(color[0] * 31.0f / 255.0f);
+    const int g = (int)std::lround(color[1] * 63.0f / 255.0f);
+    const int b = (int)std::lround(color[2] * 31.0f / 255.0f);
+    return (uint16_t)(r << 11 | g << 5 | b);
+}
+
+void unpack565(uint16_t packed, int* color) {
+    const int r = packed >> 11 & 31;
+    const int g = packed >> 5 & 63;
+    const int b = packed & 31;
+    color[0] = r << 3 | r >> 2;
+    color[1] = g << 2 | g >> 4;
+    color[2] = b << 3 | b >> 2;
+    color[3] = 255;
+}
+
+// BC1 in four-color mode: two RGB565 endpoints and 2-bit indices
+void encodeBC1(const Pixel* block, unsigned char* out) {
+    float low[4];
+    float high[4];
+    axisEndpoints(block, 3, low, high);
+    uint16_t c0 = pack565(high);
+    uint16_t c1 = pack565(low);
+    if (c0 < c1)
+        std::swap(c0, c1);
+
+    uint32_t indices = 0;
+    if (c0 != c1) {
+        int palette[4][4];
+        unpack565(c0, palette[0]);
+        unpack565(c1, palette[1]);
+        for (int c = 0; c < 3; ++c) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        for (int i = 0; i < 16; ++i)
+            indices |= (uint32_t)nearest(block[i], palette, 4, 3) << (2 * i);
+    }
+    out[0] = (unsigned char)(c0 & 0xFF);
+    out[1] = (unsigned char)(c0 >> 8);
+    out[2] = (unsigned char)(c1 & 0xFF);
+    out[3] = (unsigned char)(c1 >> 8);
+    for (int b = 0; b < 4; ++b)
+        out[4 + b] = (unsigned char)(indices >> (8 * b));
+}
+
+// BC4 in eight-value mode: two 8-bit endpoints and 3-bit indices, for one
+// channel of the block
+void encodeBC4(const Pixel* block, int channel, unsigned char* out) {
+    int low = 255;
+    int high = 0;
+    for (int i = 0; i < 16; ++i) {
+        low = std::min(low, (int)block[i][channel]);
+        high = std::max(high, (int)block[i][channel]);
+    }
+
+    uint64_t indices = 0;
+    if (high != low) {
+        int palette[8];
+        palette[0] = high;
+        palette[1] = low;
+        for (int i = 0; i < 6; ++i)
+            palette[2 + i] = ((6 - i) * high + (i + 1) * low) / 7;
+        for (int i = 0; i < 16; ++i) {
+            int best = 0;
+            for (int p = 1; p < 8; ++p) {
+                if (std::abs(block[i][channel] - palette[p]) <
+                    std::abs(block[i][channel] - palette[best]))
+                    best = p;
+            }
+            indices |= (uint64_t)best << (3 * i);
+        }
+    }
+    out[0] = (unsigned char)high;
+    out[1] = (unsigned char)low;
+    for (int b = 0; b < 6; ++b)
+        out[2 + b] = (unsigned char)(indices >> (8 * b));
+}
+
+// Writes fields into a 128-bit block, least significant bit first
+struct BitWriter {
+    unsigned char* out;
+    int position = 0;
+
+    void write(uint32_t value, int bits) {
+        for (int i = 0; i < bits; ++i, ++position) {
+            if (value >> i & 1)
+                out[position >> 3] |= (unsigned char)(1 << (position & 7));
+        }
+    }
+};
+
+// BC7 mode 6: one subset, RGBA endpoints of 7 bits plus a shared bit per
+// endpoint, 4-bit indices
+void encodeBC7(const Pixel* block, unsigned char* out) {
+    static const int weights[16] = { 0,  4,  9,  13, 17, 21, 26, 30,
+                                      34, 38, 43, 47, 51, 55, 60, 64 };
+    float ends[2][4];
+    axisEndpoints(block, 4, ends[0], ends[1]);
+
+    // Pick each endpoint's shared bit by the smaller rounding error
+    int quantized[2][4];
+    int pbits[2];
+    int palette[16][4];
+    for (int e = 0; e < 2; ++e) {
+        float bestError = -1.0f;
+        for (int p = 0; p < 2; ++p) {
+            int q[4];
+            float error = 0.0f;
+            for (int c = 0; c < 4; ++c) {
+                q[c] = (int)std::lround((ends[e][c] - p) / 2.0f);
+                q[c] = std::min(std::max(q[c], 0), 127);
+                const float back = (float)(q[c] << 1 | p);
+                error += (back - ends[e][c]) * (back - ends[e][c]);
+            }
+            if (bestError < 0.0f || error < bestError) {
+                bestError = error;
+                pbits[e] = p;
+                std::memcpy(quantized[e], q, sizeof(q));
+            }
+        }
+    }
+    for (int i = 0; i < 16; ++i) {
+        for (int c = 0; c < 4; ++c) {
+            const int e0 = quantized[0][c] << 1 | pbits[0];
+            const int e1 = quantized[1][c] << 1 | pbits[1];
+            palette[i][c] =
+                ((64 - weights[i]) * e0 + weights[i] * e1 + 32) >> 6;
+        }
+    }
+    int indices[16];
+    for (int i = 0; i < 16; ++i)
+        indices[i] = nearest(block[i], palette, 16, 4);
+
+    // The first index is stored without its top bit, so it must be clear
+    if (indices[0] & 8) {
+        std::swap(quantized[0], quantized[1]);
+        std::swap(pbits[0], pbits[1]);
+        for (int i = 0; i < 16; ++i)
+            indices[i] = 15 - indices[i];
+    }
+
+    std::memset(out, 0, 16);
+    BitWriter writer;
+    writer.out = out;
+    writer.write(1 << 6, 7);  // Mode 6
+    for (int c = 0; c < 4; ++c) {
+        writer.write((uint32_t)quantized[0][c], 7);
+        writer.write((uint32_t)quantized[1][c], 7);
+    }
+    writer.write((uint32_t)pbits[0], 1);
+    writer.write((uint32_t)pbits[1], 1);
+    writer.write((uint32_t)indices[0], 3);
+    for (int i = 1; i < 16; ++i)
+        writer.write((uint32_t)indices[i], 4);
+}
+
+// Half size level, averaging 2x2 texels (edges of odd sizes repeat)
+std::vector<unsigned char> downsample(const std::vector<unsigned char>& rgba,
+                                      int width, int height) {
+    const int w = std::max(width / 2, 1);
+    const int h = std::max(height / 2, 1);
+    std::vector<unsigned char> result((size_t)w * h * 4);
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            const int x0 = std::min(2 * x, width - 1);
+            const int x1 = std::min(2 * x + 1, width - 1);
+            const int y0 = std::min(2 * y, height - 1);
+            const int y1 = std::min(2 * y + 1, height - 1);
+            for (int c = 0; c < 4; ++c) {
+                const int sum = rgba[((size_t)y0 * width + x0) * 4 + c] +
+                                rgba[((size_t)y0 * width + x1) * 4 + c] +
+                                rgba[((size_t)y1 * width + x0) * 4 + c] +
+                                rgba[((size_t)y1 * width + x1) * 4 + c];
+                result[((size_t)y * w + x) * 4 + c] =
+                    (unsigned char)((sum + 2) / 4);
+            }
+        }
+    }
+    return result;
+}
+
+const char* formatName(GLenum format) {
+    switch (format) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        return "BC1";
+    case GL_COMPRESSED_RED_RGTC1:
+        return "BC4";
+    case GL_COMPRESSED_RG_RGTC2:
+        return "BC5";
+    default:
+        return "BC7";
+    }
+}
+}  // namespace
+
+namespace TextureEncoder {
+
+CompressedTexture encode(const unsigned char* pixels, int width, int height,
+                         int components) {
+    // Work in RGBA; missing channels are 0, missing alpha opaque
+    std::vector<unsigned char> rgba((size_t)width * height * 4, 0);
+    bool opaque = true;
+    for (size_t i = 0; i < (size_t)width * height; ++i) {
+        for (int c = 0; c < components; ++c)
+            rgba[i * 4 + c] = pixels[i * components + c];
+        if (components < 4)
+            rgba[i * 4 + 3] = 255;
+        opaque = opaque && rgba[i * 4 + 3] == 255;
+    }
+
+    CompressedTexture texture;
+    texture.width = width;
+    texture.height = height;
+    if (components == 1)
+        texture.format = GL_COMPRESSED_RED_RGTC1;
+    else if (components == 2)
+        texture.format = GL_COMPRESSED_RG_RGTC2;
+    else if (opaque)
+        texture.format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    else
+        texture.format = GL_COMPRESSED_RGBA_BPTC_UNORM;
+
+    int w = width;
+    int h = height;
+    for (;;) {
+        texture.levelOffsets.push_back(texture.data.size());
+        const size_t blockBytes = CompressedTexture::blockBytes(texture.format);
+        for (int by = 0; by < h; by += 4) {
+            for (int bx = 0; bx < w; bx += 4) {
+                // Blocks past the edge repeat the last row and column
+                Pixel block[16];
+                for (int i = 0; i < 16; ++i) {
+                    const int x = std::min(bx + i % 4, w - 1);
+                    const int y = std::min(by + i / 4, h - 1);
+                    std::memcpy(block[i], &rgba[((size_t)y * w + x) * 4], 4);
+                }
+                unsigned char out[16];
+                if (texture.format == GL_COMPRESSED_RED_RGTC1) {
+                    encodeBC4(block, 0, out);
+                } else if (texture.format == GL_COMPRESSED_RG_RGTC2) {
+                    encodeBC4(block, 0, out);
+                    encodeBC4(block, 1, out + 8);
+                } else if (texture.format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) {
+                    encodeBC1(block, out);
+                } else {
+                    encodeBC7(block, out);
+                }
+                texture.data.insert(texture.data.end(), out, out + blockBytes);
+            }
+        }
+        if (w == 1 && h == 1)
+            break;
+        rgba = downsample(rgba, w, h);
+        w = std::max(w / 2, 1);
+        h = std::max(h / 2, 1);
+    }
+    return texture;
+}
+
+bool cookFile(const std::string& sourcePath) {
+    int width = 0;
+    int height = 0;
+    int components = 0;
+    unsigned char* pixels =
+        stbi_load(sourcePath.c_str(), &width, &height, &components, 0);
+    if (!pixels) {
+        std::cout << "Failed to read texture: " << sourcePath << std::endl;
+        return false;
+    }
+
+    // Gray with alpha is stored as RGBA; two channels mean RG data only
+    // when a caller encodes them directly
+    std::vector<unsigned char> expanded;
+    if (components == 2) {
+        expanded.resize((size_t)width * height * 4);
+        for (size_t i = 0; i < (size_t)width * height; ++i) {
+            expanded[i * 4] = expanded[i * 4 + 1] = expanded[i * 4 + 2] =
+                pixels[i * 2];
+            expanded[i * 4 + 3] = pixels[i * 2 + 1];
+        }
+    }
+    CompressedTexture texture =
+        expanded.empty() ? encode(pixels, width, height, components)
+                         : encode(expanded.data(), width, height, 4);
+    stbi_image_free(pixels);
+
+    FileStamp source;
+    FileStamp::of(sourcePath.c_str(), source);
+    texture.sourceSize = source.size;
+    texture.sourceTime = source.time;
+
+    const std::string outPath = CompressedTexture::pathFor(sourcePath);
+    if (!texture.save(outPath)) {
+        std::cout << "Failed to write compressed texture: " << outPath
+                  << std::endl;
+        return false;
+    }
+
+    // Against the RGBA8 texture with a generated mip chain it replaces
+    const double kb = 1.0 / 1024.0;
+    const double uncompressed = (double)width * height * 4 * 4.0 / 3.0;
+    std::cout << "Compressed " << sourcePath << " -> " << outPath << " ("
+              << width << "x" << height << ", "
+              << texture.getLevelCount() << " levels, "
+              << formatName(texture.format) << "): "
+              << uncompressed * kb << " KB -> " << texture.data.size() * kb
+              << " KB" << std::endl;
+    return true;
+}
+
+}  // namespace TextureEncoder
@@ -0,0 +1,20 @@
+#pragma once
+#include <string>
+
+#include "CompressedTexture.h"
+
+// Offline block compression for the AssetCooker. The format follows the
+// image's channels: BC4 for one channel, BC5 for two, BC1 for opaque color
+// and BC7 (mode 6) for color with alpha. Mipmaps are box filtered down to
+// 1x1 before encoding, so the runtime never calls glGenerateMipmap on them.
+namespace TextureEncoder {
+
+// Encode 8-bit pixels (components 1 to 4, RGBA order, rows top down)
+CompressedTexture encode(const unsigned char* pixels, int width, int height,
+                         int components);
+
+// Decode an image file and write its compressed twin next to it. Prints
+// the sizes; returns false if the image could not be read or written.
+bool cookFile(const std::string& sourcePath);
+
+}  // namespace TextureEncoder
@@ -0,0 +1,291 @@
+#include "TextureStreamer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#include "stb_image.h"
+
+TextureStreamer::TextureStreamer() {
+    const GLbitfield flags =
+        GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, STAGING_BYTES, nullptr, flags);
+    mapped = static_cast<unsigned char*>(
+        glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, STAGING_BYTES, flags));
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    // Answer the S3TC query here, so decoders only read the result
+    CompressedTexture probe;
+    probe.format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    probe.isSupported();
+
+    // Enough decoders for the six faces of a cube map at once, with one
+    // core left to the GL thread
+    const unsigned cores = std::thread::hardware_concurrency();
+    const unsigned count = cores > 2 ? std::min(cores - 1, 6u) : 1u;
+    for (unsigned i = 0; i < count; ++i)
+        decoders.emplace_back(&TextureStreamer::decoderLoop, this);
+}
+
+TextureStreamer::~TextureStreamer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    space.notify_all();
+    for (std::thread& decoder : decoders) {
+        if (decoder.joinable())
+            decoder.join();
+    }
+}
+
+void TextureStreamer::request(const std::string& path, GLuint texture,
+                              GLenum target, int components,
+                              bool allowCompressed, bool mipmaps) {
+    Job job;
+    job.path = path;
+    job.texture = texture;
+    job.target = target;
+    job.components = components;
+    job.allowCompressed = allowCompressed;
+    job.mipmaps = mipmaps;
+
+    // Every image of one texture (a cube map's faces) shares a generation
+    auto it = generations.find(texture);
+    if (it == generations.end())
+        it = generations.emplace(texture, nextGeneration++).first;
+    job.generation = it->second;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(job);
+    }
+    wake.notify_one();
+}
+
+void TextureStreamer::cancel(GLuint texture) {
+    if (generations.erase(texture) == 0)
+        return;
+
+    // Images already decoding or staged are dropped by upload
+    std::lock_guard<std::mutex> lock(mutex);
+    jobs.erase(std::remove_if(jobs.begin(), jobs.end(),
+                              [texture](const Job& job) {
+                                  return job.texture == texture;
+                              }),
+               jobs.end());
+}
+
+bool TextureStreamer::processUploads(double budgetMs) {
+    const auto start = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(mutex);
+    retireFinished();
+    while (!staged.empty()) {
+        Staged item = std::move(staged.front());
+        staged.pop_front();
+        lock.unlock();
+        const bool uploaded = upload(item);
+        lock.lock();
+        // A dropped image's range is fenced too, so it retires in order
+        if (item.heap.empty())
+            allocations[item.sequence - firstSequence].fence =
+                glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        if (!uploaded) {
+            ++stats.canceled;
+        } else {
+            if (item.heap.empty())
+                stats.stagedBytes += item.bytes;
+            else
+                stats.directBytes += item.bytes;
+            ++stats.uploads;
+        }
+
+        const std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        if (elapsed.count() >= budgetMs)
+            break;
+    }
+    return !jobs.empty() || busyDecoders > 0 || !staged.empty() ||
+           !allocations.empty();
+}
+
+void TextureStreamer::printStats() const {
+    const double mb = 1.0 / (1024.0 * 1024.0);
+    std::cout << "Texture streaming: " << stats.uploads
+              << " images uploaded (" << stats.stagedBytes * mb
+              << " MB through the staging ring, " << stats.directBytes * mb
+              << " MB direct), " << stats.failed << " failed, "
+              << stats.canceled << " canceled, "
+              << stats.ringWaits << " decoder waits for ring space"
+              << std::endl;
+}
+
+bool TextureStreamer::allocate(size_t bytes, size_t& offset) {
+    if (allocations.empty()) {
+        offset = 0;
+    } else {
+        const size_t tail = allocations.front().offset;
+        if (head > tail && head + bytes <= STAGING_BYTES)
+            offset = head;
+        else if (head > tail && bytes <= tail)
+            offset = 0;
+        else if (head <= tail && head + bytes <= tail)
+            offset = head;
+        else
+            return false;
+    }
+    Allocation allocation;
+    allocation.offset = offset;
+    allocation.bytes = bytes;
+    allocations.push_back(allocation);
+    head = offset + bytes;
+    return true;
+}
+
+void TextureStreamer::retireFinished() {
+    bool freed = false;
+    while (!allocations.empty() && allocations.front().fence) {
+        const GLenum status = glClientWaitSync(
+            allocations.front().fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+        glDeleteSync(allocations.front().fence);
+        allocations.pop_front();
+        ++firstSequence;
+        freed = true;
+    }
+    if (freed)
+        space.notify_all();
+}
+
+void TextureStreamer::decoderLoop() {
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (stopping)
+                return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+            ++busyDecoders;
+        }
+
+        Staged item;
+        item.job = job;
+        const bool decoded = decode(item);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (decoded)
+            staged.push_back(std::move(item));
+        else
+            ++stats.failed;
+        --busyDecoders;
+    }
+}
+
+bool TextureStreamer::decode(Staged& item) {
+    const Job& job = item.job;
+    const unsigned char* source = nullptr;
+    unsigned char* pixels = nullptr;
+    if (job.allowCompressed &&
+        item.compressed.loadFor(job.path) &&
+        item.compressed.isSupported()) {
+        source = item.compressed.data.data();
+        item.bytes = item.compressed.data.size();
+        item.width = item.compressed.width;
+        item.height = item.compressed.height;
+    } else {
+        item.compressed = CompressedTexture();
+        int fileComponents = 0;
+        pixels = stbi_load(job.path.c_str(), &item.width, &item.height,
+                           &fileComponents, job.components);
+        if (!pixels) {
+            std::cout << "Texture failed to load at path: " << job.path
+                      << std::endl;
+            return false;
+        }
+        item.components = job.components ? job.components : fileComponents;
+        source = pixels;
+        item.bytes = (size_t)item.width * item.height * item.components;
+    }
+
+    // Ranges start 16-byte aligned
+    const size_t reserved = (item.bytes + 15) & ~(size_t)15;
+    bool stopped = false;
+    if (reserved > STAGING_BYTES || !mapped) {
+        item.heap.assign(source, source + item.bytes);
+    } else {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!allocate(reserved, item.offset)) {
+            ++stats.ringWaits;
+            space.wait(lock, [this, reserved, &item] {
+                return stopping || allocate(reserved, item.offset);
+            });
+        }
+        stopped = stopping;
+        item.sequence = firstSequence + allocations.size() - 1;
+        lock.unlock();
+        if (!stopped)
+            std::memcpy(mapped + item.offset, source, item.bytes);
+    }
+
+    if (pixels)
+        stbi_image_free(pixels);
+    std::vector<unsigned char>().swap(item.compressed.data);
+    return !stopped;
+}
+
+bool TextureStreamer::upload(const Staged& item) {
+    const Job& job = item.job;
+    auto it = generations.find(job.texture);
+    if (it == generations.end() || it->second != job.generation)
+        return false;  // Canceled before its image arrived
+
+    const GLenum bindTarget =
+        job.target == GL_TEXTURE_2D ? GL_TEXTURE_2D : GL_TEXTURE_CUBE_MAP;
+    const bool staging = item.heap.empty();
+    auto at = [&item, staging](size_t offset) -> const void* {
+        return staging ? reinterpret_cast<const void*>(item.offset + offset)
+                       : item.heap.data() + offset;
+    };
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging ? buffer : 0);
+    glBindTexture(bindTarget, job.texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    const CompressedTexture& compressed = item.compressed;
+    if (compressed.format != 0) {
+        for (int level = 0; level < compressed.getLevelCount(); ++level) {
+            glCompressedTexImage2D(
+                job.target, level, compressed.format,
+                compressed.levelWidth(level), compressed.levelHeight(level), 0,
+                (GLsizei)compressed.getLevelSize(level),
+                at(compressed.levelOffsets[level]));
+        }
+        glTexParameteri(bindTarget, GL_TEXTURE_MAX_LEVEL,
+                        compressed.getLevelCount() - 1);
+        if (compressed.getLevelCount() > 1)
+            glTexParameteri(bindTarget, GL_TEXTURE_MIN_FILTER,
+                            GL_LINEAR_MIPMAP_LINEAR);
+    } else {
+        static const GLenum formats[] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+        static const GLenum internalFormats[] = { GL_R8, GL_RG8, GL_RGB8,
+                                                  GL_RGBA8 };
+        const int index = std::min(std::max(item.components, 1), 4) - 1;
+        glTexImage2D(job.target, 0, internalFormats[index], item.width,
+                     item.height, 0, formats[index], GL_UNSIGNED_BYTE, at(0));
+        if (job.mipmaps && bindTarget == GL_TEXTURE_2D) {
+            glGenerateMipmap(GL_TEXTURE_2D);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                            GL_LINEAR_MIPMAP_LINEAR);
+        }
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(bindTarget, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    return true;
+}
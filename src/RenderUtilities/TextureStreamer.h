@@ -0,0 +1,143 @@
+#pragma once
+#include <glad/glad.h>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "CompressedTexture.h"
+
+// Streams image files into textures without stalling the GL thread.
+// Decoder threads read and decode each image (or its cooked .dds) and copy
+// the result into a persistently mapped pixel unpack buffer; the GL thread
+// then only issues glTexImage2D from that buffer in processUploads and
+// fences the range, which is reused once the fence has passed. Images too
+// large for the ring are uploaded from client memory instead.
+//
+// Textures exist as soon as they are requested and sample black until
+// their image arrives.
+class TextureStreamer {
+public:
+    // Staging ring the decoders write into
+    static const size_t STAGING_BYTES = 32u << 20;
+
+    static TextureStreamer& instance() {
+        static TextureStreamer streamer;
+        return streamer;
+    }
+
+    // Queue the image at path for one image of texture: target is
+    // GL_TEXTURE_2D or a cube map face, and the texture must have been
+    // bound to the matching target once. components forces the channel
+    // count (0 keeps the file's). A cooked .dds next to the file is used
+    // instead when allowCompressed is set; otherwise mipmaps, if asked for,
+    // are generated after the upload. GL thread only.
+    void request(const std::string& path, GLuint texture, GLenum target,
+                 int components, bool allowCompressed, bool mipmaps);
+
+    // Drop every image still pending for texture, so none lands in the
+    // name once it is deleted and handed out again. Call before deleting a
+    // requested texture. GL thread only.
+    void cancel(GLuint texture);
+
+    // Upload decoded images until budgetMs is spent and recycle staging
+    // ranges the GPU is done with. Returns true while anything is still
+    // decoding, waiting or in flight. GL thread only.
+    bool processUploads(double budgetMs);
+
+    void printStats() const;
+
+    // Only stops the decoders: at exit the GL context may already be gone,
+    // so the buffer is left to the driver
+    ~TextureStreamer();
+
+private:
+    struct Job {
+        std::string path;
+        GLuint texture = 0;
+        GLenum target = GL_TEXTURE_2D;
+        int components = 0;
+        bool allowCompressed = false;
+        bool mipmaps = false;
+        uint64_t generation = 0;  // Of texture when requested
+    };
+
+    // A decoded image waiting for the GL thread, in the ring or, if it did
+    // not fit, in heap
+    struct Staged {
+        Job job;
+        CompressedTexture compressed;  // Format and levels only, if cooked
+        int width = 0;
+        int height = 0;
+        int components = 0;
+        size_t bytes = 0;
+        size_t offset = 0;
+        uint64_t sequence = 0;  // Of its ring allocation
+        std::vector<unsigned char> heap;
+    };
+
+    // A ring range in allocation order, fenced once its upload is issued
+    struct Allocation {
+        size_t offset = 0;
+        size_t bytes = 0;
+        GLsync fence = 0;
+    };
+
+    struct Stats {
+        int uploads = 0;
+        int failed = 0;
+        int canceled = 0;
+        int ringWaits = 0;
+        size_t stagedBytes = 0;
+        size_t directBytes = 0;
+    };
+
+    GLuint buffer = 0;
+    unsigned char* mapped = nullptr;
+
+    // Generation of every requested texture that was not canceled since.
+    // Staged images of an older generation are dropped. GL thread only.
+    std::unordered_map<GLuint, uint64_t> generations;
+    uint64_t nextGeneration = 1;
+
+    // Shared with the decoders
+    std::mutex mutex;
+    std::condition_variable wake;   // New jobs
+    std::condition_variable space;  // Ring ranges retired
+    bool stopping = false;
+    std::deque<Job> jobs;
+    std::deque<Staged> staged;
+    std::deque<Allocation> allocations;
+    uint64_t firstSequence = 0;  // Of allocations.front()
+    size_t head = 0;             // End of the newest allocation
+    int busyDecoders = 0;
+    Stats stats;
+    std::vector<std::thread> decoders;
+
+    // Created on the GL thread by the first request
+    TextureStreamer();
+
+    // Find room for bytes after the newest allocation, wrapping to the
+    // start when the end is too short. Mutex held.
+    bool allocate(size_t bytes, size_t& offset);
+
+    // Free the oldest ranges whose uploads the GPU has finished. Ranges
+    // are freed in order, so one still decoding holds back later ones.
+    // Mutex held.
+    void retireFinished();
+
+    void decoderLoop();
+
+    // Read the image into a ring range, waiting for one to free up if the
+    // ring is full. Decoder thread.
+    bool decode(Staged& item);
+
+    // Define the texture image from the staged data. Returns false if the
+    // texture was canceled meanwhile. GL thread.
+    bool upload(const Staged& item);
+};
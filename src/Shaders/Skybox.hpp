@@ -4,8 +4,8 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
-#include <opencv2/opencv.hpp>
 #include "../RenderUtilities/Shader.h"
+#include "../RenderUtilities/TextureStreamer.h"
 
 class Skybox {
 private:
@@ -22,6 +22,7 @@ public:
             delete shader;
         glDeleteVertexArrays(1, &vao);
         glDeleteBuffers(1, &vbo);
+        TextureStreamer::instance().cancel(textureID);
         glDeleteTextures(1, &textureID);
     }
 
@@ -76,10 +77,8 @@ public:
         // Remove translation from view matrix
         glm::mat4 viewNoTrans = glm::mat4(glm::mat3(view));
 
-        glUniformMatrix4fv(glGetUniformLocation(shader->Program, "view"), 1,
-                           GL_FALSE, &viewNoTrans[0][0]);
-        glUniformMatrix4fv(glGetUniformLocation(shader->Program, "projection"),
-                           1, GL_FALSE, &projection[0][0]);
+        shader->set("view", viewNoTrans);
+        shader->set("projection", projection);
 
         glBindVertexArray(vao);
         glActiveTexture(GL_TEXTURE0);
@@ -96,17 +95,6 @@ public:
         glGenTextures(1, &textureID);
         glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
-        for (unsigned int i = 0; i < faces.size(); i++) {
-            cv::Mat img = cv::imread(faces[i], cv::IMREAD_COLOR);
-            if (!img.empty()) {
-                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB,
-                             img.cols, img.rows, 0, GL_BGR, GL_UNSIGNED_BYTE,
-                             img.data);
-            } else {
-                std::cout << "Cubemap tex failed to load at path: " << faces[i]
-                          << std::endl;
-            }
-        }
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S,
@@ -115,6 +103,18 @@ public:
                         GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R,
                         GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+        // Cooked faces are used only if all six are there and up to date,
+        // so the mip chains match. The faces decode in parallel on the
+        // streamer's threads.
+        bool cooked = true;
+        for (unsigned int i = 0; i < faces.size(); i++)
+            cooked = cooked && CompressedTexture::isCooked(faces[i]);
+        for (unsigned int i = 0; i < faces.size(); i++)
+            TextureStreamer::instance().request(
+                faces[i], textureID, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 3,
+                cooked, false);
 
         return textureID;
     }
@@ -1,10 +1,12 @@
 #include "Water.hpp"
+#include <algorithm>
 #include <GL/glu.h>
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <iostream>
+#include "../RenderUtilities/AssetCache.h"
 #include "../TrainView.H"
 #include "../TrainWindow.H"
 #include "../Utilities/3DUtils.H"
@@ -16,28 +18,23 @@ Water::~Water() {
 }
 
 void Water::cleanup() {
-    if (this->shader) {
-        delete this->shader;
-        this->shader = nullptr;
+    for (Variant& variant : variants) {
+        variant.shaders.reset();
+        variant.plane = nullptr;
+        variant.texture = nullptr;
     }
 
-    if (this->commonMatrices) {
-        glDeleteBuffers(1, &this->commonMatrices->ubo);
-        delete this->commonMatrices;
-        this->commonMatrices = nullptr;
+    if (grid) {
+        glDeleteVertexArrays(1, &grid->vao);
+        glDeleteBuffers(3, grid->vbo);
+        glDeleteBuffers(1, &grid->ebo);
+        delete grid;
+        grid = nullptr;
     }
 
-    if (this->plane) {
-        glDeleteVertexArrays(1, &this->plane->vao);
-        glDeleteBuffers(4, this->plane->vbo);
-        glDeleteBuffers(1, &this->plane->ebo);
-        delete this->plane;
-        this->plane = nullptr;
-    }
-
-    if (this->texture) {
-        delete this->texture;
-        this->texture = nullptr;
+    if (heightMap) {
+        delete heightMap;
+        heightMap = nullptr;
     }
 
     if (reflectionFBO) {
@@ -66,376 +63,146 @@ void Water::cleanup() {
     }
 }
 
-void Water::initSineWave() {
-    cleanup();
-
-    if (!this->shader) {
-        this->shader = new Shader("./shaders/sineWave.vert", nullptr, nullptr,
-                                  nullptr, "./shaders/sineWave.frag");
-    }
-
-    if (!this->commonMatrices) {
-        this->commonMatrices = new UBO();
-        this->commonMatrices->size = 2 * sizeof(glm::mat4);
-        glGenBuffers(1, &this->commonMatrices->ubo);
-        glBindBuffer(GL_UNIFORM_BUFFER, this->commonMatrices->ubo);
-        glBufferData(GL_UNIFORM_BUFFER, this->commonMatrices->size, NULL,
-                     GL_STATIC_DRAW);
-        glBindBuffer(GL_UNIFORM_BUFFER, 0);
-    }
-
-    // Initialize wave parameters
-    waveDirections.clear();
-    waveWavelengths.clear();
-    waveAmplitudes.clear();
-    waveSpeeds.clear();
-
-    // Add some waves
+void Water::init() {
+    if (grid)
+        return;
+
+    initGrid();
+    heightMap = new Texture2D("./images/waterHeightMap.jpg");
+
+    // The variants read the directional shadow, its filter and smoke
+    AssetCache& cache = AssetCache::instance();
+    const unsigned features =
+        FEATURE_SMOKE | FEATURE_DIR_SHADOW | FEATURE_VSM_SHADOWS;
+    variants[HEIGHT_MAP].shaders = cache.getShaderVariants(
+        "./shaders/heightMapWave.vert", nullptr, nullptr, nullptr,
+        "./shaders/heightMapWave.frag", features);
+    variants[HEIGHT_MAP].texture = heightMap;
+    variants[SINE_WAVE].shaders = cache.getShaderVariants(
+        "./shaders/sineWave.vert", nullptr, nullptr, nullptr,
+        "./shaders/sineWave.frag", features);
+    variants[REFLECTION].shaders = cache.getShaderVariants(
+        "./shaders/reflection.vert", nullptr, nullptr, nullptr,
+        "./shaders/reflection.frag", features);
+    for (Variant& variant : variants)
+        variant.plane = grid;
+
+    // Waves of the sine variant; the others ignore them
     // Adjusted for size 1.0 (Church size)
-    waveDirections.push_back(glm::vec2(1.0f, 0.5f));
-    waveWavelengths.push_back(0.5f);
-    waveAmplitudes.push_back(0.04f);
-    waveSpeeds.push_back(0.1f);
-
-    if (!this->plane) {
-        const int N = 200;        // High resolution
-        const float size = 1.0f;  // Same as Church
-        const float step = size / N;
-
-        std::vector<GLfloat> vertices;
-        std::vector<GLfloat> normals;
-        std::vector<GLfloat> texcoords;
-        std::vector<GLfloat> colors;
-        std::vector<GLuint> elements;
-
-        // Generate grid
-        for (int j = 0; j <= N; ++j) {
-            for (int i = 0; i <= N; ++i) {
-                float x = -size / 2.0f + i * step;
-                float z = -size / 2.0f + j * step;
-
-                vertices.push_back(x);
-                vertices.push_back(0.0f);
-                vertices.push_back(z);
-
-                normals.push_back(0.0f);
-                normals.push_back(1.0f);
-                normals.push_back(0.0f);
-
-                texcoords.push_back((float)i / N);
-                texcoords.push_back((float)j / N);
-
-                colors.push_back(1.0f);
-                colors.push_back(1.0f);
-                colors.push_back(1.0f);
-            }
-        }
-
-        for (int j = 0; j < N; ++j) {
-            for (int i = 0; i < N; ++i) {
-                int row1 = j * (N + 1);
-                int row2 = (j + 1) * (N + 1);
-
-                elements.push_back(row1 + i);
-                elements.push_back(row2 + i);
-                elements.push_back(row1 + i + 1);
-
-                elements.push_back(row1 + i + 1);
-                elements.push_back(row2 + i);
-                elements.push_back(row2 + i + 1);
-            }
-        }
-
-        this->plane = new VAO();
-        this->plane->element_amount = elements.size();
-
-        glGenVertexArrays(1, &this->plane->vao);
-        glGenBuffers(4, this->plane->vbo);
-        glGenBuffers(1, &this->plane->ebo);
-
-        glBindVertexArray(this->plane->vao);
-
-        // Position
-        glBindBuffer(GL_ARRAY_BUFFER, this->plane->vbo[0]);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat),
-                     vertices.data(), GL_STATIC_DRAW);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-        // Normal
-        glBindBuffer(GL_ARRAY_BUFFER, this->plane->vbo[1]);
-        glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(GLfloat),
-                     normals.data(), GL_STATIC_DRAW);
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-        // Texture Coords
-        glBindBuffer(GL_ARRAY_BUFFER, this->plane->vbo[2]);
-        glBufferData(GL_ARRAY_BUFFER, texcoords.size() * sizeof(GLfloat),
-                     texcoords.data(), GL_STATIC_DRAW);
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-        // Colors
-        glBindBuffer(GL_ARRAY_BUFFER, this->plane->vbo[3]);
-        glBufferData(GL_ARRAY_BUFFER, colors.size() * sizeof(GLfloat),
-                     colors.data(), GL_STATIC_DRAW);
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-        // Elements
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->plane->ebo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, elements.size() * sizeof(GLuint),
-                     elements.data(), GL_STATIC_DRAW);
-
-        glBindVertexArray(0);
-    }
+    waveDirections.assign(1, glm::vec2(1.0f, 0.5f));
+    waveWavelengths.assign(1, 0.5f);
+    waveAmplitudes.assign(1, 0.04f);
+    waveSpeeds.assign(1, 0.1f);
 }
 
-void Water::initHeightMapWave() {
-    cleanup();
-
-    if (!this->shader) {
-        this->shader =
-            new Shader("./shaders/heightMapWave.vert", nullptr, nullptr,
-                       nullptr, "./shaders/heightMapWave.frag");
-    }
-
-    if (!this->commonMatrices) {
-        this->commonMatrices = new UBO();
-        this->commonMatrices->size = 2 * sizeof(glm::mat4);
-        glGenBuffers(1, &this->commonMatrices->ubo);
-        glBindBuffer(GL_UNIFORM_BUFFER, this->commonMatrices->ubo);
-        glBufferData(GL_UNIFORM_BUFFER, this->commonMatrices->size, NULL,
-                     GL_STATIC_DRAW);
-        glBindBuffer(GL_UNIFORM_BUFFER, 0);
-    }
-
-    if (!this->texture) {
-        this->texture = new Texture2D("./images/waterHeightMap.jpg");
-    }
-
-    if (!this->plane) {
-        const int N = 200;        // High resolution
-        const float size = 1.0f;  // Same as Church
-        const float step = size / N;
-
-        std::vector<GLfloat> vertices;
-        std::vector<GLfloat> normals;
-        std::vector<GLfloat> texcoords;
-        std::vector<GLfloat> colors;
-        std::vector<GLuint> elements;
-
-        // Generate grid
-        for (int j = 0; j <= N; ++j) {
-            for (int i = 0; i <= N; ++i) {
-                float x = -size / 2.0f + i * step;
-                float z = -size / 2.0f + j * step;
-
-                vertices.push_back(x);
-                vertices.push_back(0.0f);
-                vertices.push_back(z);
-
-                normals.push_back(0.0f);
-                normals.push_back(1.0f);
-                normals.push_back(0.0f);
-
-                texcoords.push_back((float)i / N);
-                texcoords.push_back((float)j / N);
-
-                colors.push_back(1.0f);
-                colors.push_back(1.0f);
-                colors.push_back(1.0f);
-            }
-        }
-
-        for (int j = 0; j < N; ++j) {
-            for (int i = 0; i < N; ++i) {
-                int row1 = j * (N + 1);
-                int row2 = (j + 1) * (N + 1);
-
-                elements.push_back(row1 + i);
-                elements.push_back(row2 + i);
-                elements.push_back(row1 + i + 1);
-
-                elements.push_back(row1 + i + 1);
-                elements.push_back(row2 + i);
-                elements.push_back(row2 + i + 1);
-            }
-        }
-
-        this->plane = new VAO();
-        this->plane->element_amount = elements.size();
-
-        glGenVertexArrays(1, &this->plane->vao);
-        glGenBuffers(4, this->plane->vbo);
-        glGenBuffers(1, &this->plane->ebo);
-
-        glBindVertexArray(this->plane->vao);
-
-        // Position
-        glBindBuffer(GL_ARRAY_BUFFER, this->plane->vbo[0]);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat),
-                     vertices.data(), GL_STATIC_DRAW);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-        // Normal
-        glBindBuffer(GL_ARRAY_BUFFER, this->plane->vbo[1]);
-        glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(GLfloat),
-                     normals.data(), GL_STATIC_DRAW);
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-        // Texture Coords
-        glBindBuffer(GL_ARRAY_BUFFER, this->plane->vbo[2]);
-        glBufferData(GL_ARRAY_BUFFER, texcoords.size() * sizeof(GLfloat),
-                     texcoords.data(), GL_STATIC_DRAW);
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-        // Colors
-        glBindBuffer(GL_ARRAY_BUFFER, this->plane->vbo[3]);
-        glBufferData(GL_ARRAY_BUFFER, colors.size() * sizeof(GLfloat),
-                     colors.data(), GL_STATIC_DRAW);
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-        // Elements
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->plane->ebo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, elements.size() * sizeof(GLuint),
-                     elements.data(), GL_STATIC_DRAW);
-
-        glBindVertexArray(0);
-    }
+void Water::printStats() const {
+    const double kb = 1.0 / 1024.0;
+    // Render targets of the reflection variant: two RGB8 colors, 24 and 32
+    // bit depth
+    const size_t targetBytes =
+        reflectionFBO
+            ? (size_t)waterFBOWidth * waterFBOHeight * (3 + 3 + 3 + 4)
+            : 0;
+    std::cout << "Water grid: " << gridBytes * kb
+              << " KB, shared by every water variant" << std::endl;
+    std::cout << "Water height map: "
+              << (heightMap ? heightMap->getGpuBytes() : 0) * kb
+              << " KB texture" << std::endl;
+    std::cout << "Water sine wave: 0 KB of its own" << std::endl;
+    std::cout << "Water reflection: " << targetBytes * kb
+              << " KB render targets at " << waterFBOWidth << "x"
+              << waterFBOHeight << ", " << reflectionPasses
+              << " reflection and " << refractionPasses
+              << " refraction passes over " << passFrames << " frames"
+              << std::endl;
 }
 
-void Water::initReflectionWater(TrainView* tw) {
-    cleanup();
-
-    if (!this->shader) {
-        this->shader = new Shader("./shaders/reflection.vert", nullptr, nullptr,
-                                  nullptr, "./shaders/reflection.frag");
+// Unit grid the variants displace and scale; 200x200 to match the
+// resolution of the terrain so the top view looks seamless
+void Water::initGrid() {
+    const int N = 200;        // High resolution
+    const float size = 1.0f;  // Same as Church
+    const float step = size / N;
+
+    std::vector<GLfloat> vertices;
+    std::vector<GLfloat> normals;
+    std::vector<GLfloat> texcoords;
+    std::vector<GLuint> elements;
+
+    // Generate grid
+    for (int j = 0; j <= N; ++j) {
+        for (int i = 0; i <= N; ++i) {
+            float x = -size / 2.0f + i * step;
+            float z = -size / 2.0f + j * step;
+
+            vertices.push_back(x);
+            vertices.push_back(0.0f);
+            vertices.push_back(z);
+
+            normals.push_back(0.0f);
+            normals.push_back(1.0f);
+            normals.push_back(0.0f);
+
+            texcoords.push_back((float)i / N);
+            texcoords.push_back((float)j / N);
+        }
     }
 
-    if (!this->commonMatrices) {
-        this->commonMatrices = new UBO();
-        this->commonMatrices->size = 2 * sizeof(glm::mat4);
-        glGenBuffers(1, &this->commonMatrices->ubo);
-        glBindBuffer(GL_UNIFORM_BUFFER, this->commonMatrices->ubo);
-        glBufferData(GL_UNIFORM_BUFFER, this->commonMatrices->size, NULL,
-                     GL_STATIC_DRAW);
-        glBindBuffer(GL_UNIFORM_BUFFER, 0);
-    }
+    for (int j = 0; j < N; ++j) {
+        for (int i = 0; i < N; ++i) {
+            int row1 = j * (N + 1);
+            int row2 = (j + 1) * (N + 1);
 
-    if (!this->plane) {
-        const int N =
-            200;  // match resolution of terrain / other water types so top view looks seamless
-        // base mesh size (unit plane). Actual size is handled by model matrix scale in drawPlane
-        float size = 1.0f;
-        const float step = size / N;  // side length of each square
-
-        std::vector<GLfloat> vertices;
-        std::vector<GLfloat> normals;
-        std::vector<GLfloat> texcoords;
-        std::vector<GLfloat> colors;
-        std::vector<GLuint> elements;
-
-        // Generate grid vertices (N+1) x (N+1)
-        for (int j = 0; j <= N; ++j) {
-            for (int i = 0; i <= N; ++i) {
-                float x = -size / 2.0f + i * step;
-                float z = -size / 2.0f + j * step;
-
-                vertices.push_back(x);
-                vertices.push_back(0.0f);
-                vertices.push_back(z);
-
-                normals.push_back(0.0f);
-                normals.push_back(1.0f);
-                normals.push_back(0.0f);
-
-                texcoords.push_back((float)i / N);
-                texcoords.push_back((float)j / N);
-
-                // color gradient (for visualization)
-                colors.push_back((float)i / N);
-                colors.push_back((float)j / N);
-                colors.push_back(1.0f - (float)i / N);
-            }
-        }
+            elements.push_back(row1 + i);
+            elements.push_back(row2 + i);
+            elements.push_back(row1 + i + 1);
 
-        // Generate indices (2 triangles per square)
-        for (int j = 0; j < N; ++j) {
-            for (int i = 0; i < N; ++i) {
-                int row1 = j * (N + 1);
-                int row2 = (j + 1) * (N + 1);
-
-                GLuint a = row1 + i;
-                GLuint b = row1 + i + 1;
-                GLuint c = row2 + i;
-                GLuint d = row2 + i + 1;
-
-                // two right triangles forming a square
-                // triangle 1: a-b-c (lower left)
-                elements.push_back(a);
-                elements.push_back(b);
-                elements.push_back(c);
-
-                // triangle 2: b-d-c (upper right)
-                elements.push_back(b);
-                elements.push_back(d);
-                elements.push_back(c);
-            }
+            elements.push_back(row1 + i + 1);
+            elements.push_back(row2 + i);
+            elements.push_back(row2 + i + 1);
         }
-
-        this->plane = new VAO();
-        this->plane->element_amount = static_cast<GLuint>(elements.size());
-
-        glGenVertexArrays(1, &this->plane->vao);
-        glGenBuffers(4, this->plane->vbo);
-        glGenBuffers(1, &this->plane->ebo);
-        glBindVertexArray(this->plane->vao);
-
-        // Position
-        glBindBuffer(GL_ARRAY_BUFFER, this->plane->vbo[0]);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat),
-                     vertices.data(), GL_STATIC_DRAW);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat),
-                              (GLvoid*)0);
-        glEnableVertexAttribArray(0);
-
-        // Normal
-        glBindBuffer(GL_ARRAY_BUFFER, this->plane->vbo[1]);
-        glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(GLfloat),
-                     normals.data(), GL_STATIC_DRAW);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat),
-                              (GLvoid*)0);
-        glEnableVertexAttribArray(1);
-
-        // Texcoord
-        glBindBuffer(GL_ARRAY_BUFFER, this->plane->vbo[2]);
-        glBufferData(GL_ARRAY_BUFFER, texcoords.size() * sizeof(GLfloat),
-                     texcoords.data(), GL_STATIC_DRAW);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat),
-                              (GLvoid*)0);
-        glEnableVertexAttribArray(2);
-
-        // Color
-        glBindBuffer(GL_ARRAY_BUFFER, this->plane->vbo[3]);
-        glBufferData(GL_ARRAY_BUFFER, colors.size() * sizeof(GLfloat),
-                     colors.data(), GL_STATIC_DRAW);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat),
-                              (GLvoid*)0);
-        glEnableVertexAttribArray(3);
-
-        // Element buffer
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->plane->ebo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, elements.size() * sizeof(GLuint),
-                     elements.data(), GL_STATIC_DRAW);
-
-        glBindVertexArray(0);
     }
+
+    grid = new VAO();
+    grid->element_amount = elements.size();
+
+    glGenVertexArrays(1, &grid->vao);
+    glGenBuffers(3, grid->vbo);
+    glGenBuffers(1, &grid->ebo);
+
+    glBindVertexArray(grid->vao);
+
+    // Position
+    glBindBuffer(GL_ARRAY_BUFFER, grid->vbo[0]);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat),
+                 vertices.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+    // Normal
+    glBindBuffer(GL_ARRAY_BUFFER, grid->vbo[1]);
+    glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(GLfloat),
+                 normals.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+    // Texture Coords
+    glBindBuffer(GL_ARRAY_BUFFER, grid->vbo[2]);
+    glBufferData(GL_ARRAY_BUFFER, texcoords.size() * sizeof(GLfloat),
+                 texcoords.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+    // Elements
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, grid->ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, elements.size() * sizeof(GLuint),
+                 elements.data(), GL_STATIC_DRAW);
+
+    glBindVertexArray(0);
+
+    gridBytes = (vertices.size() + normals.size() + texcoords.size()) *
+                    sizeof(GLfloat) +
+                elements.size() * sizeof(GLuint);
 }
 
 void Water::initWaterFBOs(int width, int height) {
@@ -453,6 +220,7 @@ void Water::initWaterFBOs(int width, int height) {
     glBindFramebuffer(GL_FRAMEBUFFER, reflectionFBO);
 
     if (reflectionTexture == 0 || resize) {
+        reflectionCurrent = false;
         if (reflectionTexture == 0) {
             glGenTextures(1, &reflectionTexture);
         }
@@ -491,6 +259,7 @@ void Water::initWaterFBOs(int width, int height) {
     glBindFramebuffer(GL_FRAMEBUFFER, refractionFBO);
 
     if (refractionTexture == 0 || resize) {
+        refractionCurrent = false;
         if (refractionTexture == 0) {
             glGenTextures(1, &refractionTexture);
         }
@@ -529,11 +298,42 @@ void Water::initWaterFBOs(int width, int height) {
     glBindFramebuffer(GL_FRAMEBUFFER, prevFBO);
 }
 
-void Water::renderReflection(TrainView* tw) {
+void Water::renderPasses(TrainView* tw, const MatrixStack& camera) {
     if (tw->tw->shaderBrowser->value() != 5)
         return;  // Only for reflection water
 
-    initWaterFBOs(tw->w(), tw->h());
+    const float scale = glm::clamp(renderScale, 0.1f, 1.0f);
+    initWaterFBOs(std::max(1, (int)(tw->w() * scale)),
+                  std::max(1, (int)(tw->h() * scale)));
+    ++passFrames;
+
+    const bool cameraMoved =
+        camera.view != lastView || camera.projection != lastProjection;
+    lastView = camera.view;
+    lastProjection = camera.projection;
+
+    // Stale targets first; otherwise the scheduled pass, if one is due
+    bool reflect = !reflectionCurrent;
+    bool refract = !refractionCurrent;
+    const int interval = cameraMoved ? 1 : std::max(stillRefreshInterval, 1);
+    if (!reflect && !refract && ++framesSincePass >= interval) {
+        reflect = reflectionNext;
+        refract = !reflectionNext;
+    }
+    if (reflect != refract) {
+        reflectionNext = refract;
+        framesSincePass = 0;
+    }
+
+    if (reflect)
+        renderReflection(tw, camera);
+    if (refract)
+        renderRefraction(tw, camera);
+}
+
+void Water::renderReflection(TrainView* tw, const MatrixStack& camera) {
+    if (tw->tw->shaderBrowser->value() != 5)
+        return;  // Only for reflection water
 
     // Save previous FBO, viewport, and matrices to restore later
     GLint prevFBO = 0;
@@ -541,30 +341,22 @@ void Water::renderReflection(TrainView* tw) {
     GLint prevViewport[4];
     glGetIntegerv(GL_VIEWPORT, prevViewport);
 
-    // Save current camera modelview matrix
-    glm::mat4 originalModelView;
-    glGetFloatv(GL_MODELVIEW_MATRIX, &originalModelView[0][0]);
-
     glBindFramebuffer(GL_FRAMEBUFFER, reflectionFBO);
     glViewport(0, 0, waterFBOWidth, waterFBOHeight);
     glEnable(GL_DEPTH_TEST);
     glClearColor(0.05f, 0.12f, 0.18f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    // Use the same projection as main scene
-    glMatrixMode(GL_PROJECTION);
-    glPushMatrix();
-    // Projection is already set by setProjection(), don't change it
-
-    // Apply mirror transformation on top of existing camera view
-    glMatrixMode(GL_MODELVIEW);
-    glPushMatrix();
-    // Start with current camera view
-    glLoadMatrixf(&originalModelView[0][0]);
-    // Then apply mirror transformation
-    glTranslatef(0.0f, waterHeight, 0.0f);
-    glScalef(1.0f, -1.0f, 1.0f);
-    glTranslatef(0.0f, -waterHeight, 0.0f);
+    // Same projection as the main scene, with the camera view mirrored
+    // about the water plane
+    MatrixStack mirrored = camera;
+    mirrored.view = glm::translate(mirrored.view,
+                                   glm::vec3(0.0f, waterHeight, 0.0f));
+    mirrored.view = glm::scale(mirrored.view, glm::vec3(1.0f, -1.0f, 1.0f));
+    mirrored.view = glm::translate(mirrored.view,
+                                   glm::vec3(0.0f, -waterHeight, 0.0f));
+    mirrored.setClipPlane(glm::vec4(0.0f, 1.0f, 0.0f, -waterHeight));
+    mirrored.load();
 
     // Clip everything below the water plane for reflection
     glEnable(GL_CLIP_PLANE0);
@@ -573,108 +365,59 @@ void Water::renderReflection(TrainView* tw) {
 
     // Set up lighting for reflection view
     tw->setLighting();
+    tw->updateFrameConstants(mirrored);
 
     // Draw skybox in reflected view
-    if (tw->skybox) {
-        glm::mat4 view_matrix;
-        glGetFloatv(GL_MODELVIEW_MATRIX, &view_matrix[0][0]);
-        glm::mat4 projection_matrix;
-        glGetFloatv(GL_PROJECTION_MATRIX, &projection_matrix[0][0]);
-        tw->skybox->draw(view_matrix, projection_matrix);
-    }
+    if (tw->skybox)
+        tw->skybox->draw(mirrored.view, mirrored.projection);
 
     // Draw all scene objects in reflection view
     glUseProgram(0);
 
     // Draw terrain in reflection (respect clip plane — keep GL_CLIP_PLANE0 enabled)
     if (tw->terrain) {
-        glm::mat4 view_matrix;
-        glGetFloatv(GL_MODELVIEW_MATRIX, &view_matrix[0][0]);
-        glm::mat4 projection_matrix;
-        glGetFloatv(GL_PROJECTION_MATRIX, &projection_matrix[0][0]);
-        glm::mat4 invView = glm::inverse(view_matrix);
-        glm::vec3 cameraPos = glm::vec3(invView[3]);
-        bool enableShadow = tw->tw && tw->tw->directionalLightButton &&
-                            tw->tw->directionalLightButton->value() != 0;
-        bool enableLight = enableShadow;
-        bool enablePointLight = tw->tw && tw->tw->pointLightButton &&
-                                tw->tw->pointLightButton->value() != 0;
-        bool enablePointShadow = enablePointLight;
-        glm::vec3 pointLightPos = tw->getPointLightPos();
-        bool enableSpotLight = tw->tw && tw->tw->spotLightButton &&
-                               tw->tw->spotLightButton->value() != 0;
-        bool enableSpotShadow = enableSpotLight;
-        glm::vec3 spotLightPos = tw->getSpotLightPos();
-        glm::vec3 spotLightDir = tw->getSpotLightDir();
-        float spotInnerCos = glm::cos(glm::radians(22.0f));
-        float spotOuterCos = glm::cos(glm::radians(32.0f));
-        glm::vec4 clipPlane(0.0f, 1.0f, 0.0f, -waterHeight);
-        glm::vec2 smokeParams(tw->getSmokeStart(), tw->getSmokeEnd());
-        bool smokeEnabled = (tw->tw && tw->tw->smokeButton)
-                                ? (tw->tw->smokeButton->value() != 0)
-                                : false;
-        tw->terrain->draw(
-            view_matrix, projection_matrix, tw->getLightSpaceMatrix(),
-            tw->getShadowMap(), tw->getDirLightDir(), cameraPos, smokeParams,
-            smokeEnabled, enableShadow, enableLight, pointLightPos,
-            tw->getPointShadowMap(), tw->getPointFarPlane(), enablePointShadow,
-            enablePointLight, spotLightPos, spotLightDir,
-            tw->getSpotLightMatrix(), tw->getSpotShadowMap(),
-            tw->getSpotFarPlane(), spotInnerCos, spotOuterCos, enableSpotShadow,
-            enableSpotLight, clipPlane, true);
+        tw->terrain->draw(tw->getSceneConstants(), tw->getShadowAtlas());
     }
 
     glEnable(GL_LIGHTING);
     setupObjects();
 
     // Draw all scene elements: track, train, oden, control points
-    tw->drawStuff();
+    tw->drawStuff(mirrored);
 
     // Disable clip plane before restoring matrices/state
     glDisable(GL_CLIP_PLANE0);
-
-    glMatrixMode(GL_PROJECTION);
-    glPopMatrix();
-    glMatrixMode(GL_MODELVIEW);
-    glPopMatrix();
+    camera.load();
 
     // Restore previous framebuffer and viewport
     glBindFramebuffer(GL_FRAMEBUFFER, prevFBO);
     glViewport(prevViewport[0], prevViewport[1], prevViewport[2],
                prevViewport[3]);
+
+    reflectionCurrent = true;
+    ++reflectionPasses;
 }
 
-void Water::renderRefraction(TrainView* tw) {
+void Water::renderRefraction(TrainView* tw, const MatrixStack& camera) {
     if (tw->tw->shaderBrowser->value() != 5)
         return;  // Only for reflection water
 
-    initWaterFBOs(tw->w(), tw->h());
-
     // Save previous FBO, viewport, and matrices to restore later
     GLint prevFBO = 0;
     glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prevFBO);
     GLint prevViewport[4];
     glGetIntegerv(GL_VIEWPORT, prevViewport);
 
-    // Save current camera modelview matrix
-    glm::mat4 originalModelView;
-    glGetFloatv(GL_MODELVIEW_MATRIX, &originalModelView[0][0]);
-
     glBindFramebuffer(GL_FRAMEBUFFER, refractionFBO);
     glViewport(0, 0, waterFBOWidth, waterFBOHeight);
     glEnable(GL_DEPTH_TEST);
     glClearColor(0.05f, 0.12f, 0.18f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    // Use the same projection as main scene
-    glMatrixMode(GL_PROJECTION);
-    glPushMatrix();
-    // Projection is already set, don't change it
-
     // Regular view for refraction (use current camera view)
-    glMatrixMode(GL_MODELVIEW);
-    glPushMatrix();
-    glLoadMatrixf(&originalModelView[0][0]);
+    MatrixStack underwater = camera;
+    underwater.setClipPlane(glm::vec4(0.0f, -1.0f, 0.0f, waterHeight));
+    underwater.load();
 
     // Clip everything above the water plane for refraction
     // This shows only objects underwater
@@ -684,6 +427,7 @@ void Water::renderRefraction(TrainView* tw) {
 
     // Set up lighting for refraction view
     tw->setLighting();
+    tw->updateFrameConstants(underwater);
 
     // Draw all scene objects that intersect with water (for underwater appearance)
     glEnable(GL_LIGHTING);
@@ -691,55 +435,21 @@ void Water::renderRefraction(TrainView* tw) {
 
     // Draw terrain in refraction (respect clip plane — keep GL_CLIP_PLANE0 enabled)
     if (tw->terrain) {
-        glm::mat4 view_matrix;
-        glGetFloatv(GL_MODELVIEW_MATRIX, &view_matrix[0][0]);
-        glm::mat4 projection_matrix;
-        glGetFloatv(GL_PROJECTION_MATRIX, &projection_matrix[0][0]);
-        glm::mat4 invView = glm::inverse(view_matrix);
-        glm::vec3 cameraPos = glm::vec3(invView[3]);
-        bool enableShadow = tw->tw && tw->tw->directionalLightButton &&
-                            tw->tw->directionalLightButton->value() != 0;
-        bool enableLight = enableShadow;
-        bool enablePointLight = tw->tw && tw->tw->pointLightButton &&
-                                tw->tw->pointLightButton->value() != 0;
-        bool enablePointShadow = enablePointLight;
-        glm::vec3 pointLightPos = tw->getPointLightPos();
-        bool enableSpotLight = tw->tw && tw->tw->spotLightButton &&
-                               tw->tw->spotLightButton->value() != 0;
-        bool enableSpotShadow = enableSpotLight;
-        glm::vec3 spotLightPos = tw->getSpotLightPos();
-        glm::vec3 spotLightDir = tw->getSpotLightDir();
-        float spotInnerCos = glm::cos(glm::radians(22.0f));
-        float spotOuterCos = glm::cos(glm::radians(32.0f));
-        glm::vec4 clipPlane(0.0f, -1.0f, 0.0f, waterHeight);
-        glm::vec2 smokeParams(tw->getSmokeStart(), tw->getSmokeEnd());
-        bool smokeEnabled = (tw->tw && tw->tw->smokeButton)
-                                ? (tw->tw->smokeButton->value() != 0)
-                                : false;
-        tw->terrain->draw(
-            view_matrix, projection_matrix, tw->getLightSpaceMatrix(),
-            tw->getShadowMap(), tw->getDirLightDir(), cameraPos, smokeParams,
-            smokeEnabled, enableShadow, enableLight, pointLightPos,
-            tw->getPointShadowMap(), tw->getPointFarPlane(), enablePointShadow,
-            enablePointLight, spotLightPos, spotLightDir,
-            tw->getSpotLightMatrix(), tw->getSpotShadowMap(),
-            tw->getSpotFarPlane(), spotInnerCos, spotOuterCos, enableSpotShadow,
-            enableSpotLight, clipPlane, true);
+        tw->terrain->draw(tw->getSceneConstants(), tw->getShadowAtlas());
     }
 
     // Draw all scene elements clipped below water: track, train, oden, control points
-    tw->drawStuff();
+    tw->drawStuff(underwater);
 
     // Disable clip plane before restoring matrices/state
     glDisable(GL_CLIP_PLANE0);
-
-    glMatrixMode(GL_PROJECTION);
-    glPopMatrix();
-    glMatrixMode(GL_MODELVIEW);
-    glPopMatrix();
+    camera.load();
 
     // Restore previous framebuffer and viewport
     glBindFramebuffer(GL_FRAMEBUFFER, prevFBO);
     glViewport(prevViewport[0], prevViewport[1], prevViewport[2],
                prevViewport[3]);
+
+    refractionCurrent = true;
+    ++refractionPasses;
 }
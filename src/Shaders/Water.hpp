@@ -1,31 +1,56 @@
 #pragma once
 #include <glm/glm.hpp>
+#include <cstddef>
+#include <memory>
 #include <vector>
 #include "../RenderUtilities/BufferObject.h"
 #include "../RenderUtilities/Shader.h"
+#include "../RenderUtilities/ShaderVariants.h"
 #include "../RenderUtilities/Texture.h"
 
 class TrainView;  // Forward declaration
+class MatrixStack;
 
+// The water content of the shader browser. The variants are built once by
+// init and stay resident, all drawing the same grid, so switching between
+// them only picks another program.
 class Water {
 public:
+    enum Kind { HEIGHT_MAP, SINE_WAVE, REFLECTION, KIND_COUNT };
+
+    struct Variant {
+        std::shared_ptr<ShaderVariants> shaders;  // Through the AssetCache
+        VAO* plane = nullptr;                     // The shared grid
+        Texture2D* texture = nullptr;             // Not owned
+    };
+
     Water();
     ~Water();
 
-    void initSineWave();
-    void initHeightMapWave();
-    // Initialize reflection water with size tied to current terrain in TrainView
-    void initReflectionWater(TrainView* tw);
+    // Build the grid, textures and every variant. GL thread; later calls do
+    // nothing.
+    void init();
+    const Variant& get(Kind kind) const { return variants[kind]; }
+    void printStats() const;
+
     void initWaterFBOs(int width, int height);
 
+    // Run the reflection and refraction passes due this frame, into targets
+    // renderScale times the window size. While the camera moves the passes
+    // alternate frames; while it is still one runs every
+    // stillRefreshInterval frames. A pass whose target is new runs at once.
+    void renderPasses(TrainView* tw, const MatrixStack& camera);
+
+    // Mark both targets stale, for frames the reflection water is not drawn
+    void invalidatePasses() { reflectionCurrent = refractionCurrent = false; }
+
     // Render methods need access to TrainView to draw the scene
-    void renderReflection(TrainView* tw);
-    void renderRefraction(TrainView* tw);
+    // camera is the main view; each pass derives its own from it
+    void renderReflection(TrainView* tw, const MatrixStack& camera);
+    void renderRefraction(TrainView* tw, const MatrixStack& camera);
 
-    VAO* plane = nullptr;
-    Texture2D* texture = nullptr;
-    Shader* shader = nullptr;
-    UBO* commonMatrices = nullptr;
+    float renderScale = 0.5f;
+    int stillRefreshInterval = 4;
 
     // FBOs
     unsigned int reflectionFBO = 0;
@@ -48,5 +73,24 @@ public:
     float heightMapScale = 0.05f;
 
 private:
+    Variant variants[KIND_COUNT];
+    VAO* grid = nullptr;
+    size_t gridBytes = 0;
+    Texture2D* heightMap = nullptr;
+
+    // Pass scheduling
+    bool reflectionCurrent = false;
+    bool refractionCurrent = false;
+    bool reflectionNext = true;  // Which pass the schedule runs next
+    int framesSincePass = 0;
+    glm::mat4 lastView{ 0.0f };
+    glm::mat4 lastProjection{ 0.0f };
+
+    // Since startup
+    int passFrames = 0;
+    int reflectionPasses = 0;
+    int refractionPasses = 0;
+
+    void initGrid();
     void cleanup();
 };
@@ -0,0 +1,360 @@
+#include "HeightMapTiles.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <opencv2/opencv.hpp>
+
+#include "../RenderUtilities/FileStamp.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+const char kMagic[4] = { 'H', 'M', 'T', '2' };
+
+uint64_t tileBytes(uint32_t tileSize) {
+    return (uint64_t)tileSize * tileSize * sizeof(uint16_t);
+}
+}  // namespace
+
+// ---------------------------------------------------------------------------
+// HeightTileFile
+// ---------------------------------------------------------------------------
+
+bool HeightTileFile::open(const char* path) {
+    close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping =
+        CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        CloseHandle(file);
+        return false;
+    }
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    fileHandle = file;
+    mappingHandle = mapping;
+    data = static_cast<const unsigned char*>(view);
+    size = (size_t)fileSize.QuadPart;
+#else
+    fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+
+    void* view = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view == MAP_FAILED) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+
+    data = static_cast<const unsigned char*>(view);
+    size = (size_t)st.st_size;
+#endif
+
+    // Validate the header and level table before anyone reads tiles
+    bool valid = size >= sizeof(HeightTileHeader) &&
+                 std::memcmp(getHeader().magic, kMagic, 4) == 0 &&
+                 getHeader().levelCount > 0 && getHeader().tileSize > 0 &&
+                 size >= sizeof(HeightTileHeader) +
+                             getHeader().levelCount * sizeof(HeightTileLevel);
+    for (int l = 0; valid && l < getLevelCount(); ++l) {
+        const HeightTileLevel& level = getLevel(l);
+        uint64_t end = level.offset + (uint64_t)level.tilesX * level.tilesZ *
+                                          tileBytes(getHeader().tileSize);
+        valid = end <= size;
+    }
+
+    if (!valid) {
+        std::cout << "Invalid tiled height map: " << path << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void HeightTileFile::close() {
+#ifdef _WIN32
+    if (data)
+        UnmapViewOfFile(data);
+    if (mappingHandle)
+        CloseHandle(mappingHandle);
+    if (fileHandle)
+        CloseHandle(fileHandle);
+    mappingHandle = nullptr;
+    fileHandle = nullptr;
+#else
+    if (data)
+        munmap(const_cast<unsigned char*>(data), size);
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+#endif
+    data = nullptr;
+    size = 0;
+}
+
+const uint16_t* HeightTileFile::getTile(int level, int tileX,
+                                        int tileZ) const {
+    const HeightTileLevel& info = getLevel(level);
+    uint64_t index = (uint64_t)tileZ * info.tilesX + tileX;
+    return reinterpret_cast<const uint16_t*>(
+        data + info.offset + index * tileBytes(getHeader().tileSize));
+}
+
+bool HeightTileFile::matchesSource(const char* imagePath) const {
+    return FileStamp::matches(imagePath, getHeader().sourceSize,
+                              getHeader().sourceTime);
+}
+
+bool HeightTileFile::cook(const char* imagePath, const char* outPath,
+                          int tileSize) {
+    cv::Mat image =
+        cv::imread(imagePath, cv::IMREAD_GRAYSCALE | cv::IMREAD_ANYDEPTH);
+    if (image.empty()) {
+        std::cout << "Failed to load height map: " << imagePath << std::endl;
+        return false;
+    }
+
+    // 8-bit maps are widened so 0..255 keeps its old meaning (color - 100)
+    if (image.depth() != CV_16U)
+        image.convertTo(image, CV_16U, 257.0);
+
+    std::vector<cv::Mat> levels;
+    levels.push_back(image);
+    while (std::max(levels.back().cols, levels.back().rows) > tileSize) {
+        const cv::Mat& src = levels.back();
+        cv::Mat dst;
+        cv::resize(src, dst,
+                   cv::Size(std::max(1, src.cols / 2), std::max(1, src.rows / 2)),
+                   0, 0, cv::INTER_AREA);
+        levels.push_back(dst);
+    }
+
+    HeightTileHeader header;
+    std::memcpy(header.magic, kMagic, 4);
+    header.levelCount = (uint32_t)levels.size();
+    header.width = (uint32_t)image.cols;
+    header.depth = (uint32_t)image.rows;
+    header.tileSize = (uint32_t)tileSize;
+    header.heightScale = 1.0f / 257.0f;
+    header.heightOffset = -100.0f;
+    header.reserved = 0;
+    FileStamp source;
+    FileStamp::of(imagePath, source);
+    header.sourceSize = source.size;
+    header.sourceTime = source.time;
+
+    std::vector<HeightTileLevel> table(levels.size());
+    uint64_t offset = sizeof(HeightTileHeader) +
+                      levels.size() * sizeof(HeightTileLevel);
+    for (size_t l = 0; l < levels.size(); ++l) {
+        table[l].width = (uint32_t)levels[l].cols;
+        table[l].depth = (uint32_t)levels[l].rows;
+        table[l].tilesX = (table[l].width + tileSize - 1) / tileSize;
+        table[l].tilesZ = (table[l].depth + tileSize - 1) / tileSize;
+        table[l].offset = offset;
+        offset += (uint64_t)table[l].tilesX * table[l].tilesZ *
+                  tileBytes(tileSize);
+    }
+
+    std::ofstream out(outPath, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cout << "Failed to write tiled height map: " << outPath
+                  << std::endl;
+        return false;
+    }
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(table.data()),
+              table.size() * sizeof(HeightTileLevel));
+
+    std::vector<uint16_t> tile((size_t)tileSize * tileSize);
+    for (size_t l = 0; l < levels.size(); ++l) {
+        const cv::Mat& src = levels[l];
+        for (uint32_t tz = 0; tz < table[l].tilesZ; ++tz) {
+            for (uint32_t tx = 0; tx < table[l].tilesX; ++tx) {
+                // Pad edge tiles by repeating the last row / column
+                for (int z = 0; z < tileSize; ++z) {
+                    int sz = std::min<int>(tz * tileSize + z, src.rows - 1);
+                    const uint16_t* row = src.ptr<uint16_t>(sz);
+                    for (int x = 0; x < tileSize; ++x) {
+                        int sx = std::min<int>(tx * tileSize + x, src.cols - 1);
+                        tile[z * tileSize + x] = row[sx];
+                    }
+                }
+                out.write(reinterpret_cast<const char*>(tile.data()),
+                          tile.size() * sizeof(uint16_t));
+            }
+        }
+    }
+
+    std::cout << "Cooked tiled height map " << outPath << " (" << image.cols
+              << "x" << image.rows << ", " << levels.size() << " levels)"
+              << std::endl;
+    return (bool)out;
+}
+
+// ---------------------------------------------------------------------------
+// HeightTileCache
+// ---------------------------------------------------------------------------
+
+HeightTileCache::HeightTileCache(const HeightTileFile* file, size_t capacity)
+    : file(file), capacity(std::max<size_t>(capacity, 1)) {
+    pager = std::thread(&HeightTileCache::pagerLoop, this);
+}
+
+HeightTileCache::~HeightTileCache() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    if (pager.joinable())
+        pager.join();
+}
+
+float HeightTileCache::sample(int level, int x, int z) {
+    const HeightTileLevel& info = file->getLevel(level);
+    const int tileSize = (int)file->getHeader().tileSize;
+
+    x = std::max(0, std::min(x, (int)info.width - 1));
+    z = std::max(0, std::min(z, (int)info.depth - 1));
+
+    uint64_t key = makeKey(level, x / tileSize, z / tileSize);
+    TileData heights = find(key);
+    if (!heights) {
+        heights = decode(key);
+        insert(key, heights);
+    }
+    return (*heights)[(z % tileSize) * tileSize + (x % tileSize)];
+}
+
+void HeightTileCache::prefetch(int level, int x, int z, int radius) {
+    const HeightTileLevel& info = file->getLevel(level);
+    const int tileSize = (int)file->getHeader().tileSize;
+    const int centerX = x / tileSize;
+    const int centerZ = z / tileSize;
+
+    bool queued = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int tz = centerZ - radius; tz <= centerZ + radius; ++tz) {
+            for (int tx = centerX - radius; tx <= centerX + radius; ++tx) {
+                if (tx < 0 || tz < 0 || tx >= (int)info.tilesX ||
+                    tz >= (int)info.tilesZ)
+                    continue;
+                uint64_t key = makeKey(level, tx, tz);
+                if (resident.count(key) || !pending.insert(key).second)
+                    continue;
+                requests.push_back(key);
+                queued = true;
+            }
+        }
+    }
+    if (queued)
+        wake.notify_one();
+}
+
+size_t HeightTileCache::getResidentCount() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return resident.size();
+}
+
+HeightTileCache::TileData HeightTileCache::decode(uint64_t key) const {
+    const int level = (int)(key >> 48);
+    const int tileZ = (int)((key >> 24) & 0xFFFFFF);
+    const int tileX = (int)(key & 0xFFFFFF);
+
+    const HeightTileHeader& header = file->getHeader();
+    const uint16_t* raw = file->getTile(level, tileX, tileZ);
+    const size_t count = (size_t)header.tileSize * header.tileSize;
+
+    auto heights = std::make_shared<std::vector<float>>(count);
+    for (size_t i = 0; i < count; ++i)
+        (*heights)[i] = header.heightOffset + raw[i] * header.heightScale;
+    return heights;
+}
+
+HeightTileCache::TileData HeightTileCache::find(uint64_t key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = resident.find(key);
+    if (it == resident.end())
+        return nullptr;
+    lru.splice(lru.begin(), lru, it->second);
+    return it->second->heights;
+}
+
+void HeightTileCache::insert(uint64_t key, const TileData& heights) {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.erase(key);
+
+    auto it = resident.find(key);
+    if (it != resident.end()) {
+        lru.splice(lru.begin(), lru, it->second);
+        return;
+    }
+
+    lru.push_front(Entry{ key, heights });
+    resident[key] = lru.begin();
+
+    while (resident.size() > capacity) {
+        resident.erase(lru.back().key);
+        lru.pop_back();
+    }
+}
+
+void HeightTileCache::pagerLoop() {
+    for (;;) {
+        uint64_t key;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || !requests.empty(); });
+            if (stopping)
+                return;
+            key = requests.front();
+            requests.pop_front();
+            if (resident.count(key)) {
+                pending.erase(key);
+                continue;
+            }
+        }
+        insert(key, decode(key));
+    }
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// On-disk layout of a tiled heightmap (.hmt): header, one HeightTileLevel per
+// mip level, then raw 16-bit tiles. Level 0 is full resolution and every
+// following level halves both axes. Edge tiles are padded so each tile holds
+// exactly tileSize * tileSize samples.
+struct HeightTileHeader {
+    char magic[4];  // "HMT2"
+    uint32_t levelCount;
+    uint32_t width;
+    uint32_t depth;
+    uint32_t tileSize;
+    float heightScale;  // height = heightOffset + sample * heightScale
+    float heightOffset;
+    uint32_t reserved;
+    uint64_t sourceSize;  // Byte size and mtime of the image it was cooked
+    int64_t sourceTime;   // from, to detect a changed source
+};
+
+struct HeightTileLevel {
+    uint32_t width;
+    uint32_t depth;
+    uint32_t tilesX;
+    uint32_t tilesZ;
+    uint64_t offset;  // Byte offset of the first tile of this level
+};
+
+// Read-only memory mapping of a .hmt file. Nothing is decoded up front; the
+// OS pages the bytes in when a tile is touched.
+class HeightTileFile {
+public:
+    HeightTileFile() = default;
+    HeightTileFile(const HeightTileFile&) = delete;
+    HeightTileFile& operator=(const HeightTileFile&) = delete;
+    ~HeightTileFile() { close(); }
+
+    bool open(const char* path);
+    void close();
+
+    bool isOpen() const { return data != nullptr; }
+
+    const HeightTileHeader& getHeader() const {
+        return *reinterpret_cast<const HeightTileHeader*>(data);
+    }
+
+    int getLevelCount() const { return (int)getHeader().levelCount; }
+
+    const HeightTileLevel& getLevel(int level) const {
+        return reinterpret_cast<const HeightTileLevel*>(
+            data + sizeof(HeightTileHeader))[level];
+    }
+
+    const uint16_t* getTile(int level, int tileX, int tileZ) const;
+
+    // True if the file was cooked from the image as it is on disk now
+    bool matchesSource(const char* imagePath) const;
+
+    // Convert a grayscale image (8 or 16 bit) into a .hmt file. This is the
+    // only place that decodes the whole image; very large parks should be
+    // cooked once offline and shipped as .hmt.
+    static bool cook(const char* imagePath, const char* outPath,
+                     int tileSize = 256);
+
+private:
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+// Fixed-capacity set of decoded tiles with LRU eviction. A background pager
+// thread fills it from prefetch requests; a lookup that misses decodes the
+// tile synchronously, which is cheap since the file is already mapped.
+class HeightTileCache {
+public:
+    HeightTileCache(const HeightTileFile* file, size_t capacity);
+    ~HeightTileCache();
+
+    // Height at integer sample (x, z) of the given level, clamped to the edge
+    float sample(int level, int x, int z);
+
+    // Queue the tiles within radius tiles of (x, z) for the pager
+    void prefetch(int level, int x, int z, int radius);
+
+    size_t getResidentCount();
+
+private:
+    typedef std::shared_ptr<const std::vector<float>> TileData;
+
+    struct Entry {
+        uint64_t key;
+        TileData heights;
+    };
+
+    static uint64_t makeKey(int level, int tileX, int tileZ) {
+        return ((uint64_t)level << 48) | ((uint64_t)tileZ << 24) |
+               (uint64_t)tileX;
+    }
+
+    TileData decode(uint64_t key) const;
+    TileData find(uint64_t key);
+    void insert(uint64_t key, const TileData& heights);
+    void pagerLoop();
+
+    const HeightTileFile* file;
+    size_t capacity;
+
+    std::list<Entry> lru;  // Front is most recently used
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> resident;
+
+    std::deque<uint64_t> requests;
+    std::unordered_set<uint64_t> pending;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread pager;
+};
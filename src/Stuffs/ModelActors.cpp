@@ -1,11 +1,14 @@
 #include "ModelActors.hpp"
 
 #include <glad/glad.h>
+#include <algorithm>
 #include <cstdio>
-#include <glm/gtc/matrix_inverse.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <memory>
 #include <string>
+#include <vector>
 
+#include "../RenderUtilities/AssetCache.h"
 #include "../RenderUtilities/Model.h"
 #include "../RenderUtilities/Shader.h"
 #include "../TrainView.H"
@@ -33,157 +36,186 @@ std::string resolveAssetPath(const std::string& relative) {
     }
     return relative;
 }
+
+// Depth range the sort keys are quantized over
+const float MAX_SORT_DEPTH = 5000.0f;
+
+// Largest simplification error allowed on screen, as a fraction of the
+// viewport height. Reflections and shadows hide detail, so their passes
+// accept coarser levels.
+const float MAIN_LOD_TOLERANCE = 0.001f;
+const float REFLECTION_LOD_TOLERANCE = 0.003f;
+const float SHADOW_LOD_TOLERANCE = 0.004f;
+
+// Fraction of the viewport height one world unit at p covers; for passes
+// with several views, the largest over them
+float screenPerUnit(const MatrixStack& matrices, const glm::vec3& p) {
+    auto perUnit = [&p](const glm::mat4& viewProj) {
+        const glm::vec4 clip = viewProj * glm::vec4(p, 1.0f);
+        const float yScale = glm::length(
+            glm::vec3(viewProj[0][1], viewProj[1][1], viewProj[2][1]));
+        // Orthographic views have w == 1; a center behind a perspective
+        // camera counts as very close
+        return 0.5f * yScale / std::max(clip.w, 1e-3f);
+    };
+    if (matrices.cullViews.empty())
+        return perUnit(matrices.projection * matrices.view);
+    float largest = 0.0f;
+    for (const glm::mat4& viewProj : matrices.cullViews)
+        largest = std::max(largest, perUnit(viewProj));
+    return largest;
+}
 }  // namespace
 
+std::shared_ptr<ShaderVariants> modelShaderVariants() {
+    return AssetCache::instance().getShaderVariants(
+        "./shaders/model.vert", nullptr, nullptr, nullptr,
+        "./shaders/model.frag",
+        FEATURE_CLIP_PLANE | FEATURE_SMOKE | FEATURE_DIR_SHADOW |
+            FEATURE_VSM_SHADOWS | FEATURE_FLAT_SHADOW);
+}
+
 ModelActor::ModelActor(TrainView* view, std::string path, float uniformScale)
-    : owner(view), modelRelativePath(std::move(path)), scale(uniformScale) {}
+    : owner(view), modelRelativePath(std::move(path)), scale(uniformScale) {
+    // Start loading in the background right away; instances of a model
+    // share its buffers
+    model =
+        AssetCache::instance().getModel(resolveAssetPath(modelRelativePath));
+}
 
 void ModelActor::ensureResources() {
-    if (!shader) {
-        shader = new Shader("./shaders/model.vert", nullptr, nullptr, nullptr,
-                            "./shaders/model.frag");
-    }
-    if (!model) {
-        const std::string assetPath = resolveAssetPath(modelRelativePath);
-        model = new Model(assetPath);
+    // Every actor draws with the same variants, so the render queue can
+    // batch them under a single bind per variant
+    if (!shaders) {
+        shaders = modelShaderVariants();
     }
 }
 
-void ModelActor::drawInternal(const glm::mat4& modelMatrix, bool doingShadows,
-                              float smokeStart, float smokeEnd) {
+void ModelActor::drawInternal(const MatrixStack& matrices,
+                              const glm::mat4& modelMatrix,
+                              bool doingShadows) {
     if (!owner)
         return;
 
-    ensureResources();
-
-    glm::mat4 viewMatrix;
-    glGetFloatv(GL_MODELVIEW_MATRIX, &viewMatrix[0][0]);
-    glm::mat4 projectionMatrix;
-    glGetFloatv(GL_PROJECTION_MATRIX, &projectionMatrix[0][0]);
-
-    glm::mat4 scaledModel =
-        modelMatrix * glm::scale(glm::mat4(1.0f), glm::vec3(scale));
-    glm::mat3 normalMatrix =
-        glm::mat3(glm::transpose(glm::inverse(scaledModel)));
-
-    glm::vec3 cameraPos(0.0f);
-    if (!doingShadows) {
-        glm::mat4 invView = glm::inverse(viewMatrix);
-        cameraPos = glm::vec3(invView[3]);
-    }
-
-    float resolvedStart = smokeStart;
-    float resolvedEnd = smokeEnd;
-    if (owner && (resolvedStart < 0.0f || resolvedEnd <= resolvedStart)) {
-        resolvedStart = owner->getSmokeStart();
-        resolvedEnd = owner->getSmokeEnd();
-    }
-
-    glm::vec2 smokeParams(-1.0f, -1.0f);
-    if (resolvedEnd > resolvedStart && resolvedStart >= 0.0f) {
-        smokeParams = glm::vec2(resolvedStart, resolvedEnd);
-    }
-
-    shader->Use();
-
-    auto setMat4 = [&](const char* name, const glm::mat4& mat) {
-        const GLint loc = glGetUniformLocation(shader->Program, name);
-        if (loc >= 0) {
-            glUniformMatrix4fv(loc, 1, GL_FALSE, &mat[0][0]);
-        }
-    };
-
-    auto setMat3 = [&](const char* name, const glm::mat3& mat) {
-        const GLint loc = glGetUniformLocation(shader->Program, name);
-        if (loc >= 0) {
-            glUniformMatrix3fv(loc, 1, GL_FALSE, &mat[0][0]);
-        }
-    };
-
-    setMat4("uModel", scaledModel);
-    setMat4("uView", viewMatrix);
-    setMat4("uProjection", projectionMatrix);
-    setMat3("uNormalMatrix", normalMatrix);
+    // Nothing is drawn until the loader has uploaded the model
+    if (!model->isReady())
+        return;
 
-    // Directional shadow map inputs (so models receive shadows too)
-    if (owner) {
-        setMat4("uLightSpace", owner->getLightSpaceMatrix());
-
-        const GLint dirLoc =
-            glGetUniformLocation(shader->Program, "u_lightDir");
-        if (dirLoc >= 0) {
-            glm::vec3 dir = owner->getDirLightDir();
-            glUniform3fv(dirLoc, 1, &dir[0]);
-        }
+    ensureResources();
 
-        const bool shadowOn = owner->tw && owner->tw->directionalLightButton &&
-                              owner->tw->directionalLightButton->value() != 0;
-        const GLint enableShadowLoc =
-            glGetUniformLocation(shader->Program, "u_enableShadow");
-        if (enableShadowLoc >= 0) {
-            glUniform1i(enableShadowLoc, shadowOn ? 1 : 0);
+    // Anything the caller pushed (the legacy planar shadow projection, for
+    // one) is folded into the model matrix, since the shaders take the view
+    // from the frame constants
+    const glm::mat4 scaledModel = matrices.model() * modelMatrix *
+                                  glm::scale(glm::mat4(1.0f), glm::vec3(scale));
+
+    RenderQueue& queue = owner->getRenderQueue();
+    const std::vector<Mesh>& meshes = model->getMeshes();
+
+    // Skip the whole model, then single meshes, outside the pass's view.
+    // Projective stacks keep everything.
+    const bool affine = scaledModel[0][3] == 0.0f &&
+                        scaledModel[1][3] == 0.0f &&
+                        scaledModel[2][3] == 0.0f &&
+                        scaledModel[3][3] == 1.0f;
+    // Indices of the meshes to draw; all of them when not set
+    std::shared_ptr<std::vector<int>> visible;
+    if (affine) {
+        if (!matrices.isVisible(model->getBounds().transformed(scaledModel))) {
+            queue.countCulled(1, (int)meshes.size());
+            return;
         }
-
-        const GLint shadowMapLoc =
-            glGetUniformLocation(shader->Program, "u_shadowMap");
-        if (shadowMapLoc >= 0) {
-            GLint prevActiveTexture;
-            glGetIntegerv(GL_ACTIVE_TEXTURE, &prevActiveTexture);
-            glActiveTexture(GL_TEXTURE10);
-            glBindTexture(GL_TEXTURE_2D, owner->getShadowMap());
-            glUniform1i(shadowMapLoc, 10);
-            glActiveTexture(prevActiveTexture);
+        if (meshes.size() > 1) {
+            visible = std::make_shared<std::vector<int>>();
+            for (int i = 0; i < (int)meshes.size(); ++i) {
+                const BoundingBox bounds =
+                    meshes[i].getBounds().transformed(scaledModel);
+                if (matrices.isVisible(bounds))
+                    visible->push_back(i);
+            }
+            queue.countCulled(0, (int)(meshes.size() - visible->size()));
+            if (visible->size() == meshes.size())
+                visible.reset();
         }
     }
 
-    const GLint shadowLoc =
-        glGetUniformLocation(shader->Program, "uShadowPass");
-    if (shadowLoc >= 0) {
-        glUniform1i(shadowLoc, doingShadows ? 1 : 0);
-    }
-
-    const GLint smokeLoc =
-        glGetUniformLocation(shader->Program, "uSmokeParams");
-    if (smokeLoc >= 0) {
-        glUniform2fv(smokeLoc, 1, &smokeParams[0]);
-    }
-
-    const GLint smokeEnabledLoc =
-        glGetUniformLocation(shader->Program, "smokeEnabled");
-    if (smokeEnabledLoc >= 0 && owner && owner->tw && owner->tw->smokeButton) {
-        glUniform1i(smokeEnabledLoc, owner->tw->smokeButton->value() ? 1 : 0);
-    }
-
-    const GLint camLoc = glGetUniformLocation(shader->Program, "uCameraPos");
-    if (camLoc >= 0) {
-        glUniform3fv(camLoc, 1, &cameraPos[0]);
+    const glm::vec4 viewPos = matrices.view * scaledModel[3];
+    const float depth = -viewPos.z;
+    const Model* drawn = model.get();
+
+    // Level of detail from the model's projected size. Projective stacks
+    // are placed by the actor's own transform.
+    Shader* caster = owner->getShadowCasterShader();
+    const glm::mat4 placement =
+        affine ? scaledModel
+               : modelMatrix * glm::scale(glm::mat4(1.0f), glm::vec3(scale));
+    const float unitScale = std::max(
+        std::max(glm::length(glm::vec3(placement[0])),
+                 glm::length(glm::vec3(placement[1]))),
+        glm::length(glm::vec3(placement[2])));
+    const glm::vec3 center =
+        glm::vec3(placement * glm::vec4(model->getBounds().center(), 1.0f));
+    float tolerance = MAIN_LOD_TOLERANCE;
+    if (caster || doingShadows)
+        tolerance = SHADOW_LOD_TOLERANCE;
+    else if (matrices.clipEnabled)
+        tolerance = REFLECTION_LOD_TOLERANCE;
+    const int lod = drawn->selectLod(
+        screenPerUnit(matrices, center) * unitScale, tolerance);
+    queue.countLod(lod);
+
+    // Every visible mesh goes out in one indirect multi-draw over the
+    // model's merged buffers
+    RenderItem item;
+    item.vao = drawn->getVAO();
+
+    // Cascade shadow pass: depth only, through the layered caster program
+    if (caster) {
+        const glm::mat4 modelView = matrices.view * scaledModel;
+        item.program = caster->Program;
+        item.key = RenderQueue::makeKey(OPAQUE_PASS, item.program, 0, depth,
+                                        MAX_SORT_DEPTH);
+        item.draw = [&matrices, modelView, drawn, visible, lod]() {
+            glMatrixMode(GL_MODELVIEW);
+            glLoadMatrixf(&modelView[0][0]);
+            drawn->drawMeshes(visible.get(), lod);
+            matrices.loadModelView();
+        };
+        queue.submit(item);
+        return;
     }
 
-    // Clip plane for water reflection shaders
-    glm::vec4 clipPlane(0.0f);
-    if (glIsEnabled(GL_CLIP_PLANE0)) {
-        double clippedPlaneEquation[4];
-        glGetClipPlane(GL_CLIP_PLANE0, clippedPlaneEquation);
-        clipPlane = glm::vec4(
-            (float)clippedPlaneEquation[0], (float)clippedPlaneEquation[1],
-            (float)clippedPlaneEquation[2], (float)clippedPlaneEquation[3]);
-    }
+    TrainView* view = owner;
+    // The planar shadow pass draws flat, so only the clip plane matters
+    unsigned features = view->getSceneFeatures();
+    if (doingShadows)
+        features = (features & FEATURE_CLIP_PLANE) | FEATURE_FLAT_SHADOW;
+    Shader* program = shaders->get(features);
+    item.program = program->Program;
+    item.textureCount = std::max(drawn->getTextureArrayCount(), 1);
+    for (int i = 0; i < drawn->getTextureArrayCount(); ++i)
+        item.textures[i] = drawn->getTextureArray(i);
+    item.textureTarget = GL_TEXTURE_2D_ARRAY;
+    item.key = RenderQueue::makeKey(OPAQUE_PASS, item.program,
+                                    item.textures[0], depth, MAX_SORT_DEPTH);
 
-    // Set clip plane uniform
-    const GLint clipPlaneLoc =
-        glGetUniformLocation(shader->Program, "uClipPlane");
-    if (clipPlaneLoc >= 0) {
-        glUniform4fv(clipPlaneLoc, 1, &clipPlane[0]);
-    }
+    // Directional shadow map inputs (so models receive shadows too)
+    item.setup = [program, view]() {
+        view->getShadowAtlas().apply(program, 10);
+        Model::setTextureUnits(*program);
+    };
 
-    GLboolean wasCullEnabled = glIsEnabled(GL_CULL_FACE);
-    glDisable(GL_CULL_FACE);
-    model->Draw(*shader);
-    if (wasCullEnabled)
-        glEnable(GL_CULL_FACE);
-    model->Draw(*shader);
+    item.draw = [view, drawn, visible, scaledModel, lod]() {
+        view->getSceneConstants().pushObject(scaledModel);
+        drawn->bindMaterials();
 
-    glUseProgram(0);
+        GLboolean wasCullEnabled = glIsEnabled(GL_CULL_FACE);
+        glDisable(GL_CULL_FACE);
+        drawn->drawMeshes(visible.get(), lod);
+        if (wasCullEnabled)
+            glEnable(GL_CULL_FACE);
+    };
+    queue.submit(item);
 }
 
 McChest::McChest(TrainView* owner)
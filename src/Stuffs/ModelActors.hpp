@@ -2,11 +2,16 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <memory>
 #include <string>
 
 class TrainView;
-class Shader;
+class ShaderVariants;
 class Model;
+class MatrixStack;
+
+// Variants of the program every model actor draws with
+std::shared_ptr<ShaderVariants> modelShaderVariants();
 
 class ModelActor {
 public:
@@ -15,16 +20,18 @@ public:
 protected:
     ModelActor(TrainView* owner, std::string modelPath, float uniformScale);
 
-    void drawInternal(const glm::mat4& modelMatrix, bool doingShadows,
-                      float smokeStart = -1.0f, float smokeEnd = -1.0f);
+    // modelMatrix is relative to the top of the caller's stack
+    void drawInternal(const MatrixStack& matrices, const glm::mat4& modelMatrix,
+                      bool doingShadows);
 
 private:
     void ensureResources();
 
 protected:
     TrainView* owner = nullptr;
-    Shader* shader = nullptr;
-    Model* model = nullptr;
+    // Both shared through the AssetCache
+    std::shared_ptr<ShaderVariants> shaders;
+    std::shared_ptr<Model> model;
     std::string modelRelativePath;
     float scale = 1.0f;
 };
@@ -33,10 +40,10 @@ class McChest : public ModelActor {
 public:
     explicit McChest(TrainView* owner);
 
-    void draw(const glm::vec3& position) {
+    void draw(const MatrixStack& matrices, const glm::vec3& position) {
         glm::mat4 model(1.0f);
         model = glm::translate(model, position);
-        drawInternal(model, false);
+        drawInternal(matrices, model, false);
     }
 };
 
@@ -44,15 +51,15 @@ class McMinecart : public ModelActor {
 public:
     explicit McMinecart(TrainView* owner);
 
-    void draw(const glm::vec3& position) {
+    void draw(const MatrixStack& matrices, const glm::vec3& position) {
         glm::mat4 model(1.0f);
         model = glm::translate(model, position);
-        drawInternal(model, false);
+        drawInternal(matrices, model, false);
     }
 
-    void draw(const glm::mat4& modelMatrix, bool doingShadows,
-              float smokeStart, float smokeEnd) {
-        drawInternal(modelMatrix, doingShadows, smokeStart, smokeEnd);
+    void draw(const MatrixStack& matrices, const glm::mat4& modelMatrix,
+              bool doingShadows) {
+        drawInternal(matrices, modelMatrix, doingShadows);
     }
 };
 
@@ -60,11 +67,11 @@ class McFox : public ModelActor {
 public:
     explicit McFox(TrainView* owner);
 
-    void draw(const glm::vec3& position) {
+    void draw(const MatrixStack& matrices, const glm::vec3& position) {
         glm::mat4 model(1.0f);
         model = glm::translate(model, position);
         model = glm::rotate(model, glm::radians(180.0f), glm::vec3(0, 1, 0));
-        drawInternal(model, false);
+        drawInternal(matrices, model, false);
     }
 };
 
@@ -72,15 +79,15 @@ class McVillager : public ModelActor {
 public:
     explicit McVillager(TrainView* owner);
 
-    void draw(const glm::vec3& position) {
+    void draw(const MatrixStack& matrices, const glm::vec3& position) {
         glm::mat4 model(1.0f);
         model = glm::translate(model, position);
-        drawInternal(model, false);
+        drawInternal(matrices, model, false);
     }
 
-    void draw(const glm::mat4& modelMatrix, bool doingShadows,
-              float smokeStart, float smokeEnd) {
-        drawInternal(modelMatrix, doingShadows, smokeStart, smokeEnd);
+    void draw(const MatrixStack& matrices, const glm::mat4& modelMatrix,
+              bool doingShadows) {
+        drawInternal(matrices, modelMatrix, doingShadows);
     }
 };
 
@@ -88,11 +95,11 @@ class Tunnel : public ModelActor {
 public:
     explicit Tunnel(TrainView* owner);
 
-    void draw(const glm::vec3& position) {
+    void draw(const MatrixStack& matrices, const glm::vec3& position) {
         glm::mat4 model(1.0f);
         model = glm::translate(model, position);
         model = glm::rotate(model, glm::radians(-45.0f), glm::vec3(0, 1, 0));
-        drawInternal(model, false);
+        drawInternal(matrices, model, false);
     }
 };
 
@@ -100,16 +107,17 @@ class Ghast : public ModelActor {
 public:
     explicit Ghast(TrainView* owner);
 
-    void draw(const glm::vec3& position, float yawRadians) {
+    void draw(const MatrixStack& matrices, const glm::vec3& position,
+              float yawRadians) {
         glm::mat4 model(1.0f);
         model = glm::translate(model, position);
         model = glm::rotate(model, yawRadians + glm::radians(90.0f), glm::vec3(0, 1, 0));
-        drawInternal(model, false);
+        drawInternal(matrices, model, false);
     }
 
-    void draw(const glm::mat4& modelMatrix, bool doingShadows,
-              float smokeStart, float smokeEnd) {
-        drawInternal(modelMatrix, doingShadows, smokeStart, smokeEnd);
+    void draw(const MatrixStack& matrices, const glm::mat4& modelMatrix,
+              bool doingShadows) {
+        drawInternal(matrices, modelMatrix, doingShadows);
     }
 };
 
@@ -117,15 +125,15 @@ class TNT : public ModelActor {
 public:
     explicit TNT(TrainView* owner);
 
-    void draw(const glm::vec3& position) {
+    void draw(const MatrixStack& matrices, const glm::vec3& position) {
         glm::mat4 model(1.0f);
         model = glm::translate(model, position);
-        drawInternal(model, false);
+        drawInternal(matrices, model, false);
     }
 
-    void draw(const glm::mat4& modelMatrix, bool doingShadows,
-              float smokeStart, float smokeEnd) {
-        drawInternal(modelMatrix, doingShadows, smokeStart, smokeEnd);
+    void draw(const MatrixStack& matrices, const glm::mat4& modelMatrix,
+              bool doingShadows) {
+        drawInternal(matrices, modelMatrix, doingShadows);
     }
 };
 
@@ -133,16 +141,17 @@ class Jet : public ModelActor {
 public:
    explicit Jet(TrainView* owner);
 
-    void draw(const glm::vec3& position, float yawRadians) {
+    void draw(const MatrixStack& matrices, const glm::vec3& position,
+              float yawRadians) {
         glm::mat4 model(1.0f);
         model = glm::translate(model, position);
         model = glm::rotate(model, yawRadians + glm::radians(180.0f), glm::vec3(0, 1, 0));
-        drawInternal(model, false);
+        drawInternal(matrices, model, false);
     }
 
-    void draw(const glm::mat4& modelMatrix, bool doingShadows,
-              float smokeStart, float smokeEnd) {
-        drawInternal(modelMatrix, doingShadows, smokeStart, smokeEnd);
+    void draw(const MatrixStack& matrices, const glm::mat4& modelMatrix,
+              bool doingShadows) {
+        drawInternal(matrices, modelMatrix, doingShadows);
     }
 };
 
@@ -150,14 +159,14 @@ class Soldier : public ModelActor {
 public:
     explicit Soldier(TrainView* owner);
 
-    void draw(const glm::vec3& position) {
+    void draw(const MatrixStack& matrices, const glm::vec3& position) {
         glm::mat4 model(1.0f);
         model = glm::translate(model, position);
-        drawInternal(model, false);
+        drawInternal(matrices, model, false);
     }
 
-    void draw(const glm::mat4& modelMatrix, bool doingShadows,
-              float smokeStart, float smokeEnd) {
-        drawInternal(modelMatrix, doingShadows, smokeStart, smokeEnd);
+    void draw(const MatrixStack& matrices, const glm::mat4& modelMatrix,
+              bool doingShadows) {
+        drawInternal(matrices, modelMatrix, doingShadows);
     }
 };
\ No newline at end of file
@@ -13,6 +13,8 @@ public:
     void setColor(const glm::vec3& rgb);
     void setRecursionLevel(int level);
 
+    const glm::vec3& getCenter() const { return center; }
+
     void draw(bool doingShadows) const;
 
 private:
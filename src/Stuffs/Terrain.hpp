@@ -7,12 +7,17 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <iostream>
-#include <opencv2/opencv.hpp>
+#include <memory>
+#include <string>
 #include <vector>
 
+#include "../RenderUtilities/AssetCache.h"
 #include "../RenderUtilities/BufferObject.h"
-#include "../RenderUtilities/Shader.h"
+#include "../RenderUtilities/SceneConstants.h"
+#include "../RenderUtilities/ShaderVariants.h"
+#include "../RenderUtilities/ShadowAtlas.h"
 #include "../TrainWindow.H"
+#include "HeightMapTiles.hpp"
 
 class TrainWindow;  // Forward declaration
 
@@ -22,10 +27,20 @@ private:
     int depth;
     float scaleXZ = 2.0f;  // Scale the grid horizontally
     int blockSize = 10;    // size of blocks in pixels (Minecraft style)
-    std::vector<float> heightMap;
+    std::vector<float> heightMap;  // Only used by the procedural basin
+
+    // Heights are streamed from a memory mapped tile file through a small
+    // resident cache, so the source image never has to fit in RAM
+    HeightTileFile tileFile;
+    HeightTileCache* tiles = nullptr;
+    size_t tileCacheCapacity = 64;  // 64 tiles of 256^2 floats = 16 MB
+
+    // Mip level the render mesh is built from, keeps it under 1024^2 verts
+    int meshLevel = 0;
+    int maxMeshResolution = 1024;
 
     VAO* plane = nullptr;
-    Shader* shader = nullptr;
+    std::shared_ptr<ShaderVariants> shaders;
 
     TrainWindow* tw = nullptr;
 
@@ -85,59 +100,87 @@ private:
     }
 
     void loadHeightMap(const char* fileName) {
-        cv::Mat image = cv::imread(fileName, cv::IMREAD_GRAYSCALE);
-        if (image.empty()) {
-            std::cout << "Failed to load height map: " << fileName << std::endl;
+        if (!tiles) {
+            // The image is cooked into a .hmt next to it on first run and
+            // cooked again whenever the image's size or mtime changes
+            std::string tiledPath = fileName;
+            size_t dot = tiledPath.find_last_of('.');
+            tiledPath = tiledPath.substr(0, dot) + ".hmt";
+
+            if (tileFile.open(tiledPath.c_str()) &&
+                !tileFile.matchesSource(fileName))
+                tileFile.close();
+
+            if (!tileFile.isOpen() &&
+                HeightTileFile::cook(fileName, tiledPath.c_str())) {
+                tileFile.open(tiledPath.c_str());
+            }
+
+            if (tileFile.isOpen()) {
+                width = (int)tileFile.getHeader().width;
+                depth = (int)tileFile.getHeader().depth;
+                tiles = new HeightTileCache(&tileFile, tileCacheCapacity);
+            }
+        }
+
+        if (!tiles) {
             heightMap.resize(width * depth, 0.0f);
             generateBasin();
             return;
         }
 
-        width = image.cols;
-        depth = image.rows;
-        heightMap.resize(width * depth);
+        meshLevel = 0;
+        while (meshLevel + 1 < tileFile.getLevelCount() &&
+               std::max(getLevelWidth(meshLevel), getLevelDepth(meshLevel)) >
+                   maxMeshResolution) {
+            ++meshLevel;
+        }
+    }
+
+    int getLevelWidth(int level) const {
+        return tiles ? (int)tileFile.getLevel(level).width : width;
+    }
 
-        int step = blockSize;
-        float quantStep = step * 2;
+    int getLevelDepth(int level) const {
+        return tiles ? (int)tileFile.getLevel(level).depth : depth;
+    }
 
-        for (int z = 0; z < depth; ++z) {
-            for (int x = 0; x < width; ++x) {
-                if (tw && tw->minecraftButton->value()) {
-                    int sampleX = (x / step) * step;
-                    int sampleZ = (z / step) * step;
-
-                    if (sampleX >= width)
-                        sampleX = width - 1;
-                    if (sampleZ >= depth)
-                        sampleZ = depth - 1;
-
-                    unsigned char color =
-                        image.at<unsigned char>(sampleZ, sampleX);
-                    float rawH = color - 100.0f;
-                    float h = std::floor(rawH / quantStep) * quantStep - 6.0f;
-                    setHeight(x, z, h);
-                } else {
-                    unsigned char color = image.at<unsigned char>(z, x);
-                    float h = color - 100.0f;
-                    setHeight(x, z, h);
-                }
-            }
-        }
+    // Unquantized height of sample (x, z) on the given mip level
+    float getRawHeight(int level, int x, int z) const {
+        if (tiles)
+            return tiles->sample(level, x, z);
+        return heightMap[z * width + x];
     }
 
     float getHeight(int x, int z) const {
-        if (x >= 0 && x < width && z >= 0 && z < depth) {
-            return heightMap[z * width + x];
+        if (x < 0 || x >= width || z < 0 || z >= depth)
+            return 0.0f;
+
+        if (tw && tw->minecraftButton->value()) {
+            // One quantized height per block
+            int step = blockSize;
+            float quantStep = step * 2;
+            int sampleX = std::min((x / step) * step, width - 1);
+            int sampleZ = std::min((z / step) * step, depth - 1);
+            float rawH = getRawHeight(0, sampleX, sampleZ);
+            return std::floor(rawH / quantStep) * quantStep - 6.0f;
         }
-        return 0.0f;
+        return getRawHeight(0, x, z);
+    }
+
+    // Height on the mesh level, clamped to its edges
+    float getMeshHeight(int x, int z) const {
+        x = std::max(0, std::min(x, getLevelWidth(meshLevel) - 1));
+        z = std::max(0, std::min(z, getLevelDepth(meshLevel) - 1));
+        return getRawHeight(meshLevel, x, z);
     }
 
     glm::vec3 getNormal(int x, int z) {
-        float hL = getHeight(x - 1, z);
-        float hR = getHeight(x + 1, z);
-        float hD = getHeight(x, z - 1);
-        float hU = getHeight(x, z + 1);
-        glm::vec3 normal(hL - hR, 2.0f, hD - hU);
+        float hL = getMeshHeight(x - 1, z);
+        float hR = getMeshHeight(x + 1, z);
+        float hD = getMeshHeight(x, z - 1);
+        float hU = getMeshHeight(x, z + 1);
+        glm::vec3 normal(hL - hR, 2.0f * (1 << meshLevel), hD - hU);
         return glm::normalize(normal);
     }
 
@@ -178,6 +221,10 @@ public:
     Terrain(int width = 200, int depth = 200) : width(width), depth(depth) {}
 
     ~Terrain() {
+        if (tiles) {
+            delete tiles;  // Stops the pager before the file is unmapped
+            tiles = nullptr;
+        }
         if (plane) {
             glDeleteVertexArrays(1, &plane->vao);
             // Assuming buffer object handles deletion of array, but standard is:
@@ -186,10 +233,6 @@ public:
             delete plane;
             plane = nullptr;
         }
-        if (shader) {
-            delete shader;
-            shader = nullptr;
-        }
     }
 
     void init(TrainWindow* tw) {
@@ -208,6 +251,24 @@ public:
         }
     }
 
+    // Ask the pager for the tiles around the camera and the train
+    void updateStreaming(const glm::vec3& cameraPos, const glm::vec3& trainPos) {
+        if (!tiles)
+            return;
+
+        const glm::vec3 points[2] = { cameraPos, trainPos };
+        for (const glm::vec3& p : points) {
+            int gridX = (int)((p.x + width / 2.0f * scaleXZ) / scaleXZ);
+            int gridZ = (int)((p.z + depth / 2.0f * scaleXZ) / scaleXZ);
+            if (gridX < 0 || gridX >= width || gridZ < 0 || gridZ >= depth)
+                continue;
+            tiles->prefetch(0, gridX, gridZ, 1);
+            if (meshLevel > 0)
+                tiles->prefetch(meshLevel, gridX >> meshLevel,
+                                gridZ >> meshLevel, 1);
+        }
+    }
+
     void buildMesh() {
         if (plane) {
             glDeleteVertexArrays(1, &plane->vao);
@@ -224,7 +285,6 @@ public:
 
         if (tw && tw->minecraftButton->value()) {
             GLuint curIndex = 0;
-            const float cell = blockSize * scaleXZ;
 
             auto pushQuad = [&](const glm::vec3& a, const glm::vec3& b,
                                 const glm::vec3& c, const glm::vec3& d,
@@ -243,8 +303,11 @@ public:
                 curIndex += 4;
             };
 
-            for (int z = 0; z < depth; z += blockSize) {
-                for (int x = 0; x < width; x += blockSize) {
+            const int stride = blockSize << meshLevel;
+            const float cell = stride * scaleXZ;
+
+            for (int z = 0; z < depth; z += stride) {
+                for (int x = 0; x < width; x += stride) {
                     float h = getHeight(x, z);
                     float y0 = std::min(h, -100.0f);
                     float y1 = h;
@@ -280,12 +343,16 @@ public:
                 }
             }
         } else {
-            for (int z = 0; z < depth; ++z) {
-                for (int x = 0; x < width; ++x) {
-                    float h = getHeight(x, z);
-                    vertices.push_back(x * scaleXZ);
+            const int meshWidth = getLevelWidth(meshLevel);
+            const int meshDepth = getLevelDepth(meshLevel);
+            const float spacing = scaleXZ * (1 << meshLevel);
+
+            for (int z = 0; z < meshDepth; ++z) {
+                for (int x = 0; x < meshWidth; ++x) {
+                    float h = getMeshHeight(x, z);
+                    vertices.push_back(x * spacing);
                     vertices.push_back(h);
-                    vertices.push_back(z * scaleXZ);
+                    vertices.push_back(z * spacing);
 
                     glm::vec3 n = getNormal(x, z);
                     normals.push_back(n.x);
@@ -299,11 +366,11 @@ public:
                 }
             }
 
-            for (int z = 0; z < depth - 1; ++z) {
-                for (int x = 0; x < width - 1; ++x) {
-                    int topLeft = z * width + x;
+            for (int z = 0; z < meshDepth - 1; ++z) {
+                for (int x = 0; x < meshWidth - 1; ++x) {
+                    int topLeft = z * meshWidth + x;
                     int topRight = topLeft + 1;
-                    int bottomLeft = (z + 1) * width + x;
+                    int bottomLeft = (z + 1) * meshWidth + x;
                     int bottomRight = bottomLeft + 1;
 
                     indices.push_back(topLeft);
@@ -383,113 +450,39 @@ public:
         }
     }
 
-    void draw(const glm::mat4& view, const glm::mat4& proj,
-              const glm::mat4& lightSpace, GLuint shadowMap,
-              const glm::vec3& lightDir, const glm::vec3& viewPos,
-              const glm::vec2& smokeParams, bool smokeEnabled,
-              bool enableShadow, bool enableLight,
-              // Point light inputs
-              const glm::vec3& pointLightPos, GLuint pointShadowMap,
-              float pointFarPlane, bool enablePointShadow,
-              bool enablePointLight,
-              // Spot light inputs
-              const glm::vec3& spotLightPos, const glm::vec3& spotLightDir,
-              const glm::mat4& spotLightMatrix, GLuint spotShadowMap,
-              float spotFarPlane, float spotInnerCos, float spotOuterCos,
-              bool enableSpotShadow, bool enableSpotLight,
-              // Clip plane
-              const glm::vec4& clipPlane, bool enableClip) {
+    // Every light, shadow, smoke and clip combination the terrain shader
+    // is specialized on
+    ShaderVariants& getShaderVariants() {
+        if (!shaders) {
+            shaders = AssetCache::instance().getShaderVariants(
+                "./shaders/terrain.vert", nullptr, nullptr, nullptr,
+                "./shaders/terrain.frag",
+                FEATURE_CLIP_PLANE | FEATURE_SMOKE | FEATURE_DIR_LIGHT |
+                    FEATURE_POINT_LIGHT | FEATURE_SPOT_LIGHT |
+                    FEATURE_DIR_SHADOW | FEATURE_POINT_SHADOW |
+                    FEATURE_SPOT_SHADOW | FEATURE_VSM_SHADOWS);
+        }
+        return *shaders;
+    }
+
+    // Camera, lights, smoke and the clip plane come from the scene constants
+    void draw(SceneConstants& constants, const ShadowAtlas& shadowAtlas) {
         if (!plane)
             return;
 
-        GLint prevActiveTexture = GL_TEXTURE0;
-        glGetIntegerv(GL_ACTIVE_TEXTURE, &prevActiveTexture);
-
-        if (!shader) {
-            shader = new Shader("./shaders/terrain.vert", nullptr, nullptr,
-                                nullptr, "./shaders/terrain.frag");
-        }
-
+        Shader* shader = getShaderVariants().get(
+            ShaderVariants::sceneFeatures(constants, shadowAtlas.filtered));
         shader->Use();
+        constants.pushObject(getModelMatrix());
 
-        glm::mat4 model = getModelMatrix();
-        glUniformMatrix4fv(glGetUniformLocation(shader->Program, "u_model"), 1,
-                           GL_FALSE, glm::value_ptr(model));
-        glUniformMatrix4fv(glGetUniformLocation(shader->Program, "u_view"), 1,
-                           GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(glGetUniformLocation(shader->Program, "u_proj"), 1,
-                           GL_FALSE, glm::value_ptr(proj));
-        glUniformMatrix4fv(
-            glGetUniformLocation(shader->Program, "u_lightSpace"), 1, GL_FALSE,
-            glm::value_ptr(lightSpace));
-        glUniform4fv(glGetUniformLocation(shader->Program, "u_clipPlane"), 1,
-                     glm::value_ptr(clipPlane));
-        glUniform1i(glGetUniformLocation(shader->Program, "u_enableClip"),
-                    enableClip ? 1 : 0);
-
-        glUniform3fv(glGetUniformLocation(shader->Program, "u_lightDir"), 1,
-                     glm::value_ptr(lightDir));
-        glUniform3fv(glGetUniformLocation(shader->Program, "u_viewPos"), 1,
-                     glm::value_ptr(viewPos));
-
-        glUniform2fv(glGetUniformLocation(shader->Program, "u_smokeParams"), 1,
-                     glm::value_ptr(smokeParams));
-        glUniform1i(glGetUniformLocation(shader->Program, "smokeEnabled"),
-                    smokeEnabled ? 1 : 0);
-        glUniform1i(glGetUniformLocation(shader->Program, "u_enableShadow"),
-                    enableShadow ? 1 : 0);
-        glUniform1i(glGetUniformLocation(shader->Program, "u_enableLight"),
-                    enableLight ? 1 : 0);
-
-        glUniform3fv(glGetUniformLocation(shader->Program, "u_pointLightPos"),
-                     1, glm::value_ptr(pointLightPos));
-        glUniform1i(glGetUniformLocation(shader->Program, "u_enablePointLight"),
-                    enablePointLight ? 1 : 0);
-        glUniform1i(
-            glGetUniformLocation(shader->Program, "u_enablePointShadow"),
-            enablePointShadow ? 1 : 0);
-        glUniform1f(glGetUniformLocation(shader->Program, "u_pointFarPlane"),
-                    pointFarPlane);
-
-        glUniform3fv(glGetUniformLocation(shader->Program, "u_spotLightPos"), 1,
-                     glm::value_ptr(spotLightPos));
-        glUniform3fv(glGetUniformLocation(shader->Program, "u_spotLightDir"), 1,
-                     glm::value_ptr(spotLightDir));
-        glUniformMatrix4fv(
-            glGetUniformLocation(shader->Program, "u_spotLightMatrix"), 1,
-            GL_FALSE, glm::value_ptr(spotLightMatrix));
-        glUniform1f(glGetUniformLocation(shader->Program, "u_spotFarPlane"),
-                    spotFarPlane);
-        glUniform1f(glGetUniformLocation(shader->Program, "u_spotInnerCos"),
-                    spotInnerCos);
-        glUniform1f(glGetUniformLocation(shader->Program, "u_spotOuterCos"),
-                    spotOuterCos);
-        glUniform1i(glGetUniformLocation(shader->Program, "u_enableSpotShadow"),
-                    enableSpotShadow ? 1 : 0);
-        glUniform1i(glGetUniformLocation(shader->Program, "u_enableSpotLight"),
-                    enableSpotLight ? 1 : 0);
-
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, shadowMap);
-        glUniform1i(glGetUniformLocation(shader->Program, "u_shadowMap"), 0);
-
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, pointShadowMap);
-        glUniform1i(glGetUniformLocation(shader->Program, "u_pointShadowMap"),
-                    1);
-
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, spotShadowMap);
-        glUniform1i(glGetUniformLocation(shader->Program, "u_spotShadowMap"),
-                    2);
+        // Every light's shadow views live in the one atlas
+        shadowAtlas.apply(shader, 0);
 
         glBindVertexArray(plane->vao);
         glDrawElements(GL_TRIANGLES, plane->element_amount, GL_UNSIGNED_INT, 0);
         glBindVertexArray(0);
 
         glUseProgram(0);
-
-        glActiveTexture(prevActiveTexture);
     }
 
     void drawPointShadow(Shader* depthShader, const glm::mat4& lightMatrix,
@@ -499,16 +492,10 @@ public:
 
         depthShader->Use();
         glm::mat4 model = getModelMatrix();
-        glUniformMatrix4fv(
-            glGetUniformLocation(depthShader->Program, "u_model"), 1, GL_FALSE,
-            glm::value_ptr(model));
-        glUniformMatrix4fv(
-            glGetUniformLocation(depthShader->Program, "u_lightMatrix"), 1,
-            GL_FALSE, glm::value_ptr(lightMatrix));
-        glUniform3fv(glGetUniformLocation(depthShader->Program, "u_lightPos"),
-                     1, glm::value_ptr(lightPos));
-        glUniform1f(glGetUniformLocation(depthShader->Program, "u_farPlane"),
-                    farPlane);
+        depthShader->set("u_model", model);
+        depthShader->set("u_lightMatrix", lightMatrix);
+        depthShader->set("u_lightPos", lightPos);
+        depthShader->set("u_farPlane", farPlane);
 
         glBindVertexArray(plane->vao);
         glDrawElements(GL_TRIANGLES, plane->element_amount, GL_UNSIGNED_INT, 0);
@@ -5,25 +5,19 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <memory>
 #include "../TrainView.H"
 #include "../TrainWindow.H"
+#include "../RenderUtilities/AssetCache.h"
 #include "../RenderUtilities/BufferObject.h"
 #include "../RenderUtilities/Shader.h"
+#include "../RenderUtilities/ShaderVariants.h"
 #include "../RenderUtilities/Texture.h"
 
 class TotemOfUndying {
 private:
     void cleanup() {
-        if (this->shader) {
-            delete this->shader;
-            this->shader = nullptr;
-        }
-
-        if (this->commonMatrices) {
-            glDeleteBuffers(1, &this->commonMatrices->ubo);
-            delete this->commonMatrices;
-            this->commonMatrices = nullptr;
-        }
+        this->shaders.reset();
 
         if (this->quad) {
             glDeleteVertexArrays(1, &this->quad->vao);
@@ -42,8 +36,7 @@ private:
 public:
     VAO* quad = nullptr;
     Texture2D* texture = nullptr;
-    Shader* shader = nullptr;
-    UBO* commonMatrices = nullptr;
+    std::shared_ptr<ShaderVariants> shaders;  // Through the AssetCache
     TrainView* owner = nullptr;
 
     TotemOfUndying() {}
@@ -58,20 +51,12 @@ public:
         }
 
         // Initialize shader (use custom totem shader for better alpha handling)
-        if (!this->shader) {
-            this->shader = new Shader("./shaders/totem.vert", nullptr, nullptr,
-                                      nullptr, "./shaders/totem.frag");
-        }
-
-        // Initialize UBO for common matrices
-        if (!this->commonMatrices) {
-            this->commonMatrices = new UBO();
-            this->commonMatrices->size = 2 * sizeof(glm::mat4);
-            glGenBuffers(1, &this->commonMatrices->ubo);
-            glBindBuffer(GL_UNIFORM_BUFFER, this->commonMatrices->ubo);
-            glBufferData(GL_UNIFORM_BUFFER, this->commonMatrices->size, NULL,
-                         GL_STATIC_DRAW);
-            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        // Variants on the directional shadow, its filter and smoke
+        if (!this->shaders) {
+            this->shaders = AssetCache::instance().getShaderVariants(
+                "./shaders/totem.vert", nullptr, nullptr, nullptr,
+                "./shaders/totem.frag",
+                FEATURE_SMOKE | FEATURE_DIR_SHADOW | FEATURE_VSM_SHADOWS);
         }
 
         // Create billboard quad
@@ -149,13 +134,15 @@ public:
         }
     }
 
-    void draw(const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix,
-              const glm::vec3& cameraPos, float smokeStart,
-              float smokeEnd) {
-        if (!this->shader || !this->quad || !this->texture) {
+    // Camera, lights and smoke come from the owner's scene constants
+    void draw() {
+        if (!this->owner || !this->shaders || !this->quad || !this->texture) {
             return;
         }
 
+        SceneConstants& constants = owner->getSceneConstants();
+        const glm::vec3 cameraPos(constants.frame.cameraPos);
+
         // Save current GL state
         GLint prevProgram;
         glGetIntegerv(GL_CURRENT_PROGRAM, &prevProgram);
@@ -206,70 +193,17 @@ public:
         modelMatrix[3] = glm::vec4(billboardPos, 1.0f);
 
         // Use shader
-        this->shader->Use();
-
-        // Set uniforms
-        glUniformMatrix4fv(
-            glGetUniformLocation(this->shader->Program, "u_model"), 1, GL_FALSE,
-            &modelMatrix[0][0]);
-        glUniformMatrix4fv(
-            glGetUniformLocation(this->shader->Program, "u_view"), 1, GL_FALSE,
-            &viewMatrix[0][0]);
-        glUniformMatrix4fv(
-            glGetUniformLocation(this->shader->Program, "u_projection"), 1,
-            GL_FALSE, &projectionMatrix[0][0]);
+        Shader* shader = this->shaders->get(owner->getSceneFeatures());
+        shader->Use();
 
-        // Directional shadow map inputs
-        if (owner) {
-            const glm::mat4 lightSpace = owner->getLightSpaceMatrix();
-            glUniformMatrix4fv(
-                glGetUniformLocation(this->shader->Program, "u_lightSpace"), 1,
-                GL_FALSE, &lightSpace[0][0]);
-
-            const GLint dirLoc =
-                glGetUniformLocation(this->shader->Program, "u_lightDir");
-            if (dirLoc >= 0) {
-                glm::vec3 dir = owner->getDirLightDir();
-                glUniform3fv(dirLoc, 1, &dir[0]);
-            }
-
-            const bool shadowOn = owner->tw && owner->tw->directionalLightButton &&
-                                  owner->tw->directionalLightButton->value() != 0;
-            const GLint enableShadowLoc =
-                glGetUniformLocation(this->shader->Program, "u_enableShadow");
-            if (enableShadowLoc >= 0) {
-                glUniform1i(enableShadowLoc, shadowOn ? 1 : 0);
-            }
-
-            const GLint shadowMapLoc =
-                glGetUniformLocation(this->shader->Program, "u_shadowMap");
-            if (shadowMapLoc >= 0) {
-                glActiveTexture(GL_TEXTURE10);
-                glBindTexture(GL_TEXTURE_2D, owner->getShadowMap());
-                glUniform1i(shadowMapLoc, 10);
-            }
-        }
+        constants.pushObject(modelMatrix);
 
-        const GLint camLoc =
-            glGetUniformLocation(this->shader->Program, "u_cameraPos");
-        if (camLoc >= 0) {
-            glUniform3fv(camLoc, 1, &cameraPos[0]);
-        }
-        const GLint smokeLoc =
-            glGetUniformLocation(this->shader->Program, "u_smokeParams");
-        if (smokeLoc >= 0) {
-            glUniform2f(smokeLoc, smokeStart, smokeEnd);
-        }
-        const GLint smokeEnabledLoc =
-            glGetUniformLocation(this->shader->Program, "smokeEnabled");
-        if (smokeEnabledLoc >= 0 && owner && owner->tw && owner->tw->smokeButton) {
-            glUniform1i(smokeEnabledLoc, owner->tw->smokeButton->value() ? 1 : 0);
-        }
+        // Directional shadow map inputs
+        owner->getShadowAtlas().apply(shader, 10);
 
         // Bind texture
         this->texture->bind(0);
-        glUniform1i(glGetUniformLocation(this->shader->Program, "u_texture"),
-                0);
+        shader->set("u_texture", 0);
 
         // Enable blending for transparency
         glEnable(GL_BLEND);
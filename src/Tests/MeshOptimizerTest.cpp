@@ -0,0 +1,54 @@
+// Checks of the import-time mesh optimizer that need no GL context. Exits
+// non-zero on the first failure.
+
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "../RenderUtilities/MeshOptimizer.h"
+
+namespace {
+int failures = 0;
+
+void expectMisses(const char* name, const std::vector<unsigned int>& indices,
+                  size_t vertexCount, size_t expected) {
+    const float triangles = (float)(indices.size() / 3);
+    const float misses =
+        MeshOptimizer::acmr(indices, vertexCount) * triangles;
+    if (std::fabs(misses - (float)expected) > 0.01f) {
+        std::cout << name << ": " << misses << " misses, expected "
+                  << expected << std::endl;
+        ++failures;
+    }
+}
+
+// A 16-entry FIFO still holds the first vertex after 16 misses and has
+// evicted it after 17
+void testAcmrCacheBoundary() {
+    std::vector<unsigned int> full;
+    for (unsigned int i = 0; i < 16; ++i)
+        full.push_back(i);
+    full.push_back(0);
+    full.push_back(1);
+    expectMisses("16 distinct, then reuse", full, 16, 16);
+
+    std::vector<unsigned int> over;
+    for (unsigned int i = 0; i < 17; ++i)
+        over.push_back(i);
+    over.push_back(0);
+    expectMisses("17 distinct, then reuse", over, 17, 18);
+}
+
+void testAcmrRepeatedTriangle() {
+    const std::vector<unsigned int> indices = { 0, 1, 2, 0, 1, 2, 2, 1, 0 };
+    expectMisses("repeated triangle", indices, 3, 3);
+}
+}  // namespace
+
+int main() {
+    testAcmrCacheBoundary();
+    testAcmrRepeatedTriangle();
+    if (failures == 0)
+        std::cout << "MeshOptimizer tests passed" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,85 @@
+// Offline asset cooker. Models are imported once with Assimp and written as
+// a .mesh file next to them, which the runtime maps instead of importing;
+// the vertex cache ACMR of each model is printed before and after the
+// import optimization. Images (the scene's and those the models use) are
+// block compressed with a full mip chain into a .dds file next to them,
+// which the texture loaders upload instead of decoding the image.
+//
+//   AssetCooker [model or image ...]
+//
+// Without arguments it cooks every model the scene actors draw and every
+// image the scene loads, with paths relative to the assets directory (the
+// default working directory). Cook again after changing an asset or the
+// Vertex layout; mesh and image files older than their source, or from
+// another layout, are rejected at load and the source is used as before.
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../RenderUtilities/CookedMesh.h"
+#include "../RenderUtilities/Model.h"
+#include "../RenderUtilities/TextureEncoder.h"
+
+namespace {
+bool isImage(std::string path) {
+    std::transform(path.begin(), path.end(), path.begin(),
+                   [](unsigned char c) { return (char)std::tolower(c); });
+    for (const char* extension : { ".png", ".jpg", ".jpeg", ".tga", ".bmp" }) {
+        const std::string suffix = extension;
+        if (path.size() > suffix.size() &&
+            path.compare(path.size() - suffix.size(), suffix.size(),
+                         suffix) == 0)
+            return true;
+    }
+    return false;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+    std::vector<std::string> models;
+    std::vector<std::string> images;
+    for (int i = 1; i < argc; ++i)
+        (isImage(argv[i]) ? images : models).push_back(argv[i]);
+    if (argc == 1) {
+        models = { "./models/minecraftChest/model/Obj/chest.obj",
+                   "./models/minecraftMinecart/scene.gltf",
+                   "./models/minecraftFox/Fox.fbx",
+                   "./models/minecraftVillager/scene.gltf",
+                   "./models/tunnel/scene.gltf",
+                   "./models/minecraftGhast/ghast.obj",
+                   "./models/minecraftTNTBall/scene.gltf",
+                   "./models/fighterJet/scene.gltf",
+                   "./models/soldier/scene.gltf" };
+        images = { "./images/church.png",
+                   "./images/totemOfUndying.png",
+                   "./images/waterHeightMap.jpg",
+                   "./images/bumpMapping.png",
+                   "./images/skyboxSun/right.jpg",
+                   "./images/skyboxSun/left.jpg",
+                   "./images/skyboxSun/top.jpg",
+                   "./images/skyboxSun/bottom.jpg",
+                   "./images/skyboxSun/front.jpg",
+                   "./images/skyboxSun/back.jpg" };
+    }
+
+    int failed = 0;
+    for (const std::string& path : models) {
+        if (!Model::cook(path, CookedMeshFile::pathFor(path), &images))
+            ++failed;
+    }
+    std::cout << models.size() - failed << " of " << models.size()
+              << " models cooked" << std::endl;
+
+    int failedImages = 0;
+    for (const std::string& path : images) {
+        if (!TextureEncoder::cookFile(path))
+            ++failedImages;
+    }
+    std::cout << images.size() - failedImages << " of " << images.size()
+              << " images compressed" << std::endl;
+    return failed == 0 && failedImages == 0 ? 0 : 1;
+}
@@ -34,6 +34,7 @@ references)
 #include <vector>
 
 #include <glad/glad.h>
+#include <FL/gl.h>
 #include <mmsystem.h>
 #include <windows.h>  // we will need OpenGL, and OpenGL needs windows.h
 
@@ -43,7 +44,9 @@ references)
 #include <glm/gtc/type_ptr.hpp>
 #include "ControlPoint.H"
 #include "GL/glu.h"
+#include "RenderUtilities/AssetCache.h"
 #include "RenderUtilities/Shader.h"
+#include "RenderUtilities/TextureStreamer.h"
 #include "Stuffs/SubdivisionSphere.hpp"
 #include "Stuffs/totemOfUndying.hpp"
 #include "TrainView.H"
@@ -61,6 +64,14 @@ references)
 #define DIVIDE_LINE 250.0f  // reduced for performance; was 1000
 #define GUAGE 5.0f
 
+// Depth range the render queue's sort keys are quantized over
+static const float MAX_SORT_DEPTH = 5000.0f;
+
+// Box train dimensions, shared by its static meshes and drawTrain
+static const float TRAIN_HALF_EXTENT = 5.0f;
+static const float TRAIN_WHEEL_RADIUS = 3.25f;
+static const float TRAIN_WHEEL_WIDTH = 2.0f;
+
 static bool g_bgmStarted = false;
 
 static bool fileExistsW(const std::wstring& path) {
@@ -302,11 +313,13 @@ int TrainView::handle(int event) {
             if ((last_push == FL_LEFT_MOUSE) && (selectedCube >= 0)) {
                 ControlPoint* cp = &m_pTrack->points[selectedCube];
 
-                double r1x, r1y, r1z, r2x, r2y, r2z;
-                getMouseLine(r1x, r1y, r1z, r2x, r2y, r2z);
+                // The ray comes from the CPU camera, not the GL matrices
+                glm::vec3 r1, r2;
+                if (!buildMouseRay(r1, r2))
+                    return 1;
 
                 double rx, ry, rz;
-                mousePoleGo(r1x, r1y, r1z, r2x, r2y, r2z,
+                mousePoleGo(r1.x, r1.y, r1.z, r2.x, r2.y, r2.z,
                             static_cast<double>(cp->pos.x),
                             static_cast<double>(cp->pos.y),
                             static_cast<double>(cp->pos.z), rx, ry, rz,
@@ -359,6 +372,14 @@ int TrainView::handle(int event) {
 
                 return 1;
             };
+            if (k == 'b') {
+                startShadowBenchmark();
+                return 1;
+            }
+            if (k == 'r') {
+                reportRenderQueue();
+                return 1;
+            }
             break;
     }
 
@@ -493,319 +514,498 @@ glm::vec3 TrainView::getSpotLightDir() const {
     return computeSpotLightDir();
 }
 
-void TrainView::initShadowMap() {
-    if (shadowFBO != 0 && shadowDepthMap != 0)
+void TrainView::updateLightConstants() {
+    const bool directionalOn =
+        tw && tw->directionalLightButton && tw->directionalLightButton->value();
+    const bool pointOn =
+        tw && tw->pointLightButton && tw->pointLightButton->value();
+    const bool spotOn =
+        tw && tw->spotLightButton && tw->spotLightButton->value();
+
+    LightConstants lights;
+    lights.dirLightDir = glm::vec4(glm::normalize(dirLightDir), 0.0f);
+    lights.pointLightPos = glm::vec4(getPointLightPos(), 1.0f);
+    lights.spotLightPos = glm::vec4(getSpotLightPos(), 1.0f);
+    lights.spotLightDir = glm::vec4(getSpotLightDir(), 0.0f);
+    lights.spotCone = glm::vec4(glm::cos(glm::radians(22.0f)),
+                                glm::cos(glm::radians(32.0f)), 0.0f, 0.0f);
+    lights.enabled = glm::ivec4(directionalOn, pointOn, spotOn, 0);
+    lights.shadows = lights.enabled;
+    sceneConstants.setLights(lights);
+}
+
+void TrainView::initShadowAtlas() {
+    if (!cascadeShadowShader) {
+        // Depth only: no fragment stage
+        cascadeShadowShader = new Shader(
+            "./shaders/cascadeShadowDepth.vert", nullptr, nullptr,
+            "./shaders/cascadeShadowDepth.geom", nullptr);
+    }
+    if (!pointShadowShader) {
+        pointShadowShader = new Shader(
+            "./shaders/pointShadowCube.vert", nullptr, nullptr,
+            "./shaders/pointShadowCube.geom", "./shaders/pointShadowCube.frag");
+    }
+    if (!spotShadowShader) {
+        spotShadowShader =
+            new Shader("./shaders/pointShadowDepth.vert", nullptr, nullptr,
+                       nullptr, "./shaders/pointShadowDepth.frag");
+    }
+
+    if (shadowAtlas.fbo != 0)
         return;
 
-    glGenFramebuffers(1, &shadowFBO);
-    glGenTextures(1, &shadowDepthMap);
-
-    glBindTexture(GL_TEXTURE_2D, shadowDepthMap);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, shadowMapResolution,
-                 shadowMapResolution, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
-                           shadowDepthMap, 0);
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    // Registration order fixes the light indices the shaders use:
+    // 0 directional, 1 point, 2 spot
+    shadowAtlas.init();
+    dirShadowLight = shadowAtlas.addLight(
+        DIRECTIONAL_SHADOW,
+        std::vector<int>(shadowCascades.tileSize,
+                         shadowCascades.tileSize + shadowCascades.count));
+    pointShadowLight =
+        shadowAtlas.addLight(POINT_SHADOW, std::vector<int>(6, 512));
+    spotShadowLight = shadowAtlas.addLight(SPOT_SHADOW, { 1024 });
+
+    // Cascades snap to the texel size of the tiles they actually got
+    const ShadowLight& dirLight = shadowAtlas.lights[dirShadowLight];
+    for (int c = 0; c < shadowCascades.count; ++c)
+        shadowCascades.tileSize[c] =
+            shadowAtlas.viewRects[dirLight.firstView + c].z;
+
+    // The spotlight rides on the train, so only static casters reach it
+    shadowAtlas.lights[spotShadowLight].dynamicCasters = false;
+
+    // The cascades are refit to the camera every frame, so a cached copy of
+    // their static depth would almost never be reused
+    shadowAtlas.lights[dirShadowLight].cached = false;
 }
 
 void TrainView::updateLightMatrices() {
     dirLightDir = glm::normalize(dirLightDir);
-    glm::vec3 lightDir = dirLightDir;
 
-    float halfExtent = 150.0f;
+    // Shadows reach as far as the terrain does
+    float maxDistance = 1000.0f;
     if (terrain) {
         float terrainWidth = terrain->getWidth() * terrain->getScaleXZ();
         float terrainDepth = terrain->getDepth() * terrain->getScaleXZ();
-        halfExtent = std::max(terrainWidth, terrainDepth) * 0.6f;
+        maxDistance = std::max(terrainWidth, terrainDepth) * 1.5f;
     }
 
-    const float nearPlane = 10.0f;
-    const float farPlane = 800.0f;
+    // The cascades follow the camera the main pass is about to use
+    MatrixStack camera;
+    buildCamera(camera);
 
-    glm::vec3 center(0.0f, 0.0f, 0.0f);
-    glm::vec3 lightPos =
-        center - lightDir * 250.0f + glm::vec3(0.0f, 150.0f, 0.0f);
+    shadowCascades.fit(camera.view, camera.projection, dirLightDir,
+                       maxDistance);
+}
 
-    lightView = glm::lookAt(lightPos, center, glm::vec3(0.0f, 1.0f, 0.0f));
-    lightProj = glm::ortho(-halfExtent, halfExtent, -halfExtent, halfExtent,
-                           nearPlane, farPlane);
-    lightSpaceMatrix = lightProj * lightView;
+void TrainView::bindSceneTarget(GLuint fbo, const glm::ivec4& viewport) {
+    sceneFbo = fbo;
+    sceneViewport = viewport;
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(viewport.x, viewport.y, viewport.z, viewport.w);
 }
 
-void TrainView::renderShadowMap() {
-    if (!terrain || !tw || !tw->directionalLightButton ||
-        tw->directionalLightButton->value() == 0)
+void TrainView::renderShadowAtlas() {
+    if (!terrain || !tw)
         return;
 
-    initShadowMap();
-    updateLightMatrices();
+    initShadowAtlas();
+
+    ShadowLight& dirLight = shadowAtlas.lights[dirShadowLight];
+    ShadowLight& pointLight = shadowAtlas.lights[pointShadowLight];
+    ShadowLight& spotLight = shadowAtlas.lights[spotShadowLight];
+    dirLight.enabled = tw->directionalLightButton &&
+                       tw->directionalLightButton->value() != 0;
+    pointLight.enabled =
+        tw->pointLightButton && tw->pointLightButton->value() != 0;
+    spotLight.enabled =
+        tw->spotLightButton && tw->spotLightButton->value() != 0;
+
+    // A light's static tiles are reused while its key stays the same
+    std::vector<float> lightKeys[ShadowAtlas::MAX_LIGHTS];
+
+    if (dirLight.enabled) {
+        updateLightMatrices();
+        for (int c = 0; c < shadowCascades.count; ++c)
+            shadowAtlas.viewMatrices[dirLight.firstView + c] =
+                shadowCascades.matrices[c];
+    }
+
+    if (pointLight.enabled) {
+        const glm::vec3 lightPos = computePointLightPos();
+        const glm::mat4 shadowProj =
+            glm::perspective(glm::radians(90.0f), 1.0f, pointShadowNearPlane,
+                             pointShadowFarPlane);
+
+        std::array<glm::mat4, 6> shadowTransforms = {
+            glm::lookAt(lightPos, lightPos + glm::vec3(1.0f, 0.0f, 0.0f),
+                        glm::vec3(0.0f, -1.0f, 0.0f)),
+            glm::lookAt(lightPos, lightPos + glm::vec3(-1.0f, 0.0f, 0.0f),
+                        glm::vec3(0.0f, -1.0f, 0.0f)),
+            glm::lookAt(lightPos, lightPos + glm::vec3(0.0f, 1.0f, 0.0f),
+                        glm::vec3(0.0f, 0.0f, 1.0f)),
+            glm::lookAt(lightPos, lightPos + glm::vec3(0.0f, -1.0f, 0.0f),
+                        glm::vec3(0.0f, 0.0f, -1.0f)),
+            glm::lookAt(lightPos, lightPos + glm::vec3(0.0f, 0.0f, 1.0f),
+                        glm::vec3(0.0f, -1.0f, 0.0f)),
+            glm::lookAt(lightPos, lightPos + glm::vec3(0.0f, 0.0f, -1.0f),
+                        glm::vec3(0.0f, -1.0f, 0.0f))
+        };
+        for (size_t i = 0; i < shadowTransforms.size(); ++i)
+            shadowAtlas.viewMatrices[pointLight.firstView + i] =
+                shadowProj * shadowTransforms[i];
+
+        pointLight.position = lightPos;
+        pointLight.farPlane = pointShadowFarPlane;
+        lightKeys[pointShadowLight] = { lightPos.x, lightPos.y, lightPos.z,
+                                        pointShadowFarPlane };
+    }
+
+    if (spotLight.enabled) {
+        const glm::vec3 lightPos = computeSpotLightPos();
+        const glm::vec3 lightDir = computeSpotLightDir();
+        glm::vec3 up(0.0f, 1.0f, 0.0f);
+        if (std::abs(glm::dot(up, lightDir)) > 0.95f)
+            up = glm::vec3(0.0f, 0.0f, 1.0f);
+
+        glm::mat4 lightView = glm::lookAt(lightPos, lightPos + lightDir, up);
+        glm::mat4 lightProj =
+            glm::perspective(glm::radians(35.0f), 1.0f, spotShadowNearPlane,
+                             spotShadowFarPlane);
+        spotLightMatrix = lightProj * lightView;
+        shadowAtlas.viewMatrices[spotLight.firstView] = spotLightMatrix;
 
-    GLint prevFBO = 0;
-    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prevFBO);
+        spotLight.position = lightPos;
+        spotLight.farPlane = spotShadowFarPlane;
+        const float* spotData = glm::value_ptr(spotLightMatrix);
+        lightKeys[spotShadowLight].assign(spotData, spotData + 16);
+    }
 
-    GLint viewport[4];
-    glGetIntegerv(GL_VIEWPORT, viewport);
+    shadowAtlas.upload();
 
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowFBO);
-    glViewport(0, 0, shadowMapResolution, shadowMapResolution);
-    glClear(GL_DEPTH_BUFFER_BIT);
+    bool dirty[ShadowAtlas::MAX_LIGHTS] = {};
+    bool staticDirty = false;
+    for (size_t i = 0; i < shadowAtlas.lights.size(); ++i) {
+        const ShadowLight& light = shadowAtlas.lights[i];
+        dirty[i] = light.enabled &&
+                   (!light.cached ||
+                    !light.cache.isCurrent(lightKeys[i], staticSceneVersion));
+        staticDirty = staticDirty ||
+                      (dirty[i] && light.cached && light.dynamicCasters);
+    }
 
     glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
     glDisable(GL_BLEND);
     glDisable(GL_STENCIL_TEST);
     glEnable(GL_DEPTH_TEST);
-    glEnable(GL_POLYGON_OFFSET_FILL);
-    glPolygonOffset(4.0f, 4.0f);
     glEnable(GL_CULL_FACE);
     glCullFace(GL_FRONT);
 
+    // Geometry reaches the caster shaders in world space; each light's
+    // views apply their own matrices
     glMatrixMode(GL_PROJECTION);
     glPushMatrix();
-    glLoadMatrixf(glm::value_ptr(lightProj));
+    glLoadIdentity();
     glMatrixMode(GL_MODELVIEW);
     glPushMatrix();
-    glLoadMatrixf(glm::value_ptr(lightView));
+    glLoadIdentity();
+
+    // Static casters are only redrawn into the static atlas when a light
+    // moved or the static scene changed
+    if (staticDirty) {
+        glBindFramebuffer(GL_FRAMEBUFFER, shadowAtlas.staticFbo);
+        for (size_t i = 0; i < shadowAtlas.lights.size(); ++i) {
+            ShadowLight& light = shadowAtlas.lights[i];
+            if (!dirty[i] || !light.cached || !light.dynamicCasters)
+                continue;
+            shadowAtlas.clearViews(light);
+            renderShadowLight(light, STATIC_CASTERS);
+            light.cache.markCurrent(lightKeys[i], staticSceneVersion);
+        }
+    }
 
-    drawStuff(true);
-    terrain->drawDepth();
+    // Every light then shares one pass over the live atlas: cached static
+    // depth is copied in and dynamic casters are drawn on top
+    bool rendered[ShadowAtlas::MAX_LIGHTS] = {};
+    glBindFramebuffer(GL_FRAMEBUFFER, shadowAtlas.fbo);
+    for (size_t i = 0; i < shadowAtlas.lights.size(); ++i) {
+        ShadowLight& light = shadowAtlas.lights[i];
+        if (!light.enabled)
+            continue;
+
+        if (light.cached && light.dynamicCasters) {
+            shadowAtlas.copyStatic(light);
+            renderShadowLight(light, DYNAMIC_CASTERS);
+            rendered[i] = true;
+        } else if (dirty[i]) {
+            // Uncached lights and lights without dynamic casters draw
+            // straight into the live tiles
+            shadowAtlas.clearViews(light);
+            renderShadowLight(light, ALL_CASTERS);
+            light.cache.markCurrent(lightKeys[i], staticSceneVersion);
+            rendered[i] = true;
+        }
+    }
+
+    glUseProgram(0);
 
     glPopMatrix();
     glMatrixMode(GL_PROJECTION);
     glPopMatrix();
     glMatrixMode(GL_MODELVIEW);
 
-    glDisable(GL_POLYGON_OFFSET_FILL);
     glCullFace(GL_BACK);
     glDisable(GL_CULL_FACE);
     glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, prevFBO);
-    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
-}
-
-void TrainView::initPointShadowMap() {
-    if (pointShadowFBO != 0 && pointShadowDepthMap != 0 && pointShadowShader)
-        return;
-
-    if (!pointShadowShader) {
-        pointShadowShader =
-            new Shader("./shaders/pointShadowDepth.vert", nullptr, nullptr,
-                       nullptr, "./shaders/pointShadowDepth.frag");
+    if (shadowFilter == VSM_FILTER) {
+        for (size_t i = 0; i < shadowAtlas.lights.size(); ++i) {
+            const ShadowLight& light = shadowAtlas.lights[i];
+            if (!rendered[i])
+                continue;
+            shadowAtlas.moments.filter(
+                shadowMomentsShader, shadowAtlas.depth, shadowAtlas.size,
+                &shadowAtlas.viewRects[light.firstView], light.viewCount);
+        }
     }
 
-    if (pointShadowFBO == 0)
-        glGenFramebuffers(1, &pointShadowFBO);
-    if (pointShadowDepthMap == 0)
-        glGenTextures(1, &pointShadowDepthMap);
+    bindSceneTarget(sceneFbo, sceneViewport);
+}
 
-    glBindTexture(GL_TEXTURE_CUBE_MAP, pointShadowDepthMap);
-    for (int i = 0; i < 6; ++i) {
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0,
-                     GL_DEPTH_COMPONENT24, pointShadowMapResolution,
-                     pointShadowMapResolution, 0, GL_DEPTH_COMPONENT, GL_FLOAT,
-                     nullptr);
+void TrainView::renderShadowLight(const ShadowLight& light,
+                                  ShadowCasterSet set) {
+    Shader* casterShader = cascadeShadowShader;
+    if (light.type == POINT_SHADOW)
+        casterShader = pointShadowShader;
+    else if (light.type == SPOT_SHADOW)
+        casterShader = spotShadowShader;
+
+    casterShader->Use();
+    casterShader->set("u_shadowLight",
+                      (int)(&light - &shadowAtlas.lights[0]));
+    casterShader->set("u_lightPos", light.position);
+    casterShader->set("u_farPlane", light.farPlane);
+
+    // Window-depth maps need a slope bias; distance maps are compared with
+    // their own bias in the receivers
+    if (light.type != POINT_SHADOW) {
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(4.0f, 4.0f);
+    }
+
+    shadowAtlas.setViewports(light);
+    if (light.type == SPOT_SHADOW) {
+        // Only the terrain is tall enough to matter in the spotlight
+        terrain->drawPointShadow(spotShadowShader, spotLightMatrix,
+                                 light.position, light.farPlane);
+    } else {
+        drawShadowCasters(casterShader, light, set);
     }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, pointShadowFBO);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
-                         pointShadowDepthMap, 0);
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDisable(GL_SCISSOR_TEST);
+    glDisable(GL_POLYGON_OFFSET_FILL);
 }
 
-void TrainView::renderPointShadowMap() {
-    if (!terrain || !tw || !tw->pointLightButton ||
-        tw->pointLightButton->value() == 0)
-        return;
-
-    initPointShadowMap();
-
-    GLint prevFBO = 0;
-    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prevFBO);
-    GLint viewport[4];
-    glGetIntegerv(GL_VIEWPORT, viewport);
-
-    glm::vec3 lightPos = computePointLightPos();
-    glm::mat4 shadowProj = glm::perspective(
-        glm::radians(90.0f), 1.0f, pointShadowNearPlane, pointShadowFarPlane);
-
-    std::array<glm::mat4, 6> shadowTransforms = {
-        glm::lookAt(lightPos, lightPos + glm::vec3(1.0f, 0.0f, 0.0f),
-                    glm::vec3(0.0f, -1.0f, 0.0f)),
-        glm::lookAt(lightPos, lightPos + glm::vec3(-1.0f, 0.0f, 0.0f),
-                    glm::vec3(0.0f, -1.0f, 0.0f)),
-        glm::lookAt(lightPos, lightPos + glm::vec3(0.0f, 1.0f, 0.0f),
-                    glm::vec3(0.0f, 0.0f, 1.0f)),
-        glm::lookAt(lightPos, lightPos + glm::vec3(0.0f, -1.0f, 0.0f),
-                    glm::vec3(0.0f, 0.0f, -1.0f)),
-        glm::lookAt(lightPos, lightPos + glm::vec3(0.0f, 0.0f, 1.0f),
-                    glm::vec3(0.0f, -1.0f, 0.0f)),
-        glm::lookAt(lightPos, lightPos + glm::vec3(0.0f, 0.0f, -1.0f),
-                    glm::vec3(0.0f, -1.0f, 0.0f))
-    };
+void TrainView::drawShadowCasters(Shader* casterShader,
+                                  const ShadowLight& light,
+                                  ShadowCasterSet set) {
+    shadowCasterShader = casterShader;
+    shadowCasterSet = set;
 
-    glBindFramebuffer(GL_FRAMEBUFFER, pointShadowFBO);
-    glViewport(0, 0, pointShadowMapResolution, pointShadowMapResolution);
-    glEnable(GL_DEPTH_TEST);
-    glDisable(GL_BLEND);
-    glDisable(GL_STENCIL_TEST);
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_FRONT);
+    // Casters are drawn in world space, so the view stays identity; they
+    // are culled against every view of the light
+    MatrixStack world;
+    world.cullViews.assign(
+        shadowAtlas.viewMatrices + light.firstView,
+        shadowAtlas.viewMatrices + light.firstView + light.viewCount);
+    casterShader->Use();
+    drawStuff(world, true);
 
-    pointShadowShader->Use();
-    glUniform3fv(glGetUniformLocation(pointShadowShader->Program, "u_lightPos"),
-                 1, glm::value_ptr(lightPos));
-    glUniform1f(glGetUniformLocation(pointShadowShader->Program, "u_farPlane"),
-                pointShadowFarPlane);
+    if (set != DYNAMIC_CASTERS) {
+        casterShader->Use();
+        terrain->drawDepth();
+    }
 
-    for (size_t i = 0; i < shadowTransforms.size(); ++i) {
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
-                               GL_TEXTURE_CUBE_MAP_POSITIVE_X + (GLenum)i,
-                               pointShadowDepthMap, 0);
-        glClear(GL_DEPTH_BUFFER_BIT);
+    shadowCasterShader = nullptr;
+    shadowCasterSet = ALL_CASTERS;
+}
 
-        glm::mat4 lightMat = shadowProj * shadowTransforms[i];
-        glUniformMatrix4fv(
-            glGetUniformLocation(pointShadowShader->Program, "u_lightMatrix"),
-            1, GL_FALSE, glm::value_ptr(lightMat));
+void TrainView::updateStaticSceneVersion() {
+    // FNV-1a over everything the static casters are built from
+    size_t hash = 2166136261u;
+    auto mix = [&hash](float value) {
+        const unsigned char* bytes =
+            reinterpret_cast<const unsigned char*>(&value);
+        for (size_t i = 0; i < sizeof(float); ++i) {
+            hash ^= bytes[i];
+            hash *= 16777619u;
+        }
+    };
 
-        terrain->drawPointShadow(pointShadowShader, lightMat, lightPos,
-                                 pointShadowFarPlane);
+    for (const ControlPoint& cp : m_pTrack->points) {
+        mix(cp.pos.x);
+        mix(cp.pos.y);
+        mix(cp.pos.z);
+        mix(cp.orient.x);
+        mix(cp.orient.y);
+        mix(cp.orient.z);
+    }
+    mix((float)tw->splineBrowser->value());
+    mix(currentTension(0.5f));
+    mix((float)tw->minecraftButton->value());
+    mix((float)tw->trainCam->value());  // Control points hide in train cam
+    mix((float)AssetCache::instance().uploadedModels());  // Models appear
+    if (tw->sphereRecursionSlider)
+        mix((float)tw->sphereRecursionSlider->value());
+    if (terrain) {
+        mix((float)terrain->getWidth());
+        mix((float)terrain->getDepth());
     }
 
-    glUseProgram(0);
-    glCullFace(GL_BACK);
-    glDisable(GL_CULL_FACE);
-    glBindFramebuffer(GL_FRAMEBUFFER, prevFBO);
-    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    if (hash != staticSceneHash) {
+        staticSceneHash = hash;
+        ++staticSceneVersion;
+    }
 }
 
-void TrainView::initSpotShadowMap() {
-    if (spotShadowFBO != 0 && spotShadowDepthMap != 0 && spotShadowShader)
-        return;
+void TrainView::updateShadowFilter() {
+    ShadowFilter filter = (tw->vsmButton && tw->vsmButton->value())
+                              ? VSM_FILTER
+                              : PCF_FILTER;
+    if (shadowBenchmark.frame >= 0) {
+        filter = shadowBenchmark.frame < shadowBenchmark.framesPerMode
+                     ? PCF_FILTER
+                     : VSM_FILTER;
+    }
 
-    if (!spotShadowShader) {
-        spotShadowShader =
-            new Shader("./shaders/pointShadowDepth.vert", nullptr, nullptr,
-                       nullptr, "./shaders/pointShadowDepth.frag");
+    if (filter == VSM_FILTER) {
+        if (!shadowMomentsShader) {
+            shadowMomentsShader =
+                new Shader("./shaders/shadowMoments.vert", nullptr, nullptr,
+                           nullptr, "./shaders/shadowMoments.frag");
+        }
+        // Half resolution is plenty once the moments are blurred
+        shadowAtlas.moments.init(shadowAtlas.size / 2);
     }
 
-    if (spotShadowFBO == 0)
-        glGenFramebuffers(1, &spotShadowFBO);
-    if (spotShadowDepthMap == 0)
-        glGenTextures(1, &spotShadowDepthMap);
-
-    glBindTexture(GL_TEXTURE_2D, spotShadowDepthMap);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24,
-                 spotShadowMapResolution, spotShadowMapResolution, 0,
-                 GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    // The spot pass is skipped while its tile is current, which would leave
+    // its moments stale after switching filters
+    if (filter != shadowFilter && spotShadowLight >= 0)
+        shadowAtlas.lights[spotShadowLight].cache.invalidate();
 
-    glBindFramebuffer(GL_FRAMEBUFFER, spotShadowFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
-                           spotShadowDepthMap, 0);
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    shadowFilter = filter;
+    shadowAtlas.filtered = filter == VSM_FILTER;
 }
 
-void TrainView::renderSpotShadowMap() {
-    if (!terrain || !tw || !tw->spotLightButton ||
-        tw->spotLightButton->value() == 0)
-        return;
-
-    initSpotShadowMap();
-
-    GLint prevFBO = 0;
-    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prevFBO);
-    GLint viewport[4];
-    glGetIntegerv(GL_VIEWPORT, viewport);
+static void shadowBenchmarkRedraw(void* view) {
+    static_cast<TrainView*>(view)->redraw();
+}
 
-    glm::vec3 lightPos = computeSpotLightPos();
-    glm::vec3 lightDir = computeSpotLightDir();
-    glm::vec3 up(0.0f, 1.0f, 0.0f);
-    if (std::abs(glm::dot(up, lightDir)) > 0.95f)
-        up = glm::vec3(0.0f, 0.0f, 1.0f);
+static void assetLoadRedraw(void* view) {
+    static_cast<TrainView*>(view)->redraw();
+}
 
-    glm::mat4 lightView = glm::lookAt(lightPos, lightPos + lightDir, up);
-    glm::mat4 lightProj = glm::perspective(
-        glm::radians(35.0f), 1.0f, spotShadowNearPlane, spotShadowFarPlane);
-    spotLightMatrix = lightProj * lightView;
+void TrainView::startShadowBenchmark() {
+    if (shadowBenchmark.frame >= 0)
+        return;
 
-    glBindFramebuffer(GL_FRAMEBUFFER, spotShadowFBO);
-    glViewport(0, 0, spotShadowMapResolution, spotShadowMapResolution);
-    glClear(GL_DEPTH_BUFFER_BIT);
-    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-    glDisable(GL_BLEND);
-    glDisable(GL_STENCIL_TEST);
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_POLYGON_OFFSET_FILL);
-    glPolygonOffset(4.0f, 4.0f);
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_FRONT);
+    shadowBenchmark.frame = 0;
+    for (int i = 0; i < 2; ++i) {
+        shadowBenchmark.shadowMs[i] = 0.0;
+        shadowBenchmark.sceneMs[i] = 0.0;
+    }
+    std::cout << "Shadow benchmark: " << shadowBenchmark.framesPerMode
+              << " frames with PCF, then " << shadowBenchmark.framesPerMode
+              << " with VSM" << std::endl;
+    redraw();
+}
 
-    spotShadowShader->Use();
-    glUniform3fv(glGetUniformLocation(spotShadowShader->Program, "u_lightPos"),
-                 1, glm::value_ptr(lightPos));
-    glUniform1f(glGetUniformLocation(spotShadowShader->Program, "u_farPlane"),
-                spotShadowFarPlane);
-    glUniformMatrix4fv(
-        glGetUniformLocation(spotShadowShader->Program, "u_lightMatrix"), 1,
-        GL_FALSE, glm::value_ptr(spotLightMatrix));
+void TrainView::recordShadowBenchmark() {
+    // The first frames of each mode pay for allocation and shader compiles
+    const int warmupFrames = 10;
+    const int perMode = shadowBenchmark.framesPerMode;
+    const int mode = shadowBenchmark.frame < perMode ? 0 : 1;
 
-    terrain->drawPointShadow(spotShadowShader, spotLightMatrix, lightPos,
-                             spotShadowFarPlane);
+    if (shadowBenchmark.frame % perMode >= warmupFrames) {
+        GLuint64 stamps[3];
+        for (int i = 0; i < 3; ++i) {
+            glGetQueryObjectui64v(shadowBenchmark.queries[i], GL_QUERY_RESULT,
+                                  &stamps[i]);
+        }
+        shadowBenchmark.shadowMs[mode] += (stamps[1] - stamps[0]) / 1.0e6;
+        shadowBenchmark.sceneMs[mode] += (stamps[2] - stamps[1]) / 1.0e6;
+    }
 
-    glUseProgram(0);
-    glDisable(GL_POLYGON_OFFSET_FILL);
-    glCullFace(GL_BACK);
-    glDisable(GL_CULL_FACE);
-    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    if (++shadowBenchmark.frame < 2 * perMode) {
+        Fl::add_timeout(0.0, shadowBenchmarkRedraw, this);
+        return;
+    }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, prevFBO);
-    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    const char* lights[3] = { "directional", "point", "spot" };
+    const bool lightOn[3] = { tw->directionalLightButton->value() != 0,
+                              tw->pointLightButton->value() != 0,
+                              tw->spotLightButton->value() != 0 };
+    std::cout << "Shadow benchmark results (GPU ms per frame, lights:";
+    for (int i = 0; i < 3; ++i) {
+        if (lightOn[i])
+            std::cout << " " << lights[i];
+    }
+    std::cout << ")" << std::endl;
+
+    const char* names[2] = { "PCF", "VSM" };
+    const double samples = perMode - warmupFrames;
+    for (int i = 0; i < 2; ++i) {
+        double shadow = shadowBenchmark.shadowMs[i] / samples;
+        double scene = shadowBenchmark.sceneMs[i] / samples;
+        std::cout << "  " << names[i] << ": shadow maps " << shadow
+                  << ", lit scene " << scene << ", total " << shadow + scene
+                  << std::endl;
+    }
+
+    glDeleteQueries(3, shadowBenchmark.queries);
+    for (int i = 0; i < 3; ++i)
+        shadowBenchmark.queries[i] = 0;
+    shadowBenchmark.frame = -1;
+    redraw();
 }
 
-void TrainView::setUBO() {
-    float wdt = this->pixel_w();
-    float hgt = this->pixel_h();
-
-    glm::mat4 viewMatrix;
-    glGetFloatv(GL_MODELVIEW_MATRIX, &viewMatrix[0][0]);
-
-    glm::mat4 projectionMatrix;
-    glGetFloatv(GL_PROJECTION_MATRIX, &projectionMatrix[0][0]);
+void TrainView::reportRenderQueue() const {
+    const RenderQueue::Stats& stats = renderQueue.lastFrameStats();
+    const int issued =
+        stats.programBinds + stats.textureBinds + stats.vaoBinds;
+    std::cout << "Render queue (last frame): " << stats.items << " draws, "
+              << stats.programBinds << " program, " << stats.textureBinds
+              << " texture and " << stats.vaoBinds << " VAO binds; "
+              << stats.bindsSaved << " of " << issued + stats.bindsSaved
+              << " binds saved" << std::endl;
+    std::cout << "Frustum culling (last frame): " << stats.culledObjects
+              << " models and " << stats.culledMeshes << " meshes skipped"
+              << std::endl;
+    std::cout << "Model LODs (last frame):";
+    for (int lod = 0; lod < 4; ++lod)
+        std::cout << " " << stats.modelLods[lod];
+    std::cout << " draws at LOD 0-3" << std::endl;
+    AssetCache::instance().printStats();
+    ProgramCache::printStats();
+    church->printStats();
+    water->printStats();
+    TextureStreamer::instance().printStats();
+}
 
-    glBindBuffer(GL_UNIFORM_BUFFER, this->commonMatrices->ubo);
-    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4),
-                    &projectionMatrix[0][0]);
-    glBufferSubData(GL_UNIFORM_BUFFER, sizeof(glm::mat4), sizeof(glm::mat4),
-                    &viewMatrix[0][0]);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+void TrainView::updateFrameConstants(const MatrixStack& matrices) {
+    FrameConstants frame;
+    frame.view = matrices.view;
+    frame.projection = matrices.projection;
+    frame.invView = glm::inverse(frame.view);
+    frame.cameraPos = frame.invView[3];
+    frame.smokeParams =
+        glm::vec4(smokeStartDistance, smokeEndDistance, 0.0f, 0.0f);
+    frame.clipPlane = matrices.clipPlane;
+    frame.flags = glm::ivec4(matrices.clipEnabled ? 1 : 0,
+                             tw && tw->smokeButton && tw->smokeButton->value(),
+                             0, 0);
+    sceneConstants.setFrame(frame);
 }
 
 void TrainView::initFrameBufferShader() {
@@ -851,21 +1051,18 @@ void TrainView::initFrameBufferShader() {
 }
 
 void TrainView::clearGlad() {
+    this->planeShaders = nullptr;
     this->shader = nullptr;
-    this->commonMatrices = nullptr;
     this->plane = nullptr;
     this->texture = nullptr;
 }
 
 void TrainView::drawPlane() {
-    if (!this->shader || !this->plane)
+    if (!this->planeShaders || !this->plane)
         return;
 
-    setUBO();
-    glBindBufferRange(GL_UNIFORM_BUFFER, /*binding point*/ 0,
-                      this->commonMatrices->ubo, 0, this->commonMatrices->size);
-
     //bind shader
+    this->shader = this->planeShaders->get(getSceneFeatures());
     this->shader->Use();
 
     glm::mat4 modelMatrix = glm::mat4(1.0f);
@@ -884,10 +1081,8 @@ void TrainView::drawPlane() {
         modelMatrix = glm::scale(modelMatrix, glm::vec3(40.0f, 40.0f, 40.0f));
     }
 
-    glUniformMatrix4fv(glGetUniformLocation(this->shader->Program, "u_model"),
-                       1, GL_FALSE, &modelMatrix[0][0]);
-    glUniform3fv(glGetUniformLocation(this->shader->Program, "u_color"), 1,
-                 &glm::vec3(0.5f, 0.0f, 0.0f)[0]);
+    sceneConstants.pushObject(modelMatrix);
+    this->shader->set("u_color", glm::vec3(0.5f, 0.0f, 0.0f));
 
     if (this->texture) {
         this->texture->bind(0);
@@ -895,146 +1090,68 @@ void TrainView::drawPlane() {
         Texture2D::unbind(0);
     }
 
-    glUniform1i(glGetUniformLocation(this->shader->Program, "u_texture"), 0);
+    this->shader->set("u_texture", 0);
 
     // Time uniform for wave animation
     static auto start = std::chrono::steady_clock::now();
     float t =
         std::chrono::duration<float>(std::chrono::steady_clock::now() - start)
             .count();
-    glUniform1f(glGetUniformLocation(this->shader->Program, "u_time"), t);
+    this->shader->set("u_time", t);
 
     // Wave uniforms
     if (tw->shaderBrowser->value() == 3 || tw->shaderBrowser->value() == 4 ||
         tw->shaderBrowser->value() == 5) {
         int waveCount = (int)water->waveDirections.size();
-        glUniform1i(glGetUniformLocation(this->shader->Program, "u_waveCount"),
-                    waveCount);
+        this->shader->set("u_waveCount", waveCount);
         if (waveCount > 0) {
-            glUniform2fv(
-                glGetUniformLocation(this->shader->Program, "u_direction"),
-                waveCount, &water->waveDirections[0][0]);
-            glUniform1fv(
-                glGetUniformLocation(this->shader->Program, "u_wavelength"),
-                waveCount, &water->waveWavelengths[0]);
-            glUniform1fv(
-                glGetUniformLocation(this->shader->Program, "u_amplitude"),
-                waveCount, &water->waveAmplitudes[0]);
-            glUniform1fv(glGetUniformLocation(this->shader->Program, "u_speed"),
+            glUniform2fv(this->shader->getUniformLocation("u_direction"),
+                         waveCount, &water->waveDirections[0][0]);
+            glUniform1fv(this->shader->getUniformLocation("u_wavelength"),
+                         waveCount, &water->waveWavelengths[0]);
+            glUniform1fv(this->shader->getUniformLocation("u_amplitude"),
+                         waveCount, &water->waveAmplitudes[0]);
+            glUniform1fv(this->shader->getUniformLocation("u_speed"),
                          waveCount, &water->waveSpeeds[0]);
         }
-        glUniform2fv(glGetUniformLocation(this->shader->Program, "u_scroll"), 1,
-                     &water->heightMapScroll[0]);
-        glUniform1f(
-            glGetUniformLocation(this->shader->Program, "u_heightScale"),
-            water->heightMapScale);
+        this->shader->set("u_scroll", water->heightMapScroll);
+        this->shader->set("u_heightScale", water->heightMapScale);
 
         // Reflection & Refraction textures for water shader
         if (water->reflectionTexture != 0) {
             glActiveTexture(GL_TEXTURE1);
             glBindTexture(GL_TEXTURE_2D, water->reflectionTexture);
-            glUniform1i(
-                glGetUniformLocation(this->shader->Program, "u_reflectionTex"),
-                1);
+            this->shader->set("u_reflectionTex", 1);
         }
         if (water->refractionTexture != 0) {
             glActiveTexture(GL_TEXTURE2);
             glBindTexture(GL_TEXTURE_2D, water->refractionTexture);
-            glUniform1i(
-                glGetUniformLocation(this->shader->Program, "u_refractionTex"),
-                2);
+            this->shader->set("u_refractionTex", 2);
         }
         if (water->refractionDepthTexture != 0) {
             glActiveTexture(GL_TEXTURE3);
             glBindTexture(GL_TEXTURE_2D, water->refractionDepthTexture);
-            glUniform1i(
-                glGetUniformLocation(this->shader->Program, "u_depthTex"), 3);
+            this->shader->set("u_depthTex", 3);
         }
 
-        glUniform1f(
-            glGetUniformLocation(this->shader->Program, "u_waterHeight"),
-            water->waterHeight);
+        this->shader->set("u_waterHeight", water->waterHeight);
 
         if (tw->shaderBrowser->value() == 5) {
-            glUniform1f(glGetUniformLocation(this->shader->Program,
-                                             "u_distortionStrength"),
-                        0.0012f);
-            glUniform1f(
-                glGetUniformLocation(this->shader->Program, "u_normalStrength"),
-                0.015f);
-            glUniform3f(
-                glGetUniformLocation(this->shader->Program, "u_waterColor"),
-                0.02f, 0.32f, 0.52f);
-            glUniform1f(glGetUniformLocation(this->shader->Program,
-                                             "u_reflectRefractRatio"),
-                        (float)tw->reflectRefractSlider->value());
+            this->shader->set("u_distortionStrength", 0.0012f);
+            this->shader->set("u_normalStrength", 0.015f);
+            this->shader->set("u_waterColor", glm::vec3(0.02f, 0.32f, 0.52f));
+            this->shader->set("u_reflectRefractRatio",
+                              (float)tw->reflectRefractSlider->value());
         }
     }
 
-    // Camera position and skybox for shader
-    glm::mat4 viewMatrix;
-    glGetFloatv(GL_MODELVIEW_MATRIX, &viewMatrix[0][0]);
-    glm::mat4 invView = glm::inverse(viewMatrix);
-    glm::vec3 cameraPos = glm::vec3(invView[3]);
-    glUniform3fv(glGetUniformLocation(this->shader->Program, "u_cameraPos"), 1,
-                 &cameraPos[0]);
-
-    // Directional shadow-map uniforms (optional per-shader)
-    const bool enableShadow = (tw && tw->directionalLightButton &&
-                               tw->directionalLightButton->value() != 0);
-
-    GLint enableShadowLoc =
-        glGetUniformLocation(this->shader->Program, "u_enableShadow");
-    if (enableShadowLoc >= 0) {
-        glUniform1i(enableShadowLoc, enableShadow ? 1 : 0);
-    }
-
-    GLint lightDirLoc =
-        glGetUniformLocation(this->shader->Program, "u_lightDir");
-    if (lightDirLoc >= 0) {
-        glm::vec3 lightDir = getDirLightDir();
-        glUniform3fv(lightDirLoc, 1, &lightDir[0]);
-    }
-
-    GLint lightSpaceLoc =
-        glGetUniformLocation(this->shader->Program, "uLightSpace");
-    if (lightSpaceLoc >= 0) {
-        glm::mat4 ls = getLightSpaceMatrix();
-        glUniformMatrix4fv(lightSpaceLoc, 1, GL_FALSE, &ls[0][0]);
-    }
-
-    GLint shadowMapLoc =
-        glGetUniformLocation(this->shader->Program, "u_shadowMap");
-    if (shadowMapLoc >= 0) {
-        GLint prevActiveTexture = GL_TEXTURE0;
-        glGetIntegerv(GL_ACTIVE_TEXTURE, &prevActiveTexture);
-        glActiveTexture(GL_TEXTURE10);
-        glBindTexture(GL_TEXTURE_2D, getShadowMap());
-        glUniform1i(shadowMapLoc, 10);
-        glActiveTexture(prevActiveTexture);
-    }
-
-    GLint smokeLoc =
-        glGetUniformLocation(this->shader->Program, "u_smokeParams");
-    if (smokeLoc >= 0) {
-        glUniform2f(smokeLoc, smokeStartDistance, smokeEndDistance);
-    }
-
-    GLint smokeEnabledLoc =
-        glGetUniformLocation(this->shader->Program, "smokeEnabled");
-    if (smokeEnabledLoc >= 0 && tw && tw->smokeButton) {
-        glUniform1i(smokeEnabledLoc, tw->smokeButton->value() ? 1 : 0);
-    }
+    shadowAtlas.apply(this->shader, 10);
 
     // Bind skybox for reflection
     if (skybox && skybox->getTexture() != 0) {
         glActiveTexture(GL_TEXTURE5);
         glBindTexture(GL_TEXTURE_CUBE_MAP, skybox->getTexture());
-        GLint skyboxLoc =
-            glGetUniformLocation(this->shader->Program, "u_skybox");
-        if (skyboxLoc >= 0) {
-            glUniform1i(skyboxLoc, 5);
-        }
+        this->shader->set("u_skybox", 5);
     }
 
     //bind VAO
@@ -1062,13 +1179,43 @@ void TrainView::draw() {
         if (!gladLoadGL()) {
             throw std::runtime_error("Could not initialize GLAD!");
         }
+        sceneConstants.init();
+
         // Initialize Skybox once
         skybox->init();
         totem->init(this);
         terrain->init(tw);
+        buildPrimitiveMeshes();
+        church->init();
+        water->init();
+        warmUpShaders();
         glInited = true;
     }
 
+    renderQueue.beginFrame();
+
+    // Models finished by the background loader and images decoded by the
+    // texture streamer are uploaded a few milliseconds at a time; keep
+    // redrawing until they are all in
+    const double assetUploadBudgetMs = 4.0;
+    const double textureUploadBudgetMs = 2.0;
+    const bool texturesPending =
+        TextureStreamer::instance().processUploads(textureUploadBudgetMs);
+    const bool assetsPending =
+        AssetCache::instance().processUploads(assetUploadBudgetMs);
+    if ((texturesPending || assetsPending) &&
+        !Fl::has_timeout(assetLoadRedraw, this))
+        Fl::add_timeout(1.0 / 30.0, assetLoadRedraw, this);
+
+    // Show a loading screen until the programs warmUpShaders started have
+    // compiled, rather than stalling the first frames on them
+    if (Shader::finishCompleted() > 0) {
+        drawLoadingScreen();
+        if (!Fl::has_timeout(assetLoadRedraw, this))
+            Fl::add_timeout(1.0 / 30.0, assetLoadRedraw, this);
+        return;
+    }
+
     // Start/stop background music based on UI toggle; defaults to on when toggle is absent
     bool bgmEnabled = true;
     if (tw && tw->bgmButton) {
@@ -1091,59 +1238,24 @@ void TrainView::draw() {
 
     clearGlad();
 
-    // Reinitialize content shaders depending on selection
-    static int lastShader = -1;
-    int shaderType = tw->shaderBrowser->value();
-
-    if (shaderType != lastShader) {
-        if (shaderType == 1) {
-            church->initSimple();
-        } else if (shaderType == 2) {
-            church->initColorful();
-        } else if (shaderType == 3) {
-            water->initHeightMapWave();
-        } else if (shaderType == 4) {
-            water->initSineWave();
-        } else if (shaderType == 5) {
-            water->initReflectionWater(this);
-        } else if (shaderType == 6) {
-            church->initSierpinski();
-        }
-        lastShader = shaderType;
-    }
-
-    if (shaderType == 1) {
-        this->shader = church->shader;
-        this->plane = church->plane;
-        this->texture = church->texture;
-        this->commonMatrices = church->commonMatrices;
-    } else if (shaderType == 2) {
-        this->shader = church->shader;
-        this->plane = church->plane;
-        this->texture = church->texture;
-        this->commonMatrices = church->commonMatrices;
-    } else if (shaderType == 3) {
-        this->shader = water->shader;
-        this->plane = water->plane;
-        this->texture = water->texture;
-        this->commonMatrices = water->commonMatrices;
-    } else if (shaderType == 4) {
-        this->shader = water->shader;
-        this->plane = water->plane;
-        this->texture = water->texture;
-        this->commonMatrices = water->commonMatrices;
-    } else if (shaderType == 5) {
-        this->shader = water->shader;
-        this->plane = water->plane;
-        this->texture = water->texture;
-        this->commonMatrices = water->commonMatrices;
-    } else if (shaderType == 6) {
-        this->shader = church->shader;
-        this->plane = church->plane;
-        this->texture = church->texture;
-        this->commonMatrices = church->commonMatrices;
-    } else {
-        clearGlad();
+    // Every content variant is resident; the selection only picks one
+    const int shaderType = tw->shaderBrowser->value();
+    if (shaderType == 1 || shaderType == 2 || shaderType == 6) {
+        const Church::Variant& variant =
+            church->get(shaderType == 1   ? Church::SIMPLE
+                        : shaderType == 2 ? Church::COLORFUL
+                                          : Church::SIERPINSKI);
+        this->planeShaders = variant.shaders.get();
+        this->plane = variant.plane;
+        this->texture = variant.texture;
+    } else if (shaderType >= 3 && shaderType <= 5) {
+        const Water::Variant& variant =
+            water->get(shaderType == 3   ? Water::HEIGHT_MAP
+                       : shaderType == 4 ? Water::SINE_WAVE
+                                         : Water::REFLECTION);
+        this->planeShaders = variant.shaders.get();
+        this->plane = variant.plane;
+        this->texture = variant.texture;
     }
 
     // ---------- Initialize Framebuffer Shaders ----------
@@ -1175,8 +1287,7 @@ void TrainView::draw() {
     // Shadow-map rendering uses fixed-function transforms + mixed draw paths,
     // so aggressively reset a few key states before any shadow pass.
     glUseProgram(0);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glViewport(0, 0, w(), h());
+    bindSceneTarget(0, glm::ivec4(0, 0, w(), h()));
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, 0);
     glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
@@ -1191,23 +1302,28 @@ void TrainView::draw() {
     glCullFace(GL_BACK);
     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
-    if (directionalLightOn) {
-        renderShadowMap();
-    }
+    updateShadowFilter();
+    updateStaticSceneVersion();
 
-    if (pointLightOn) {
-        renderPointShadowMap();
+    if (shadowBenchmark.frame >= 0) {
+        if (shadowBenchmark.queries[0] == 0)
+            glGenQueries(3, shadowBenchmark.queries);
+        glQueryCounter(shadowBenchmark.queries[0], GL_TIMESTAMP);
     }
 
-    if (spotLightOn) {
-        renderSpotShadowMap();
+    if (directionalLightOn || pointLightOn || spotLightOn) {
+        renderShadowAtlas();
     }
 
+    if (shadowBenchmark.frame >= 0)
+        glQueryCounter(shadowBenchmark.queries[1], GL_TIMESTAMP);
+
+    updateLightConstants();
+
     // Blayne prefers GL_DIFFUSE
     glColorMaterial(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glViewport(0, 0, w(), h());
+    bindSceneTarget(0, glm::ivec4(0, 0, w(), h()));
 
     // clear the window, be sure to clear the Z-Buffer too (single clear)
     glClearColor(0, 0, .3f, 0);
@@ -1229,42 +1345,40 @@ void TrainView::draw() {
     glEnable(GL_DEPTH_TEST);
 
     // ---------- Set up Projection and Lighting ----------
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-
-    setProjection();
+    // The camera lives on the CPU; GL only receives it for fixed-function
+    // geometry and the light positions
+    MatrixStack matrices;
+    buildCamera(matrices);
+    matrices.load();
 
     setLighting();
 
     // ---------- Draw the skybox ----------
-    glm::mat4 view_matrix;
-    glGetFloatv(GL_MODELVIEW_MATRIX, &view_matrix[0][0]);
-    glm::mat4 projection_matrix;
-    glGetFloatv(GL_PROJECTION_MATRIX, &projection_matrix[0][0]);
-
-    skybox->draw(view_matrix, projection_matrix);
+    skybox->draw(matrices.view, matrices.projection);
 
-    // Cache inverse view matrix for compatibility shaders (oden/subdivision sphere)
-    // At this point, modelview should represent the camera view (no per-object model transforms).
-    {
-        glm::mat4 baseView;
-        glGetFloatv(GL_MODELVIEW_MATRIX, &baseView[0][0]);
-        cachedInvViewMatrix = glm::inverse(baseView);
-    }
+    // Every scene shader reads the camera from the frame constants until a
+    // water pass swaps in its own view
+    updateFrameConstants(matrices);
 
     // ---------- Draw the objects and shadows ----------
     glUseProgram(0);
     glEnable(GL_LIGHTING);
     setupObjects();
 
-    drawStuff();
+    drawStuff(matrices);
 
     // Legacy stencil "squish" shadows can conflict with shadow mapping
     // and post-processing; skip them when directional shadow mapping is on
     // OR when we're doing post-process passes.
     if (!tw->topCam->value() && !directionalLightOn && !postProcessEnabled) {
+        // The squish goes on the CPU stack too, so shader-drawn models
+        // flatten the same way as the fixed-function geometry
+        const glm::mat4 squish(1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1);
         setupShadows();
-        drawStuff(true);
+        matrices.push();
+        matrices.multiply(squish);
+        drawStuff(matrices, true);
+        matrices.pop();
         unsetupShadows();
     }
 
@@ -1274,55 +1388,26 @@ void TrainView::draw() {
         GLint viewport[4];
         glGetIntegerv(GL_VIEWPORT, viewport);
 
-        water->renderReflection(this);
-        water->renderRefraction(this);
+        water->renderPasses(this, matrices);
 
         // Restore viewport and matrices
         glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
-        glMatrixMode(GL_PROJECTION);
-        glLoadIdentity();
-        setProjection();
+        matrices.load();
         setLighting();
+        updateFrameConstants(matrices);
+    } else {
+        water->invalidatePasses();
     }
 
     // ---------- Draw the totem billboard (with depth, before post-processing) ----------
-    glm::mat4 totemViewMatrix;
-    glGetFloatv(GL_MODELVIEW_MATRIX, &totemViewMatrix[0][0]);
-    glm::mat4 totemProjectionMatrix;
-    glGetFloatv(GL_PROJECTION_MATRIX, &totemProjectionMatrix[0][0]);
-
-    glm::mat4 invView = glm::inverse(totemViewMatrix);
-    glm::vec3 totemCameraPos = glm::vec3(invView[3]);
-
-    totem->draw(totemViewMatrix, totemProjectionMatrix, totemCameraPos,
-                smokeStartDistance, smokeEndDistance);
+    totem->draw();
 
     // ---------- Draw the terrain ----------
-    glm::vec3 cameraPos = totemCameraPos;
-    bool enableShadow = directionalLightOn;
-    bool enableLight = directionalLightOn;
-    glm::vec3 pointLightPos = getPointLightPos();
-    bool enablePointLight = pointLightOn;
-    bool enablePointShadow = pointLightOn;
-    glm::vec3 spotLightPos = getSpotLightPos();
-    glm::vec3 spotLightDir = getSpotLightDir();
-    bool enableSpotLight = spotLightOn;
-    bool enableSpotShadow = spotLightOn;
-    float spotInnerCos = glm::cos(glm::radians(22.0f));
-    float spotOuterCos = glm::cos(glm::radians(32.0f));
-    glm::vec4 noClipPlane(0.0f);
-    glm::vec2 smokeParams(smokeStartDistance, smokeEndDistance);
-    bool smokeEnabled =
-        (tw && tw->smokeButton) ? (tw->smokeButton->value() != 0) : false;
-
-    terrain->draw(totemViewMatrix, totemProjectionMatrix, lightSpaceMatrix,
-                  shadowDepthMap, glm::normalize(dirLightDir), cameraPos,
-                  smokeParams, smokeEnabled, enableShadow, enableLight,
-                  pointLightPos, getPointShadowMap(), getPointFarPlane(),
-                  enablePointShadow, enablePointLight, spotLightPos,
-                  spotLightDir, getSpotLightMatrix(), getSpotShadowMap(),
-                  getSpotFarPlane(), spotInnerCos, spotOuterCos,
-                  enableSpotShadow, enableSpotLight, noClipPlane, false);
+    terrain->updateStreaming(
+        glm::vec3(sceneConstants.frame.cameraPos),
+        glm::vec3(trainPosition.x, trainPosition.y, trainPosition.z));
+
+    terrain->draw(sceneConstants, shadowAtlas);
 
     // ---------- Draw the plane ----------
     drawPlane();
@@ -1377,15 +1462,9 @@ void TrainView::draw() {
             applyEffect(
                 toonShader,
                 [&]() {
-                    glUniform1f(
-                        glGetUniformLocation(toonShader->Program, "width"),
-                        (float)w());
-                    glUniform1f(
-                        glGetUniformLocation(toonShader->Program, "height"),
-                        (float)h());
-                    glUniform1i(glGetUniformLocation(toonShader->Program,
-                                                     "screenTexture"),
-                                0);
+                    toonShader->set("width", (float)w());
+                    toonShader->set("height", (float)h());
+                    toonShader->set("screenTexture", 0);
                 },
                 isLast);
             --remainingEffects;
@@ -1396,15 +1475,9 @@ void TrainView::draw() {
             applyEffect(
                 crosshatchShader,
                 [&]() {
-                    glUniform1f(glGetUniformLocation(crosshatchShader->Program,
-                                                     "width"),
-                                (float)w());
-                    glUniform1f(glGetUniformLocation(crosshatchShader->Program,
-                                                     "height"),
-                                (float)h());
-                    glUniform1i(glGetUniformLocation(crosshatchShader->Program,
-                                                     "screenTexture"),
-                                0);
+                    crosshatchShader->set("width", (float)w());
+                    crosshatchShader->set("height", (float)h());
+                    crosshatchShader->set("screenTexture", 0);
                 },
                 isLast);
             --remainingEffects;
@@ -1415,15 +1488,9 @@ void TrainView::draw() {
             applyEffect(
                 stippleShader,
                 [&]() {
-                    glUniform1f(
-                        glGetUniformLocation(stippleShader->Program, "width"),
-                        (float)w());
-                    glUniform1f(
-                        glGetUniformLocation(stippleShader->Program, "height"),
-                        (float)h());
-                    glUniform1i(glGetUniformLocation(stippleShader->Program,
-                                                     "screenTexture"),
-                                0);
+                    stippleShader->set("width", (float)w());
+                    stippleShader->set("height", (float)h());
+                    stippleShader->set("screenTexture", 0);
                 },
                 isLast);
             --remainingEffects;
@@ -1434,15 +1501,9 @@ void TrainView::draw() {
             applyEffect(
                 paintShader,
                 [&]() {
-                    glUniform1f(
-                        glGetUniformLocation(paintShader->Program, "width"),
-                        (float)w());
-                    glUniform1f(
-                        glGetUniformLocation(paintShader->Program, "height"),
-                        (float)h());
-                    glUniform1i(glGetUniformLocation(paintShader->Program,
-                                                     "screenTexture"),
-                                0);
+                    paintShader->set("width", (float)w());
+                    paintShader->set("height", (float)h());
+                    paintShader->set("screenTexture", 0);
                 },
                 isLast);
             --remainingEffects;
@@ -1453,18 +1514,10 @@ void TrainView::draw() {
             applyEffect(
                 pixelShader,
                 [&]() {
-                    glUniform1f(
-                        glGetUniformLocation(pixelShader->Program, "pixelSize"),
-                        5.0f);
-                    glUniform1f(glGetUniformLocation(pixelShader->Program,
-                                                     "screenWidth"),
-                                (float)w());
-                    glUniform1f(glGetUniformLocation(pixelShader->Program,
-                                                     "screenHeight"),
-                                (float)h());
-                    glUniform1i(glGetUniformLocation(pixelShader->Program,
-                                                     "screenTexture"),
-                                0);
+                    pixelShader->set("pixelSize", 5.0f);
+                    pixelShader->set("screenWidth", (float)w());
+                    pixelShader->set("screenHeight", (float)h());
+                    pixelShader->set("screenTexture", 0);
                 },
                 isLast);
             --remainingEffects;
@@ -1475,9 +1528,7 @@ void TrainView::draw() {
             applyEffect(
                 grayscaleShader,
                 [&]() {
-                    glUniform1i(glGetUniformLocation(grayscaleShader->Program,
-                                                     "screenTexture"),
-                                0);
+                    grayscaleShader->set("screenTexture", 0);
                 },
                 isLast);
             --remainingEffects;
@@ -1488,21 +1539,11 @@ void TrainView::draw() {
             applyEffect(
                 edgeShader,
                 [&]() {
-                    glUniform1f(
-                        glGetUniformLocation(edgeShader->Program, "width"),
-                        (float)w());
-                    glUniform1f(
-                        glGetUniformLocation(edgeShader->Program, "height"),
-                        (float)h());
-                    glUniform1f(
-                        glGetUniformLocation(edgeShader->Program, "strength"),
-                        1.0f);
-                    glUniform1f(
-                        glGetUniformLocation(edgeShader->Program, "threshold"),
-                        0.15f);
-                    glUniform1i(glGetUniformLocation(edgeShader->Program,
-                                                     "screenTexture"),
-                                0);
+                    edgeShader->set("width", (float)w());
+                    edgeShader->set("height", (float)h());
+                    edgeShader->set("strength", 1.0f);
+                    edgeShader->set("threshold", 0.15f);
+                    edgeShader->set("screenTexture", 0);
                 },
                 isLast);
             --remainingEffects;
@@ -1533,18 +1574,12 @@ void TrainView::draw() {
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-            glUniform1f(glGetUniformLocation(fxaaShader->Program, "width"),
-                        (float)w());
-            glUniform1f(glGetUniformLocation(fxaaShader->Program, "height"),
-                        (float)h());
-            glUniform1f(glGetUniformLocation(fxaaShader->Program, "spanMax"),
-                        8.0f);
-            glUniform1f(glGetUniformLocation(fxaaShader->Program, "reduceMin"),
-                        1.0f / 128.0f);
-            glUniform1f(glGetUniformLocation(fxaaShader->Program, "reduceMul"),
-                        1.0f / 8.0f);
-            glUniform1i(
-                glGetUniformLocation(fxaaShader->Program, "screenTexture"), 0);
+            fxaaShader->set("width", (float)w());
+            fxaaShader->set("height", (float)h());
+            fxaaShader->set("spanMax", 8.0f);
+            fxaaShader->set("reduceMin", 1.0f / 128.0f);
+            fxaaShader->set("reduceMul", 1.0f / 8.0f);
+            fxaaShader->set("screenTexture", 0);
 
             readBuffer->drawQuad();
 
@@ -1591,15 +1626,20 @@ void TrainView::draw() {
     glBindTexture(GL_TEXTURE_2D, 0);
     glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
     glBindVertexArray(0);
+
+    if (shadowBenchmark.frame >= 0) {
+        glQueryCounter(shadowBenchmark.queries[2], GL_TIMESTAMP);
+        recordShadowBenchmark();
+    }
 }
 
 //************************************************************************
 //
-// * This sets up both the Projection and the ModelView matrices
-//   HOWEVER: it doesn't clear the projection first (the caller handles
-//   that) - its important for picking
+// * Build the view and projection of the active camera on the CPU. This
+//   is the only place the cameras are defined; nothing reads them back
+//   from GL.
 //========================================================================
-void TrainView::setProjection()
+void TrainView::buildCamera(MatrixStack& matrices)
 //========================================================================
 {
     // Compute the aspect ratio (we'll need it)
@@ -1607,7 +1647,12 @@ void TrainView::setProjection()
 
     if (tw->worldCam->value()) {
         // ---------- World Cam ----------
-        arcball.setProjection(false);
+        HMatrix arcballView;
+        arcball.getViewMatrix(arcballView);
+        matrices.setCamera(
+            glm::perspective(glm::radians(arcball.getFieldOfView()), aspect,
+                             0.1f, 1000.0f),
+            glm::make_mat4(&arcballView[0][0]));
     } else if (tw->topCam->value()) {
         // ---------- Top Cam ----------
         float wi, he;
@@ -1635,11 +1680,10 @@ void TrainView::setProjection()
 
         // Set up the top camera drop mode to be orthogonal and set
         // up proper projection matrix
-        glMatrixMode(GL_PROJECTION);
-        glOrtho(-wi, wi, -he, he, 200, -200);
-        glMatrixMode(GL_MODELVIEW);
-        glLoadIdentity();
-        glRotatef(-90, 1, 0, 0);
+        matrices.setCamera(
+            glm::ortho(-wi, wi, -he, he, 200.0f, -200.0f),
+            glm::rotate(glm::mat4(1.0f), glm::radians(-90.0f),
+                        glm::vec3(1.0f, 0.0f, 0.0f)));
     } else {
         // ---------- Train Cam ----------
         // Position camera behind and above the train using train's local frame
@@ -1647,15 +1691,33 @@ void TrainView::setProjection()
         const Pnt3f eye = trainPosition + eyeOffset;
         const Pnt3f center = trainPosition + trainForward * 40.0f;
 
-        glMatrixMode(GL_PROJECTION);
-        gluPerspective(60.0, aspect, 0.1, 5000.0);
-        glMatrixMode(GL_MODELVIEW);
-        glLoadIdentity();
-        gluLookAt(eye.x, eye.y, eye.z, center.x, center.y, center.z, trainUp.x,
-                  trainUp.y, trainUp.z);
+        matrices.setCamera(
+            glm::perspective(glm::radians(60.0f), aspect, 0.1f, 5000.0f),
+            glm::lookAt(glm::vec3(eye.x, eye.y, eye.z),
+                        glm::vec3(center.x, center.y, center.z),
+                        glm::vec3(trainUp.x, trainUp.y, trainUp.z)));
     }
+}
+
+//************************************************************************
+//
+// * This sets up both the Projection and the ModelView matrices
+//   HOWEVER: it doesn't clear the projection first (the caller handles
+//   that) - its important for picking
+//========================================================================
+void TrainView::setProjection()
+//========================================================================
+{
+    MatrixStack matrices;
+    buildCamera(matrices);
+
+    glMatrixMode(GL_PROJECTION);
+    glMultMatrixf(&matrices.projection[0][0]);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadMatrixf(&matrices.view[0][0]);
 
 #ifdef EXAMPLE_SOLUTION
+    float aspect = static_cast<float>(w()) / static_cast<float>(h());
     trainCamView(this, aspect);
 #endif
 }
@@ -1721,7 +1783,8 @@ void TrainView::updateGhastFireballs(float dt) {
     }
 }
 
-void TrainView::drawGhastFireballs(bool doingShadows) {
+void TrainView::drawGhastFireballs(MatrixStack& matrices,
+                                   bool doingShadows) {
     if (ghastFireballs.empty())
         return;
 
@@ -1735,23 +1798,28 @@ void TrainView::drawGhastFireballs(bool doingShadows) {
             glm::mat4 model(1.0f);
             model = glm::translate(model, fb.pos);
             model = glm::rotate(model, yaw, glm::vec3(0, 1, 0));
-            tnt->draw(model, doingShadows, smokeStartDistance,
-                      smokeEndDistance);
+            tnt->draw(matrices, model, doingShadows);
         }
     } else {
         if (doingShadows)
             return;
-        glPushAttrib(GL_ENABLE_BIT | GL_POINT_BIT | GL_CURRENT_BIT |
-                     GL_LIGHTING_BIT);
-        glDisable(GL_LIGHTING);
-        glPointSize(50.0f);
-        glBegin(GL_POINTS);
-        glColor3ub(255, 120, 30);
-        for (const auto& fb : ghastFireballs) {
-            glVertex3f(fb.pos.x, fb.pos.y, fb.pos.z);
-        }
-        glEnd();
-        glPopAttrib();
+        RenderItem item;
+        item.key = RenderQueue::makeKey(OPAQUE_PASS, 0, 0, 0.0f,
+                                        MAX_SORT_DEPTH);
+        item.draw = [this]() {
+            glPushAttrib(GL_ENABLE_BIT | GL_POINT_BIT | GL_CURRENT_BIT |
+                         GL_LIGHTING_BIT);
+            glDisable(GL_LIGHTING);
+            glPointSize(50.0f);
+            glBegin(GL_POINTS);
+            glColor3ub(255, 120, 30);
+            for (const auto& fb : ghastFireballs) {
+                glVertex3f(fb.pos.x, fb.pos.y, fb.pos.z);
+            }
+            glEnd();
+            glPopAttrib();
+        };
+        renderQueue.submit(item);
     }
 }
 
@@ -1911,26 +1979,19 @@ bool TrainView::fetchViewMatrices(double* outModel, double* outProj,
     if (!outModel || !outProj || !outViewport)
         return false;
 
-    make_current();
+    // Same camera the last frame drew with, straight from the CPU
+    MatrixStack camera;
+    buildCamera(camera);
 
-    glGetIntegerv(GL_VIEWPORT, outViewport);
-
-    glMatrixMode(GL_PROJECTION);
-    glPushMatrix();
-    glMatrixMode(GL_MODELVIEW);
-    glPushMatrix();
-
-    setProjection();
-
-    glGetDoublev(GL_PROJECTION_MATRIX, outProj);
-    glGetDoublev(GL_MODELVIEW_MATRIX, outModel);
-
-    glMatrixMode(GL_MODELVIEW);
-    glPopMatrix();
-    glMatrixMode(GL_PROJECTION);
-    glPopMatrix();
-    glMatrixMode(GL_MODELVIEW);
+    const float* proj = glm::value_ptr(camera.projection);
+    const float* view = glm::value_ptr(camera.view);
+    std::copy(proj, proj + 16, outProj);
+    std::copy(view, view + 16, outModel);
 
+    outViewport[0] = 0;
+    outViewport[1] = 0;
+    outViewport[2] = w();
+    outViewport[3] = h();
     return true;
 }
 
@@ -2009,36 +2070,71 @@ void TrainView::updateGhastMotion() {
 //       colored shadows). this gets called twice per draw
 //       -- once for the objects, once for the shadows
 //========================================================================
-void TrainView::drawStuff(bool doingShadows) {
+void TrainView::drawStuff(MatrixStack& matrices, bool doingShadows) {
+    // Cached shadow passes draw the static and dynamic casters separately
+    const bool drawStatic =
+        !doingShadows || shadowCasterSet != DYNAMIC_CASTERS;
+    const bool drawDynamic =
+        !doingShadows || shadowCasterSet != STATIC_CASTERS;
+
+    // Everything is submitted to the render queue and drawn sorted by state
+    // at the end. Immediate-mode geometry uses the caster program in a
+    // layered shadow pass and the fixed-function pipeline otherwise.
+    const GLuint legacyProgram =
+        shadowCasterShader ? shadowCasterShader->Program : 0;
+    auto viewDepth = [&matrices](const glm::vec3& p) {
+        return -(matrices.modelView() * glm::vec4(p, 1.0f)).z;
+    };
+
     // Draw the control points
     // don't draw the control points if you're driving
     // (otherwise you get sea-sick as you drive through them)
-    if (!tw->trainCam->value()) {
+    if (drawStatic && !tw->trainCam->value()) {
         for (size_t i = 0; i < m_pTrack->points.size(); ++i) {
-            if (!doingShadows) {
-                if (((int)i) != selectedCube)
-                    glColor3ub(240, 60, 60);
-                else
-                    glColor3ub(240, 240, 30);
-            }
-            m_pTrack->points[i].draw();
+            const Pnt3f& pos = m_pTrack->points[i].pos;
+            RenderItem item;
+            item.program = legacyProgram;
+            item.key = RenderQueue::makeKey(
+                OPAQUE_PASS, legacyProgram, 0,
+                viewDepth(glm::vec3(pos.x, pos.y, pos.z)), MAX_SORT_DEPTH);
+            item.draw = [this, i, doingShadows]() {
+                if (!doingShadows) {
+                    if (((int)i) != selectedCube)
+                        glColor3ub(240, 60, 60);
+                    else
+                        glColor3ub(240, 240, 30);
+                }
+                m_pTrack->points[i].draw(controlPointMesh);
+            };
+            renderQueue.submit(item);
         }
     }
 
     // draw the track
-    drawTrack(doingShadows);
+    if (drawStatic) {
+        RenderItem item;
+        item.program = legacyProgram;
+        item.key = RenderQueue::makeKey(OPAQUE_PASS, legacyProgram, 0, 0.0f,
+                                        MAX_SORT_DEPTH);
+        item.draw = [this, &matrices, doingShadows]() {
+            drawTrack(matrices, doingShadows);
+        };
+        renderQueue.submit(item);
+    }
 
 #ifdef EXAMPLE_SOLUTION
     drawTrack(this, doingShadows);
 #endif
 
     // draw the train
-    drawTrain(doingShadows);
+    if (drawDynamic)
+        drawTrain(matrices, doingShadows);
 
     // draw the oden
-    drawOden(doingShadows);
+    if (drawStatic)
+        drawOden(matrices, doingShadows);
 
-    if (subdivisionSphere) {
+    if (subdivisionSphere && drawStatic) {
         if (tw && tw->sphereRecursionSlider) {
             const int sliderRecursion = static_cast<int>(
                 std::round(tw->sphereRecursionSlider->value()));
@@ -2048,116 +2144,57 @@ void TrainView::drawStuff(bool doingShadows) {
                 currentSphereRecursion = clampedRecursion;
             }
         }
-        if (!doingShadows) {
-            if (!odenBumpShader) {
-                odenBumpShader =
-                    new Shader("./shaders/odenBump.vert", nullptr, nullptr,
-                               nullptr, "./shaders/odenBump.frag");
-            }
-
-            const bool directionalLightOn =
-                tw && tw->directionalLightButton &&
-                (tw->directionalLightButton->value() != 0);
-            const bool pointLightOn = tw && tw->pointLightButton &&
-                                      (tw->pointLightButton->value() != 0);
-            const bool spotLightOn = tw && tw->spotLightButton &&
-                                     (tw->spotLightButton->value() != 0);
-
-            odenBumpShader->Use();
-            // Bump disabled for subdivision sphere
-            glUniform1i(
-                glGetUniformLocation(odenBumpShader->Program, "u_bumpEnabled"),
-                0);
-            glUniform1f(
-                glGetUniformLocation(odenBumpShader->Program, "u_bumpStrength"),
-                2.5f);
-            glUniform1i(
-                glGetUniformLocation(odenBumpShader->Program, "u_enableLight0"),
-                directionalLightOn ? 1 : 0);
-            glUniform1i(
-                glGetUniformLocation(odenBumpShader->Program, "u_enableLight1"),
-                pointLightOn ? 1 : 0);
-            glUniform1i(
-                glGetUniformLocation(odenBumpShader->Program, "u_enableLight2"),
-                spotLightOn ? 1 : 0);
-
-            glUniformMatrix4fv(
-                glGetUniformLocation(odenBumpShader->Program, "u_invView"), 1,
-                GL_FALSE, &cachedInvViewMatrix[0][0]);
-
-            glm::mat4 ls = getLightSpaceMatrix();
-            glUniformMatrix4fv(
-                glGetUniformLocation(odenBumpShader->Program, "uLightSpace"), 1,
-                GL_FALSE, &ls[0][0]);
-
-            glm::vec3 lightDir = getDirLightDir();
-            glUniform3fv(
-                glGetUniformLocation(odenBumpShader->Program, "u_lightDir"), 1,
-                &lightDir[0]);
-
-            glUniform1i(
-                glGetUniformLocation(odenBumpShader->Program, "u_enableShadow"),
-                directionalLightOn ? 1 : 0);
-
-            {
-                const GLint smokeParamsLoc = glGetUniformLocation(
-                    odenBumpShader->Program, "u_smokeParams");
-                if (smokeParamsLoc >= 0) {
-                    glUniform2f(smokeParamsLoc, smokeStartDistance,
-                               smokeEndDistance);
-                }
-
-                const GLint smokeEnabledLoc = glGetUniformLocation(
-                    odenBumpShader->Program, "smokeEnabled");
-                if (smokeEnabledLoc >= 0 && tw && tw->smokeButton) {
-                    glUniform1i(smokeEnabledLoc,
-                                tw->smokeButton->value() ? 1 : 0);
-                }
-            }
-
-            {
-                GLint prevActiveTexture = GL_TEXTURE0;
-                glGetIntegerv(GL_ACTIVE_TEXTURE, &prevActiveTexture);
-                glActiveTexture(GL_TEXTURE10);
-                glBindTexture(GL_TEXTURE_2D, getShadowMap());
-                glUniform1i(glGetUniformLocation(odenBumpShader->Program,
-                                                 "u_shadowMap"),
-                            10);
-                glActiveTexture(prevActiveTexture);
-            }
-        }
-
-        subdivisionSphere->draw(doingShadows);
 
+        RenderItem item;
+        item.program = legacyProgram;
         if (!doingShadows) {
-            glUseProgram(0);
+            // Bump disabled for subdivision sphere
+            Shader* bumpShader = getOdenBumpShader(false);
+            item.program = bumpShader->Program;
+            item.setup = [this, bumpShader]() {
+                shadowAtlas.apply(bumpShader, 10);
+            };
         }
+        const float depth = viewDepth(subdivisionSphere->getCenter());
+        item.key = RenderQueue::makeKey(OPAQUE_PASS, item.program, 0, depth,
+                                        MAX_SORT_DEPTH);
+        item.draw = [this, doingShadows]() {
+            subdivisionSphere->draw(doingShadows);
+        };
+        renderQueue.submit(item);
     }
 
     // ---------- Draw Models ----------
-    if (mcChest)
-        mcChest->draw(glm::vec3(0, -10, 0));
-    if (mcFox)
-        mcFox->draw(glm::vec3(-20, -10, -20));
-    if (tunnel)
-        tunnel->draw(glm::vec3(80, -30, 80));
-    if (ghast && tw->minecraftButton->value()) {
-        if (!doingShadows)
-            updateGhastMotion();
-        ghast->draw(ghastPosition, ghastYaw + ghastBaseYawOffset);
-    }
-    if (jet && !tw->minecraftButton->value()) {
-        if (!doingShadows)
-            updateGhastMotion();
-        jet->draw(ghastPosition, ghastYaw + ghastBaseYawOffset);
-    }
-    drawGhastFireballs(doingShadows);
+    if (drawStatic) {
+        if (mcChest)
+            mcChest->draw(matrices, glm::vec3(0, -10, 0));
+        if (mcFox)
+            mcFox->draw(matrices, glm::vec3(-20, -10, -20));
+        if (tunnel)
+            tunnel->draw(matrices, glm::vec3(80, -30, 80));
+    }
+    if (drawDynamic) {
+        if (ghast && tw->minecraftButton->value()) {
+            if (!doingShadows)
+                updateGhastMotion();
+            ghast->draw(matrices, ghastPosition,
+                        ghastYaw + ghastBaseYawOffset);
+        }
+        if (jet && !tw->minecraftButton->value()) {
+            if (!doingShadows)
+                updateGhastMotion();
+            jet->draw(matrices, ghastPosition, ghastYaw + ghastBaseYawOffset);
+        }
+        drawGhastFireballs(matrices, doingShadows);
+    }
 
 #ifdef EXAMPLE_SOLUTION
     // don't draw the train if you're looking out the front window
     if (!tw->trainCam->value())
         drawTrain(this, doingShadows);
 #endif
+
+    renderQueue.flush();
 }
 
 float TrainView::currentTension(float fallback) const {
@@ -2200,11 +2237,15 @@ void TrainView::buildBasisMatrix(int mode, float out[4][4]) const {
     }
 }
 
-void TrainView::drawTrack(bool doingShadows) {
+void TrainView::drawTrack(MatrixStack& matrices, bool doingShadows) {
     const size_t pointCount = m_pTrack->points.size();
     if (pointCount < 2)
         return;
 
+    // Track vertices are in world space; queued items before this one may
+    // have left their own modelview loaded
+    matrices.loadModelView();
+
     float M[4][4] = { 0 };
     buildBasisMatrix(tw->splineBrowser->value(), M);
 
@@ -2847,7 +2888,71 @@ void TrainView::drawTrack(bool doingShadows) {
     glLineWidth(1.0f);
 }
 
-void TrainView::drawTrain(bool doingShadows) {
+// Build the procedural train, oden and control point geometry once; drawing
+// only places it
+void TrainView::buildPrimitiveMeshes() {
+    // Train body: white with a green front (+x)
+    const glm::vec3 bodyHalf(TRAIN_HALF_EXTENT);
+    trainBodyMesh.setColor(255, 255, 255);
+    trainBodyMesh.addBox(glm::vec3(0.0f), bodyHalf,
+                         PrimitiveMesh::BOX_ALL_FACES &
+                             ~PrimitiveMesh::BOX_POS_X);
+    trainBodyMesh.setColor(89, 110, 57);
+    trainBodyMesh.addBox(glm::vec3(0.0f), bodyHalf, PrimitiveMesh::BOX_POS_X);
+    trainBodyMesh.upload();
+
+    const GLubyte rimColor[3] = { 45, 45, 45 };
+    const GLubyte capColors[2][3] = { { 70, 140, 255 }, { 255, 80, 95 } };
+    trainWheelMesh.addWheel(TRAIN_WHEEL_RADIUS, TRAIN_WHEEL_WIDTH, 48, 24,
+                            rimColor, capColors);
+    trainWheelMesh.upload();
+
+    // Oden: tofu and pork ball share the bump shader, the pig blood cake
+    // is drawn fixed function
+    const float tofuWidth = 20.0f;
+    const float tofuDepth = 20.0f;
+    const float tofuHeight = 25.0f;
+    odenMesh.addBox(glm::vec3(0.0f, tofuHeight * 0.5f, 0.0f),
+                    glm::vec3(tofuWidth, tofuHeight, tofuDepth) * 0.5f);
+    const float porkBallRadius = 10.0f;
+    odenMesh.addSphere(
+        glm::vec3(0.0f, 0.6f * tofuHeight, 0.7f * tofuWidth), porkBallRadius,
+        16, 16);
+    odenMesh.upload();
+
+    const glm::vec3 pigBloodCakeSize(20.0f, 10.0f, 15.0f);
+    pigBloodCakeMesh.addBox(
+        glm::vec3(-0.7f * tofuWidth, 0.4f * tofuHeight, 0.0f),
+        pigBloodCakeSize * 0.5f);
+    pigBloodCakeMesh.upload();
+
+    // Control point: a cube without its top, capped by the point
+    const float pointSize = 2.0f;
+    controlPointMesh.addBox(
+        glm::vec3(0.0f), glm::vec3(pointSize),
+        PrimitiveMesh::BOX_ALL_FACES & ~PrimitiveMesh::BOX_POS_Y);
+    const glm::vec3 corners[4] = {
+        glm::vec3(pointSize, pointSize, pointSize),
+        glm::vec3(-pointSize, pointSize, pointSize),
+        glm::vec3(-pointSize, pointSize, -pointSize),
+        glm::vec3(pointSize, pointSize, -pointSize)
+    };
+    GLuint apex = controlPointMesh.addVertex(
+        glm::vec3(0.0f, 3.0f * pointSize, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+        glm::vec2(0.5f, 1.0f));
+    GLuint ring[4];
+    for (int i = 0; i < 4; ++i) {
+        glm::vec3 n =
+            glm::normalize(glm::vec3(corners[i].x, 0.0f, corners[i].z));
+        ring[i] = controlPointMesh.addVertex(corners[i], n,
+                                             glm::vec2(i * 0.25f, 0.0f));
+    }
+    for (int i = 0; i < 4; ++i)
+        controlPointMesh.addTriangle(apex, ring[(i + 1) % 4], ring[i]);
+    controlPointMesh.upload();
+}
+
+void TrainView::drawTrain(MatrixStack& matrices, bool doingShadows) {
     villagerPosValid = false;
 
     const size_t pointCount = m_pTrack->points.size();
@@ -3169,8 +3274,8 @@ void TrainView::drawTrain(bool doingShadows) {
         }
     }
 
-    const float wheelRadius = 3.25f;
-    const float wheelWidth = 2.0f;
+    const float wheelRadius = TRAIN_WHEEL_RADIUS;
+    const float wheelWidth = TRAIN_WHEEL_WIDTH;
     const float twoPi = 2.0f * static_cast<float>(M_PI);
     const float bodyLift = 5.0f;
     const float wheelBodyGap = -2.0f;
@@ -3193,7 +3298,7 @@ void TrainView::drawTrain(bool doingShadows) {
         }
     }
 
-    const float halfExtent = 5.0f;
+    const float halfExtent = TRAIN_HALF_EXTENT;
     Pnt3f halfUp = up * halfExtent;
     Pnt3f center = position + halfUp + up * bodyLift;
 
@@ -3203,172 +3308,51 @@ void TrainView::drawTrain(bool doingShadows) {
     }
 
     if (!useMinecraftTrain && !tw->trainCam->value()) {
-        Pnt3f halfForward = tangent * halfExtent;
-        Pnt3f halfRight = right * halfExtent;
-
-        Pnt3f frontTopRight = center + halfForward + halfRight + halfUp;
-        Pnt3f frontTopLeft = center + halfForward - halfRight + halfUp;
-        Pnt3f frontBottomRight = center + halfForward + halfRight - halfUp;
-        Pnt3f frontBottomLeft = center + halfForward - halfRight - halfUp;
-        Pnt3f backTopRight = center - halfForward + halfRight + halfUp;
-        Pnt3f backTopLeft = center - halfForward - halfRight + halfUp;
-        Pnt3f backBottomRight = center - halfForward + halfRight - halfUp;
-        Pnt3f backBottomLeft = center - halfForward - halfRight - halfUp;
-
-        if (!doingShadows) {
-            glColor3ub(255, 255, 255);
-        }
-
-        glBegin(GL_QUADS);
-        // Front face
-        if (!doingShadows) {
-            glColor3ub(89, 110, 57);
-        }
-        glNormal3f(tangent.x, tangent.y, tangent.z);
-        glTexCoord2f(0.0f, 0.0f);
-        glVertex3f(frontBottomLeft.x, frontBottomLeft.y, frontBottomLeft.z);
-        glTexCoord2f(1.0f, 0.0f);
-        glVertex3f(frontBottomRight.x, frontBottomRight.y, frontBottomRight.z);
-        glTexCoord2f(1.0f, 1.0f);
-        glVertex3f(frontTopRight.x, frontTopRight.y, frontTopRight.z);
-        glTexCoord2f(0.0f, 1.0f);
-        glVertex3f(frontTopLeft.x, frontTopLeft.y, frontTopLeft.z);
-
-        // Back face
-        if (!doingShadows) {
-            glColor3ub(255, 255, 255);
-        }
-        glNormal3f(-tangent.x, -tangent.y, -tangent.z);
-        glTexCoord2f(0.0f, 0.0f);
-        glVertex3f(backBottomRight.x, backBottomRight.y, backBottomRight.z);
-        glTexCoord2f(1.0f, 0.0f);
-        glVertex3f(backBottomLeft.x, backBottomLeft.y, backBottomLeft.z);
-        glTexCoord2f(1.0f, 1.0f);
-        glVertex3f(backTopLeft.x, backTopLeft.y, backTopLeft.z);
-        glTexCoord2f(0.0f, 1.0f);
-        glVertex3f(backTopRight.x, backTopRight.y, backTopRight.z);
-
-        // Left face
-        glNormal3f(-right.x, -right.y, -right.z);
-        glTexCoord2f(0.0f, 0.0f);
-        glVertex3f(backBottomLeft.x, backBottomLeft.y, backBottomLeft.z);
-        glTexCoord2f(1.0f, 0.0f);
-        glVertex3f(frontBottomLeft.x, frontBottomLeft.y, frontBottomLeft.z);
-        glTexCoord2f(1.0f, 1.0f);
-        glVertex3f(frontTopLeft.x, frontTopLeft.y, frontTopLeft.z);
-        glTexCoord2f(0.0f, 1.0f);
-        glVertex3f(backTopLeft.x, backTopLeft.y, backTopLeft.z);
-
-        // Right face
-        glNormal3f(right.x, right.y, right.z);
-        glTexCoord2f(0.0f, 0.0f);
-        glVertex3f(frontBottomRight.x, frontBottomRight.y, frontBottomRight.z);
-        glTexCoord2f(1.0f, 0.0f);
-        glVertex3f(backBottomRight.x, backBottomRight.y, backBottomRight.z);
-        glTexCoord2f(1.0f, 1.0f);
-        glVertex3f(backTopRight.x, backTopRight.y, backTopRight.z);
-        glTexCoord2f(0.0f, 1.0f);
-        glVertex3f(frontTopRight.x, frontTopRight.y, frontTopRight.z);
-
-        // Top face
-        glNormal3f(up.x, up.y, up.z);
-        glTexCoord2f(0.0f, 0.0f);
-        glVertex3f(frontTopLeft.x, frontTopLeft.y, frontTopLeft.z);
-        glTexCoord2f(1.0f, 0.0f);
-        glVertex3f(frontTopRight.x, frontTopRight.y, frontTopRight.z);
-        glTexCoord2f(1.0f, 1.0f);
-        glVertex3f(backTopRight.x, backTopRight.y, backTopRight.z);
-        glTexCoord2f(0.0f, 1.0f);
-        glVertex3f(backTopLeft.x, backTopLeft.y, backTopLeft.z);
-
-        // Bottom face
-        glNormal3f(-up.x, -up.y, -up.z);
-        glTexCoord2f(0.0f, 0.0f);
-        glVertex3f(backBottomLeft.x, backBottomLeft.y, backBottomLeft.z);
-        glTexCoord2f(1.0f, 0.0f);
-        glVertex3f(backBottomRight.x, backBottomRight.y, backBottomRight.z);
-        glTexCoord2f(1.0f, 1.0f);
-        glVertex3f(frontBottomRight.x, frontBottomRight.y, frontBottomRight.z);
-        glTexCoord2f(0.0f, 1.0f);
-        glVertex3f(frontBottomLeft.x, frontBottomLeft.y, frontBottomLeft.z);
-        glEnd();
+        // Static body and wheel meshes placed by the train's frame
+        RenderItem item;
+        item.program = shadowCasterShader ? shadowCasterShader->Program : 0;
+        const float depth =
+            -(matrices.modelView() * glm::vec4(center.x, center.y, center.z,
+                                               1.0f)).z;
+        item.key = RenderQueue::makeKey(OPAQUE_PASS, item.program, 0, depth,
+                                        MAX_SORT_DEPTH);
+
+        // Local x runs along the track, y up and z to the right
+        auto toGlm = [](const Pnt3f& p) { return glm::vec3(p.x, p.y, p.z); };
+        glm::mat4 frame(1.0f);
+        frame[0] = glm::vec4(toGlm(tangent), 0.0f);
+        frame[1] = glm::vec4(toGlm(up), 0.0f);
+        frame[2] = glm::vec4(toGlm(right), 0.0f);
+        frame[3] = glm::vec4(toGlm(center), 1.0f);
 
         const float axleInnerOffset =
             -1.5f;  // negative moves wheels closer to center
         const float axleInset =
             halfExtent + wheelWidth * 0.5f + axleInnerOffset;
-        Pnt3f bodyBottom = center - halfUp;
-        Pnt3f axleCenter = bodyBottom - up * (wheelRadius + wheelBodyGap);
-        const int rimSlices = 48;
-        const int sectorSlices = 24;
-        const float halfWheelWidth = wheelWidth * 0.5f;
-
-        auto drawWheel = [&](const Pnt3f& center) {
-            if (!doingShadows) {
-                glColor3ub(45, 45, 45);
-            }
-
-            glBegin(GL_QUAD_STRIP);
-            for (int i = 0; i <= rimSlices; ++i) {
-                float theta = (static_cast<float>(i) / rimSlices) * twoPi;
-                float angle = theta + wheelAngle;
-                float c = std::cos(angle);
-                float s = std::sin(angle);
-                Pnt3f radial = (up * c + tangent * s) * wheelRadius;
-                Pnt3f normal = radial;
-                normal.normalize();
-
-                Pnt3f outer = center + radial + right * halfWheelWidth;
-                Pnt3f inner = center + radial - right * halfWheelWidth;
-
-                glNormal3f(normal.x, normal.y, normal.z);
-                glVertex3f(outer.x, outer.y, outer.z);
-                glVertex3f(inner.x, inner.y, inner.z);
+        const float axleHeight = -halfExtent - (wheelRadius + wheelBodyGap);
+        glm::mat4 wheels[2];
+        for (int i = 0; i < 2; ++i) {
+            const float side = i == 0 ? 1.0f : -1.0f;
+            wheels[i] = glm::translate(
+                frame, glm::vec3(0.0f, axleHeight, side * axleInset));
+            wheels[i] = glm::rotate(wheels[i], -wheelAngle,
+                                    glm::vec3(0.0f, 0.0f, 1.0f));
+        }
+
+        item.draw = [this, frame, wheels, doingShadows]() {
+            glPushMatrix();
+            glMultMatrixf(&frame[0][0]);
+            trainBodyMesh.draw(!doingShadows);
+            glPopMatrix();
+
+            for (const glm::mat4& wheel : wheels) {
+                glPushMatrix();
+                glMultMatrixf(&wheel[0][0]);
+                trainWheelMesh.draw(!doingShadows);
+                glPopMatrix();
             }
-            glEnd();
-
-            auto drawCap = [&](float sign) {
-                Pnt3f capCenter = center + right * (sign * halfWheelWidth);
-                Pnt3f capNormal = right * sign;
-
-                glBegin(GL_TRIANGLES);
-                for (int i = 0; i < sectorSlices; ++i) {
-                    float theta0 =
-                        (static_cast<float>(i) / sectorSlices) * twoPi +
-                        wheelAngle;
-                    float theta1 =
-                        (static_cast<float>(i + 1) / sectorSlices) * twoPi +
-                        wheelAngle;
-
-                    Pnt3f rim0 = capCenter + (up * std::cos(theta0) +
-                                              tangent * std::sin(theta0)) *
-                                                 wheelRadius;
-                    Pnt3f rim1 = capCenter + (up * std::cos(theta1) +
-                                              tangent * std::sin(theta1)) *
-                                                 wheelRadius;
-
-                    if (!doingShadows) {
-                        if (i % 2 == 0) {
-                            glColor3ub(70, 140, 255);
-                        } else {
-                            glColor3ub(255, 80, 95);
-                        }
-                    }
-
-                    glNormal3f(capNormal.x, capNormal.y, capNormal.z);
-                    glVertex3f(capCenter.x, capCenter.y, capCenter.z);
-                    glVertex3f(rim0.x, rim0.y, rim0.z);
-                    glVertex3f(rim1.x, rim1.y, rim1.z);
-                }
-                glEnd();
-            };
-
-            drawCap(1.0f);
-            drawCap(-1.0f);
         };
-
-        drawWheel(axleCenter + right * axleInset);
-        drawWheel(axleCenter - right * axleInset);
+        renderQueue.submit(item);
     }
 
     // Update train state
@@ -3403,10 +3387,9 @@ void TrainView::drawTrain(bool doingShadows) {
         villagerWorldPos = glm::vec3(villagerWorld);
         villagerPosValid = true;
 
-        mcVillager->draw(modelMatrix / assetFix * villagerOffset, doingShadows,
-                         smokeStartDistance, smokeEndDistance);
-        mcMinecart->draw(modelMatrix, doingShadows, smokeStartDistance,
-                         smokeEndDistance);
+        mcVillager->draw(matrices, modelMatrix / assetFix * villagerOffset,
+                         doingShadows);
+        mcMinecart->draw(matrices, modelMatrix, doingShadows);
     }
 
     if (useMinecraftTrain && !tw->trainCam->value()) {
@@ -3429,8 +3412,7 @@ void TrainView::drawTrain(bool doingShadows) {
         villagerWorldPos = glm::vec3(villagerWorld);
         villagerPosValid = true;
 
-        mcVillager->draw(modelMatrix, doingShadows, smokeStartDistance,
-                         smokeEndDistance);
+        mcVillager->draw(matrices, modelMatrix, doingShadows);
     } else if (!useMinecraftTrain && !tw->trainCam->value()) {
         auto toGlm = [](const Pnt3f& p) {
             return glm::vec3(p.x, p.y, p.z);
@@ -3451,267 +3433,184 @@ void TrainView::drawTrain(bool doingShadows) {
         villagerWorldPos = glm::vec3(villagerWorld);
         villagerPosValid = true;
 
-        soldier->draw(modelMatrix, doingShadows, smokeStartDistance,
-                      smokeEndDistance);
+        soldier->draw(matrices, modelMatrix, doingShadows);
     }
 }
 
-void TrainView::drawOden(bool doingShadows) {
+void TrainView::drawOden(MatrixStack& matrices, bool doingShadows) {
     const float offsetX = 50.0f;
     const float offsetY = 0.0f;
     const float offsetZ = -30.0f;
 
-    glPushMatrix();
-    glTranslatef(offsetX, offsetY, offsetZ);
-
     const bool bumpEnabled = (!doingShadows) && tw && tw->bumpButton &&
                              (tw->bumpButton->value() != 0);
 
+    RenderItem item;
+    item.program = shadowCasterShader ? shadowCasterShader->Program : 0;
+    Shader* bumpShader = nullptr;
+
     // Use a compatibility shader in the normal pass so legacy geometry
-    // (immediate mode + GLU quadric) can receive the directional shadow map.
+    // (client-array meshes) can receive the directional shadow map.
     if (!doingShadows) {
-        if (!odenBumpShader) {
-            odenBumpShader =
-                new Shader("./shaders/odenBump.vert", nullptr, nullptr, nullptr,
-                           "./shaders/odenBump.frag");
-        }
+        bumpShader = getOdenBumpShader(bumpEnabled);
         if (!odenBumpTexture) {
             odenBumpTexture = new Texture2D("./images/bumpMapping.png",
                                             Texture2D::TEXTURE_HEIGHT);
         }
+        item.program = bumpShader->Program;
 
-        const bool directionalLightOn = tw && tw->directionalLightButton &&
-                                        tw->directionalLightButton->value();
-        const bool pointLightOn =
-            tw && tw->pointLightButton && tw->pointLightButton->value();
-        const bool spotLightOn =
-            tw && tw->spotLightButton && tw->spotLightButton->value();
-
-        odenBumpShader->Use();
+        // Lights, smoke and the inverse view come from the scene constants
+        item.setup = [this, bumpShader]() {
+            shadowAtlas.apply(bumpShader, 10);
+        };
 
         // Bump texture (unit 0) – only required when bump is enabled.
-        if (bumpEnabled) {
-            odenBumpTexture->bind(0);
-            odenBumpShader->setInt("u_bumpTex", 0);
-        } else {
-            Texture2D::unbind(0);
-            odenBumpShader->setInt("u_bumpTex", 0);
-        }
-
-        glUniform1i(
-            glGetUniformLocation(odenBumpShader->Program, "u_bumpEnabled"),
-            bumpEnabled ? 1 : 0);
-        glUniform1f(
-            glGetUniformLocation(odenBumpShader->Program, "u_bumpStrength"),
-            2.5f);
-        glUniform1i(
-            glGetUniformLocation(odenBumpShader->Program, "u_enableLight0"),
-            directionalLightOn ? 1 : 0);
-        glUniform1i(
-            glGetUniformLocation(odenBumpShader->Program, "u_enableLight1"),
-            pointLightOn ? 1 : 0);
-        glUniform1i(
-            glGetUniformLocation(odenBumpShader->Program, "u_enableLight2"),
-            spotLightOn ? 1 : 0);
-
-        // Directional shadow-map uniforms
-        glUniformMatrix4fv(
-            glGetUniformLocation(odenBumpShader->Program, "u_invView"), 1,
-            GL_FALSE, &cachedInvViewMatrix[0][0]);
-
-        glm::mat4 ls = getLightSpaceMatrix();
-        glUniformMatrix4fv(
-            glGetUniformLocation(odenBumpShader->Program, "uLightSpace"), 1,
-            GL_FALSE, &ls[0][0]);
-
-        glm::vec3 lightDir = getDirLightDir();
-        glUniform3fv(
-            glGetUniformLocation(odenBumpShader->Program, "u_lightDir"), 1,
-            &lightDir[0]);
-
-        glUniform1i(
-            glGetUniformLocation(odenBumpShader->Program, "u_enableShadow"),
-            directionalLightOn ? 1 : 0);
-
-        {
-            const GLint smokeParamsLoc =
-                glGetUniformLocation(odenBumpShader->Program, "u_smokeParams");
-            if (smokeParamsLoc >= 0) {
-                glUniform2f(smokeParamsLoc, smokeStartDistance, smokeEndDistance);
-            }
+        item.textures[0] = bumpEnabled ? odenBumpTexture->getId() : 0;
+        item.textureCount = 1;
+    }
 
-            const GLint smokeEnabledLoc =
-                glGetUniformLocation(odenBumpShader->Program, "smokeEnabled");
-            if (smokeEnabledLoc >= 0 && tw && tw->smokeButton) {
-                glUniform1i(smokeEnabledLoc, tw->smokeButton->value() ? 1 : 0);
-            }
+    const glm::vec3 offset(offsetX, offsetY, offsetZ);
+    const float depth =
+        -(matrices.modelView() * glm::vec4(offset, 1.0f)).z;
+    item.key = RenderQueue::makeKey(OPAQUE_PASS, item.program,
+                                    item.textures[0], depth, MAX_SORT_DEPTH);
+    item.draw = [this, &matrices, offset, doingShadows, bumpShader]() {
+        if (bumpShader) {
+            bumpShader->set("u_bumpTex", 0);
+            bumpShader->set("u_bumpStrength", 2.5f);
         }
 
-        {
-            GLint prevActiveTexture = GL_TEXTURE0;
-            glGetIntegerv(GL_ACTIVE_TEXTURE, &prevActiveTexture);
-            glActiveTexture(GL_TEXTURE10);
-            glBindTexture(GL_TEXTURE_2D, getShadowMap());
-            glUniform1i(
-                glGetUniformLocation(odenBumpShader->Program, "u_shadowMap"),
-                10);
-            glActiveTexture(prevActiveTexture);
+        // Tofu and pork ball
+        if (!doingShadows) {
+            glColor3ub(150, 150, 150);
         }
-    }
-
-    // ----------- Tofu --------------
-    const float tofuWidth = 20.0f;
-    const float tofuDepth = 20.0f;
-    const float tofuHeight = 25.0f;
-    const float halfTofuWidth = tofuWidth / 2.0f;
-    const float halfTofuDepth = tofuDepth / 2.0f;
-    const float halfTofuHeight = tofuHeight / 2.0f;
+        drawOdenGeometry(matrices, offset, odenMesh);
+    };
+    renderQueue.submit(item);
+
+    // Pig blood cake: fixed-function and untextured in the normal pass, so
+    // it is its own item and the queue tracks the program change
+    RenderItem cake;
+    cake.program = doingShadows && shadowCasterShader
+                       ? shadowCasterShader->Program
+                       : 0;
     if (!doingShadows) {
-        glColor3ub(150, 150, 150);
+        cake.textures[0] = 0;
+        cake.textureCount = 1;
     }
+    cake.key = RenderQueue::makeKey(OPAQUE_PASS, cake.program, 0, depth,
+                                    MAX_SORT_DEPTH);
+    cake.draw = [this, &matrices, offset, doingShadows]() {
+        if (!doingShadows) {
+            glColor3ub(150, 150, 150);
+        }
+        drawOdenGeometry(matrices, offset, pigBloodCakeMesh);
+    };
+    renderQueue.submit(cake);
+}
 
-    glPushMatrix();
-    glTranslatef(0.0f, halfTofuHeight, 0.0f);
-    glBegin(GL_QUADS);
-
-    // Front face (+Z)
-    glNormal3f(0.0f, 0.0f, 1.0f);
-    glVertex3f(-halfTofuWidth, -halfTofuHeight, halfTofuDepth);
-    glVertex3f(halfTofuWidth, -halfTofuHeight, halfTofuDepth);
-    glVertex3f(halfTofuWidth, halfTofuHeight, halfTofuDepth);
-    glVertex3f(-halfTofuWidth, halfTofuHeight, halfTofuDepth);
-    // Back face (-Z)
-    glNormal3f(0.0f, 0.0f, -1.0f);
-    glVertex3f(-halfTofuWidth, -halfTofuHeight, -halfTofuDepth);
-    glVertex3f(halfTofuWidth, -halfTofuHeight, -halfTofuDepth);
-    glVertex3f(halfTofuWidth, halfTofuHeight, -halfTofuDepth);
-    glVertex3f(-halfTofuWidth, halfTofuHeight, -halfTofuDepth);
-    // Left face (-X)
-    glNormal3f(-1.0f, 0.0f, 0.0f);
-    glVertex3f(-halfTofuWidth, -halfTofuHeight, -halfTofuDepth);
-    glVertex3f(-halfTofuWidth, -halfTofuHeight, halfTofuDepth);
-    glVertex3f(-halfTofuWidth, halfTofuHeight, halfTofuDepth);
-    glVertex3f(-halfTofuWidth, halfTofuHeight, -halfTofuDepth);
-    // Right face (+X)
-    glNormal3f(1.0f, 0.0f, 0.0f);
-    glVertex3f(halfTofuWidth, -halfTofuHeight, halfTofuDepth);
-    glVertex3f(halfTofuWidth, -halfTofuHeight, -halfTofuDepth);
-    glVertex3f(halfTofuWidth, halfTofuHeight, -halfTofuDepth);
-    glVertex3f(halfTofuWidth, halfTofuHeight, halfTofuDepth);
-    // Top face (+Y)
-    glNormal3f(0.0f, 1.0f, 0.0f);
-    glVertex3f(-halfTofuWidth, halfTofuHeight, halfTofuDepth);
-    glVertex3f(halfTofuWidth, halfTofuHeight, halfTofuDepth);
-    glVertex3f(halfTofuWidth, halfTofuHeight, -halfTofuDepth);
-    glVertex3f(-halfTofuWidth, halfTofuHeight, -halfTofuDepth);
-    // Bottom face (-Y)
-    glNormal3f(0.0f, -1.0f, 0.0f);
-    glVertex3f(-halfTofuWidth, -halfTofuHeight, -halfTofuDepth);
-    glVertex3f(halfTofuWidth, -halfTofuHeight, -halfTofuDepth);
-    glVertex3f(halfTofuWidth, -halfTofuHeight, halfTofuDepth);
-    glVertex3f(-halfTofuWidth, -halfTofuHeight, halfTofuDepth);
-    glEnd();
-
-    glPopMatrix();
-
-    // ---------- Pork ball --------------
-    const float porkBallRadius = 10.0f;
-    glPushMatrix();
-    glTranslatef(0.0f, 0.6f * tofuHeight, 0.7f * tofuWidth);
+ShaderVariants& TrainView::getOdenBumpShaders() {
+    if (!odenBumpShaders) {
+        odenBumpShaders = AssetCache::instance().getShaderVariants(
+            "./shaders/odenBump.vert", nullptr, nullptr, nullptr,
+            "./shaders/odenBump.frag",
+            FEATURE_SMOKE | FEATURE_DIR_LIGHT | FEATURE_POINT_LIGHT |
+                FEATURE_SPOT_LIGHT | FEATURE_DIR_SHADOW |
+                FEATURE_VSM_SHADOWS | FEATURE_BUMP_MAP);
+    }
+    return *odenBumpShaders;
+}
 
-    // (shader setup moved to the top of drawOden)
+Shader* TrainView::getOdenBumpShader(bool bump) {
+    return getOdenBumpShaders().get(getSceneFeatures() |
+                                    (bump ? FEATURE_BUMP_MAP : 0u));
+}
 
-    GLUquadric* quad = gluNewQuadric();
-    gluQuadricNormals(quad, GLU_SMOOTH);
-    if (bumpEnabled) {
-        gluQuadricTexture(quad, GL_TRUE);
+// Compile the variants the first frames will ask for: the current lights
+// and shadow filter, with and without smoke and the reflection clip plane.
+// Other light combinations compile when toggled.
+void TrainView::prewarmShaderVariants() {
+    getOdenBumpShaders();
+    prewarmedShaders.push_back(modelShaderVariants());
+    prewarmedShaders.push_back(odenBumpShaders);
+
+    // The church, water and totem programs use only the shadow and smoke
+    // bits of these masks
+    std::vector<ShaderVariants*> planes = { totem->shaders.get() };
+    for (int i = 0; i < Church::KIND_COUNT; ++i)
+        planes.push_back(church->get((Church::Kind)i).shaders.get());
+    for (int i = 0; i < Water::KIND_COUNT; ++i)
+        planes.push_back(water->get((Water::Kind)i).shaders.get());
+
+    const unsigned lights =
+        getSceneFeatures() & ~(FEATURE_CLIP_PLANE | FEATURE_SMOKE);
+    const unsigned views[] = { 0u, FEATURE_CLIP_PLANE, FEATURE_SMOKE,
+                               FEATURE_CLIP_PLANE | FEATURE_SMOKE };
+    for (unsigned view : views) {
+        terrain->getShaderVariants().prewarm(lights | view);
+        prewarmedShaders[0]->prewarm(lights | view);
+        prewarmedShaders[0]->prewarm((view & FEATURE_CLIP_PLANE) |
+                                     FEATURE_FLAT_SHADOW);
+        prewarmedShaders[1]->prewarm(lights | view);
+        prewarmedShaders[1]->prewarm(lights | view | FEATURE_BUMP_MAP);
+        for (ShaderVariants* plane : planes) {
+            if (plane)
+                plane->prewarm(lights | view);
+        }
     }
-    gluSphere(quad, porkBallRadius, 16, 16);
-    gluDeleteQuadric(quad);
+}
 
-    if (!doingShadows) {
-        Texture2D::unbind(0);
-        glUseProgram(0);
+// Create every program the scene can switch to, so none compiles in the
+// middle of a frame: the post-process and shadow shaders and the scene
+// variants. Programs found in the ProgramCache load from disk; the rest
+// compile on the driver's threads where it supports parallel compiles,
+// behind the loading screen.
+void TrainView::warmUpShaders() {
+    initFrameBufferShader();
+    initShadowAtlas();
+    if (!shadowMomentsShader) {
+        shadowMomentsShader =
+            new Shader("./shaders/shadowMoments.vert", nullptr, nullptr,
+                       nullptr, "./shaders/shadowMoments.frag");
     }
-    glPopMatrix();
 
-    // ---------- Pig blood cake ----------
-    const float pigBloodCakeWidth = 20.0f;
-    const float pigBloodCakeDepth = 15.0f;
-    const float pigBloodCakeHeight = 10.0f;
-    const float halfPigBloodCakeWidth = pigBloodCakeWidth / 2.0f;
-    const float halfPigBloodCakeDepth = pigBloodCakeDepth / 2.0f;
-    const float halfPigBloodCakeHeight = pigBloodCakeHeight / 2.0f;
+    updateShadowFilter();
+    updateLightConstants();
+    prewarmShaderVariants();
+}
 
-    glPushMatrix();
-    glTranslatef(-0.7f * tofuWidth, 0.4f * tofuHeight, 0.0f);
-    glBegin(GL_QUADS);
-
-    // Front face (+Z)
-    glNormal3f(0.0f, 0.0f, 1.0f);
-    glVertex3f(-halfPigBloodCakeWidth, -halfPigBloodCakeHeight,
-               halfPigBloodCakeDepth);
-    glVertex3f(halfPigBloodCakeWidth, -halfPigBloodCakeHeight,
-               halfPigBloodCakeDepth);
-    glVertex3f(halfPigBloodCakeWidth, halfPigBloodCakeHeight,
-               halfPigBloodCakeDepth);
-    glVertex3f(-halfPigBloodCakeWidth, halfPigBloodCakeHeight,
-               halfPigBloodCakeDepth);
-    // Back face (-Z)
-    glNormal3f(0.0f, 0.0f, -1.0f);
-    glVertex3f(-halfPigBloodCakeWidth, -halfPigBloodCakeHeight,
-               -halfPigBloodCakeDepth);
-    glVertex3f(halfPigBloodCakeWidth, -halfPigBloodCakeHeight,
-               -halfPigBloodCakeDepth);
-    glVertex3f(halfPigBloodCakeWidth, halfPigBloodCakeHeight,
-               -halfPigBloodCakeDepth);
-    glVertex3f(-halfPigBloodCakeWidth, halfPigBloodCakeHeight,
-               -halfPigBloodCakeDepth);
-    // Left face (-X)
-    glNormal3f(-1.0f, 0.0f, 0.0f);
-    glVertex3f(-halfPigBloodCakeWidth, -halfPigBloodCakeHeight,
-               -halfPigBloodCakeDepth);
-    glVertex3f(-halfPigBloodCakeWidth, -halfPigBloodCakeHeight,
-               halfPigBloodCakeDepth);
-    glVertex3f(-halfPigBloodCakeWidth, halfPigBloodCakeHeight,
-               halfPigBloodCakeDepth);
-    glVertex3f(-halfPigBloodCakeWidth, halfPigBloodCakeHeight,
-               -halfPigBloodCakeDepth);
-    // Right face (+X)
-    glNormal3f(1.0f, 0.0f, 0.0f);
-    glVertex3f(halfPigBloodCakeWidth, -halfPigBloodCakeHeight,
-               halfPigBloodCakeDepth);
-    glVertex3f(halfPigBloodCakeWidth, -halfPigBloodCakeHeight,
-               -halfPigBloodCakeDepth);
-    glVertex3f(halfPigBloodCakeWidth, halfPigBloodCakeHeight,
-               -halfPigBloodCakeDepth);
-    glVertex3f(halfPigBloodCakeWidth, halfPigBloodCakeHeight,
-               halfPigBloodCakeDepth);
-    // Top face (+Y)
-    glNormal3f(0.0f, 1.0f, 0.0f);
-    glVertex3f(-halfPigBloodCakeWidth, halfPigBloodCakeHeight,
-               halfPigBloodCakeDepth);
-    glVertex3f(halfPigBloodCakeWidth, halfPigBloodCakeHeight,
-               halfPigBloodCakeDepth);
-    glVertex3f(halfPigBloodCakeWidth, halfPigBloodCakeHeight,
-               -halfPigBloodCakeDepth);
-    glVertex3f(-halfPigBloodCakeWidth, halfPigBloodCakeHeight,
-               -halfPigBloodCakeDepth);
-    // Bottom face (-Y)
-    glNormal3f(0.0f, -1.0f, 0.0f);
-    glVertex3f(-halfPigBloodCakeWidth, -halfPigBloodCakeHeight,
-               -halfPigBloodCakeDepth);
-    glVertex3f(halfPigBloodCakeWidth, -halfPigBloodCakeHeight,
-               -halfPigBloodCakeDepth);
-    glVertex3f(halfPigBloodCakeWidth, -halfPigBloodCakeHeight,
-               halfPigBloodCakeDepth);
-    glVertex3f(-halfPigBloodCakeWidth, -halfPigBloodCakeHeight,
-               halfPigBloodCakeDepth);
-    glEnd();
+void TrainView::drawLoadingScreen() {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, pixel_w(), pixel_h());
+    glClearColor(0, 0, .3f, 0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    glPopMatrix();
+    glUseProgram(0);
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glOrtho(0, w(), 0, h(), -1, 1);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_LIGHTING);
+    glColor3f(1, 1, 1);
+    gl_font(FL_HELVETICA, 18);
+    gl_draw("Loading shaders...", 20.0f, 20.0f);
+    glEnable(GL_DEPTH_TEST);
+}
 
-    glPopMatrix();
+// One static oden mesh at offset, drawn from the render queue
+void TrainView::drawOdenGeometry(MatrixStack& matrices,
+                                 const glm::vec3& offset,
+                                 const PrimitiveMesh& mesh) {
+    matrices.push();
+    matrices.translate(offset);
+    matrices.loadModelView();
+
+    mesh.draw(false);
+
+    matrices.pop();
+    matrices.loadModelView();
 }
 
 //
@@ -3761,7 +3660,7 @@ void TrainView::doPick()
     // draw the cubes, loading the names as we go
     for (size_t i = 0; i < m_pTrack->points.size(); ++i) {
         glLoadName((GLuint)(i + 1));
-        m_pTrack->points[i].draw();
+        m_pTrack->points[i].draw(controlPointMesh);
     }
 
     // go back to drawing mode, and see how picking did
@@ -146,6 +146,10 @@ TrainWindow::TrainWindow(const int x, const int y)
         Fl_Button* rzp = new Fl_Button(700, pty, 30, 20, "R-Z");
         rzp->callback((Fl_Callback*)rmzCB, this);
 
+        // Prefiltered (variance) shadows instead of PCF; 'b' benchmarks both
+        vsmButton = new Fl_Button(735, pty, 60, 20, "VSM");
+        togglify(vsmButton, 0);
+
         pty += 30;
 
         // ---------- Lighting Buttons ----------
@@ -256,6 +256,24 @@ getMatrix(HMatrix m) const
 	qAll.toMatrix(m);
 }
 
+//**************************************************************************
+//
+// * Get the camera matrix setProjection puts on the modelview stack,
+//   without touching the GL matrix stacks
+//==========================================================================
+void ArcBallCam::
+getViewMatrix(HMatrix m) const
+//==========================================================================
+{
+	getMatrix(m);
+
+	// premultiply by the translation to the eye
+	const float eye[3] = { -eyeX, -eyeY, -eyeZ };
+	for (int c = 0; c < 4; c++)
+		for (int r = 0; r < 3; r++)
+			m[c][r] += eye[r] * m[c][3];
+}
+
 //**************************************************************************
 //
 // * a simplified interface - so you never see the insides of arcball